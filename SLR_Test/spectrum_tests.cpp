@@ -0,0 +1,114 @@
+//
+//  spectrum_tests.cpp
+//
+//  Created by 渡部 心 on 2017/07/06.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#include <gtest/gtest.h>
+#include <chrono>
+
+#include <libSLR/BasicTypes/spectrum_types.h>
+#include <libSLR/BasicTypes/spectral_coefficient_table.h>
+#include <libSLR/RNG/XORShiftRNG.h>
+
+#ifdef SLR_Use_Spectral_Representation
+TEST(SpectralCoefficientTableTest, ColorAccuracy) {
+    using namespace SLR;
+    typedef UpsampledContinuousSpectrum Upsampled;
+    
+    const SpectralCoefficientTable &table = SpectralCoefficientTable::instance();
+    
+    // JP: sRGBの色域内の反射率について、表から得たスペクトルのXYZ値を元の色と比較する。
+    // EN: compare the XYZ values of spectra obtained from the table with the original colors for reflectances within the sRGB gamut.
+    const int NumSteps = 11;
+    float maxChromaticityError = 0.0f;
+    float maxLuminanceError = 0.0f;
+    for (int ib = 0; ib < NumSteps; ++ib) {
+        for (int ig = 0; ig < NumSteps; ++ig) {
+            for (int ir = 0; ir < NumSteps; ++ir) {
+                float rgb[3] = {(float)ir / (NumSteps - 1), (float)ig / (NumSteps - 1), (float)ib / (NumSteps - 1)};
+                if (rgb[0] + rgb[1] + rgb[2] == 0)
+                    continue;
+                float uvs[3];
+                Upsampled::sRGB_to_uvs(SpectrumType::Reflectance, rgb, uvs);
+                float xy[2];
+                Upsampled::uv_to_xy(uvs, xy);
+                
+                SigmoidPolynomialSpectrum sp = table.lookup(uvs[0], uvs[1]);
+                float XYZ[3] = {0, 0, 0};
+                for (int i = 0; i < NumCMFSamples; ++i) {
+                    float value = uvs[2] * sp.evaluate((float)i / (NumCMFSamples - 1));
+                    XYZ[0] += xbarReferenceValues[i] * value;
+                    XYZ[1] += ybarReferenceValues[i] * value;
+                    XYZ[2] += zbarReferenceValues[i] * value;
+                }
+                float b = XYZ[0] + XYZ[1] + XYZ[2];
+                float luminance = Upsampled::uvs_to_luminance(uvs) / Upsampled::EqualEnergyReflectance;
+                maxChromaticityError = std::max(maxChromaticityError, std::fabs(XYZ[0] / b - xy[0]));
+                maxChromaticityError = std::max(maxChromaticityError, std::fabs(XYZ[1] / b - xy[1]));
+                maxLuminanceError = std::max(maxLuminanceError, std::fabs(XYZ[1] - luminance) / luminance);
+            }
+        }
+    }
+    printf("max chromaticity error: %g, max relative luminance error: %g\n", maxChromaticityError, maxLuminanceError);
+    EXPECT_LT(maxChromaticityError, 1e-3f);
+    EXPECT_LT(maxLuminanceError, 5e-3f);
+}
+
+TEST(SpectralCoefficientTableTest, EvaluationThroughput) {
+    using namespace SLR;
+    typedef UpsampledContinuousSpectrum Upsampled;
+    
+    const SpectralCoefficientTable &table = SpectralCoefficientTable::instance();
+    
+    const uint32_t NumColors = 4096;
+    const uint32_t NumRepeats = 256;
+    std::vector<float> uvsValues(3 * NumColors);
+    XORShiftRNG rng(1234567);
+    for (int i = 0; i < NumColors; ++i) {
+        float rgb[3] = {rng.getFloat0cTo1o(), rng.getFloat0cTo1o(), rng.getFloat0cTo1o()};
+        Upsampled::sRGB_to_uvs(SpectrumType::Reflectance, rgb, &uvsValues[3 * i]);
+    }
+    
+    WavelengthSamples wls;
+    for (int i = 0; i < NumSpectralSamples; ++i)
+        wls[i] = WavelengthLowBound + (WavelengthHighBound - WavelengthLowBound) * (i + 0.5f) / NumSpectralSamples;
+    
+    // JP: 現在の経路(隣接データ点の探索とスペクトルデータの補間)と係数表による評価の1スペクトルあたりの時間を比較する。
+    // EN: compare the time per spectrum of the current path (search of adjacent data points and interpolation of spectral data) and
+    //     evaluation with the coefficient table.
+    double upsampledCost;
+    {
+        const Upsampled::WavelengthBins wlBins(wls);
+        SampledSpectrum sum;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int r = 0; r < NumRepeats; ++r) {
+            for (int i = 0; i < NumColors; ++i) {
+                const float* uvs = &uvsValues[3 * i];
+                sum += Upsampled(uvs[0], uvs[1], uvs[2]).evaluate(wlBins);
+            }
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        upsampledCost = std::chrono::duration<double, std::nano>(end - start).count() / (NumRepeats * NumColors);
+        EXPECT_TRUE(sum.allFinite());
+    }
+    double tableCost;
+    {
+        const SigmoidPolynomialSpectrum::NormalizedWavelengths nwls(wls);
+        SampledSpectrum sum;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int r = 0; r < NumRepeats; ++r) {
+            for (int i = 0; i < NumColors; ++i) {
+                const float* uvs = &uvsValues[3 * i];
+                sum += table.lookup(uvs[0], uvs[1]).evaluate(nwls, uvs[2]);
+            }
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        tableCost = std::chrono::duration<double, std::nano>(end - start).count() / (NumRepeats * NumColors);
+        EXPECT_TRUE(sum.allFinite());
+    }
+    printf("upsampled: %8.2f [ns/spectrum]\n", upsampledCost);
+    printf("table    : %8.2f [ns/spectrum] (x%.2f)\n", tableCost, tableCost / upsampledCost);
+}
+#endif
@@ -0,0 +1,181 @@
+//
+//  texture_tests.cpp
+//
+//  Created by 渡部 心 on 2017/07/03.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#include <gtest/gtest.h>
+#include <chrono>
+
+#include <libSLR/MemoryAllocators/Allocator.h>
+#include <libSLR/BasicTypes/spectrum_types.h>
+#include <libSLR/Core/image_2d.h>
+#include <libSLR/Texture/image_textures.h>
+#include <libSLR/Core/distributions.h>
+#include <libSLR/RNG/XORShiftRNG.h>
+
+static SLR::TiledImage2D* createGradientImage(uint32_t width, uint32_t height) {
+    using namespace SLR;
+    
+    std::vector<Gray8> data(width * height);
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x)
+            data[y * width + x].v = (uint8_t)(4 * x + 2 * y);
+    TiledImage2D* image = new TiledImage2D(data.data(), width, height, ColorFormat::Gray8, &DefaultAllocator::instance(),
+                                           ImageStoreMode::AlphaTexture, SpectrumType::Reflectance);
+    image->generateMipmaps();
+    return image;
+}
+
+static SLR::TiledImage2D* createColorImage(uint32_t width, uint32_t height) {
+    using namespace SLR;
+    
+    std::vector<RGB8x3> data(width * height);
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x)
+            data[y * width + x] = RGB8x3{(uint8_t)x, (uint8_t)y, (uint8_t)(x ^ y)};
+    TiledImage2D* image = new TiledImage2D(data.data(), width, height, ColorFormat::RGB8x3, &DefaultAllocator::instance(),
+                                           ImageStoreMode::AsIs, SpectrumType::Reflectance);
+    image->generateMipmaps();
+    return image;
+}
+
+TEST(ImageTextureTest, WrapModes) {
+    using namespace SLR;
+    
+    const uint32_t Width = 8;
+    const uint32_t Height = 8;
+    std::unique_ptr<TiledImage2D> image(createGradientImage(Width, Height));
+    auto texelValue = [](int32_t x, int32_t y) { return (4 * x + 2 * y) / 255.0f; };
+    
+    ImageFloatTexture repeatTex(image.get(), nullptr, ImageTextureFilter::Trilinear, ImageTextureWrap::Repeat);
+    ImageFloatTexture clampTex(image.get(), nullptr, ImageTextureFilter::Trilinear, ImageTextureWrap::Clamp);
+    ImageFloatTexture mirrorTex(image.get(), nullptr, ImageTextureFilter::Trilinear, ImageTextureWrap::Mirror);
+    
+    // JP: テクセル中心での双線形補間はテクセル値そのものになる。
+    // EN: bilinear interpolation at a texel center becomes the texel value itself.
+    const int32_t xs[] = {-10, -2, -1, 0, 3, 7, 8, 9, 17};
+    for (int32_t x : xs) {
+        Point3D p((x + 0.5f) / Width, 2.5f / Height, 0.0f);
+        int32_t repeatX = ((x % (int32_t)Width) + Width) % Width;
+        int32_t clampX = std::clamp<int32_t>(x, 0, Width - 1);
+        int32_t mirrorX = ((x % (int32_t)(2 * Width)) + 2 * Width) % (2 * Width);
+        mirrorX = mirrorX < Width ? mirrorX : 2 * Width - 1 - mirrorX;
+        EXPECT_NEAR(repeatTex.evaluate(p), texelValue(repeatX, 2), 1e-5f);
+        EXPECT_NEAR(clampTex.evaluate(p), texelValue(clampX, 2), 1e-5f);
+        EXPECT_NEAR(mirrorTex.evaluate(p), texelValue(mirrorX, 2), 1e-5f);
+    }
+}
+
+TEST(ImageTextureTest, FilterWeights) {
+    using namespace SLR;
+    
+    const uint32_t Width = 37;
+    const uint32_t Height = 21;
+    std::unique_ptr<TiledImage2D> image(createGradientImage(Width, Height));
+    
+    // JP: 3次Bスプラインは線形関数を再現するため、勾配の内部では双線形補間と一致する。
+    // EN: cubic B-spline reproduces linear functions, so it matches bilinear interpolation in the interior of the gradient.
+    ImageFloatTexture bilinearTex(image.get(), nullptr, ImageTextureFilter::Trilinear, ImageTextureWrap::Clamp);
+    ImageFloatTexture bicubicTex(image.get(), nullptr, ImageTextureFilter::Bicubic, ImageTextureWrap::Clamp);
+    XORShiftRNG rng(1234567);
+    for (int i = 0; i < 1000; ++i) {
+        Point3D p((2 + (Width - 4) * rng.getFloat0cTo1o()) / Width, (2 + (Height - 4) * rng.getFloat0cTo1o()) / Height, 0.0f);
+        EXPECT_NEAR(bicubicTex.evaluate(p), bilinearTex.evaluate(p), 1e-4f);
+    }
+}
+
+// JP: 1回の参照あたりのコストを従来のトライリニア(2x2)と比較する。
+// EN: compare the cost per lookup with the conventional trilinear (2x2).
+TEST(ImageTextureTest, LookupCost) {
+    using namespace SLR;
+    
+    const uint32_t NumLookups = 1 << 20;
+    std::unique_ptr<TiledImage2D> image(createColorImage(1024, 1024));
+    
+    struct FilterEntry {
+        const char* name;
+        ImageTextureFilter filter;
+    };
+    const FilterEntry filters[] = {
+        {"trilinear", ImageTextureFilter::Trilinear},
+        {"bicubic", ImageTextureFilter::Bicubic},
+        {"ewa", ImageTextureFilter::EWA},
+    };
+    
+    WavelengthSamples wls;
+    for (int i = 0; i < SampledSpectrum::NumComponents; ++i)
+        wls[i] = WavelengthLowBound + (WavelengthHighBound - WavelengthLowBound) * (i + 0.5f) / SampledSpectrum::NumComponents;
+    
+    double baseCost = 0.0;
+    for (const FilterEntry &entry : filters) {
+        ImageSpectrumTexture texture(image.get(), nullptr, entry.filter, ImageTextureWrap::Repeat);
+        XORShiftRNG rng(1234567);
+        TexCoord2D dTexCoordDx(0.5f / 1024, 0.0f);
+        TexCoord2D dTexCoordDy(0.0f, 0.25f / 1024);
+        
+        SampledSpectrum sum;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < NumLookups; ++i) {
+            Point3D p(rng.getFloat0cTo1o(), rng.getFloat0cTo1o(), 0.0f);
+            sum += texture.evaluate(p, dTexCoordDx, dTexCoordDy, wls);
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        double cost = std::chrono::duration<double, std::nano>(end - start).count() / NumLookups;
+        if (baseCost == 0.0)
+            baseCost = cost;
+        printf("%-10s: %8.2f [ns/lookup] (x%.2f)\n", entry.name, cost, cost / baseCost);
+        
+        EXPECT_TRUE(sum.allFinite());
+    }
+}
+
+TEST(ProceduralNoiseTest, BatchMatchesScalar) {
+    using namespace SLR;
+    typedef Point3DTemplate<float> Point3DType;
+    
+    // JP: 繰り返しの有無と負の座標を含む点で、まとめた評価が1点ずつの評価と厳密に一致することを確かめる。
+    // EN: check that batched evaluation exactly matches evaluation of each point for points including repetition and negative coordinates.
+    const uint32_t NumBatches = 4096;
+    XORShiftRNG rng(1234567);
+    for (int32_t repeat : {0, 4}) {
+        ImprovedPerlinNoise3DGeneratorTemplate<float> perlinGen(repeat);
+        WorleyNoise3DGeneratorTemplate<float> worleyGen(repeat);
+        for (int b = 0; b < NumBatches; ++b) {
+            Point3DType ps[4];
+            float frequencies[4];
+            for (int i = 0; i < 4; ++i) {
+                ps[i] = Point3DType(rng.getFloat0cTo1o(), rng.getFloat0cTo1o(), rng.getFloat0cTo1o());
+                if (repeat > 0) {
+                    frequencies[i] = (float)(1 << (rng.getUInt() % 4));
+                }
+                else {
+                    ps[i] = Point3DType(20 * ps[i].x - 10, 20 * ps[i].y - 10, 20 * ps[i].z - 10);
+                    frequencies[i] = 1 + 7 * rng.getFloat0cTo1o();
+                }
+            }
+            
+            // JP: Perlinノイズのハッシュは負の格子座標に対応していないため、繰り返しがある場合のみ確かめる。
+            // EN: hashing of Perlin noise does not support negative lattice coordinates, so check it only with repetition.
+            if (repeat > 0) {
+                float values[4];
+                perlinGen.evaluateBatch(ps, frequencies, values);
+                for (int i = 0; i < 4; ++i)
+                    EXPECT_EQ(perlinGen.evaluate(ps[i], frequencies[i]), values[i]);
+            }
+            
+            float sqDistances[4];
+            uint32_t hashes[4], fpIndices[4];
+            worleyGen.evaluateBatch(ps, frequencies, sqDistances, hashes, fpIndices);
+            for (int i = 0; i < 4; ++i) {
+                float sqDistance;
+                uint32_t hash, fpIdx;
+                worleyGen.evaluate(ps[i], frequencies[i], &sqDistance, &hash, &fpIdx);
+                EXPECT_EQ(sqDistance, sqDistances[i]);
+                EXPECT_EQ(hash, hashes[i]);
+                EXPECT_EQ(fpIdx, fpIndices[i]);
+            }
+        }
+    }
+}
@@ -0,0 +1,210 @@
+//
+//  LightBVH.cpp
+//
+//  Created by 渡部 心 on 2017/06/20.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#include "LightBVH.h"
+
+namespace SLR {
+    // cos(max(0, thetaA - thetaB))
+    static inline float cosSubClamped(float sinA, float cosA, float sinB, float cosB) {
+        if (cosA > cosB)
+            return 1.0f;
+        return cosA * cosB + sinA * sinB;
+    }
+    
+    // sin(max(0, thetaA - thetaB))
+    static inline float sinSubClamped(float sinA, float cosA, float sinB, float cosB) {
+        if (cosA > cosB)
+            return 0.0f;
+        return sinA * cosB - cosA * sinB;
+    }
+    
+    static inline float safeSqrt(float x) {
+        return std::sqrt(std::max(x, 0.0f));
+    }
+    
+    float LightBounds::importance(const Point3D &p) const {
+        if (power <= 0.0f)
+            return 0.0f;
+        
+        Point3D center = bbox.centroid();
+        float halfDiag2 = sqDistance(center, bbox.maxP);
+        float dist2 = sqDistance(p, center);
+        
+        // JP: シェーディング点が境界球の内側にある場合は方向による制限を掛けられない。
+        // EN: directional bound cannot be applied when the shading point is inside the bounding sphere.
+        // JP: 大きさの無い光源の位置と一致する場合に0で割らないように距離の2乗に下限を設ける。
+        // EN: clamp the squared distance from below to avoid division by zero when coinciding with the position of a light without extent.
+        const float MinSqDistance = 1e-10f;
+        if (dist2 <= halfDiag2)
+            return power / std::max(std::max(dist2, halfDiag2), MinSqDistance);
+        
+        Vector3D dirToP = (p - center) / std::sqrt(dist2);
+        float cosThetaW = dot(axis, dirToP);
+        float sinThetaW = safeSqrt(1 - cosThetaW * cosThetaW);
+        float sinThetaO = safeSqrt(1 - cosThetaO * cosThetaO);
+        
+        // angle subtended by the bounding sphere
+        float sinThetaB2 = halfDiag2 / dist2;
+        float cosThetaB = safeSqrt(1 - sinThetaB2);
+        float sinThetaB = std::sqrt(sinThetaB2);
+        
+        float cosThetaX = cosSubClamped(sinThetaW, cosThetaW, sinThetaO, cosThetaO);
+        float sinThetaX = sinSubClamped(sinThetaW, cosThetaW, sinThetaO, cosThetaO);
+        float cosThetaP = cosSubClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB);
+        if (cosThetaP <= cosThetaE)
+            return 0.0f;
+        
+        return power * cosThetaP / dist2;
+    }
+    
+    LightBounds LightBounds::unify(const LightBounds &a, const LightBounds &b) {
+        if (a.power <= 0.0f)
+            return b;
+        if (b.power <= 0.0f)
+            return a;
+        
+        LightBounds ret;
+        ret.bbox = calcUnion(a.bbox, b.bbox);
+        ret.power = a.power + b.power;
+        ret.cosThetaE = std::min(a.cosThetaE, b.cosThetaE);
+        
+        float thetaA = std::acos(std::min(std::max(a.cosThetaO, -1.0f), 1.0f));
+        float thetaB = std::acos(std::min(std::max(b.cosThetaO, -1.0f), 1.0f));
+        float thetaD = std::acos(std::min(std::max(dot(a.axis, b.axis), -1.0f), 1.0f));
+        if (std::min(thetaD + thetaB, (float)M_PI) <= thetaA) {
+            ret.axis = a.axis;
+            ret.cosThetaO = a.cosThetaO;
+            return ret;
+        }
+        if (std::min(thetaD + thetaA, (float)M_PI) <= thetaB) {
+            ret.axis = b.axis;
+            ret.cosThetaO = b.cosThetaO;
+            return ret;
+        }
+        
+        // JP: 2つのコーンを含む最小のコーンを求める。
+        // EN: compute the minimum cone containing both cones.
+        float thetaO = 0.5f * (thetaA + thetaD + thetaB);
+        Vector3D rotAxis = cross(a.axis, b.axis);
+        if (thetaO >= M_PI || rotAxis.sqLength() == 0.0f) {
+            ret.axis = a.axis;
+            ret.cosThetaO = -1.0f;
+            return ret;
+        }
+        rotAxis = normalize(rotAxis);
+        float thetaR = thetaO - thetaA;
+        float cosR = std::cos(thetaR);
+        float sinR = std::sin(thetaR);
+        // Rodrigues' rotation formula
+        ret.axis = normalize(a.axis * cosR + cross(rotAxis, a.axis) * sinR + rotAxis * (dot(rotAxis, a.axis) * (1 - cosR)));
+        ret.cosThetaO = std::cos(thetaO);
+        return ret;
+    }
+    
+    
+    
+    LightBVH::LightBVH(const std::vector<LightBounds> &lights) {
+        uint32_t numLights = (uint32_t)lights.size();
+        m_lightToLeaf.resize(numLights);
+        if (numLights == 0)
+            return;
+        
+        std::vector<uint32_t> indices(numLights);
+        for (int i = 0; i < numLights; ++i)
+            indices[i] = i;
+        m_nodes.reserve(2 * numLights - 1);
+        buildRecursive(lights, indices.data(), 0, numLights, UINT32_MAX);
+    }
+    
+    uint32_t LightBVH::buildRecursive(const std::vector<LightBounds> &lights, uint32_t* indices, uint32_t start, uint32_t end, uint32_t parent) {
+        uint32_t nodeIdx = (uint32_t)m_nodes.size();
+        m_nodes.emplace_back();
+        m_nodes[nodeIdx].parent = parent;
+        
+        if (end - start == 1) {
+            Node &node = m_nodes[nodeIdx];
+            node.bounds = lights[indices[start]];
+            node.children[0] = node.children[1] = UINT32_MAX;
+            node.lightIndex = indices[start];
+            node.isLeaf = true;
+            m_lightToLeaf[indices[start]] = nodeIdx;
+            return nodeIdx;
+        }
+        
+        // JP: 重心の範囲が最大の軸の中央値で分割する。
+        // EN: split at the median along the axis of the widest centroid extent.
+        BoundingBox3D centroidBounds;
+        for (int i = start; i < end; ++i)
+            centroidBounds.unify(lights[indices[i]].bbox.centroid());
+        BoundingBox3D::Axis axis = centroidBounds.widestAxis();
+        uint32_t mid = (start + end) / 2;
+        std::nth_element(indices + start, indices + mid, indices + end, [&lights, axis](uint32_t a, uint32_t b) {
+            return lights[a].bbox.centerOfAxis(axis) < lights[b].bbox.centerOfAxis(axis);
+        });
+        
+        uint32_t c0 = buildRecursive(lights, indices, start, mid, nodeIdx);
+        uint32_t c1 = buildRecursive(lights, indices, mid, end, nodeIdx);
+        Node &node = m_nodes[nodeIdx];
+        node.bounds = LightBounds::unify(m_nodes[c0].bounds, m_nodes[c1].bounds);
+        node.children[0] = c0;
+        node.children[1] = c1;
+        node.lightIndex = UINT32_MAX;
+        node.isLeaf = false;
+        return nodeIdx;
+    }
+    
+    float LightBVH::calcChildProb(uint32_t nodeIdx, const Point3D &p, uint32_t childSlot) const {
+        const Node &node = m_nodes[nodeIdx];
+        const LightBounds &b0 = m_nodes[node.children[0]].bounds;
+        const LightBounds &b1 = m_nodes[node.children[1]].bounds;
+        float imp0 = b0.importance(p);
+        float imp1 = b1.importance(p);
+        // JP: 両方の重要度が0の場合はパワーに比例して選び、パワーも0の場合は等確率で選ぶ。
+        // EN: choose proportionally to power when both importances are zero, and uniformly when both powers are also zero.
+        if (imp0 + imp1 <= 0.0f) {
+            imp0 = b0.power;
+            imp1 = b1.power;
+        }
+        if (imp0 + imp1 <= 0.0f)
+            return 0.5f;
+        float prob0 = imp0 / (imp0 + imp1);
+        return childSlot == 0 ? prob0 : (1 - prob0);
+    }
+    
+    uint32_t LightBVH::sample(const Point3D &p, float u, float* prob, float* remapped) const {
+        SLRAssert(!m_nodes.empty(), "There are no lights.");
+        *prob = 1.0f;
+        uint32_t nodeIdx = 0;
+        while (!m_nodes[nodeIdx].isLeaf) {
+            float prob0 = calcChildProb(nodeIdx, p, 0);
+            if (u < prob0) {
+                u = std::min(u / prob0, 0.99999994f);
+                *prob *= prob0;
+                nodeIdx = m_nodes[nodeIdx].children[0];
+            }
+            else {
+                u = std::min((u - prob0) / (1 - prob0), 0.99999994f);
+                *prob *= 1 - prob0;
+                nodeIdx = m_nodes[nodeIdx].children[1];
+            }
+        }
+        *remapped = u;
+        return m_nodes[nodeIdx].lightIndex;
+    }
+    
+    float LightBVH::evaluatePMF(const Point3D &p, uint32_t lightIdx) const {
+        float prob = 1.0f;
+        uint32_t nodeIdx = m_lightToLeaf[lightIdx];
+        while (m_nodes[nodeIdx].parent != UINT32_MAX) {
+            uint32_t parentIdx = m_nodes[nodeIdx].parent;
+            uint32_t childSlot = m_nodes[parentIdx].children[0] == nodeIdx ? 0 : 1;
+            prob *= calcChildProb(parentIdx, p, childSlot);
+            nodeIdx = parentIdx;
+        }
+        return prob;
+    }
+}
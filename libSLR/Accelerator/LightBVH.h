@@ -0,0 +1,73 @@
+//
+//  LightBVH.h
+//
+//  Created by 渡部 心 on 2017/06/20.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#ifndef __SLR_LightBVH__
+#define __SLR_LightBVH__
+
+#include "../defines.h"
+#include "../declarations.h"
+#include "../BasicTypes/BoundingBox3D.h"
+
+namespace SLR {
+    // References
+    // Importance Sampling of Many Lights with Adaptive Tree Splitting
+    
+    // JP: 光源群の空間的な範囲と放射方向の範囲を保守的に表す。
+    //     放射方向はcosThetaOの角度を持つ法線のコーンと、各法線からcosThetaEの角度までの放射で表す。
+    // EN: conservatively represents the spatial and emission directional extent of a set of lights.
+    //     Emission directions are represented by a cone of normals with angle cosThetaO and emission up to cosThetaE from each normal.
+    struct SLR_API LightBounds {
+        BoundingBox3D bbox;
+        Vector3D axis;
+        float cosThetaO;
+        float cosThetaE;
+        float power;
+        
+        LightBounds() : axis(Vector3D::Ez), cosThetaO(1.0f), cosThetaE(1.0f), power(0.0f) { }
+        LightBounds(const BoundingBox3D &bb, const Vector3D &ax, float cosO, float cosE, float pw) :
+        bbox(bb), axis(ax), cosThetaO(cosO), cosThetaE(cosE), power(pw) { }
+        
+        // JP: シェーディング点から見た光源群の重要度。
+        // EN: importance of the lights seen from a shading point.
+        float importance(const Point3D &p) const;
+        
+        static LightBounds unify(const LightBounds &a, const LightBounds &b);
+    };
+    
+    
+    
+    // JP: 光源の空間範囲と法線コーンに基づくBVH。
+    //     シェーディング点に応じて確率的に木を辿って光源を選択し、MIS用に同じ選択確率を評価できる。
+    // EN: BVH based on spatial extents and normal cones of lights.
+    //     It selects a light by stochastically traversing the tree according to a shading point,
+    //     and can evaluate the same selection probability for MIS.
+    class SLR_API LightBVH {
+        struct Node {
+            LightBounds bounds;
+            uint32_t children[2];
+            uint32_t parent;
+            uint32_t lightIndex;
+            bool isLeaf;
+        };
+        
+        std::vector<Node> m_nodes;
+        std::vector<uint32_t> m_lightToLeaf;
+        
+        uint32_t buildRecursive(const std::vector<LightBounds> &lights, uint32_t* indices, uint32_t start, uint32_t end, uint32_t parent);
+        float calcChildProb(uint32_t nodeIdx, const Point3D &p, uint32_t childSlot) const;
+    public:
+        LightBVH(const std::vector<LightBounds> &lights);
+        
+        uint32_t numLights() const { return (uint32_t)m_lightToLeaf.size(); }
+        const LightBounds &rootBounds() const { return m_nodes[0].bounds; }
+        
+        uint32_t sample(const Point3D &p, float u, float* prob, float* remapped) const;
+        float evaluatePMF(const Point3D &p, uint32_t lightIdx) const;
+    };
+}
+
+#endif /* __SLR_LightBVH__ */
@@ -0,0 +1,144 @@
+//
+//  MediumBVH.cpp
+//
+//  Created by 渡部 心 on 2017/06/25.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#include "MediumBVH.h"
+
+#include <atomic>
+
+namespace SLR {
+    MediumBVH::MediumBVH(const std::vector<const MediumObject*> &objs) : m_objs(objs) {
+        uint32_t numObjs = (uint32_t)objs.size();
+        if (numObjs == 0)
+            return;
+        
+        std::vector<BoundingBox3D> bboxes(numObjs);
+        std::vector<uint32_t> indices(numObjs);
+        for (int i = 0; i < numObjs; ++i) {
+            bboxes[i] = objs[i]->bounds();
+            indices[i] = i;
+        }
+        m_nodes.reserve(2 * numObjs - 1);
+        m_objIndices.reserve(numObjs);
+        buildRecursive(bboxes, indices.data(), 0, numObjs);
+    }
+    
+    uint32_t MediumBVH::buildRecursive(const std::vector<BoundingBox3D> &bboxes, uint32_t* indices, uint32_t start, uint32_t end) {
+        uint32_t nodeIdx = (uint32_t)m_nodes.size();
+        m_nodes.emplace_back();
+        
+        BoundingBox3D bbox;
+        BoundingBox3D centroidBounds;
+        for (int i = start; i < end; ++i) {
+            bbox.unify(bboxes[indices[i]]);
+            centroidBounds.unify(bboxes[indices[i]].centroid());
+        }
+        
+        if (end - start <= MaxNumObjectsInLeaf) {
+            Node &node = m_nodes[nodeIdx];
+            node.bbox = bbox;
+            node.children[0] = node.children[1] = UINT32_MAX;
+            node.offsetFirstLeaf = (uint32_t)m_objIndices.size();
+            node.numLeaves = end - start;
+            node.axis = BoundingBox3D::Axis_X;
+            for (int i = start; i < end; ++i)
+                m_objIndices.push_back(indices[i]);
+            return nodeIdx;
+        }
+        
+        // JP: 重心の範囲が最大の軸の中央値で分割する。
+        //     媒質の数はたかだか数百程度なので構築コストよりも単純さを優先する。
+        // EN: split at the median along the axis of the widest centroid extent.
+        //     Prefer simplicity over build cost since the number of media is at most several hundreds.
+        BoundingBox3D::Axis axis = centroidBounds.widestAxis();
+        uint32_t mid = (start + end) / 2;
+        std::nth_element(indices + start, indices + mid, indices + end, [&bboxes, axis](uint32_t a, uint32_t b) {
+            return bboxes[a].centerOfAxis(axis) < bboxes[b].centerOfAxis(axis);
+        });
+        
+        uint32_t c0 = buildRecursive(bboxes, indices, start, mid);
+        uint32_t c1 = buildRecursive(bboxes, indices, mid, end);
+        Node &node = m_nodes[nodeIdx];
+        node.bbox = bbox;
+        node.children[0] = c0;
+        node.children[1] = c1;
+        node.offsetFirstLeaf = 0;
+        node.numLeaves = 0;
+        node.axis = axis;
+        return nodeIdx;
+    }
+    
+    bool MediumBVH::queryNextBoundaries(const Ray &ray, const RaySegment &segment, float* distToBoundary,
+                                        BoundaryEvent* events, uint32_t* numEvents, uint32_t maxNumEvents) const {
+        *numEvents = 0;
+        if (m_nodes.empty())
+            return false;
+        
+        float nearestDist = INFINITY;
+        // JP: 最近の境界と同じとみなす距離の上限。
+        // EN: upper limit of distance regarded as the same as the nearest boundary.
+        float coincidentLimit = segment.distMax;
+        
+        uint32_t stack[64];
+        uint32_t stackDepth = 0;
+        stack[stackDepth++] = 0;
+        while (stackDepth > 0) {
+            const Node &node = m_nodes[stack[--stackDepth]];
+            if (!node.bbox.intersect(ray, RaySegment(segment.distMin, coincidentLimit)))
+                continue;
+            
+            if (node.numLeaves > 0) {
+                for (uint32_t i = 0; i < node.numLeaves; ++i) {
+                    uint32_t objIdx = m_objIndices[node.offsetFirstLeaf + i];
+                    float dist;
+                    bool enter;
+                    if (!m_objs[objIdx]->intersectBoundary(ray, segment, &dist, &enter))
+                        continue;
+                    
+                    if (dist >= coincidentLimit)
+                        continue;
+                    
+                    if (dist < nearestDist) {
+                        nearestDist = dist;
+                        coincidentLimit = std::min(distanceAfterBoundary(nearestDist), segment.distMax);
+                        // JP: 新しい最近の境界から離れたイベントを取り除く。
+                        // EN: remove events apart from the new nearest boundary.
+                        uint32_t numRemaining = 0;
+                        for (uint32_t j = 0; j < *numEvents; ++j) {
+                            if (events[j].distance < coincidentLimit)
+                                events[numRemaining++] = events[j];
+                        }
+                        *numEvents = numRemaining;
+                    }
+                    // JP: 同時に跨ぐ境界が多すぎる場合は以降のイベントを捨てる。リリースビルドでも配列の範囲外に書き込まないよう明示的に確認する。
+                    // EN: discard subsequent events when too many boundaries are crossed at once.
+                    //     Check explicitly so as not to write outside the array even in release builds.
+                    if (*numEvents >= maxNumEvents) {
+                        static std::atomic<bool> s_reported(false);
+                        if (!s_reported.exchange(true))
+                            printf("MediumBVH: too many coincident medium boundaries (> %u), some are ignored.\n", maxNumEvents);
+                        continue;
+                    }
+                    BoundaryEvent &ev = events[(*numEvents)++];
+                    ev.objIndex = objIdx;
+                    ev.distance = dist;
+                    ev.enter = enter;
+                }
+            }
+            else {
+                SLRAssert(stackDepth + 2 <= 64, "Traversal stack overflow.");
+                // JP: レイの向きに応じて近い側の子を先に辿る。
+                // EN: traverse the near child first according to the ray direction.
+                bool dirIsNeg = ray.dir[node.axis] < 0;
+                stack[stackDepth++] = node.children[dirIsNeg ? 0 : 1];
+                stack[stackDepth++] = node.children[dirIsNeg ? 1 : 0];
+            }
+        }
+        
+        *distToBoundary = nearestDist;
+        return *numEvents > 0;
+    }
+}
@@ -0,0 +1,103 @@
+//
+//  MediumBVH.h
+//
+//  Created by 渡部 心 on 2017/06/25.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#ifndef __SLR_MediumBVH__
+#define __SLR_MediumBVH__
+
+#include "../defines.h"
+#include "../declarations.h"
+#include "../BasicTypes/BoundingBox3D.h"
+#include "../Core/medium_object.h"
+
+namespace SLR {
+    // JP: 媒質オブジェクトの境界に関する問い合わせのためのBVH。
+    //     点を含む媒質の列挙と、レイに沿った次の境界(同じ距離にある複数の境界を含む)の探索を行う。
+    // EN: BVH for queries about boundaries of medium objects.
+    //     It enumerates media containing a point and finds the next boundaries along a ray (including multiple boundaries at the same distance).
+    class SLR_API MediumBVH {
+    public:
+        struct BoundaryEvent {
+            uint32_t objIndex;
+            float distance;
+            bool enter;
+        };
+    
+    private:
+        static const uint32_t MaxNumObjectsInLeaf = 4;
+        
+        struct Node {
+            BoundingBox3D bbox;
+            uint32_t children[2];
+            uint32_t offsetFirstLeaf;
+            uint32_t numLeaves;
+            BoundingBox3D::Axis axis;
+        };
+        
+        std::vector<const MediumObject*> m_objs;
+        std::vector<Node> m_nodes;
+        std::vector<uint32_t> m_objIndices;
+        
+        uint32_t buildRecursive(const std::vector<BoundingBox3D> &bboxes, uint32_t* indices, uint32_t start, uint32_t end);
+        
+        // JP: 境界上の点も含むように閉区間で判定する。
+        // EN: test with closed intervals so that points on the boundary are included.
+        static bool containsInclusive(const BoundingBox3D &bbox, const Point3D &p) {
+            return ((p.x >= bbox.minP.x && p.x <= bbox.maxP.x) &&
+                    (p.y >= bbox.minP.y && p.y <= bbox.maxP.y) &&
+                    (p.z >= bbox.minP.z && p.z <= bbox.maxP.z));
+        }
+    public:
+        MediumBVH(const std::vector<const MediumObject*> &objs);
+        
+        // JP: 点pを含む媒質のインデックスについてfunc(objIdx)を呼ぶ。
+        // EN: call func(objIdx) for indices of media containing the point p.
+        template <typename Func>
+        void queryContaining(const Point3D &p, float time, Func func) const {
+            if (m_nodes.empty())
+                return;
+            uint32_t stack[64];
+            uint32_t stackDepth = 0;
+            stack[stackDepth++] = 0;
+            while (stackDepth > 0) {
+                const Node &node = m_nodes[stack[--stackDepth]];
+                if (!containsInclusive(node.bbox, p))
+                    continue;
+                if (node.numLeaves > 0) {
+                    for (uint32_t i = 0; i < node.numLeaves; ++i) {
+                        uint32_t objIdx = m_objIndices[node.offsetFirstLeaf + i];
+                        if (m_objs[objIdx]->contains(p, time))
+                            func(objIdx);
+                    }
+                }
+                else {
+                    SLRAssert(stackDepth + 2 <= 64, "Traversal stack overflow.");
+                    stack[stackDepth++] = node.children[0];
+                    stack[stackDepth++] = node.children[1];
+                }
+            }
+        }
+        
+        // JP: 距離distの境界を跨いだ後に次の問い合わせを始める距離。
+        //     相対誤差だけだとレイ原点付近の境界で内外判定が変わらないため絶対誤差も加える。
+        // EN: distance from which the next query starts after crossing a boundary at the distance dist.
+        //     Add an absolute margin as well since only relative one doesn't change the inside/outside test at boundaries near the ray origin.
+        static float distanceAfterBoundary(float dist) {
+            return dist * (1.0f + Ray::Epsilon) + Ray::Epsilon;
+        }
+        
+        // JP: セグメント内で最も近い境界までの距離dと、[d, distanceAfterBoundary(d))に位置する境界の列をeventsに返す。
+        //     呼び出し側は次の問い合わせをdistanceAfterBoundary(d)から始めることで、重なった境界を取りこぼさない。
+        //     境界が無い場合はfalseを返す。
+        // EN: return the distance d to the nearest boundary within the segment and the boundaries located in [d, distanceAfterBoundary(d)) in events.
+        //     The caller doesn't miss coincident boundaries by starting the next query from distanceAfterBoundary(d).
+        //     This returns false when there are no boundaries.
+        bool queryNextBoundaries(const Ray &ray, const RaySegment &segment, float* distToBoundary,
+                                 BoundaryEvent* events, uint32_t* numEvents, uint32_t maxNumEvents) const;
+    };
+}
+
+#endif /* __SLR_MediumBVH__ */
@@ -0,0 +1,90 @@
+//
+//  PointKDTree.cpp
+//
+//  Created by 渡部 心 on 2017/06/14.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#include "PointKDTree.h"
+
+#include "../Helper/ThreadPool.h"
+
+namespace SLR {
+    // JP: n個の節点からなる左詰め平衡木の左部分木の節点数。
+    // EN: the number of nodes in the left subtree of a left-balanced tree with n nodes.
+    uint32_t PointKDTree::calcLeftSubtreeSize(uint32_t n) {
+        if (n <= 1)
+            return 0;
+        uint32_t m = 1;
+        while ((m << 1) <= n)
+            m <<= 1;
+        uint32_t numLastLevel = n - (m - 1);
+        return (m / 2 - 1) + std::min(numLastLevel, m / 2);
+    }
+    
+    void PointKDTree::buildSubtree(const BuildTask &task, uint32_t* order, uint32_t* balanced, uint32_t splitDepth, std::vector<BuildTask>* deferredTasks) {
+        if (task.start >= task.end)
+            return;
+        if (deferredTasks && splitDepth == 0) {
+            deferredTasks->push_back(task);
+            return;
+        }
+        
+        BoundingBox3D bbox;
+        for (int i = task.start; i < task.end; ++i) {
+            uint32_t idx = order[i];
+            bbox.unify(Point3D(m_positions[0][idx], m_positions[1][idx], m_positions[2][idx]));
+        }
+        BoundingBox3D::Axis axis = bbox.widestAxis();
+        
+        uint32_t median = task.start + calcLeftSubtreeSize(task.end - task.start);
+        const std::vector<float> &coords = m_positions[axis];
+        std::nth_element(order + task.start, order + median, order + task.end,
+                         [&coords](uint32_t idxA, uint32_t idxB) { return coords[idxA] < coords[idxB]; });
+        balanced[task.nodeIdx] = order[median];
+        m_splitAxes[task.nodeIdx] = axis;
+        
+        uint32_t nextSplitDepth = splitDepth > 0 ? splitDepth - 1 : 0;
+        buildSubtree(BuildTask{2 * task.nodeIdx + 1, task.start, median}, order, balanced, nextSplitDepth, deferredTasks);
+        buildSubtree(BuildTask{2 * task.nodeIdx + 2, median + 1, task.end}, order, balanced, nextSplitDepth, deferredTasks);
+    }
+    
+    void PointKDTree::buildTree(uint32_t numThreads) {
+        if (m_numPoints == 0)
+            return;
+        
+        std::vector<uint32_t> order(m_numPoints);
+        std::vector<uint32_t> balanced(m_numPoints);
+        for (int i = 0; i < m_numPoints; ++i)
+            order[i] = i;
+        
+        // JP: 上位の階層は逐次的に分割し、スレッド数より十分多い独立な部分木を作る。
+        // EN: split the upper levels sequentially to make enough independent subtrees compared to the number of threads.
+        uint32_t splitDepth = 0;
+        while ((1u << splitDepth) < 4 * numThreads && splitDepth < 16)
+            ++splitDepth;
+        std::vector<BuildTask> deferredTasks;
+        buildSubtree(BuildTask{0, 0, m_numPoints}, order.data(), balanced.data(), numThreads > 1 ? splitDepth : 0, numThreads > 1 ? &deferredTasks : nullptr);
+        
+        if (!deferredTasks.empty()) {
+            ThreadPool threadPool(numThreads);
+            for (int i = 0; i < deferredTasks.size(); ++i) {
+                const BuildTask &task = deferredTasks[i];
+                threadPool.enqueue([this, &task, &order, &balanced](uint32_t threadID) {
+                    buildSubtree(task, order.data(), balanced.data(), 0, nullptr);
+                });
+            }
+            threadPool.wait();
+        }
+        
+        // JP: 位置を木の格納順に並び替える。
+        // EN: reorder the positions into the storage order of the tree.
+        for (int axis = 0; axis < 3; ++axis) {
+            std::vector<float> reordered(m_numPoints);
+            for (int i = 0; i < m_numPoints; ++i)
+                reordered[i] = m_positions[axis][balanced[i]];
+            m_positions[axis].swap(reordered);
+        }
+        m_indices.swap(balanced);
+    }
+}
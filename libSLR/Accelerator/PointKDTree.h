@@ -0,0 +1,212 @@
+//
+//  PointKDTree.h
+//
+//  Created by 渡部 心 on 2017/06/14.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#ifndef __SLR_PointKDTree__
+#define __SLR_PointKDTree__
+
+#include "../defines.h"
+#include "../declarations.h"
+#include "../BasicTypes/BoundingBox3D.h"
+
+namespace SLR {
+    // JP: フォトンやヒットポイントといった点群に対する密度推定用の空間インデックス。
+    //     左詰め平衡k-d木をヒープ順に配置し、位置はSoA形式で保持する。
+    //     構築は上位の階層を逐次的に分割した後、独立な部分木を並列に構築する。
+    //     クエリーはコールバック形式でヒープ割り当てを一切行わない。
+    // EN: spatial index for density estimation over point sets like photons or hitpoints.
+    //     A left-balanced k-d tree is laid out in heap order and positions are stored as SoA.
+    //     The build sequentially partitions the upper levels, then builds independent subtrees in parallel.
+    //     Queries are callback based and never allocate heap memory.
+    class SLR_API PointKDTree {
+        static const uint32_t MaxDepth = 64;
+        
+        struct BuildTask {
+            uint32_t nodeIdx;
+            uint32_t start;
+            uint32_t end;
+        };
+        
+        std::vector<float> m_positions[3];
+        std::vector<uint8_t> m_splitAxes;
+        std::vector<uint32_t> m_indices;
+        BoundingBox3D m_bounds;
+        uint32_t m_numPoints;
+        
+        static uint32_t calcLeftSubtreeSize(uint32_t n);
+        void buildSubtree(const BuildTask &task, uint32_t* order, uint32_t* balanced, uint32_t splitDepth, std::vector<BuildTask>* deferredTasks);
+        void buildTree(uint32_t numThreads);
+    public:
+        PointKDTree() : m_numPoints(0) {}
+        
+        // JP: getPosition(i)はi番目の点の位置を返す。
+        // EN: getPosition(i) returns the position of the i-th point.
+        template <typename GetPosition>
+        void build(uint32_t numPoints, GetPosition getPosition, uint32_t numThreads) {
+            m_numPoints = numPoints;
+            for (int i = 0; i < 3; ++i)
+                m_positions[i].resize(numPoints);
+            m_splitAxes.resize(numPoints);
+            m_indices.resize(numPoints);
+            m_bounds = BoundingBox3D();
+            for (int i = 0; i < numPoints; ++i) {
+                Point3D p = getPosition(i);
+                m_positions[0][i] = p.x;
+                m_positions[1][i] = p.y;
+                m_positions[2][i] = p.z;
+                m_bounds.unify(p);
+            }
+            buildTree(numThreads);
+        }
+        
+        // JP: 点に付随するデータを木の格納順に並び替える。以降のクエリーは並び替え後のインデックスを返す。
+        // EN: reorder the data associated with the points into the storage order of the tree.
+        //     Subsequent queries return indices into the reordered data.
+        template <typename T>
+        void reorderPayload(std::vector<T>* payload) {
+            SLRAssert(payload->size() == m_numPoints, "The size of the payload does not match the number of points.");
+            // JP: デフォルトコンストラクターを持たないデータも扱えるように追加しながら並べ替える。
+            // EN: reorder by appending so that data without a default constructor can be handled.
+            std::vector<T> reordered;
+            reordered.reserve(m_numPoints);
+            for (int i = 0; i < m_numPoints; ++i) {
+                reordered.push_back(std::move((*payload)[m_indices[i]]));
+                m_indices[i] = i;
+            }
+            payload->swap(reordered);
+        }
+        
+        uint32_t numPoints() const { return m_numPoints; }
+        const BoundingBox3D &bounds() const { return m_bounds; }
+        
+        // JP: 半径内の全ての点に対してprocess(index, squaredDistance)を呼ぶ。
+        // EN: call process(index, squaredDistance) for every point within the radius.
+        template <typename ProcessPoint>
+        void queryRadius(const Point3D &p, float radius, ProcessPoint process) const {
+            if (m_numPoints == 0)
+                return;
+            const float qp[3] = {p.x, p.y, p.z};
+            const float sqRadius = radius * radius;
+            
+            uint32_t stack[MaxDepth];
+            uint32_t depth = 0;
+            stack[depth++] = 0;
+            while (depth > 0) {
+                uint32_t nodeIdx = stack[--depth];
+                uint8_t axis = m_splitAxes[nodeIdx];
+                float d = qp[axis] - m_positions[axis][nodeIdx];
+                uint32_t nearIdx = 2 * nodeIdx + (d < 0 ? 1 : 2);
+                uint32_t farIdx = 2 * nodeIdx + (d < 0 ? 2 : 1);
+                if (farIdx < m_numPoints && d * d <= sqRadius)
+                    stack[depth++] = farIdx;
+                if (nearIdx < m_numPoints)
+                    stack[depth++] = nearIdx;
+                
+                float dx = qp[0] - m_positions[0][nodeIdx];
+                float dy = qp[1] - m_positions[1][nodeIdx];
+                float dz = qp[2] - m_positions[2][nodeIdx];
+                float sqDist = dx * dx + dy * dy + dz * dz;
+                if (sqDist <= sqRadius)
+                    process(m_indices[nodeIdx], sqDist);
+            }
+        }
+        
+        // JP: 半径maxRadius内で最も近いk点(k <= MaxK)を探索し、各点についてprocess(index, squaredDistance)を呼ぶ。
+        //     返り値は見つかった点を全て含む半径の2乗(k点未満の場合はmaxRadiusの2乗)。
+        // EN: find the k (<= MaxK) nearest points within maxRadius, then call process(index, squaredDistance) for each of them.
+        //     The return value is the squared radius enclosing all the found points (squared maxRadius if fewer than k points are found).
+        template <uint32_t MaxK, typename ProcessPoint>
+        float queryKNearest(const Point3D &p, uint32_t k, float maxRadius, ProcessPoint process) const {
+            SLRAssert(k <= MaxK, "k must not exceed MaxK.");
+            const float maxSqRadius = maxRadius * maxRadius;
+            if (m_numPoints == 0 || k == 0)
+                return maxSqRadius;
+            const float qp[3] = {p.x, p.y, p.z};
+            
+            // JP: 見つかった点は距離の最大ヒープとして保持する。
+            // EN: found points are kept as a max heap on the distance.
+            uint32_t foundIndices[MaxK];
+            float foundSqDists[MaxK];
+            uint32_t numFound = 0;
+            float sqRadius = maxSqRadius;
+            
+            uint32_t stack[MaxDepth];
+            float stackSqDists[MaxDepth];
+            uint32_t depth = 0;
+            stack[depth] = 0;
+            stackSqDists[depth] = 0.0f;
+            ++depth;
+            while (depth > 0) {
+                --depth;
+                if (stackSqDists[depth] > sqRadius)
+                    continue;
+                uint32_t nodeIdx = stack[depth];
+                uint8_t axis = m_splitAxes[nodeIdx];
+                float d = qp[axis] - m_positions[axis][nodeIdx];
+                uint32_t nearIdx = 2 * nodeIdx + (d < 0 ? 1 : 2);
+                uint32_t farIdx = 2 * nodeIdx + (d < 0 ? 2 : 1);
+                if (farIdx < m_numPoints && d * d <= sqRadius) {
+                    stack[depth] = farIdx;
+                    stackSqDists[depth] = d * d;
+                    ++depth;
+                }
+                if (nearIdx < m_numPoints) {
+                    stack[depth] = nearIdx;
+                    stackSqDists[depth] = 0.0f;
+                    ++depth;
+                }
+                
+                float dx = qp[0] - m_positions[0][nodeIdx];
+                float dy = qp[1] - m_positions[1][nodeIdx];
+                float dz = qp[2] - m_positions[2][nodeIdx];
+                float sqDist = dx * dx + dy * dy + dz * dz;
+                if (sqDist > sqRadius)
+                    continue;
+                
+                if (numFound < k) {
+                    // sift up
+                    uint32_t idx = numFound++;
+                    while (idx > 0) {
+                        uint32_t parent = (idx - 1) / 2;
+                        if (foundSqDists[parent] >= sqDist)
+                            break;
+                        foundIndices[idx] = foundIndices[parent];
+                        foundSqDists[idx] = foundSqDists[parent];
+                        idx = parent;
+                    }
+                    foundIndices[idx] = m_indices[nodeIdx];
+                    foundSqDists[idx] = sqDist;
+                }
+                else {
+                    // replace the farthest point then sift down
+                    uint32_t idx = 0;
+                    while (true) {
+                        uint32_t child = 2 * idx + 1;
+                        if (child >= numFound)
+                            break;
+                        if (child + 1 < numFound && foundSqDists[child + 1] > foundSqDists[child])
+                            ++child;
+                        if (foundSqDists[child] <= sqDist)
+                            break;
+                        foundIndices[idx] = foundIndices[child];
+                        foundSqDists[idx] = foundSqDists[child];
+                        idx = child;
+                    }
+                    foundIndices[idx] = m_indices[nodeIdx];
+                    foundSqDists[idx] = sqDist;
+                }
+                if (numFound == k)
+                    sqRadius = foundSqDists[0];
+            }
+            
+            for (int i = 0; i < numFound; ++i)
+                process(foundIndices[i], foundSqDists[i]);
+            return sqRadius;
+        }
+    };
+}
+
+#endif /* __SLR_PointKDTree__ */
@@ -36,6 +36,24 @@ namespace SLR {
         RaySegmentTemplate(RealType dMin = 0.0f, RealType dMax = INFINITY) : 
         distMin(dMin), distMax(dMax) { }
     };
+    
+    
+    
+    // JP: 画素座標に関するレイの原点と方向の微分(レイ微分)。
+    //     validがfalseの場合は微分を追跡していない。
+    // EN: derivatives of the origin and the direction of a ray with respect to the pixel coordinates (ray differentials).
+    //     Differentials are not tracked when "valid" is false.
+    template <typename RealType>
+    struct SLR_API RayDifferentialTemplate {
+        Vector3DTemplate<RealType> dOdx, dOdy;
+        Vector3DTemplate<RealType> dDdx, dDdy;
+        bool valid;
+        
+        RayDifferentialTemplate() : valid(false) { }
+        RayDifferentialTemplate(const Vector3DTemplate<RealType> &dodx, const Vector3DTemplate<RealType> &dody,
+                                const Vector3DTemplate<RealType> &dddx, const Vector3DTemplate<RealType> &dddy) :
+        dOdx(dodx), dOdy(dody), dDdx(dddx), dDdy(dddy), valid(true) { }
+    };
 }
 
 #endif /* __SLR_Ray__ */
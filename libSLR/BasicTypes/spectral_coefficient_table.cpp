@@ -0,0 +1,202 @@
+//
+//  spectral_coefficient_table.cpp
+//
+//  Created by 渡部 心 on 2017/07/06.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#include "spectral_coefficient_table.h"
+
+#include "../Helper/ThreadPool.h"
+
+#ifdef SLR_Use_Spectral_Representation
+namespace SLR {
+    static double determinant3x3(const double m[3][3]) {
+        return (m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) -
+                m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+                m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]));
+    }
+    
+    static bool solve3x3(const double A[3][3], const double b[3], double x[3]) {
+        double det = determinant3x3(A);
+        if (det == 0 || !std::isfinite(det))
+            return false;
+        for (int k = 0; k < 3; ++k) {
+            double m[3][3];
+            for (int i = 0; i < 3; ++i)
+                for (int j = 0; j < 3; ++j)
+                    m[i][j] = j == k ? b[i] : A[i][j];
+            x[k] = determinant3x3(m) / det;
+        }
+        return true;
+    }
+    
+    // JP: フィッティングはアップサンプリングのスペクトルデータと同じ5nm間隔の波長で行う。
+    // EN: fitting is done at the wavelengths at 5nm intervals same as the spectral data for upsampling.
+    static const uint32_t NumFittingSamples = 95;
+    static const uint32_t CMFStride = (NumCMFSamples - 1) / (NumFittingSamples - 1);
+    
+    // JP: シグモイド多項式スペクトルのXYZ値と係数に関するヤコビ行列を求める。
+    // EN: compute the XYZ values of a sigmoid-polynomial spectrum and the Jacobian with respect to the coefficients.
+    static void computeXYZ(const double c[3], const double cmfs[][3], double XYZ[3], double J[3][3]) {
+        for (int k = 0; k < 3; ++k) {
+            XYZ[k] = 0;
+            for (int m = 0; m < 3; ++m)
+                J[k][m] = 0;
+        }
+        for (int i = 0; i < NumFittingSamples; ++i) {
+            double l = (double)i / (NumFittingSamples - 1);
+            double x = (c[0] * l + c[1]) * l + c[2];
+            double sqX = 1 + x * x;
+            double s = 0.5 + 0.5 * x / std::sqrt(sqX);
+            double ds = 0.5 / (sqX * std::sqrt(sqX));
+            const double dx[3] = {l * l, l, 1};
+            for (int k = 0; k < 3; ++k) {
+                XYZ[k] += cmfs[i][k] * s;
+                for (int m = 0; m < 3; ++m)
+                    J[k][m] += cmfs[i][k] * ds * dx[m];
+            }
+        }
+    }
+    
+    static double computeError(const double XYZ[3], const double target[3], double r[3]) {
+        for (int k = 0; k < 3; ++k)
+            r[k] = XYZ[k] - target[k];
+        return r[0] * r[0] + r[1] * r[1] + r[2] * r[2];
+    }
+    
+    // JP: 単位スケールのUpsampledContinuousSpectrum(u, v, 1)と同じXYZ値を持つシグモイド多項式スペクトルを求める。
+    //     隣の格子点の解が与えられた場合、それがロジット空間での初期値より良ければ初期値として使う。
+    // EN: find a sigmoid-polynomial spectrum with the same XYZ values as UpsampledContinuousSpectrum(u, v, 1) with unit scale.
+    //     When the solution of the adjacent lattice point is given, use it as the initial guess if it is better than one in the logit space.
+    static SigmoidPolynomialSpectrum fitSigmoidPolynomial(float u, float v, const double cmfs[][3], const SigmoidPolynomialSpectrum* neighbor) {
+        float wavelengths[NumFittingSamples];
+        float values[NumFittingSamples];
+        for (int i = 0; i < NumFittingSamples; ++i)
+            wavelengths[i] = WavelengthLowBound + (WavelengthHighBound - WavelengthLowBound) * i / (NumFittingSamples - 1);
+        UpsampledContinuousSpectrum(u, v, 1.0f).evaluate(wavelengths, NumFittingSamples, values);
+        
+        SigmoidPolynomialSpectrum ret;
+        ret.c0 = ret.c1 = ret.c2 = 0.0f;
+        ret.scale = 0.0f;
+        float maxValue = *std::max_element(values, values + NumFittingSamples);
+        if (maxValue <= 0.0f)
+            return ret;
+        
+        // JP: シグモイドの値域[0, 1)に収まるよう最大値に余裕を持たせてスペクトルを正規化し、そのXYZ値を目標とする。
+        // EN: normalize the spectrum with a margin on the maximum to fit in the sigmoid's range [0, 1), and target its XYZ values.
+        const double scale = 1.05 * maxValue;
+        double target[3] = {0, 0, 0};
+        
+        // JP: ロジット空間での重み付き最小二乗法で初期値を求める。重みは可視域を重視するよう等色関数の和とする。
+        // EN: obtain an initial guess by weighted least squares in the logit space. Weights are the sum of CMFs to emphasize the visible range.
+        double AtA[3][3] = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
+        double Atb[3] = {0, 0, 0};
+        for (int i = 0; i < NumFittingSamples; ++i) {
+            double y = values[i] / scale;
+            for (int k = 0; k < 3; ++k)
+                target[k] += cmfs[i][k] * y;
+            
+            double t = 2 * std::clamp(y, 0.01, 0.99) - 1;
+            double x = t / std::sqrt(1 - t * t);
+            double l = (double)i / (NumFittingSamples - 1);
+            const double f[3] = {l * l, l, 1};
+            double w = cmfs[i][0] + cmfs[i][1] + cmfs[i][2] + 1e-4;
+            for (int j = 0; j < 3; ++j) {
+                Atb[j] += w * f[j] * x;
+                for (int k = 0; k < 3; ++k)
+                    AtA[j][k] += w * f[j] * f[k];
+            }
+        }
+        double c[3];
+        if (!solve3x3(AtA, Atb, c))
+            c[0] = c[1] = c[2] = 0;
+        
+        double XYZ[3], J[3][3], r[3];
+        computeXYZ(c, cmfs, XYZ, J);
+        double error = computeError(XYZ, target, r);
+        if (neighbor) {
+            double nc[3] = {neighbor->c0, neighbor->c1, neighbor->c2};
+            double nXYZ[3], nJ[3][3], nr[3];
+            computeXYZ(nc, cmfs, nXYZ, nJ);
+            double nError = computeError(nXYZ, target, nr);
+            if (nError < error) {
+                std::copy(nc, nc + 3, c);
+                std::copy(nr, nr + 3, r);
+                std::copy(&nJ[0][0], &nJ[0][0] + 9, &J[0][0]);
+                error = nError;
+            }
+        }
+        
+        // JP: XYZ値の残差に対するレーベンバーグ・マーカート法で係数を詰める。
+        // EN: refine the coefficients by the Levenberg-Marquardt method on the residual of XYZ values.
+        double damping = 1e-3;
+        for (int it = 0; it < 100 && error > 1e-12; ++it) {
+            double A[3][3], b[3];
+            for (int j = 0; j < 3; ++j) {
+                b[j] = -(J[0][j] * r[0] + J[1][j] * r[1] + J[2][j] * r[2]);
+                for (int k = 0; k < 3; ++k)
+                    A[j][k] = J[0][j] * J[0][k] + J[1][j] * J[1][k] + J[2][j] * J[2][k];
+                A[j][j] *= 1 + damping;
+            }
+            double delta[3];
+            if (!solve3x3(A, b, delta))
+                break;
+            
+            double newC[3] = {c[0] + delta[0], c[1] + delta[1], c[2] + delta[2]};
+            double newXYZ[3], newJ[3][3], newR[3];
+            computeXYZ(newC, cmfs, newXYZ, newJ);
+            double newError = computeError(newXYZ, target, newR);
+            if (newError < error) {
+                std::copy(newC, newC + 3, c);
+                std::copy(newR, newR + 3, r);
+                std::copy(&newJ[0][0], &newJ[0][0] + 9, &J[0][0]);
+                error = newError;
+                damping = std::max(damping * 0.3, 1e-8);
+            }
+            else {
+                damping *= 10;
+                if (damping > 1e8)
+                    break;
+            }
+        }
+        
+        ret.c0 = (float)c[0];
+        ret.c1 = (float)c[1];
+        ret.c2 = (float)c[2];
+        ret.scale = (float)scale;
+        return ret;
+    }
+    
+    SpectralCoefficientTable::SpectralCoefficientTable() {
+        m_numNodesU = UpsampledContinuousSpectrum::GridWidth * NumNodesPerUnit + 1;
+        m_numNodesV = UpsampledContinuousSpectrum::GridHeight * NumNodesPerUnit + 1;
+        m_nodes.resize(m_numNodesU * m_numNodesV);
+        
+        double cmfs[NumFittingSamples][3];
+        for (int i = 0; i < NumFittingSamples; ++i) {
+            cmfs[i][0] = xbarReferenceValues[CMFStride * i] / integralCMF;
+            cmfs[i][1] = ybarReferenceValues[CMFStride * i] / integralCMF;
+            cmfs[i][2] = zbarReferenceValues[CMFStride * i] / integralCMF;
+        }
+        
+        // JP: 行ごとに並列にフィッティングする。行内では隣の格子点の解を初期値の候補として収束を早める。
+        // EN: fit in parallel for each row. Within a row, use the solution of the adjacent lattice point as a candidate of the initial guess
+        //     to accelerate convergence.
+        ThreadPool threadPool;
+        for (int iv = 0; iv < m_numNodesV; ++iv) {
+            threadPool.enqueue([this, iv, &cmfs](uint32_t threadID) {
+                SigmoidPolynomialSpectrum* row = m_nodes.data() + m_numNodesU * iv;
+                for (int iu = 0; iu < m_numNodesU; ++iu)
+                    row[iu] = fitSigmoidPolynomial((float)iu / NumNodesPerUnit, (float)iv / NumNodesPerUnit, cmfs, iu > 0 ? &row[iu - 1] : nullptr);
+            });
+        }
+        threadPool.wait();
+    }
+    
+    const SpectralCoefficientTable &SpectralCoefficientTable::instance() {
+        static SpectralCoefficientTable s_instance;
+        return s_instance;
+    }
+}
+#endif
@@ -0,0 +1,129 @@
+//
+//  spectral_coefficient_table.h
+//
+//  Created by 渡部 心 on 2017/07/06.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#ifndef __SLR_spectral_coefficient_table__
+#define __SLR_spectral_coefficient_table__
+
+#include "../defines.h"
+#include "../declarations.h"
+#include "spectrum_types.h"
+#include <nmmintrin.h>
+
+#ifdef SLR_Use_Spectral_Representation
+namespace SLR {
+    // JP: 正規化した波長の2次多項式をシグモイド関数で包んだ滑らかなスペクトル。
+    //     scale * s(c0 * l^2 + c1 * l + c2), s(x) = 0.5 + 0.5 * x / sqrt(1 + x^2)で表され、1波長あたり数回の積和と平方根で評価できる。
+    // EN: smooth spectrum given by a quadratic polynomial of the normalized wavelength wrapped by a sigmoid function.
+    //     It is represented as scale * s(c0 * l^2 + c1 * l + c2), s(x) = 0.5 + 0.5 * x / sqrt(1 + x^2),
+    //     and can be evaluated with a few multiply-adds and a square root per wavelength.
+    struct SigmoidPolynomialSpectrum {
+        float c0, c1, c2;
+        float scale;
+        
+        // JP: 多項式の変数となる[0, 1]に正規化された波長。多数のスペクトルを同じ波長サンプルで評価する場合に一度だけ求めて共有する。
+        // EN: wavelengths normalized to [0, 1] which are the variable of the polynomial.
+        //     These are computed once and shared when evaluating many spectra with the same wavelength samples.
+        struct NormalizedWavelengths {
+            float lambdas[NumSpectralSamples];
+            
+            NormalizedWavelengths(const WavelengthSamples &wls) {
+                for (int i = 0; i < NumSpectralSamples; ++i)
+                    lambdas[i] = normalizeWavelength(wls.lambdas[i]);
+            }
+        };
+        
+        static float normalizeWavelength(float lambda) {
+            return (lambda - WavelengthLowBound) / (WavelengthHighBound - WavelengthLowBound);
+        }
+        
+        static float sigmoid(float x) {
+            return 0.5f + 0.5f * x / std::sqrt(1.0f + x * x);
+        }
+        
+        float evaluate(float normalizedLambda) const {
+            return scale * sigmoid((c0 * normalizedLambda + c1) * normalizedLambda + c2);
+        }
+        
+        // JP: 4波長ずつSIMDで評価する。
+        // EN: evaluate four wavelengths at a time with SIMD.
+        SampledSpectrum evaluate(const NormalizedWavelengths &nwls, float multiplier) const {
+            static_assert(NumSpectralSamples % 4 == 0, "The number of spectral samples is assumed to be a multiple of 4.");
+            const __m128 c0v = _mm_set_ps1(c0);
+            const __m128 c1v = _mm_set_ps1(c1);
+            const __m128 c2v = _mm_set_ps1(c2);
+            const __m128 one = _mm_set_ps1(1.0f);
+            const __m128 halfScale = _mm_set_ps1(0.5f * scale * multiplier);
+            SampledSpectrum ret;
+            for (int i = 0; i < NumSpectralSamples; i += 4) {
+                __m128 l = _mm_loadu_ps(nwls.lambdas + i);
+                __m128 x = _mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(c0v, l), c1v), l), c2v);
+                __m128 y = _mm_div_ps(x, _mm_sqrt_ps(_mm_add_ps(one, _mm_mul_ps(x, x))));
+                _mm_storeu_ps(ret.values + i, _mm_mul_ps(halfScale, _mm_add_ps(one, y)));
+            }
+            return ret;
+        }
+    };
+    
+    
+    
+    // JP: UpsampledContinuousSpectrumの(u, v)平面上の格子点ごとに、同じXYZ値を持つシグモイド多項式スペクトルの係数を事前計算した表。
+    //     アップサンプリングされるスペクトルはスケールに比例するため、明るさの次元は不要で2次元の表で足りる。
+    //     参照は4格子点の係数の双線形補間のみで、隣接データ点の探索とスペクトルデータの補間を置き換える。
+    //     格子点の間では係数の補間によって色がわずかにずれる。
+    // EN: table of coefficients of sigmoid-polynomial spectra, precomputed for each lattice point on the (u, v) plane of UpsampledContinuousSpectrum,
+    //     which have the same XYZ values.
+    //     An upsampled spectrum is proportional to its scale, so the brightness dimension is unnecessary and a 2D table suffices.
+    //     Lookup is only bilinear interpolation of coefficients at four lattice points, replacing the search of adjacent data points and
+    //     interpolation of spectral data.
+    //     Interpolation of coefficients slightly shifts the color between lattice points.
+    class SLR_API SpectralCoefficientTable {
+        static const uint32_t NumNodesPerUnit = 16;
+        
+        uint32_t m_numNodesU;
+        uint32_t m_numNodesV;
+        std::vector<SigmoidPolynomialSpectrum> m_nodes;
+        
+        SpectralCoefficientTable(const SpectralCoefficientTable &) = delete;
+        SpectralCoefficientTable &operator=(const SpectralCoefficientTable &) = delete;
+    public:
+        SpectralCoefficientTable();
+        
+        // JP: 初回の呼び出し時に表を並列に構築する。
+        // EN: build the table in parallel at the first call.
+        static const SpectralCoefficientTable &instance();
+        
+        // JP: 単位スケールのUpsampledContinuousSpectrum(u, v, 1)に対応する係数を返す。
+        // EN: return the coefficients corresponding to UpsampledContinuousSpectrum(u, v, 1) with unit scale.
+        SigmoidPolynomialSpectrum lookup(float u, float v) const {
+            float fu = std::clamp(u * NumNodesPerUnit, 0.0f, m_numNodesU - 1.0f);
+            float fv = std::clamp(v * NumNodesPerUnit, 0.0f, m_numNodesV - 1.0f);
+            uint32_t iu = std::min((uint32_t)fu, m_numNodesU - 2);
+            uint32_t iv = std::min((uint32_t)fv, m_numNodesV - 2);
+            float s = fu - iu;
+            float t = fv - iv;
+            
+            const SigmoidPolynomialSpectrum &n00 = m_nodes[m_numNodesU * iv + iu];
+            const SigmoidPolynomialSpectrum &n10 = m_nodes[m_numNodesU * iv + iu + 1];
+            const SigmoidPolynomialSpectrum &n01 = m_nodes[m_numNodesU * (iv + 1) + iu];
+            const SigmoidPolynomialSpectrum &n11 = m_nodes[m_numNodesU * (iv + 1) + iu + 1];
+            float w00 = (1 - s) * (1 - t);
+            float w10 = s * (1 - t);
+            float w01 = (1 - s) * t;
+            float w11 = s * t;
+            
+            SigmoidPolynomialSpectrum ret;
+            ret.c0 = w00 * n00.c0 + w10 * n10.c0 + w01 * n01.c0 + w11 * n11.c0;
+            ret.c1 = w00 * n00.c1 + w10 * n10.c1 + w01 * n01.c1 + w11 * n11.c1;
+            ret.c2 = w00 * n00.c2 + w10 * n10.c2 + w01 * n01.c2 + w11 * n11.c2;
+            ret.scale = w00 * n00.scale + w10 * n10.scale + w01 * n01.scale + w11 * n11.scale;
+            return ret;
+        }
+    };
+}
+#endif
+
+#endif /* __SLR_spectral_coefficient_table__ */
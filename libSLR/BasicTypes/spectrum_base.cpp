@@ -9,6 +9,7 @@
 
 #include "rgb_types.h"
 #include "spectrum_types.h"
+#include "spectral_coefficient_table.h"
 #include "../BasicTypes/CompensatedSum.h"
 
 namespace SLR {
@@ -230,5 +231,11 @@ namespace SLR {
         integralCMF = cum;
         
         ybarSpectrum = createUnique<RegularContinuousSpectrum>(WavelengthLowBound, WavelengthHighBound, ybarReferenceValues, NumCMFSamples);
+        
+#ifdef SLR_Use_Spectral_Coefficient_Table
+        // JP: レンダリング中に構築が走らないよう、ここで係数表を構築しておく。
+        // EN: build the coefficient table here so that the construction doesn't run during rendering.
+        SpectralCoefficientTable::instance();
+#endif
     }
 }
@@ -409,6 +409,16 @@ namespace SLR {
         else {
             // need to go through triangulation :(
             // we get the indices in such an order that they form a triangle fan around idx[0].
+            
+            // JP: どの三角形にも含まれない(量子化されたスペクトル軌跡の外側の)場合はファンの中心のデータ点にフォールバックする。
+            // EN: fall back to the data point at the center of the fan when the point is not contained in any triangle
+            //     (outside the quantized spectral locus).
+            m_adjIndices = (((uint32_t)UINT8_MAX << 24) |
+                            ((uint32_t)indices[0] << 16) |
+                            ((uint32_t)indices[0] << 8) |
+                            ((uint32_t)indices[0] << 0));
+            m_s = 1.0f;
+            m_t = 0.0f;
             // compute barycentric coordinates of our xy* point for all triangles in the fan:
             const float ex = u - spectrum_data_points[indices[0]].uv[0];
             const float ey = v - spectrum_data_points[indices[0]].uv[1];
@@ -445,7 +455,7 @@ namespace SLR {
                 break;
             }
         }
-        SLRAssert((m_adjIndices && 0xFF) != UINT8_MAX, "Adjacent points must be selected at this point.");
+        SLRAssert((m_adjIndices & 0xFF) != UINT8_MAX, "Adjacent points must be selected at this point.");
     }
     
     template <typename RealType, uint32_t NumSpectralSamples>
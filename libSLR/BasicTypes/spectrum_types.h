@@ -38,6 +38,7 @@ namespace SLR {
             selectedLambdaIndex = wls.selectedLambdaIndex;
             flags = wls.flags;
         }
+        WavelengthSamplesTemplate &operator=(const WavelengthSamplesTemplate &wls) = default;
         
         RealType &operator[](uint32_t index) {
             SLRAssert(index < NumSpectralSamples, "\"index\" is out of range [0, %u].", NumSpectralSamples - 1);
@@ -189,6 +190,68 @@ namespace SLR {
         
         UpsampledContinuousSpectrumTemplate(SpectrumType spType, ColorSpace space, RealType e0, RealType e1, RealType e2);
         
+        // JP: 波長サンプルに対応するスペクトルデータのビンと補間パラメーター。
+        //     同じ波長サンプルで多数のスペクトル(例えばテクセル)を評価する場合に一度だけ求めて共有する。
+        // EN: bins of the spectrum data and interpolation parameters corresponding to wavelength samples.
+        //     These are computed once and shared when evaluating many spectra (e.g. texels) with the same wavelength samples.
+        struct WavelengthBins {
+            uint32_t bins[NumSpectralSamples];
+            RealType params[NumSpectralSamples];
+            
+            WavelengthBins(const WavelengthSamplesTemplate<RealType, NumSpectralSamples> &wls) {
+                for (int i = 0; i < NumSpectralSamples; ++i) {
+                    RealType p = (wls.lambdas[i] - MinWavelength) / (MaxWavelength - MinWavelength);
+                    p = std::clamp<RealType>(p, 0.0f, 1.0f);
+                    RealType sBinF = p * (NumWavelengthSamples - 1);
+                    // JP: 次のビンが常に有効になるよう、最後のビンは一つ手前のビンの補間パラメーター1として扱う。
+                    // EN: treat the last bin as the interpolation parameter 1 of the previous bin so that the next bin is always valid.
+                    bins[i] = std::min((uint32_t)sBinF, NumWavelengthSamples - 2);
+                    params[i] = sBinF - bins[i];
+                }
+            }
+        };
+        
+        // JP: 全波長サンプルを一度に評価する。隣接データ点ごとに全波長を処理するため内側のループはベクトル化しやすい。
+        // EN: evaluate all the wavelength samples at once. The inner loop is easy to vectorize since all the wavelengths are processed per adjacent data point.
+        SampledSpectrumTemplate<RealType, NumSpectralSamples> evaluate(const WavelengthBins &wlBins) const {
+            uint8_t adjIndices[4];
+            adjIndices[0] = (m_adjIndices >> 0) & 0xFF;
+            adjIndices[1] = (m_adjIndices >> 8) & 0xFF;
+            adjIndices[2] = (m_adjIndices >> 16) & 0xFF;
+            adjIndices[3] = (m_adjIndices >> 24) & 0xFF;
+            
+            int numAdjacents;
+            RealType weights[4];
+            if (adjIndices[3] != UINT8_MAX) {
+                weights[0] = (1 - m_s) * (1 - m_t);
+                weights[1] = m_s * (1 - m_t);
+                weights[2] = (1 - m_s) * m_t;
+                weights[3] = m_s * m_t;
+                numAdjacents = 4;
+            }
+            else {
+                weights[0] = m_s;
+                weights[1] = m_t;
+                weights[2] = 1.0f - m_s - m_t;
+                numAdjacents = 3;
+            }
+            
+            RealType values[NumSpectralSamples];
+            for (int i = 0; i < NumSpectralSamples; ++i)
+                values[i] = 0;
+            for (int j = 0; j < numAdjacents; ++j) {
+                const RealType* spectrum = spectrum_data_points[adjIndices[j]].spectrum;
+                const RealType weight = weights[j] * m_scale;
+                for (int i = 0; i < NumSpectralSamples; ++i) {
+                    RealType v0 = spectrum[wlBins.bins[i]];
+                    RealType v1 = spectrum[wlBins.bins[i] + 1];
+                    values[i] += weight * (v0 + (v1 - v0) * wlBins.params[i]);
+                }
+            }
+            
+            return SampledSpectrumTemplate<RealType, NumSpectralSamples>(values);
+        }
+        
         void calcBounds(uint32_t numBins, RealType* bounds) const override;
         SampledSpectrumTemplate<RealType, NumSpectralSamples> evaluate(const WavelengthSamplesTemplate<RealType, NumSpectralSamples> &wls) const override;
         void evaluate(const RealType* wavelengths, uint32_t numSamples, RealType* values) const override;
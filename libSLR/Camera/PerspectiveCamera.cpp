@@ -105,4 +105,18 @@ namespace SLR {
         *hitPx = m_cam.m_sensor->width() * smpX;
         *hitPy = m_cam.m_sensor->height() * smpY;
     }
+    
+    bool PerspectiveIDF::calculateDirectionDerivatives(const Vector3D &dirLocal, Vector3D* dDdu0, Vector3D* dDdu1) const {
+        // JP: 方向はpFocus - orgLocalの正規化であり、pFocusはサンプル座標に対して線形に動く。
+        // EN: the direction is the normalized pFocus - orgLocal, and pFocus moves linearly with respect to the sample coordinates.
+        Vector3D toFocus = dirLocal * (m_cam.m_objPlaneDistance / dirLocal.z);
+        float dist = toFocus.length();
+        Vector3D dir = toFocus / dist;
+        auto differentiate = [&dir, &dist](const Vector3D &dFocus) {
+            return (dFocus - dot(dFocus, dir) * dir) / dist;
+        };
+        *dDdu0 = differentiate(Vector3D(-m_cam.m_opWidth, 0, 0));
+        *dDdu1 = differentiate(Vector3D(0, -m_cam.m_opHeight, 0));
+        return true;
+    }
 }
@@ -53,6 +53,7 @@ namespace SLR {
         SampledSpectrum evaluate(const Vector3D &dirIn) const override;
         float evaluatePDF(const Vector3D &dirIn) const override;
         void calculatePixel(const Vector3D &dirIn, float* hitPx, float* hitPy) const override;
+        bool calculateDirectionDerivatives(const Vector3D &dirLocal, Vector3D* dDdu0, Vector3D* dDdu1) const override;
     };    
 }
 
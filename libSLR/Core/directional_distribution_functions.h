@@ -410,6 +410,9 @@ namespace SLR {
         virtual SampledSpectrum evaluate(const Vector3D &dirIn) const = 0;
         virtual float evaluatePDF(const Vector3D &dirIn) const = 0;
         virtual void calculatePixel(const Vector3D &dirIn, float* hitPx, float* hitPy) const = 0;
+        // JP: サンプル座標uDirに関する方向の微分を求める。レイ微分に対応しない場合はfalseを返す。
+        // EN: calculate derivatives of the direction with respect to the sample coordinates uDir. This returns false when ray differentials are not supported.
+        virtual bool calculateDirectionDerivatives(const Vector3D &dirLocal, Vector3D* dDdu0, Vector3D* dDdu1) const { return false; }
         
         virtual bool matches(DirectionType flags) const { return m_type.matches(flags); }
         bool hasNonDelta() const { return matches(DirectionType::WholeSphere | DirectionType::NonDelta); }
@@ -10,6 +10,8 @@
 #include "../BasicTypes/CompensatedSum.h"
 #include "../Helper/bmp_exporter.h"
 #include "../RNG/LinearCongruentialRNG.h"
+#include "../Helper/ThreadPool.h"
+#include <nmmintrin.h>
 
 namespace SLR {
     template <typename RealType>
@@ -333,6 +335,312 @@ namespace SLR {
     template class SLR_API RegularConstantContinuousDistribution2DTemplate<float>;
     template class SLR_API RegularConstantContinuousDistribution2DTemplate<double>;
     
+    
+    
+    // JP: Voseの方法でエイリアステーブルを構築し、値の合計を返す。
+    //     合計が0の場合は一様なテーブルを作り、確率(密度)は0とする。
+    // EN: build an alias table by Vose's method and return the sum of the values.
+    //     When the sum is zero, make a uniform table with zero probability (density).
+    template <typename RealType>
+    static RealType buildAliasTable(const RealType* values, uint32_t numValues, bool asDensity, AliasTableEntry<RealType>* entries, uint32_t* workList) {
+        CompensatedSum<RealType> sum(0);
+        for (int i = 0; i < numValues; ++i)
+            sum += values[i];
+        RealType sumValue = sum;
+        if (sumValue <= 0) {
+            for (int i = 0; i < numValues; ++i)
+                entries[i] = AliasTableEntry<RealType>{1, (uint32_t)i, 0};
+            return sumValue;
+        }
+        
+        // JP: 小さい要素を作業リストの前方から、大きい要素を後方から詰める。
+        // EN: pack small entries from the front of the work list and large entries from the back.
+        uint32_t numSmall = 0;
+        uint32_t largeBegin = numValues;
+        for (int i = 0; i < numValues; ++i) {
+            RealType scaled = values[i] * numValues / sumValue;
+            entries[i].threshold = scaled;
+            entries[i].secondIndex = i;
+            entries[i].value = asDensity ? scaled : values[i] / sumValue;
+            if (scaled < 1)
+                workList[numSmall++] = i;
+            else
+                workList[--largeBegin] = i;
+        }
+        
+        // JP: 各インデックスは高々一方のリストにしか無いので2つのスタックが重なることはない。
+        // EN: the two stacks never overlap since each index is in at most one of the lists.
+        while (numSmall > 0 && largeBegin < numValues) {
+            uint32_t sIdx = workList[--numSmall];
+            uint32_t lIdx = workList[largeBegin];
+            entries[sIdx].secondIndex = lIdx;
+            entries[lIdx].threshold = (entries[lIdx].threshold + entries[sIdx].threshold) - 1;
+            if (entries[lIdx].threshold < 1) {
+                ++largeBegin;
+                workList[numSmall++] = lIdx;
+            }
+        }
+        // JP: 残りは数値誤差を除けば閾値が1である。
+        // EN: the remaining entries have threshold 1 except for numerical errors.
+        for (uint32_t i = 0; i < numSmall; ++i)
+            entries[workList[i]].threshold = 1;
+        for (uint32_t i = largeBegin; i < numValues; ++i)
+            entries[workList[i]].threshold = 1;
+        
+        return sumValue;
+    }
+    
+    // JP: 一様乱数からインデックスを選び、同じ乱数を再利用できるように[0, 1)に写像し直す。
+    // EN: choose an index from a uniform random number, then remap the number to [0, 1) so that it can be reused.
+    template <typename RealType>
+    static inline uint32_t sampleAliasTable(const AliasTableEntry<RealType>* entries, uint32_t numValues, RealType u, RealType* remapped) {
+        RealType su = u * numValues;
+        uint32_t idx = std::min((uint32_t)su, numValues - 1);
+        RealType frac = su - idx;
+        const AliasTableEntry<RealType> &entry = entries[idx];
+        const RealType OneMinusEpsilon = std::nextafter(RealType(1), RealType(0));
+        if (frac < entry.threshold) {
+            *remapped = std::min(frac / entry.threshold, OneMinusEpsilon);
+            return idx;
+        }
+        *remapped = std::min((frac - entry.threshold) / (1 - entry.threshold), OneMinusEpsilon);
+        return entry.secondIndex;
+    }
+    
+    // JP: 丸め誤差でサンプルが隣のセルに入らないようにする。
+    // EN: prevent a sample from falling into the next cell due to rounding errors.
+    template <typename RealType>
+    static inline RealType cellToContinuous(uint32_t idx, RealType t, uint32_t numValues) {
+        RealType ret = (idx + t) / numValues;
+        while ((uint32_t)(ret * numValues) > idx)
+            ret = std::nextafter(ret, RealType(0));
+        return ret;
+    }
+    
+    
+    
+    template <typename RealType>
+    DiscreteAliasDistribution1DTemplate<RealType>::DiscreteAliasDistribution1DTemplate(const RealType* values, size_t numValues) {
+        m_numValues = (uint32_t)numValues;
+        m_entries = new AliasTableEntry<RealType>[m_numValues];
+        std::vector<uint32_t> workList(m_numValues);
+        m_integral = buildAliasTable(values, m_numValues, false, m_entries, workList.data());
+    }
+    
+    template <typename RealType>
+    DiscreteAliasDistribution1DTemplate<RealType>::DiscreteAliasDistribution1DTemplate(const std::vector<RealType> &values) {
+        m_numValues = (uint32_t)values.size();
+        m_entries = new AliasTableEntry<RealType>[m_numValues];
+        std::vector<uint32_t> workList(m_numValues);
+        m_integral = buildAliasTable(values.data(), m_numValues, false, m_entries, workList.data());
+    }
+    
+    template <typename RealType>
+    uint32_t DiscreteAliasDistribution1DTemplate<RealType>::sample(RealType u, RealType* prob) const {
+        SLRAssert(u >= 0 && u < 1, "\"u\" must be in range [0, 1).");
+        RealType remapped;
+        uint32_t idx = sampleAliasTable(m_entries, m_numValues, u, &remapped);
+        *prob = m_entries[idx].value;
+        return idx;
+    };
+    
+    template <typename RealType>
+    uint32_t DiscreteAliasDistribution1DTemplate<RealType>::sample(RealType u, RealType* prob, RealType* remapped) const {
+        SLRAssert(u >= 0 && u < 1, "\"u\" must be in range [0, 1).");
+        uint32_t idx = sampleAliasTable(m_entries, m_numValues, u, remapped);
+        *prob = m_entries[idx].value;
+        return idx;
+    };
+    
+    template class SLR_API DiscreteAliasDistribution1DTemplate<float>;
+    template class SLR_API DiscreteAliasDistribution1DTemplate<double>;
+    
+    
+    
+    template <typename RealType>
+    RegularConstantContinuousAliasDistribution1DTemplate<RealType>::RegularConstantContinuousAliasDistribution1DTemplate(uint32_t numValues, const std::function<RealType(uint32_t)> &pickFunc) :
+    m_numValues(numValues) {
+        std::vector<RealType> values(m_numValues);
+        for (int i = 0; i < m_numValues; ++i)
+            values[i] = pickFunc(i);
+        m_entries = new AliasTableEntry<RealType>[m_numValues];
+        std::vector<uint32_t> workList(m_numValues);
+        m_integral = buildAliasTable(values.data(), m_numValues, true, m_entries, workList.data()) / m_numValues;
+    };
+    
+    template <typename RealType>
+    RegularConstantContinuousAliasDistribution1DTemplate<RealType>::RegularConstantContinuousAliasDistribution1DTemplate(const std::vector<RealType> &values) :
+    m_numValues((uint32_t)values.size()) {
+        m_entries = new AliasTableEntry<RealType>[m_numValues];
+        std::vector<uint32_t> workList(m_numValues);
+        m_integral = buildAliasTable(values.data(), m_numValues, true, m_entries, workList.data()) / m_numValues;
+    };
+    
+    template <typename RealType>
+    RealType RegularConstantContinuousAliasDistribution1DTemplate<RealType>::sample(RealType u, RealType* PDF) const {
+        SLRAssert(u >= 0 && u < 1, "\"u\" must be in range [0, 1).");
+        RealType t;
+        uint32_t idx = sampleAliasTable(m_entries, m_numValues, u, &t);
+        *PDF = m_entries[idx].value;
+        return cellToContinuous(idx, t, m_numValues);
+    };
+    
+    template <typename RealType>
+    RealType RegularConstantContinuousAliasDistribution1DTemplate<RealType>::evaluatePDF(RealType smp) const {
+        SLRAssert(smp >= 0 && smp < 1.0, "\"smp\" is out of range [0, 1)");
+        return m_entries[std::min((uint32_t)(smp * m_numValues), m_numValues - 1)].value;
+    };
+    
+    template class SLR_API RegularConstantContinuousAliasDistribution1DTemplate<float>;
+    template class SLR_API RegularConstantContinuousAliasDistribution1DTemplate<double>;
+    
+    
+    
+    template <typename RealType>
+    RegularConstantContinuousAliasDistribution2DTemplate<RealType>::RegularConstantContinuousAliasDistribution2DTemplate(uint32_t numD1, uint32_t numD2, const std::function<RealType(uint32_t, uint32_t)> &pickFunc) :
+    m_numD1(numD1), m_numD2(numD2) {
+        m_entries = new AliasTableEntry<RealType>[m_numD1 * m_numD2];
+        m_topEntries = new AliasTableEntry<RealType>[m_numD2];
+        std::vector<RealType> rowIntegrals(m_numD2);
+        
+        // JP: 各行の値を評価してテーブルを作成する。
+        // EN: evaluate values of each row and build its table.
+        auto buildRows = [this, &pickFunc, &rowIntegrals](uint32_t rowBegin, uint32_t rowEnd) {
+            std::vector<RealType> values(m_numD1);
+            std::vector<uint32_t> workList(m_numD1);
+            for (uint32_t y = rowBegin; y < rowEnd; ++y) {
+                for (int x = 0; x < m_numD1; ++x)
+                    values[x] = pickFunc(x, y);
+                rowIntegrals[y] = buildAliasTable(values.data(), m_numD1, true, m_entries + y * m_numD1, workList.data()) / m_numD1;
+            }
+        };
+        
+        const uint32_t ParallelBuildThreshold = 1 << 16;
+        uint32_t numThreads = std::thread::hardware_concurrency();
+        if (m_numD1 * m_numD2 >= ParallelBuildThreshold && numThreads > 1) {
+            uint32_t rowsPerTask = std::max(m_numD2 / (4 * numThreads), 1u);
+            ThreadPool threadPool(numThreads);
+            for (uint32_t y = 0; y < m_numD2; y += rowsPerTask) {
+                uint32_t rowEnd = std::min(y + rowsPerTask, m_numD2);
+                threadPool.enqueue([&buildRows, y, rowEnd](uint32_t threadID) {
+                    buildRows(y, rowEnd);
+                });
+            }
+            threadPool.wait();
+        }
+        else {
+            buildRows(0, m_numD2);
+        }
+        
+        // JP: 各行の積分値を用いてテーブルを作成する。
+        // EN: build a table using integral values of each row.
+        std::vector<uint32_t> workList(m_numD2);
+        m_integral = buildAliasTable(rowIntegrals.data(), m_numD2, true, m_topEntries, workList.data()) / m_numD2;
+        SLRAssert(std::isfinite(m_integral), "invalid integral value.");
+    };
+    
+    template <typename RealType>
+    RegularConstantContinuousAliasDistribution2DTemplate<RealType>::RegularConstantContinuousAliasDistribution2DTemplate(uint32_t numD1, uint32_t numD2, const RealType* values) :
+    RegularConstantContinuousAliasDistribution2DTemplate(numD1, numD2, [values, numD1](uint32_t x, uint32_t y) { return values[y * numD1 + x]; }) {
+    }
+    
+    template <typename RealType>
+    bool RegularConstantContinuousAliasDistribution2DTemplate<RealType>::write(FILE* fp) const {
+        bool success = fwrite(&m_integral, sizeof(m_integral), 1, fp) == 1;
+        success &= fwrite(m_topEntries, sizeof(AliasTableEntry<RealType>), m_numD2, fp) == m_numD2;
+        success &= fwrite(m_entries, sizeof(AliasTableEntry<RealType>), m_numD1 * m_numD2, fp) == m_numD1 * m_numD2;
+        return success;
+    }
+    
+    template <typename RealType>
+    RegularConstantContinuousAliasDistribution2DTemplate<RealType>* RegularConstantContinuousAliasDistribution2DTemplate<RealType>::read(FILE* fp, uint32_t numD1, uint32_t numD2) {
+        RegularConstantContinuousAliasDistribution2DTemplate* dist = new RegularConstantContinuousAliasDistribution2DTemplate(numD1, numD2);
+        bool success = fread(&dist->m_integral, sizeof(dist->m_integral), 1, fp) == 1;
+        success &= fread(dist->m_topEntries, sizeof(AliasTableEntry<RealType>), numD2, fp) == numD2;
+        success &= fread(dist->m_entries, sizeof(AliasTableEntry<RealType>), numD1 * numD2, fp) == numD1 * numD2;
+        
+        // JP: 壊れたファイルからの読み込みでサンプリングが範囲外を参照しないよう、インデックスを検証する。
+        // EN: validate indices so that sampling doesn't access out of range with data read from a broken file.
+        for (uint32_t i = 0; i < numD2 && success; ++i)
+            success &= dist->m_topEntries[i].secondIndex < numD2;
+        for (uint32_t i = 0; i < numD1 * numD2 && success; ++i)
+            success &= dist->m_entries[i].secondIndex < numD1;
+        success &= std::isfinite(dist->m_integral);
+        if (!success) {
+            delete dist;
+            return nullptr;
+        }
+        return dist;
+    }
+    
+    template <typename RealType>
+    void RegularConstantContinuousAliasDistribution2DTemplate<RealType>::sample(RealType u0, RealType u1, RealType* d0, RealType* d1, RealType* PDF) const {
+        SLRAssert(u0 >= 0 && u0 < 1, "\"u0\" must be in range [0, 1).: %g", u0);
+        SLRAssert(u1 >= 0 && u1 < 1, "\"u1\" must be in range [0, 1).: %g", u1);
+        RealType t0, t1;
+        uint32_t idxD2 = sampleAliasTable(m_topEntries, m_numD2, u1, &t1);
+        const AliasTableEntry<RealType>* rowEntries = m_entries + idxD2 * m_numD1;
+        uint32_t idxD1 = sampleAliasTable(rowEntries, m_numD1, u0, &t0);
+        *d0 = cellToContinuous(idxD1, t0, m_numD1);
+        *d1 = cellToContinuous(idxD2, t1, m_numD2);
+        *PDF = m_topEntries[idxD2].value * rowEntries[idxD1].value;
+    };
+    
+    template <typename RealType>
+    RealType RegularConstantContinuousAliasDistribution2DTemplate<RealType>::evaluatePDF(RealType d0, RealType d1) const {
+        SLRAssert(d0 >= 0 && d0 < 1.0, "\"d0\" is out of range [0, 1)");
+        SLRAssert(d1 >= 0 && d1 < 1.0, "\"d1\" is out of range [0, 1)");
+        uint32_t idxD1 = std::min(uint32_t(m_numD1 * d0), m_numD1 - 1);
+        uint32_t idxD2 = std::min(uint32_t(m_numD2 * d1), m_numD2 - 1);
+        return m_topEntries[idxD2].value * m_entries[idxD2 * m_numD1 + idxD1].value;
+    };
+    
+    // For debug visualization.
+    template <typename RealType>
+    void RegularConstantContinuousAliasDistribution2DTemplate<RealType>::exportBMP(const std::string &filename, bool logScale, float gamma) const {
+        uint32_t width = m_numD1;
+        uint32_t height = m_numD2;
+        uint32_t byteWidth = width * 3 + width % 4;
+        uint8_t* data = (uint8_t*)malloc(height * byteWidth);
+        
+        float minValue = INFINITY;
+        float maxValue = -INFINITY;
+        for (int i = 0; i < height; ++i) {
+            for (int j = 0; j < width; ++j) {
+                float value = m_topEntries[i].value * m_entries[i * width + j].value;
+                if (logScale)
+                    value = std::log(value);
+                if (std::isfinite(value)) {
+                    minValue = std::min(minValue, value);
+                    maxValue = std::max(maxValue, value);
+                }
+            }
+        }
+        for (int i = 0; i < height; ++i) {
+            for (int j = 0; j < width; ++j) {
+                float value = m_topEntries[i].value * m_entries[i * width + j].value;
+                if (logScale) {
+                    value = std::log(value);
+                    value = std::isfinite(value) ? (value - minValue) / (maxValue - minValue) : 0;
+                }
+                else {
+                    value /= maxValue;
+                }
+                uint8_t pixVal = uint8_t(std::pow(value, 1.0f / gamma) * 255);
+                
+                uint32_t idx = (height - i - 1) * byteWidth + 3 * j;
+                data[idx + 0] = pixVal;
+                data[idx + 1] = pixVal;
+                data[idx + 2] = pixVal;
+            }
+        }
+        saveBMP(filename.c_str(), data, width, height);
+        free(data);
+    };
+    
+    template class SLR_API RegularConstantContinuousAliasDistribution2DTemplate<float>;
+    template class SLR_API RegularConstantContinuousAliasDistribution2DTemplate<double>;
+    
     template <typename RealType>
     MultiContinuousDistribution2DTemplate<RealType>::MultiContinuousDistribution2DTemplate(const ContinuousDistribution2DTemplate<RealType>** dists, const RealType* importances, uint32_t numDists) : 
     m_selectDist(DiscreteDistribution1DTemplate<RealType>(importances, numDists)) {
@@ -417,7 +725,8 @@ namespace SLR {
     }
     
     template <typename RealType>
-    RealType ImprovedPerlinNoise3DGeneratorTemplate<RealType>::evaluate(const Point3DTemplate<RealType> &p, RealType frequency) const {        
+    void ImprovedPerlinNoise3DGeneratorTemplate<RealType>::computeLattice(const Point3DTemplate<RealType> &p, RealType frequency,
+                                                                          RealType fractions[3], uint8_t hashes[8]) const {
         RealType x = p.x * frequency, y = p.y * frequency, z = p.z * frequency;
         const uint32_t repeat = (uint32_t)(m_repeat * frequency);
         
@@ -440,6 +749,38 @@ namespace SLR {
         const int32_t yi = std::floor(y);
         const int32_t zi = std::floor(z);
         
+        // Next we calculate the location (from 0.0 to 1.0) in that cube.
+        fractions[0] = x - xi;
+        fractions[1] = y - yi;
+        fractions[2] = z - zi;
+        SLRAssert(fractions[0] >= 0 && fractions[0] <= 1 && fractions[1] >= 0 && fractions[1] <= 1 && fractions[2] >= 0 && fractions[2] <= 1,
+                  "xu, yu, zu must be in the unit cube [0, 1]^3.");
+        
+        const auto inc = [this, repeat](int32_t num) {
+            ++num;
+            if (repeat > 0)
+                num %= repeat;
+            return num;
+        };
+        
+        // JP: 単位立方体の頂点のハッシュ。インデックスのビット0, 1, 2がそれぞれx, y, z方向の上側の頂点を表す。
+        // EN: hashes of the vertices of the unit cube. Bits 0, 1, 2 of the index represent the upper vertex in x, y, z direction respectively.
+        hashes[0] = hash(    xi ,     yi ,     zi );
+        hashes[1] = hash(inc(xi),     yi ,     zi );
+        hashes[2] = hash(    xi , inc(yi),     zi );
+        hashes[3] = hash(inc(xi), inc(yi),     zi );
+        hashes[4] = hash(    xi ,     yi , inc(zi));
+        hashes[5] = hash(inc(xi),     yi , inc(zi));
+        hashes[6] = hash(    xi , inc(yi), inc(zi));
+        hashes[7] = hash(inc(xi), inc(yi), inc(zi));
+    }
+    
+    template <typename RealType>
+    RealType ImprovedPerlinNoise3DGeneratorTemplate<RealType>::evaluate(const Point3DTemplate<RealType> &p, RealType frequency) const {
+        RealType fractions[3];
+        uint8_t hashes[8];
+        computeLattice(p, frequency, fractions, hashes);
+        
         const auto fade = [](RealType t) {
             // Fade function as defined by Ken Perlin.
             // This eases coordinate values so that they will "ease" towards integral values.
@@ -447,34 +788,15 @@ namespace SLR {
             // 6t^5 - 15t^4 + 10t^3
             return t * t * t * (t * (t * 6 - 15) + 10);
         };
-         
-        // Next we calculate the location (from 0.0 to 1.0) in that cube.
+        
         // We also fade the location to smooth the result.
-        RealType xu = x - xi;
-        RealType yu = y - yi;
-        RealType zu = z - zi;
-        SLRAssert(xu >= 0 && xu <= 1 && yu >= 0 && yu <= 1 && zu >= 0 && zu <= 1, "xu, yu, zu must be in the unit cube [0, 1]^3.");
+        RealType xu = fractions[0];
+        RealType yu = fractions[1];
+        RealType zu = fractions[2];
         RealType u = fade(xu);
         RealType v = fade(yu);
         RealType w = fade(zu);
         
-        const auto inc = [this, repeat](int32_t num) {
-            ++num;
-            if (repeat > 0)
-                num %= repeat;
-            return num;
-        };
-        
-        uint8_t lll, llu, lul, luu, ull, ulu, uul, uuu;
-        lll = hash(    xi ,     yi ,     zi );
-        ull = hash(inc(xi),     yi ,     zi );
-        lul = hash(    xi , inc(yi),     zi );
-        uul = hash(inc(xi), inc(yi),     zi );
-        llu = hash(    xi ,     yi , inc(zi));
-        ulu = hash(inc(xi),     yi , inc(zi));
-        luu = hash(    xi , inc(yi), inc(zi));
-        uuu = hash(inc(xi), inc(yi), inc(zi));
-        
         const auto lerp = [](RealType v0, RealType v1, RealType t) {
             return v0 * (1 - t) + v1 * t;
         };
@@ -482,12 +804,12 @@ namespace SLR {
         // The gradient function calculates the dot product between a pseudorandom gradient vector and 
         // the vector from the input coordinate to the 8 surrounding points in its unit cube.
         // This is all then lerped together as a sort of weighted average based on the faded (u,v,w) values we made earlier.
-        RealType _llValue = lerp(gradient(lll, xu, yu, zu), gradient(ull, xu - 1, yu, zu), u);
-        RealType _ulValue = lerp(gradient(lul, xu, yu - 1, zu), gradient(uul, xu - 1, yu - 1, zu), u);
+        RealType _llValue = lerp(gradient(hashes[0], xu, yu, zu), gradient(hashes[1], xu - 1, yu, zu), u);
+        RealType _ulValue = lerp(gradient(hashes[2], xu, yu - 1, zu), gradient(hashes[3], xu - 1, yu - 1, zu), u);
         RealType __lValue = lerp(_llValue, _ulValue, v);
         
-        RealType _luValue = lerp(gradient(llu, xu, yu, zu - 1), gradient(ulu, xu - 1, yu, zu - 1), u);
-        RealType _uuValue = lerp(gradient(luu, xu, yu - 1, zu - 1), gradient(uuu, xu - 1, yu - 1, zu - 1), u);
+        RealType _luValue = lerp(gradient(hashes[4], xu, yu, zu - 1), gradient(hashes[5], xu - 1, yu, zu - 1), u);
+        RealType _uuValue = lerp(gradient(hashes[6], xu, yu - 1, zu - 1), gradient(hashes[7], xu - 1, yu - 1, zu - 1), u);
         RealType __uValue = lerp(_luValue, _uuValue, v);
         
         RealType ret = lerp(__lValue, __uValue, w);
@@ -495,6 +817,73 @@ namespace SLR {
         return ret;
     }
     
+    template <typename RealType>
+    void ImprovedPerlinNoise3DGeneratorTemplate<RealType>::evaluateBatch(const Point3DTemplate<RealType> ps[BatchWidth], const RealType frequencies[BatchWidth],
+                                                                         RealType values[BatchWidth]) const {
+        for (int i = 0; i < BatchWidth; ++i)
+            values[i] = evaluate(ps[i], frequencies[i]);
+    }
+    
+    // JP: 格子点のハッシュは表引きを伴うため点ごとに求め、フェード、勾配との内積と補間を4点同時にSIMDで行う。
+    //     勾配関数の分岐は勾配方向の係数の積和に置き換えており、演算順序はスカラー版と同じなので結果も一致する。
+    // EN: hashes of lattice points involve table lookups so they are computed per point,
+    //     and fading, dot products with gradients and interpolation are done for four points at once with SIMD.
+    //     Branches of the gradient function are replaced by multiply-adds with coefficients of the gradient directions,
+    //     and the order of operations is the same as the scalar version, so the results match.
+    template <>
+    void ImprovedPerlinNoise3DGeneratorTemplate<float>::evaluateBatch(const Point3DTemplate<float> ps[BatchWidth], const float frequencies[BatchWidth],
+                                                                      float values[BatchWidth]) const {
+        static const float GradientDirections[16][3] = {
+            { 1,  1,  0}, {-1,  1,  0}, { 1, -1,  0}, {-1, -1,  0},
+            { 1,  0,  1}, {-1,  0,  1}, { 1,  0, -1}, {-1,  0, -1},
+            { 0,  1,  1}, { 0, -1,  1}, { 0,  1, -1}, { 0, -1, -1},
+            { 1,  1,  0}, { 0, -1,  1}, {-1,  1,  0}, { 0, -1, -1},
+        };
+        
+        float fractions[3][BatchWidth];
+        float gradients[8][3][BatchWidth];
+        for (int i = 0; i < BatchWidth; ++i) {
+            float fraction[3];
+            uint8_t hashes[8];
+            computeLattice(ps[i], frequencies[i], fraction, hashes);
+            for (int a = 0; a < 3; ++a)
+                fractions[a][i] = fraction[a];
+            for (int c = 0; c < 8; ++c)
+                for (int a = 0; a < 3; ++a)
+                    gradients[c][a][i] = GradientDirections[hashes[c] & 0xF][a];
+        }
+        
+        const __m128 one = _mm_set_ps1(1.0f);
+        const auto fade = [&one](const __m128 &t) {
+            __m128 poly = _mm_add_ps(_mm_mul_ps(t, _mm_sub_ps(_mm_mul_ps(t, _mm_set_ps1(6.0f)), _mm_set_ps1(15.0f))), _mm_set_ps1(10.0f));
+            return _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(t, t), t), poly);
+        };
+        const auto lerp = [&one](const __m128 &v0, const __m128 &v1, const __m128 &t) {
+            return _mm_add_ps(_mm_mul_ps(v0, _mm_sub_ps(one, t)), _mm_mul_ps(v1, t));
+        };
+        
+        __m128 d[2][3];
+        for (int a = 0; a < 3; ++a) {
+            d[0][a] = _mm_loadu_ps(fractions[a]);
+            d[1][a] = _mm_sub_ps(d[0][a], one);
+        }
+        __m128 dots[8];
+        for (int c = 0; c < 8; ++c) {
+            const __m128 &dx = d[(c >> 0) & 0x1][0];
+            const __m128 &dy = d[(c >> 1) & 0x1][1];
+            const __m128 &dz = d[(c >> 2) & 0x1][2];
+            dots[c] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(gradients[c][0]), dx), _mm_mul_ps(_mm_loadu_ps(gradients[c][1]), dy)),
+                                 _mm_mul_ps(_mm_loadu_ps(gradients[c][2]), dz));
+        }
+        
+        __m128 u = fade(d[0][0]);
+        __m128 v = fade(d[0][1]);
+        __m128 w = fade(d[0][2]);
+        __m128 lValue = lerp(lerp(dots[0], dots[1], u), lerp(dots[2], dots[3], u), v);
+        __m128 uValue = lerp(lerp(dots[4], dots[5], u), lerp(dots[6], dots[7], u), v);
+        _mm_storeu_ps(values, lerp(lValue, uValue, w));
+    }
+    
     template class SLR_API ImprovedPerlinNoise3DGeneratorTemplate<float>;
     template class SLR_API ImprovedPerlinNoise3DGeneratorTemplate<double>;
     
@@ -502,17 +891,58 @@ namespace SLR {
     
     template <typename RealType>
     RealType MultiOctavePerlinNoise3DGeneratorTemplate<RealType>::evaluate(const Point3DTemplate<RealType> &p) const {
+        // JP: 各オクターブを別々のレーンとしてまとめて評価する。余ったレーンは最初のオクターブを繰り返す。
+        // EN: evaluate octaves together, each as a separate lane. Remaining lanes repeat the first octave.
+        Point3DTemplate<RealType> ps[BatchWidth];
+        RealType frequencies[BatchWidth];
+        RealType values[BatchWidth];
+        std::fill(ps, ps + BatchWidth, p);
+        
         RealType total = 0;
+        RealType frequency = m_initialFrequency;
+        RealType amplitude = m_initialAmplitude;
+        for (uint32_t i = 0; i < m_numOctaves; i += BatchWidth) {
+            uint32_t numLanes = std::min(m_numOctaves - i, (uint32_t)BatchWidth);
+            for (int j = 0; j < BatchWidth; ++j) {
+                if (j < numLanes) {
+                    frequencies[j] = frequency;
+                    frequency *= m_frequencyMultiplier;
+                }
+                else {
+                    frequencies[j] = frequencies[0];
+                }
+            }
+            m_primaryNoiseGen.evaluateBatch(ps, frequencies, values);
+            for (int j = 0; j < numLanes; ++j) {
+                total += values[j] * amplitude;
+                amplitude *= m_persistence;
+            }
+        }
+        
+        return 0.5f * (total + 1);
+    }
+    
+    template <typename RealType>
+    void MultiOctavePerlinNoise3DGeneratorTemplate<RealType>::evaluateBatch(const Point3DTemplate<RealType> ps[BatchWidth], RealType values[BatchWidth]) const {
+        RealType totals[BatchWidth];
+        RealType frequencies[BatchWidth];
+        RealType octaveValues[BatchWidth];
+        std::fill(totals, totals + BatchWidth, 0);
+        
         RealType frequency = m_initialFrequency;
         RealType amplitude = m_initialAmplitude;
         for (int i = 0; i < m_numOctaves; ++i) {
-            total += m_primaryNoiseGen.evaluate(p, frequency) * amplitude;
+            std::fill(frequencies, frequencies + BatchWidth, frequency);
+            m_primaryNoiseGen.evaluateBatch(ps, frequencies, octaveValues);
+            for (int j = 0; j < BatchWidth; ++j)
+                totals[j] += octaveValues[j] * amplitude;
             
             amplitude *= m_persistence;
             frequency *= m_frequencyMultiplier;
         }
         
-        return 0.5f * (total + 1);
+        for (int j = 0; j < BatchWidth; ++j)
+            values[j] = 0.5f * (totals[j] + 1);
     }
     
     template class SLR_API MultiOctavePerlinNoise3DGeneratorTemplate<float>;
@@ -601,9 +1031,12 @@ namespace SLR {
                     
                     uint32_t numFeaturePoints = 1;// + std::min(int32_t(8 * rng.getFloat0cTo1o()), 8);
                     for (int i = 0; i < numFeaturePoints; ++i) {
-                        Point3DType fp = Point3DType(ix + rng.getFloat0cTo1o(), 
-                                                     iy + rng.getFloat0cTo1o(), 
-                                                     iz + rng.getFloat0cTo1o());
+                        // JP: 関数の引数の評価順序は未規定なので、乱数はx, y, zの順に明示的に取り出す。
+                        // EN: the evaluation order of function arguments is unspecified, so explicitly draw random numbers in the order of x, y, z.
+                        RealType fpx = ix + rng.getFloat0cTo1o();
+                        RealType fpy = iy + rng.getFloat0cTo1o();
+                        RealType fpz = iz + rng.getFloat0cTo1o();
+                        Point3DType fp = Point3DType(fpx, fpy, fpz);
                         RealType dist2 = sqDistance(op, fp);
                         if (dist2 < *closestSqDistance) {
                             *closestSqDistance = dist2;
@@ -616,6 +1049,122 @@ namespace SLR {
         }
     }
     
+    template <typename RealType>
+    void WorleyNoise3DGeneratorTemplate<RealType>::evaluateBatch(const Point3DTemplate<RealType> ps[BatchWidth], const RealType frequencies[BatchWidth],
+                                                                 RealType closestSqDistances[BatchWidth], uint32_t hashesOfClosest[BatchWidth],
+                                                                 uint32_t closestFPIndices[BatchWidth]) const {
+        for (int i = 0; i < BatchWidth; ++i)
+            evaluate(ps[i], frequencies[i], &closestSqDistances[i], &hashesOfClosest[i], &closestFPIndices[i]);
+    }
+    
+    // JP: SSE2には32ビット整数の積の下位を求める命令が無いため、偶数・奇数レーンの64ビット積から組み立てる。
+    // EN: SSE2 lacks an instruction for the low part of 32-bit integer products, so build it from 64-bit products of even and odd lanes.
+    static inline __m128i mulLo32(const __m128i &a, const __m128i &b) {
+        __m128i even = _mm_mul_epu32(a, b);
+        __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+        return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+    }
+    
+    static inline __m128i selectInt(const __m128i &mask, const __m128i &t, const __m128i &f) {
+        return _mm_or_si128(_mm_and_si128(mask, t), _mm_andnot_si128(mask, f));
+    }
+    
+    // JP: 座標の折り返しと格子の位置は点ごとに求め、27セルの探索(FNVハッシュ、線形合同法による特徴点の生成と距離の比較)を4点同時にSIMDで行う。
+    //     整数演算と浮動小数点演算の順序はスカラー版と同じなので結果も一致する。
+    // EN: wrapping of coordinates and the lattice position are computed per point, and the search over 27 cells
+    //     (FNV hashing, generation of feature points by the linear congruential method and comparison of distances) is done for four points at once with SIMD.
+    //     The order of integer and floating point operations is the same as the scalar version, so the results match.
+    template <>
+    void WorleyNoise3DGeneratorTemplate<float>::evaluateBatch(const Point3DTemplate<float> ps[BatchWidth], const float frequencies[BatchWidth],
+                                                              float closestSqDistances[BatchWidth], uint32_t hashesOfClosest[BatchWidth],
+                                                              uint32_t closestFPIndices[BatchWidth]) const {
+        int32_t iEvalCoords[3][BatchWidth];
+        float fractions[3][BatchWidth];
+        int32_t repeats[BatchWidth];
+        for (int i = 0; i < BatchWidth; ++i) {
+            float coords[3] = {ps[i].x * frequencies[i], ps[i].y * frequencies[i], ps[i].z * frequencies[i]};
+            const uint32_t repeat = (uint32_t)(m_repeat * frequencies[i]);
+            for (int a = 0; a < 3; ++a) {
+                if (repeat > 0) {
+                    coords[a] = std::fmod(coords[a], repeat);
+                    if (coords[a] < 0)
+                        coords[a] += repeat;
+                }
+                iEvalCoords[a][i] = std::floor(coords[a]);
+                fractions[a][i] = coords[a] - iEvalCoords[a][i];
+            }
+            repeats[i] = repeat;
+        }
+        
+        const __m128i repeat = _mm_loadu_si128((const __m128i*)repeats);
+        const __m128i hasRepeat = _mm_cmpgt_epi32(repeat, _mm_setzero_si128());
+        const __m128 divisor = _mm_or_ps(_mm_and_ps(_mm_castsi128_ps(hasRepeat), _mm_cvtepi32_ps(repeat)),
+                                         _mm_andnot_ps(_mm_castsi128_ps(hasRepeat), _mm_set_ps1(1.0f)));
+        __m128i iEvalCoord[3];
+        __m128 op[3];
+        for (int a = 0; a < 3; ++a) {
+            iEvalCoord[a] = _mm_loadu_si128((const __m128i*)iEvalCoords[a]);
+            op[a] = _mm_loadu_ps(fractions[a]);
+        }
+        
+        const __m128i FNVPrime = _mm_set1_epi32(FNV_PRIME_32);
+        const __m128i LCGMultiplier = _mm_set1_epi32(1103515245);
+        const __m128i LCGIncrement = _mm_set1_epi32(12345);
+        const __m128i byteMask = _mm_set1_epi32(0xFF);
+        const __m128i exponentOfOne = _mm_set1_epi32(0x3f800000);
+        const __m128 one = _mm_set_ps1(1.0f);
+        
+        __m128 closestSqDistance = _mm_set_ps1(INFINITY);
+        __m128i hashOfClosest = _mm_setzero_si128();
+        for (int iz = -1; iz <= 1; ++iz) {
+            for (int iy = -1; iy <= 1; ++iy) {
+                for (int ix = -1; ix <= 1; ++ix) {
+                    const int32_t offsets[3] = {ix, iy, iz};
+                    __m128i iCoord[3];
+                    for (int a = 0; a < 3; ++a) {
+                        iCoord[a] = _mm_add_epi32(iEvalCoord[a], _mm_set1_epi32(offsets[a]));
+                        
+                        // JP: (iCoord + repeat) % repeat。値は小さな非負整数なので浮動小数点の除算と切り捨てで厳密に求まる。
+                        // EN: (iCoord + repeat) % repeat. The values are small non-negative integers, so floating point division and truncation give it exactly.
+                        __m128 sum = _mm_cvtepi32_ps(_mm_add_epi32(iCoord[a], repeat));
+                        __m128 quotient = _mm_cvtepi32_ps(_mm_cvttps_epi32(_mm_div_ps(sum, divisor)));
+                        __m128i wrapped = _mm_cvttps_epi32(_mm_sub_ps(sum, _mm_mul_ps(quotient, divisor)));
+                        iCoord[a] = selectInt(hasRepeat, wrapped, iCoord[a]);
+                    }
+                    
+                    // JP: getFNV1Hash32()と同じく、座標のバイト列をリトルエンディアンの順に処理する。
+                    // EN: process the byte sequence of the coordinates in little endian order same as getFNV1Hash32().
+                    __m128i hash = _mm_set1_epi32(FNV_OFFSET_BASIS_32);
+                    for (int a = 0; a < 3; ++a) {
+                        for (int b = 0; b < 4; ++b) {
+                            __m128i byte = _mm_and_si128(_mm_srli_epi32(iCoord[a], 8 * b), byteMask);
+                            hash = _mm_xor_si128(mulLo32(FNVPrime, hash), byte);
+                        }
+                    }
+                    
+                    // JP: LinearCongruentialRNG(hash)から3つの[0, 1)の値を得て特徴点との距離を求める。
+                    // EN: obtain three values in [0, 1) from LinearCongruentialRNG(hash) and compute the distance to the feature point.
+                    __m128i seed = hash;
+                    __m128 sqDist = _mm_setzero_ps();
+                    for (int a = 0; a < 3; ++a) {
+                        seed = _mm_add_epi32(mulLo32(seed, LCGMultiplier), LCGIncrement);
+                        __m128 u = _mm_sub_ps(_mm_castsi128_ps(_mm_or_si128(_mm_srli_epi32(seed, 9), exponentOfOne)), one);
+                        __m128 d = _mm_sub_ps(op[a], _mm_add_ps(_mm_set_ps1((float)offsets[a]), u));
+                        sqDist = a == 0 ? _mm_mul_ps(d, d) : _mm_add_ps(sqDist, _mm_mul_ps(d, d));
+                    }
+                    
+                    __m128 closer = _mm_cmplt_ps(sqDist, closestSqDistance);
+                    closestSqDistance = _mm_or_ps(_mm_and_ps(closer, sqDist), _mm_andnot_ps(closer, closestSqDistance));
+                    hashOfClosest = selectInt(_mm_castps_si128(closer), hash, hashOfClosest);
+                }
+            }
+        }
+        
+        _mm_storeu_ps(closestSqDistances, closestSqDistance);
+        _mm_storeu_si128((__m128i*)hashesOfClosest, hashOfClosest);
+        std::fill(closestFPIndices, closestFPIndices + BatchWidth, 0);
+    }
+    
     template class SLR_API WorleyNoise3DGeneratorTemplate<float>;
     template class SLR_API WorleyNoise3DGeneratorTemplate<double>;
     
@@ -623,21 +1172,62 @@ namespace SLR {
     
     template <typename RealType>
     RealType MultiOctaveWorleyNoise3DGeneratorTemplate<RealType>::evaluate(const Point3DTemplate<RealType> &p) const {
+        // JP: 各オクターブを別々のレーンとしてまとめて評価する。余ったレーンは最初のオクターブを繰り返す。
+        // EN: evaluate octaves together, each as a separate lane. Remaining lanes repeat the first octave.
+        Point3DTemplate<RealType> ps[BatchWidth];
+        RealType frequencies[BatchWidth];
+        RealType closestDistances[BatchWidth];
+        uint32_t hashesOfClosest[BatchWidth];
+        uint32_t closestFPIndices[BatchWidth];
+        std::fill(ps, ps + BatchWidth, p);
+        
         RealType total = 0;
+        RealType frequency = m_initialFrequency;
+        RealType amplitude = m_initialAmplitude;
+        for (uint32_t i = 0; i < m_numOctaves; i += BatchWidth) {
+            uint32_t numLanes = std::min(m_numOctaves - i, (uint32_t)BatchWidth);
+            for (int j = 0; j < BatchWidth; ++j) {
+                if (j < numLanes) {
+                    frequencies[j] = frequency;
+                    frequency *= m_frequencyMultiplier;
+                }
+                else {
+                    frequencies[j] = frequencies[0];
+                }
+            }
+            m_primaryNoiseGen.evaluateBatch(ps, frequencies, closestDistances, hashesOfClosest, closestFPIndices);
+            for (int j = 0; j < numLanes; ++j) {
+                total += (closestDistances[j] / std::sqrt(3.0)) * amplitude;
+                amplitude *= m_persistence;
+            }
+        }
+        
+        return std::fmin(total, m_clipValue);
+    }
+    
+    template <typename RealType>
+    void MultiOctaveWorleyNoise3DGeneratorTemplate<RealType>::evaluateBatch(const Point3DTemplate<RealType> ps[BatchWidth], RealType values[BatchWidth]) const {
+        RealType totals[BatchWidth];
+        RealType frequencies[BatchWidth];
+        RealType closestDistances[BatchWidth];
+        uint32_t hashesOfClosest[BatchWidth];
+        uint32_t closestFPIndices[BatchWidth];
+        std::fill(totals, totals + BatchWidth, 0);
+        
         RealType frequency = m_initialFrequency;
         RealType amplitude = m_initialAmplitude;
         for (int i = 0; i < m_numOctaves; ++i) {
-            RealType closestDistance;
-            uint32_t hashOfClosest;
-            uint32_t closestFPIdx;
-            m_primaryNoiseGen.evaluate(p, frequency, &closestDistance, &hashOfClosest, &closestFPIdx);
-            total += (closestDistance / std::sqrt(3.0)) * amplitude;
+            std::fill(frequencies, frequencies + BatchWidth, frequency);
+            m_primaryNoiseGen.evaluateBatch(ps, frequencies, closestDistances, hashesOfClosest, closestFPIndices);
+            for (int j = 0; j < BatchWidth; ++j)
+                totals[j] += (closestDistances[j] / std::sqrt(3.0)) * amplitude;
             
             amplitude *= m_persistence;
             frequency *= m_frequencyMultiplier;
         }
         
-        return std::fmin(total, m_clipValue);
+        for (int j = 0; j < BatchWidth; ++j)
+            values[j] = std::fmin(totals[j], m_clipValue);
     }
     
     template class SLR_API MultiOctaveWorleyNoise3DGeneratorTemplate<float>;
@@ -159,6 +159,99 @@ namespace SLR {
         
         void sample(RealType u0, RealType u1, RealType* d0, RealType* d1, RealType* PDF) const override;
         RealType evaluatePDF(RealType d0, RealType d1) const override;
+        
+        void exportBMP(const std::string &filename, bool logScale = false, float gamma = 1.0f) const;
+    };
+    
+    // JP: Walker/Voseのエイリアス法による分布。
+    //     二分探索の代わりに定数時間でサンプルできるが、一様乱数からの写像の連続性は失われる。
+    //     各要素は自身を選ぶ閾値、もう一方の要素のインデックスと自身の確率(密度)を連続したメモリに保持する。
+    // EN: distributions based on Walker/Vose's alias method.
+    //     These can be sampled in constant time instead of binary search, but lose continuity of the mapping from uniform random numbers.
+    //     Each entry stores the threshold to choose itself, the index of the other entry and its own probability (density) in contiguous memory.
+    template <typename RealType>
+    struct AliasTableEntry {
+        RealType threshold;
+        uint32_t secondIndex;
+        RealType value;
+    };
+    
+    template <typename RealType>
+    class SLR_API DiscreteAliasDistribution1DTemplate {
+        AliasTableEntry<RealType>* m_entries;
+        RealType m_integral;
+        uint32_t m_numValues;
+    public:
+        DiscreteAliasDistribution1DTemplate() : m_entries(nullptr) { }
+        DiscreteAliasDistribution1DTemplate(const RealType* values, size_t numValues);
+        DiscreteAliasDistribution1DTemplate(const std::vector<RealType> &values);
+        ~DiscreteAliasDistribution1DTemplate() {
+            if (m_entries)
+                delete[] m_entries;
+        }
+        
+        uint32_t sample(RealType u, RealType* prob) const;
+        uint32_t sample(RealType u, RealType* prob, RealType* remapped) const;
+        RealType evaluatePMF(uint32_t idx) const {
+            SLRAssert(idx >= 0 && idx < m_numValues, "\"idx\" is out of range [0, %u)", m_numValues);
+            return m_entries[idx].value;
+        }
+        
+        RealType integral() const { return m_integral; }
+        uint32_t numValues() const { return m_numValues; }
+    };
+    
+    template <typename RealType>
+    class SLR_API RegularConstantContinuousAliasDistribution1DTemplate : public ContinuousDistribution1DTemplate<RealType> {
+        AliasTableEntry<RealType>* m_entries;
+        RealType m_integral;
+        uint32_t m_numValues;
+    public:
+        RegularConstantContinuousAliasDistribution1DTemplate(uint32_t numValues, const std::function<RealType(uint32_t)> &pickFunc);
+        RegularConstantContinuousAliasDistribution1DTemplate(const std::vector<RealType> &values);
+        ~RegularConstantContinuousAliasDistribution1DTemplate() {
+            delete[] m_entries;
+        }
+        
+        RealType sample(RealType u, RealType* PDF) const override;
+        RealType evaluatePDF(RealType smp) const override;
+        RealType integral() const override { return m_integral; }
+        
+        uint32_t numValues() const { return m_numValues; }
+    };
+    
+    // JP: 全ての行のテーブルを1つの配列に格納する。大きなテーブルは行単位で並列に構築する。
+    // EN: stores the tables of all rows in a single array. A large table is built in parallel in row units.
+    template <typename RealType>
+    class SLR_API RegularConstantContinuousAliasDistribution2DTemplate : public ContinuousDistribution2DTemplate<RealType> {
+        AliasTableEntry<RealType>* m_entries;
+        AliasTableEntry<RealType>* m_topEntries;
+        uint32_t m_numD1;
+        uint32_t m_numD2;
+        RealType m_integral;
+        
+        RegularConstantContinuousAliasDistribution2DTemplate(uint32_t numD1, uint32_t numD2) : m_numD1(numD1), m_numD2(numD2), m_integral(0) {
+            m_entries = new AliasTableEntry<RealType>[m_numD1 * m_numD2];
+            m_topEntries = new AliasTableEntry<RealType>[m_numD2];
+        }
+    public:
+        RegularConstantContinuousAliasDistribution2DTemplate(uint32_t numD1, uint32_t numD2, const std::function<RealType(uint32_t, uint32_t)> &pickFunc);
+        // JP: 行優先で並んだnumD1 * numD2個の値から構築する。
+        // EN: build from numD1 * numD2 values in row-major order.
+        RegularConstantContinuousAliasDistribution2DTemplate(uint32_t numD1, uint32_t numD2, const RealType* values);
+        ~RegularConstantContinuousAliasDistribution2DTemplate() {
+            delete[] m_topEntries;
+            delete[] m_entries;
+        }
+        
+        // JP: 構築済みのテーブルをそのままファイルに書き出す、もしくは読み込む。readは失敗時にnullptrを返す。
+        // EN: write or read the built tables as is to or from a file. read returns nullptr on failure.
+        bool write(FILE* fp) const;
+        static RegularConstantContinuousAliasDistribution2DTemplate* read(FILE* fp, uint32_t numD1, uint32_t numD2);
+        
+        void sample(RealType u0, RealType u1, RealType* d0, RealType* d1, RealType* PDF) const override;
+        RealType evaluatePDF(RealType d0, RealType d1) const override;
+        RealType integral() const { return m_integral; }
 
         void exportBMP(const std::string &filename, bool logScale = false, float gamma = 1.0f) const;
     };
@@ -214,12 +307,23 @@ namespace SLR {
         static uint8_t hash(int32_t x, int32_t y, int32_t z);
         static RealType gradient(uint32_t hash, RealType xu, RealType yu, RealType zu);
         
+        void computeLattice(const Point3DTemplate<RealType> &p, RealType frequency, RealType fractions[3], uint8_t hashes[8]) const;
     public:
+        static const uint32_t BatchWidth = 4;
+        
         ImprovedPerlinNoise3DGeneratorTemplate(int32_t repeat) : m_repeat(repeat) {}
         
         RealType evaluate(const Point3DTemplate<RealType> &p, RealType frequency) const;
+        
+        // JP: BatchWidth個の点(もしくは周波数)をまとめて評価する。結果はevaluate()と一致する。
+        // EN: evaluate BatchWidth points (or frequencies) at once. The results match evaluate().
+        void evaluateBatch(const Point3DTemplate<RealType> ps[BatchWidth], const RealType frequencies[BatchWidth], RealType values[BatchWidth]) const;
     };
     
+    template <>
+    void ImprovedPerlinNoise3DGeneratorTemplate<float>::evaluateBatch(const Point3DTemplate<float> ps[BatchWidth], const float frequencies[BatchWidth],
+                                                                      float values[BatchWidth]) const;
+    
     // Reference:
     // Long-Period Hash Functions for Procedural Texturing
     // combined permutation table of the hash function of period 739,024 = lcm(11, 13, 16, 17, 19)
@@ -252,6 +356,8 @@ namespace SLR {
         RealType m_supValue;
         
     public:
+        static const uint32_t BatchWidth = ImprovedPerlinNoise3DGeneratorTemplate<RealType>::BatchWidth;
+        
         MultiOctavePerlinNoise3DGeneratorTemplate(uint32_t numOctaves, RealType initialFrequency, RealType supValueOrInitialAmplitude, bool supSpecified,  
                                                   RealType frequencyMultiplier, RealType persistence, uint32_t repeat) :
         m_primaryNoiseGen(repeat), 
@@ -284,6 +390,10 @@ namespace SLR {
         }
         
         RealType evaluate(const Point3DTemplate<RealType> &p) const;
+        
+        // JP: BatchWidth個の点をまとめて評価する。1点の評価ではオクターブを各レーンに割り当てる。
+        // EN: evaluate BatchWidth points at once. Evaluation of a single point assigns octaves to lanes.
+        void evaluateBatch(const Point3DTemplate<RealType> ps[BatchWidth], RealType values[BatchWidth]) const;
     };
     
     
@@ -317,12 +427,24 @@ namespace SLR {
         uint32_t m_repeat;
         
     public:
+        static const uint32_t BatchWidth = 4;
+        
         WorleyNoise3DGeneratorTemplate(uint32_t repeat) : m_repeat(repeat) {}
         
         void evaluate(const Point3DTemplate<RealType> &p, RealType frequency, 
                       RealType* closestSqDistance, uint32_t* hashOfClosest, uint32_t* closestFPIdx) const;
+        
+        // JP: BatchWidth個の点(もしくは周波数)をまとめて評価する。結果はevaluate()と一致する。
+        // EN: evaluate BatchWidth points (or frequencies) at once. The results match evaluate().
+        void evaluateBatch(const Point3DTemplate<RealType> ps[BatchWidth], const RealType frequencies[BatchWidth],
+                           RealType closestSqDistances[BatchWidth], uint32_t hashesOfClosest[BatchWidth], uint32_t closestFPIndices[BatchWidth]) const;
     };
     
+    template <>
+    void WorleyNoise3DGeneratorTemplate<float>::evaluateBatch(const Point3DTemplate<float> ps[BatchWidth], const float frequencies[BatchWidth],
+                                                              float closestSqDistances[BatchWidth], uint32_t hashesOfClosest[BatchWidth],
+                                                              uint32_t closestFPIndices[BatchWidth]) const;
+    
     
     
     template <typename RealType>
@@ -337,6 +459,8 @@ namespace SLR {
         RealType m_clipValue;
         
     public:
+        static const uint32_t BatchWidth = WorleyNoise3DGeneratorTemplate<RealType>::BatchWidth;
+        
         MultiOctaveWorleyNoise3DGeneratorTemplate(uint32_t numOctaves, RealType initialFrequency, RealType supValueOrInitialAmplitude, bool supSpecified, RealType clipValue,  
                                                   RealType frequencyMultiplier, RealType persistence, int32_t repeat) :
         m_primaryNoiseGen(repeat), 
@@ -370,6 +494,10 @@ namespace SLR {
         }
         
         RealType evaluate(const Point3DTemplate<RealType> &p) const;
+        
+        // JP: BatchWidth個の点をまとめて評価する。1点の評価ではオクターブを各レーンに割り当てる。
+        // EN: evaluate BatchWidth points at once. Evaluation of a single point assigns octaves to lanes.
+        void evaluateBatch(const Point3DTemplate<RealType> ps[BatchWidth], RealType values[BatchWidth]) const;
     };
 }
 
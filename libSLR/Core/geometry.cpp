@@ -11,8 +11,27 @@
 #include "transform.h"
 #include "surface_object.h"
 #include "medium_object.h"
+#include "texture_evaluation_cache.h"
+#include "../Accelerator/LightBVH.h"
 
 namespace SLR {
+    void Interaction::deferLightProbForOrigin(const LightBVH* lightBVH, const Point3D &origin, uint32_t lightIdx) {
+        // JP: 入れ子になった集合の内側で遅らせていた評価があれば先に済ませる。
+        // EN: resolve the evaluation deferred inside a nested aggregate first if any.
+        m_lightProbForOrigin = getLightProbForOrigin();
+        m_lightBVHForOrigin = lightBVH;
+        m_lightOrigin = origin;
+        m_lightIdxForOrigin = lightIdx;
+    }
+    
+    float Interaction::getLightProbForOrigin() const {
+        if (!m_lightBVHForOrigin)
+            return m_lightProbForOrigin;
+        return m_lightBVHForOrigin->evaluatePMF(m_lightOrigin, m_lightIdxForOrigin) * m_lightProbForOrigin;
+    }
+    
+    
+    
     void SurfaceInteraction::calculateSurfacePoint(SurfacePoint* surfPt) const {
         m_obj->calculateSurfacePoint(*this, surfPt);
     }
@@ -55,7 +74,12 @@ namespace SLR {
     }
     
     BSDF* SurfacePoint::createBSDF(const WavelengthSamples &wls, ArenaAllocator &mem) const {
-        return m_obj->createBSDF(*this, wls, mem);
+        // JP: マテリアルグラフ内で複数回参照されるテクスチャーの評価を共有するため、このシェーディング点用のキャッシュを用意する。
+        // EN: prepare a cache for this shading point to share evaluation of textures referenced multiple times in the material graph.
+        m_textureCache = mem.create<TextureEvaluationCache>();
+        BSDF* bsdf = m_obj->createBSDF(*this, wls, mem);
+        m_textureCache = nullptr;
+        return bsdf;
     }
     
     bool SurfacePoint::isEmitting() const {
@@ -74,6 +98,81 @@ namespace SLR {
         InteractionPoint::applyTransform(transform);
         m_gNormal = normalize(transform * m_gNormal);
         m_texCoord0Dir = normalize(transform * m_texCoord0Dir);
+        m_dPdTexU = transform * m_dPdTexU;
+        m_dPdTexV = transform * m_dPdTexV;
+    }
+    
+    void SurfacePoint::applyRayDifferential(const Ray &ray, const RayDifferential &rayDiff, Vector3D* dPdx, Vector3D* dPdy) {
+        m_dTexCoordDx = m_dTexCoordDy = TexCoord2D::Zero;
+        *dPdx = *dPdy = Vector3D::Zero;
+        Vector3D n = (Vector3D)m_gNormal;
+        float dirDotN = dot(ray.dir, n);
+        if (!rayDiff.valid || m_atInfinity || dirDotN == 0.0f)
+            return;
+        
+        // JP: 微小にずれたレイと接平面との交点を求める。
+        // EN: calculate intersections between the tangent plane and slightly offset rays.
+        float t = dot(m_p - ray.org, n) / dirDotN;
+        auto transfer = [&](const Vector3D &dOd, const Vector3D &dDd) {
+            Vector3D dP = dOd + t * dDd;
+            float dt = -dot(dP, n) / dirDotN;
+            return dP + dt * ray.dir;
+        };
+        *dPdx = transfer(rayDiff.dOdx, rayDiff.dDdx);
+        *dPdy = transfer(rayDiff.dOdy, rayDiff.dDdy);
+        
+        // JP: [dP/du dP/dv] * (du, dv) = dPの最小二乗解としてテクスチャー座標の微分を求める。
+        // EN: calculate derivatives of the texture coordinates as the least squares solution of [dP/du dP/dv] * (du, dv) = dP.
+        float a00 = dot(m_dPdTexU, m_dPdTexU);
+        float a01 = dot(m_dPdTexU, m_dPdTexV);
+        float a11 = dot(m_dPdTexV, m_dPdTexV);
+        float det = a00 * a11 - a01 * a01;
+        if (!(std::fabs(det) > 1e-20f))
+            return;
+        float invDet = 1.0f / det;
+        auto solve = [&](const Vector3D &dP) {
+            float b0 = dot(m_dPdTexU, dP);
+            float b1 = dot(m_dPdTexV, dP);
+            return TexCoord2D((a11 * b0 - a01 * b1) * invDet, (a00 * b1 - a01 * b0) * invDet);
+        };
+        m_dTexCoordDx = solve(*dPdx);
+        m_dTexCoordDy = solve(*dPdy);
+        if (!std::isfinite(m_dTexCoordDx.u) || !std::isfinite(m_dTexCoordDx.v) ||
+            !std::isfinite(m_dTexCoordDy.u) || !std::isfinite(m_dTexCoordDy.v))
+            m_dTexCoordDx = m_dTexCoordDy = TexCoord2D::Zero;
+    }
+    
+    RayDifferential SurfacePoint::calcSpecularRayDifferential(const Ray &ray, const RayDifferential &rayDiff, const Vector3D &dPdx, const Vector3D &dPdy,
+                                                              const Vector3D &dirIn) const {
+        if (!rayDiff.valid || m_atInfinity)
+            return RayDifferential();
+        
+        Vector3D dir = normalize(ray.dir);
+        Vector3D n = (Vector3D)m_gNormal;
+        if (dot(dir, n) > 0)
+            n = -n;
+        float cosEnter = -dot(dir, n);
+        float cosExit = -dot(dirIn, n);
+        
+        // JP: 反射の場合。
+        // EN: reflection.
+        if (cosExit <= 0.0f) {
+            return RayDifferential(dPdx, dPdy,
+                                   rayDiff.dDdx - 2 * dot(rayDiff.dDdx, n) * n,
+                                   rayDiff.dDdy - 2 * dot(rayDiff.dDdy, n) * n);
+        }
+        
+        // JP: 屈折の場合。相対屈折率は入射・射出方向の正弦の比から求める。
+        // EN: refraction. The relative index of refraction is calculated from the ratio of sines of the incident and the exit directions.
+        float sinEnter = std::sqrt(std::max(0.0f, 1 - cosEnter * cosEnter));
+        float sinExit = std::sqrt(std::max(0.0f, 1 - cosExit * cosExit));
+        float eta = sinEnter > 1e-4f ? sinExit / sinEnter : 1.0f;
+        float dMudCosEnter = eta - eta * eta * cosEnter / cosExit;
+        auto refract = [&](const Vector3D &dDd) {
+            float dCosEnter = -dot(dDd, n);
+            return eta * dDd + (dMudCosEnter * dCosEnter) * n;
+        };
+        return RayDifferential(dPdx, dPdy, refract(rayDiff.dDdx), refract(rayDiff.dDdy));
     }
     
     
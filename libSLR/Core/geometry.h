@@ -25,9 +25,13 @@ namespace SLR {
         Point3D m_p;
         StaticTransform m_appliedTransform;
         float m_lightProb;
+        float m_lightProbForOrigin;
+        const LightBVH* m_lightBVHForOrigin;
+        Point3D m_lightOrigin;
+        uint32_t m_lightIdxForOrigin;
     public:
         Interaction(float time, float dist, const Point3D &p) :
-        m_time(time), m_dist(dist), m_p(p)
+        m_time(time), m_dist(dist), m_p(p), m_lightBVHForOrigin(nullptr)
         {}
         
         float getTime() const { return m_time; }
@@ -38,6 +42,24 @@ namespace SLR {
         const StaticTransform &getAppliedTransform() const { return m_appliedTransform; }
         void setLightProb(float prob) { m_lightProb = prob; }
         float getLightProb() const { return m_lightProb; }
+        // JP: レイの原点をシェーディング点として光源を選んだ場合の選択確率。
+        // EN: light selection probability when selecting a light with the ray origin as a shading point.
+        void setLightProbForOrigin(float prob) {
+            m_lightProbForOrigin = prob;
+            m_lightBVHForOrigin = nullptr;
+        }
+        void scaleLightProbForOrigin(float scale) { m_lightProbForOrigin *= scale; }
+        // JP: 光源BVHによる原点に依存する選択確率の評価を、実際に使われるまで遅らせる。
+        //     交差判定は光源選択確率を使わない場合にも頻繁に呼ばれるため。
+        // EN: defer evaluation of the origin-dependent selection probability by a light BVH until it is actually used,
+        //     since intersection is frequently called even when the light selection probability isn't used.
+        void deferLightProbForOrigin(const LightBVH* lightBVH, const Point3D &origin, uint32_t lightIdx);
+        float getLightProbForOrigin() const;
+        
+        // JP: 局所的なランダムウォークが可能な閉じた媒質の内部での相互作用の場合にその媒質を返す。
+        // EN: return the enclosed medium if this is an interaction inside an enclosed medium which allows a local random walk.
+        virtual const EnclosedMediumObject* getEnclosure() const { return nullptr; }
+        virtual bool inMedium() const { return false; }
         
         virtual InteractionPoint* createInteractionPoint(ArenaAllocator &mem) const = 0;
     };
@@ -78,16 +100,20 @@ namespace SLR {
         friend class MediumPoint;
         
         const SingleMediumObject* m_obj;
+        const EnclosedMediumObject* m_enclosure;
         Vector3D m_dirIn;
         float m_u, m_v, m_w;
     public:
-        MediumInteraction() : Interaction(0.0f, INFINITY, Point3D::Zero)
+        MediumInteraction() : Interaction(0.0f, INFINITY, Point3D::Zero), m_enclosure(nullptr)
         {}
         MediumInteraction(float time, float dist, const Point3D &p, const Vector3D &dirIn, float u, float v, float w) :
-        Interaction(time, dist, p), m_dirIn(dirIn), m_u(u), m_v(v), m_w(w)
+        Interaction(time, dist, p), m_enclosure(nullptr), m_dirIn(dirIn), m_u(u), m_v(v), m_w(w)
         {}
         
         void setObject(const SingleMediumObject* obj) { m_obj = obj; }
+        void setEnclosure(const EnclosedMediumObject* enclosure) { m_enclosure = enclosure; }
+        const EnclosedMediumObject* getEnclosure() const override { return m_enclosure; }
+        bool inMedium() const override { return true; }
         
         Vector3D getIncomingDirection() const { return m_dirIn; }
         void getMediumParameter(float* u, float* v, float* w) const {
@@ -182,20 +208,34 @@ namespace SLR {
         float m_u, m_v;
         TexCoord2D m_texCoord;
         Vector3D m_texCoord0Dir;
+        // JP: テクスチャー座標に関する位置の微分と、画素座標に関するテクスチャー座標の微分。
+        //     後者はレイ微分が与えられた場合のみ0以外になる。
+        // EN: derivatives of the position with respect to the texture coordinates, and derivatives of the texture coordinates with respect to the pixel coordinates.
+        //     The latter become non-zero only when ray differentials are given.
+        Vector3D m_dPdTexU, m_dPdTexV;
+        TexCoord2D m_dTexCoordDx, m_dTexCoordDy;
         const SingleSurfaceObject* m_obj;
+        mutable TextureEvaluationCache* m_textureCache;
     public:
-        SurfacePoint() { }
+        SurfacePoint() :
+        m_dPdTexU(Vector3D::Zero), m_dPdTexV(Vector3D::Zero), m_dTexCoordDx(TexCoord2D::Zero), m_dTexCoordDy(TexCoord2D::Zero), m_textureCache(nullptr) { }
         SurfacePoint(const Point3D &p, bool atInfinity, const ReferenceFrame &shadingFrame,
                      const Normal3D &gNormal, float u, float v, const TexCoord2D &texCoord, const Vector3D &texCoord0Dir) :
         InteractionPoint(p, atInfinity, shadingFrame),
-        m_gNormal(gNormal), m_u(u), m_v(v), m_texCoord(texCoord), m_texCoord0Dir(texCoord0Dir) { }
+        m_gNormal(gNormal), m_u(u), m_v(v), m_texCoord(texCoord), m_texCoord0Dir(texCoord0Dir),
+        m_dPdTexU(Vector3D::Zero), m_dPdTexV(Vector3D::Zero), m_dTexCoordDx(TexCoord2D::Zero), m_dTexCoordDy(TexCoord2D::Zero), m_textureCache(nullptr) { }
         SurfacePoint(const SurfaceInteraction &si,
                      bool atInfinity, const ReferenceFrame &shadingFrame,
                      const Vector3D &texCoord0Dir) :
         InteractionPoint(si.m_p, atInfinity, shadingFrame),
-        m_gNormal(si.m_gNormal), m_u(si.m_u), m_v(si.m_v), m_texCoord(si.m_texCoord), m_texCoord0Dir(texCoord0Dir) { }
+        m_gNormal(si.m_gNormal), m_u(si.m_u), m_v(si.m_v), m_texCoord(si.m_texCoord), m_texCoord0Dir(texCoord0Dir),
+        m_dPdTexU(Vector3D::Zero), m_dPdTexV(Vector3D::Zero), m_dTexCoordDx(TexCoord2D::Zero), m_dTexCoordDy(TexCoord2D::Zero), m_textureCache(nullptr) { }
         
         void setObject(const SingleSurfaceObject* obj) { m_obj = obj; }
+        void setTextureCoordinateTangents(const Vector3D &dPdTexU, const Vector3D &dPdTexV) {
+            m_dPdTexU = dPdTexU;
+            m_dPdTexV = dPdTexV;
+        }
         
         const Normal3D &getGeometricNormal() const { return m_gNormal; }
         void getSurfaceParameter(float* u, float* v) const {
@@ -204,11 +244,27 @@ namespace SLR {
         }
         const TexCoord2D &getTextureCoordinate() const { return m_texCoord; }
         const void setTextureCoordinate(const TexCoord2D &texCoord) { m_texCoord = texCoord; }
+        void getTextureCoordinateDifferentials(TexCoord2D* dTexCoordDx, TexCoord2D* dTexCoordDy) const {
+            *dTexCoordDx = m_dTexCoordDx;
+            *dTexCoordDy = m_dTexCoordDy;
+        }
+        
+        // JP: レイ微分を接平面上に転送し、画素座標に関するテクスチャー座標の微分を計算する。
+        // EN: transfer ray differentials onto the tangent plane, and calculate derivatives of the texture coordinates with respect to the pixel coordinates.
+        void applyRayDifferential(const Ray &ray, const RayDifferential &rayDiff, Vector3D* dPdx, Vector3D* dPdy);
+        // JP: 鏡面反射・屈折で生成される方向dirInのレイのレイ微分を計算する。法線の微分は無視する。
+        // EN: calculate ray differentials of the ray in the direction dirIn generated by specular reflection or refraction. Derivatives of the normal are ignored.
+        RayDifferential calcSpecularRayDifferential(const Ray &ray, const RayDifferential &rayDiff, const Vector3D &dPdx, const Vector3D &dPdy,
+                                                    const Vector3D &dirIn) const;
         
         Normal3D getLocalGeometricNormal() const {
             return m_shadingFrame.toLocal(m_gNormal);
         }
         
+        // JP: BSDFの生成中のみ有効なテクスチャー評価のキャッシュ。それ以外ではnullptrを返す。
+        // EN: texture evaluation cache valid only during BSDF creation. This returns nullptr otherwise.
+        TextureEvaluationCache* getTextureEvaluationCache() const { return m_textureCache; }
+        
         float evaluateAreaPDF() const;
         BSDF* createBSDF(const WavelengthSamples &wls, ArenaAllocator &mem) const;
         
@@ -346,6 +402,12 @@ namespace SLR {
         virtual float area() const = 0;
         virtual void sample(float u0, float u1, SurfacePoint* surfPt, float* areaPDF, DirectionType* posType) const = 0;
         virtual float evaluateAreaPDF(const SurfacePoint& surfPt) const = 0;
+        // JP: シェーディング法線を包含するコーン。デフォルトは全球。
+        // EN: cone containing the shading normals. The default is the whole sphere.
+        virtual void normalCone(Vector3D* axis, float* cosThetaO) const {
+            *axis = Vector3D::Ez;
+            *cosThetaO = -1.0f;
+        }
     };
     
     
@@ -357,11 +419,17 @@ namespace SLR {
         virtual ~MediumDistribution() { }
 
         virtual float majorantExtinctionCoefficientAtWavelength(float wl) const = 0;
+        virtual bool isHomogeneous() const { return false; }
         
         virtual bool subdivide(Allocator* mem, MediumDistribution** fragments, uint32_t* numFragments) const = 0;
         
         virtual BoundingBox3D bounds() const = 0;
         virtual bool contains(const Point3D &p) const = 0;
+        // JP: 点に対応する媒質のパラメター座標。既定では境界ボックス中のローカル座標を用いる。
+        // EN: medium parameter coordinates corresponding to a point. Local coordinates in the bounding box are used by default.
+        virtual void calculateParameter(const Point3D &p, Point3D* param) const {
+            bounds().calculateLocalCoordinates(p, param);
+        }
         virtual bool intersectBoundary(const Ray &ray, const RaySegment &segment, float* distToBoundary, bool* enter) const = 0;
         virtual bool interact(const Ray &ray, const RaySegment &segment, const WavelengthSamples &wls, LightPathSampler &pathSampler,
                               MediumInteraction* mi, SampledSpectrum* medThroughput, bool* singleWavelength) const = 0;
@@ -369,6 +437,12 @@ namespace SLR {
                                                       bool* singleWavelength) const = 0;
         virtual void calculateMediumPoint(const MediumInteraction &mi, MediumPoint* medPt) const = 0;
         virtual SampledSpectrum evaluateExtinctionCoefficient(const Point3D &param, const WavelengthSamples &wls) const = 0;
+        // JP: 複数点の消散係数をまとめて評価する。トラッキングが複数の仮の衝突点をまとめて問い合わせるために使う。
+        // EN: evaluate extinction coefficients at multiple points at once. Tracking uses this to query several tentative collisions together.
+        virtual void evaluateExtinctionCoefficients(const Point3D* params, uint32_t numPoints, const WavelengthSamples &wls, SampledSpectrum* values) const {
+            for (int i = 0; i < numPoints; ++i)
+                values[i] = evaluateExtinctionCoefficient(params[i], wls);
+        }
         virtual SampledSpectrum evaluateAlbedo(const Point3D &param, const WavelengthSamples &wls) const = 0;
         virtual float volume() const = 0;
         virtual void sample(float u0, float u1, float u2, MediumPoint* medPt, float* volumePDF) const = 0;
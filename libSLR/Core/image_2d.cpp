@@ -9,6 +9,7 @@
 
 #include "../BasicTypes/CompensatedSum.h"
 #include "../Helper/bmp_exporter.h"
+#include "../Helper/ParallelFor.h"
 
 namespace SLR {
     const size_t sizesOfColorFormats[(uint32_t)ColorFormat::Num] = {
@@ -313,6 +314,136 @@ namespace SLR {
         }
     }
     
+    // JP: 4つのテクセルの平均を求める。uvs形式はsRGBに変換してから平均を取り、再度uvsに変換する。
+    // EN: calculate the average of four texels. uvs formats are averaged after conversion to sRGB and then converted back to uvs.
+    static void averageTexels(ColorFormat format, SpectrumType spType, const void* const texels[4], void* avg) {
+        switch (format) {
+            case ColorFormat::RGB8x3: {
+                uint32_t sum[3] = {2, 2, 2};
+                for (int i = 0; i < 4; ++i) {
+                    const RGB8x3 &pix = *(const RGB8x3*)texels[i];
+                    sum[0] += pix.r;
+                    sum[1] += pix.g;
+                    sum[2] += pix.b;
+                }
+                RGB8x3 ret{uint8_t(sum[0] / 4), uint8_t(sum[1] / 4), uint8_t(sum[2] / 4)};
+                memcpy(avg, &ret, sizeof(ret));
+                break;
+            }
+            case ColorFormat::RGB_8x4: {
+                uint32_t sum[3] = {2, 2, 2};
+                for (int i = 0; i < 4; ++i) {
+                    const RGB_8x4 &pix = *(const RGB_8x4*)texels[i];
+                    sum[0] += pix.r;
+                    sum[1] += pix.g;
+                    sum[2] += pix.b;
+                }
+                RGB_8x4 ret{uint8_t(sum[0] / 4), uint8_t(sum[1] / 4), uint8_t(sum[2] / 4), 0};
+                memcpy(avg, &ret, sizeof(ret));
+                break;
+            }
+            case ColorFormat::RGBA8x4: {
+                uint32_t sum[4] = {2, 2, 2, 2};
+                for (int i = 0; i < 4; ++i) {
+                    const RGBA8x4 &pix = *(const RGBA8x4*)texels[i];
+                    sum[0] += pix.r;
+                    sum[1] += pix.g;
+                    sum[2] += pix.b;
+                    sum[3] += pix.a;
+                }
+                RGBA8x4 ret{uint8_t(sum[0] / 4), uint8_t(sum[1] / 4), uint8_t(sum[2] / 4), uint8_t(sum[3] / 4)};
+                memcpy(avg, &ret, sizeof(ret));
+                break;
+            }
+            case ColorFormat::RGBA16Fx4: {
+                float sum[4] = {0, 0, 0, 0};
+                for (int i = 0; i < 4; ++i) {
+                    const RGBA16Fx4 &pix = *(const RGBA16Fx4*)texels[i];
+                    sum[0] += pix.r;
+                    sum[1] += pix.g;
+                    sum[2] += pix.b;
+                    sum[3] += pix.a;
+                }
+                RGBA16Fx4 ret{half(sum[0] / 4), half(sum[1] / 4), half(sum[2] / 4), half(sum[3] / 4)};
+                memcpy(avg, &ret, sizeof(ret));
+                break;
+            }
+            case ColorFormat::Gray8: {
+                uint32_t sum = 2;
+                for (int i = 0; i < 4; ++i)
+                    sum += ((const Gray8*)texels[i])->v;
+                Gray8 ret{uint8_t(sum / 4)};
+                memcpy(avg, &ret, sizeof(ret));
+                break;
+            }
+#ifdef SLR_Use_Spectral_Representation
+            case ColorFormat::uvs16Fx3: {
+                float sumRGB[3] = {0, 0, 0};
+                for (int i = 0; i < 4; ++i) {
+                    const uvs16Fx3 &pix = *(const uvs16Fx3*)texels[i];
+                    float uvs[3] = {pix.u, pix.v, pix.s};
+                    float rgb[3];
+                    UpsampledContinuousSpectrum::uvs_to_sRGB(spType, uvs, rgb);
+                    sumRGB[0] += rgb[0];
+                    sumRGB[1] += rgb[1];
+                    sumRGB[2] += rgb[2];
+                }
+                float rgb[3] = {sumRGB[0] / 4, sumRGB[1] / 4, sumRGB[2] / 4};
+                float uvs[3];
+                UpsampledContinuousSpectrum::sRGB_to_uvs(spType, rgb, uvs);
+                SLRAssert(std::isfinite(uvs[0]) && std::isfinite(uvs[1]) && std::isfinite(uvs[2]), "Invalid value.");
+                
+                uvs16Fx3 ret{half(uvs[0]), half(uvs[1]), half(uvs[2])};
+                memcpy(avg, &ret, sizeof(ret));
+                break;
+            }
+            case ColorFormat::uvsA16Fx4: {
+                float sumRGB[3] = {0, 0, 0};
+                float sumA = 0;
+                for (int i = 0; i < 4; ++i) {
+                    const uvsA16Fx4 &pix = *(const uvsA16Fx4*)texels[i];
+                    float uvs[3] = {pix.u, pix.v, pix.s};
+                    float rgb[3];
+                    UpsampledContinuousSpectrum::uvs_to_sRGB(spType, uvs, rgb);
+                    sumRGB[0] += rgb[0];
+                    sumRGB[1] += rgb[1];
+                    sumRGB[2] += rgb[2];
+                    sumA += pix.a;
+                }
+                float rgb[3] = {sumRGB[0] / 4, sumRGB[1] / 4, sumRGB[2] / 4};
+                float uvs[3];
+                UpsampledContinuousSpectrum::sRGB_to_uvs(spType, rgb, uvs);
+                SLRAssert(std::isfinite(uvs[0]) && std::isfinite(uvs[1]) && std::isfinite(uvs[2]), "Invalid value.");
+                
+                uvsA16Fx4 ret{half(uvs[0]), half(uvs[1]), half(uvs[2]), half(sumA / 4)};
+                memcpy(avg, &ret, sizeof(ret));
+                break;
+            }
+#endif
+            default:
+                SLRAssert(false, "Color format is invalid.");
+                break;
+        }
+    }
+    
+    void Image2D::downsample(const Image2D &src) {
+        SLRAssert(m_colorFormat == src.m_colorFormat, "Color formats must be the same.");
+        const size_t stride = sizesOfColorFormats[(uint32_t)m_colorFormat];
+        parallelFor(m_height, [this, &src, stride](uint32_t y) {
+            uint32_t srcY[2] = {std::min(2 * y, src.m_height - 1), std::min(2 * y + 1, src.m_height - 1)};
+            for (uint32_t x = 0; x < m_width; ++x) {
+                uint32_t srcX[2] = {std::min(2 * x, src.m_width - 1), std::min(2 * x + 1, src.m_width - 1)};
+                const void* texels[4] = {
+                    src.getInternal(srcX[0], srcY[0]), src.getInternal(srcX[1], srcY[0]),
+                    src.getInternal(srcX[0], srcY[1]), src.getInternal(srcX[1], srcY[1])
+                };
+                uint8_t avg[16];
+                averageTexels(m_colorFormat, m_spType, texels, avg);
+                setInternal(x, y, avg, stride);
+            }
+        });
+    }
+    
     void Image2D::saveImage(const std::string &filepath, bool gammaCorrection) const {
         struct BMP_RGB {
             uint8_t B, G, R;
@@ -13,6 +13,7 @@
 #include "../MemoryAllocators/Allocator.h"
 #include "../BasicTypes/spectrum_base.h"
 #include "../BasicTypes/spectrum_types.h"
+#include "../Helper/ParallelFor.h"
 #include <half.h>
 
 namespace SLR {
@@ -55,17 +56,43 @@ namespace SLR {
         ColorFormat m_colorFormat;
         SpectrumType m_spType;
         
+        // JP: テクセルがタイル単位(タイル内は行優先)で行優先に並ぶレイアウトの場合の直接参照用の情報。
+        //     そうでない場合m_directDataはnullptrで、テクセルは仮想関数を通じてのみ参照できる。
+        // EN: information for direct access when texels are laid out in row-major order of tiles (row-major within a tile).
+        //     Otherwise m_directData is nullptr and texels can be accessed only through the virtual function.
+        const uint8_t* m_directData;
+        uint32_t m_log2TileWidth;
+        uint32_t m_numTilesX;
+        
         virtual const void* getInternal(uint32_t x, uint32_t y) const = 0;
         virtual void setInternal(uint32_t x, uint32_t y, const void* data, size_t size) = 0;
+        
+        // JP: srcを2x2のボックスフィルターで縮小した値でこの画像を埋める。行ごとに並列に処理する。
+        // EN: fill this image with values of src downsampled by a 2x2 box filter. Rows are processed in parallel.
+        void downsample(const Image2D &src);
     public:
-        Image2D() { }
-        Image2D(uint32_t w, uint32_t h, ColorFormat fmt, SpectrumType spType) : m_width(w), m_height(h), m_colorFormat(fmt), m_spType(spType) { }
+        Image2D() : m_directData(nullptr), m_log2TileWidth(0), m_numTilesX(0) { }
+        Image2D(uint32_t w, uint32_t h, ColorFormat fmt, SpectrumType spType) :
+        m_width(w), m_height(h), m_colorFormat(fmt), m_spType(spType), m_directData(nullptr), m_log2TileWidth(0), m_numTilesX(0) { }
         virtual ~Image2D() { }
         
         template <typename ColFmt>
         const ColFmt &get(uint32_t x, uint32_t y) const { return *(const ColFmt*)getInternal(x, y); }
         template <typename ColFmt>
         void set(uint32_t x, uint32_t y, const ColFmt &data) { setInternal(x, y, &data, sizeof(data)); }
+        // JP: タイル幅と格納形式を静的に与えて仮想関数を介さずにテクセルを参照する。hasDirectLayout()が真である必要がある。
+        // EN: access a texel without the virtual function by statically giving the tile width and the color format. hasDirectLayout() must be true.
+        template <uint32_t log2TileWidth, typename ColFmt>
+        const ColFmt &getDirect(uint32_t x, uint32_t y) const {
+            SLRAssert(m_directData && m_log2TileWidth == log2TileWidth && sizeof(ColFmt) == sizesOfColorFormats[(uint32_t)m_colorFormat],
+                      "The layout of this image does not match the specified one.");
+            const uint32_t localMask = (1 << log2TileWidth) - 1;
+            size_t tileIdx = (size_t)(y >> log2TileWidth) * m_numTilesX + (x >> log2TileWidth);
+            return ((const ColFmt*)m_directData)[(tileIdx << (2 * log2TileWidth)) + ((y & localMask) << log2TileWidth) + (x & localMask)];
+        }
+        // JP: テクセルの生データをdstにコピーする。
+        // EN: copy raw data of a texel to dst.
+        void copyTexel(uint32_t x, uint32_t y, void* dst) const { std::memcpy(dst, getInternal(x, y), sizesOfColorFormats[(uint32_t)m_colorFormat]); }
         
         void areaAverage(float xLeft, float xRight, float yTop, float yBottom, void* avg) const;
         
@@ -73,6 +100,13 @@ namespace SLR {
         uint32_t height() const { return m_height; }
         SpectrumType spectrumType() const { return m_spType; }
         ColorFormat format() const { return m_colorFormat; }
+        bool hasDirectLayout() const { return m_directData != nullptr; }
+        uint32_t log2TileWidth() const { return m_log2TileWidth; }
+        
+        // JP: ミップマップのレベル。レベル0は自分自身。
+        // EN: mipmap levels. Level 0 is the image itself.
+        virtual uint32_t numMipLevels() const { return 1; }
+        virtual const Image2D* getMipLevel(uint32_t level) const { return this; }
         
         void saveImage(const std::string &filepath, bool gammaCorrection) const;
     };
@@ -87,6 +121,8 @@ namespace SLR {
         size_t m_numTileX;
         size_t m_allocSize;
         uint8_t* m_data;
+        Allocator* m_mem;
+        std::vector<TiledImage2DTemplate*> m_mipLevels;
         
         const void* getInternal(uint32_t x, uint32_t y) const override {
             uint32_t tx = x >> log2_tileWidth;
@@ -105,7 +141,9 @@ namespace SLR {
         }
     public:
         ~TiledImage2DTemplate() {
-            
+            for (int i = 0; i < m_mipLevels.size(); ++i)
+                m_mem->destroy(m_mipLevels[i]);
+            m_mem->free(m_data);
         }
         
         TiledImage2DTemplate(uint32_t width, uint32_t height, ColorFormat fmt, Allocator* mem) {
@@ -119,6 +157,10 @@ namespace SLR {
             size_t tileSize = m_stride * tileWidth * tileWidth;
             m_allocSize = m_numTileX * numTileY * tileSize;
             m_data = (uint8_t*)mem->alloc(m_allocSize, SLR_L1_Cacheline_Size);
+            m_mem = mem;
+            m_directData = m_data;
+            m_log2TileWidth = log2_tileWidth;
+            m_numTilesX = (uint32_t)m_numTileX;
             
             memset(m_data, 0, m_allocSize);
         }
@@ -343,14 +385,43 @@ namespace SLR {
             size_t tileSize = m_stride * tileWidth * tileWidth;
             m_allocSize = m_numTileX * numTileY * tileSize;
             m_data = (uint8_t*)mem->alloc(m_allocSize, SLR_L1_Cacheline_Size);
+            m_mem = mem;
+            m_directData = m_data;
+            m_log2TileWidth = log2_tileWidth;
+            m_numTilesX = (uint32_t)m_numTileX;
             
-            for (int i = 0; i < m_height; ++i) {
-                for (int j = 0; j < m_width; ++j) {
-                    convertFunc(j, i);
+            // JP: タイルの行ごとに共有のワーカースレッド群で並列に変換する。各ジョブは互いに重ならないタイルにのみ書き込む。
+            // EN: convert in parallel per row of tiles on the shared worker threads. Each job writes only to tiles not overlapping with each other.
+            parallelFor((uint32_t)numTileY, [this, &convertFunc](uint32_t ty) {
+                uint32_t yEnd = std::min((ty + 1) << log2_tileWidth, m_height);
+                for (uint32_t y = ty << log2_tileWidth; y < yEnd; ++y) {
+                    for (uint32_t x = 0; x < m_width; ++x) {
+                        convertFunc(x, y);
+                    }
                 }
+            });
+        }
+        
+        // JP: 1x1になるまで各辺を半分にしたミップマップのピラミッドを生成する。
+        // EN: generate a mipmap pyramid halving each side until it becomes 1x1.
+        void generateMipmaps() {
+            const TiledImage2DTemplate* prevLevel = this;
+            while (prevLevel->m_width > 1 || prevLevel->m_height > 1) {
+                TiledImage2DTemplate* level = m_mem->create<TiledImage2DTemplate>(std::max(prevLevel->m_width >> 1, 1u), std::max(prevLevel->m_height >> 1, 1u),
+                                                                                  m_colorFormat, m_mem);
+                level->m_spType = m_spType;
+                level->downsample(*prevLevel);
+                m_mipLevels.push_back(level);
+                prevLevel = level;
             }
         }
         
+        uint32_t numMipLevels() const override { return 1 + (uint32_t)m_mipLevels.size(); }
+        const Image2D* getMipLevel(uint32_t level) const override {
+            SLRAssert(level < numMipLevels(), "\"level\" is out of range.");
+            return level == 0 ? this : m_mipLevels[level - 1];
+        }
+        
         const uint8_t* data() const { return m_data; }
         size_t size() const { return m_allocSize; }
     };
@@ -8,6 +8,7 @@
 #include "medium_object.h"
 
 #include "../MemoryAllocators/ArenaAllocator.h"
+#include "../Accelerator/MediumBVH.h"
 #include "distributions.h"
 #include "surface_object.h"
 #include "light_path_sampler.h"
@@ -18,6 +19,8 @@
 #include "../Accelerator/QBVH.h"
 #include "../Scene/Scene.h"
 
+#include <atomic>
+
 namespace SLR {
     SampledSpectrum VolumetricLight::sample(const LightPosQuery &query, const VolumetricLightPosSample &smp, VolumetricLightPosQueryResult* result) const {
         return m_obj->sample(m_appliedTransform, query, smp, result);
@@ -82,6 +85,21 @@ namespace SLR {
             return false;
         mi->setObject(this);
         mi->setLightProb(isEmitting() ? 1.0f : 0.0f);
+        mi->setLightProbForOrigin(isEmitting() ? 1.0f : 0.0f);
+        
+        return true;
+    }
+    
+    bool SingleMediumObject::queryInteraction(const Ray &ray, float dist, MediumInteraction* mi) const {
+        Point3D p = ray.org + dist * ray.dir;
+        if (!m_medium->contains(p))
+            return false;
+        Point3D param;
+        m_medium->calculateParameter(p, &param);
+        *mi = MediumInteraction(ray.time, dist, p, normalize(ray.dir), param.x, param.y, param.z);
+        mi->setObject(this);
+        mi->setLightProb(isEmitting() ? 1.0f : 0.0f);
+        mi->setLightProbForOrigin(isEmitting() ? 1.0f : 0.0f);
         
         return true;
     }
@@ -146,14 +164,29 @@ namespace SLR {
         return m_medObj->intersectBoundary(localRay, segment, distToBoundary, enter);
     }
     
+    bool TransformedMediumObject::queryInteraction(const Ray &ray, float dist, MediumInteraction* mi) const {
+        StaticTransform tf;
+        m_transform->sample(ray.time, &tf);
+        Ray localRay = invert(tf) * ray;
+        if (!m_medObj->queryInteraction(localRay, dist, mi))
+            return false;
+        mi->applyTransformFromLeft(tf);
+        mi->setEnclosure(nullptr);
+        return true;
+    }
+    
     bool TransformedMediumObject::interact(const Ray &ray, const RaySegment &segment, const WavelengthSamples &wls, LightPathSampler &pathSampler,
                                            MediumInteraction* mi, SampledSpectrum* medThroughput, bool* singleWavelength) const {
         StaticTransform tf;
         m_transform->sample(ray.time, &tf);
         Ray localRay = invert(tf) * ray;
         bool hit = m_medObj->interact(localRay, segment, wls, pathSampler, mi, medThroughput, singleWavelength);
-        if (hit)
+        if (hit) {
             mi->applyTransformFromLeft(tf);
+            // JP: 局所的なランダムウォークは変換された空間をサポートしない。
+            // EN: local random walk doesn't support a transformed space.
+            mi->setEnclosure(nullptr);
+        }
         return hit;
     }
     
@@ -168,6 +201,52 @@ namespace SLR {
     
     
     
+    EnclosedMediumObject::EnclosedMediumObject(const MediumObject* medObj, const SurfaceObject* boundary, const StaticTransform medToSurfTF, bool boundaryIsVisible) :
+    m_medObj(medObj), m_boundary(boundary), m_medToSurfTF(medToSurfTF) {
+        // JP: 境界の内側の散乱点からの直接光は常に境界に遮られるため、局所的なランダムウォーク中は次イベント推定を省略できる。
+        //     そのためには境界がシーン中で可視かつ発光せず、媒質が境界全体を覆っている必要がある。
+        // EN: direct lighting from scattering points inside the boundary is always occluded by the boundary,
+        //     so next event estimation can be omitted during a local random walk.
+        //     This requires the boundary to be visible in the scene and non-emitting, and the medium to cover the whole boundary.
+        BoundingBox3D medBounds = m_medObj->bounds();
+        BoundingBox3D boundaryBounds = m_boundary->bounds();
+        bool medCoversBoundary = (medBounds.minP.x <= boundaryBounds.minP.x && medBounds.minP.y <= boundaryBounds.minP.y && medBounds.minP.z <= boundaryBounds.minP.z &&
+                                  medBounds.maxP.x >= boundaryBounds.maxP.x && medBounds.maxP.y >= boundaryBounds.maxP.y && medBounds.maxP.z >= boundaryBounds.maxP.z);
+        m_allowsLocalRandomWalk = (boundaryIsVisible && m_medToSurfTF.isIdentity() && medCoversBoundary &&
+                                   m_medObj->isHomogeneous() && !m_medObj->isEmitting() && !m_boundary->isEmitting());
+    }
+    
+    void EnclosedMediumObject::checkEnclosure(const std::vector<SurfaceObject*> &boundaryObjs, const MediumObject* sceneMedObj,
+                                              const std::vector<SurfaceObject*> &surfObjs, const std::vector<MediumObject*> &medObjs) {
+        if (!m_allowsLocalRandomWalk)
+            return;
+        
+        // JP: 境界に接するだけのもの(例: 床)は内側に入らないので、開区間で重なりを判定する。
+        // EN: test overlap with open intervals since an object only touching the boundary (e.g. a floor) doesn't get inside.
+        BoundingBox3D enclosureBounds = m_boundary->bounds();
+        const auto overlaps = [&enclosureBounds](const BoundingBox3D &b) {
+            return (b.minP.x < enclosureBounds.maxP.x && b.maxP.x > enclosureBounds.minP.x &&
+                    b.minP.y < enclosureBounds.maxP.y && b.maxP.y > enclosureBounds.minP.y &&
+                    b.minP.z < enclosureBounds.maxP.z && b.maxP.z > enclosureBounds.minP.z);
+        };
+        
+        std::set<const SurfaceObject*> boundaryObjSet(boundaryObjs.begin(), boundaryObjs.end());
+        bool enclosed = true;
+        for (int i = 0; i < surfObjs.size() && enclosed; ++i) {
+            if (boundaryObjSet.count(surfObjs[i]) == 0 && overlaps(surfObjs[i]->bounds()))
+                enclosed = false;
+        }
+        for (int i = 0; i < medObjs.size() && enclosed; ++i) {
+            if (medObjs[i] != sceneMedObj && overlaps(medObjs[i]->bounds()))
+                enclosed = false;
+        }
+        
+        if (!enclosed) {
+            printf("Local random walk is disabled for an enclosed medium since other surfaces or media can be inside its boundary.\n");
+            m_allowsLocalRandomWalk = false;
+        }
+    }
+    
     BoundingBox3D EnclosedMediumObject::bounds() const {
         return intersection(m_boundary->bounds(), m_medToSurfTF * m_medObj->bounds());
     }
@@ -215,9 +294,40 @@ namespace SLR {
         return true;
     }
     
+    bool EnclosedMediumObject::queryInteraction(const Ray &ray, float dist, MediumInteraction* mi) const {
+        if (!contains(ray.org + dist * ray.dir, ray.time))
+            return false;
+        return m_medObj->queryInteraction(ray, dist, mi);
+    }
+    
     bool EnclosedMediumObject::interact(const Ray &ray, const RaySegment &segment, const WavelengthSamples &wls, LightPathSampler &pathSampler,
                                         MediumInteraction* mi, SampledSpectrum* medThroughput, bool* singleWavelength) const {
-        return m_medObj->interact(ray, segment, wls, pathSampler, mi, medThroughput, singleWavelength);
+        bool hit = m_medObj->interact(ray, segment, wls, pathSampler, mi, medThroughput, singleWavelength);
+        if (hit && m_allowsLocalRandomWalk)
+            mi->setEnclosure(this);
+        return hit;
+    }
+    
+    bool EnclosedMediumObject::interactLocally(const Ray &ray, const RaySegment &segment, const WavelengthSamples &wls, LightPathSampler &pathSampler, ArenaAllocator &mem,
+                                               Interaction** interact, SampledSpectrum* medThroughput, bool* singleWavelength) const {
+        SLRAssert(m_allowsLocalRandomWalk, "This medium doesn't allow local random walk.");
+        // JP: 専用の加速構造で最も近い境界を求める。境界は凸とは限らないのでレイの向きによらず最初の交差を使う。
+        // EN: find the closest boundary using the dedicated acceleration structure. Use the first intersection regardless of the ray direction since the boundary is not necessarily convex.
+        SurfaceInteraction si;
+        if (!m_boundary->intersect(ray, segment, pathSampler, &si))
+            return false;
+        
+        MediumInteraction mi;
+        if (this->interact(ray, RaySegment(segment.distMin, si.getDistance()), wls, pathSampler, &mi, medThroughput, singleWavelength)) {
+            *interact = mem.create<MediumInteraction>(mi);
+            return true;
+        }
+        // JP: 境界は発光しないので光源選択確率は使われない。
+        // EN: light selection probabilities are not used since the boundary doesn't emit.
+        si.setLightProb(0.0f);
+        si.setLightProbForOrigin(0.0f);
+        *interact = mem.create<SurfaceInteraction>(si);
+        return true;
     }
     
     SampledSpectrum EnclosedMediumObject::evaluateTransmittance(const Ray &ray, const RaySegment &segment, const WavelengthSamples &wls, LightPathSampler &pathSampler, 
@@ -233,8 +343,29 @@ namespace SLR {
             bbox.unify(objs[i]->bounds());
         m_bounds = bbox;
         
-        for (int i = 0; i < objs.size(); ++i)
+        m_allHomogeneous = true;
+        for (int i = 0; i < objs.size(); ++i) {
             m_objLists.push_back(objs[i]);
+            m_allHomogeneous &= objs[i]->isHomogeneous();
+        }
+        
+        // JP: 境界ボックスの体積が小さい媒質ほど高い優先度を与える。体積が同じ場合は後の媒質を優先する。
+        // EN: give higher priority to a medium with smaller bounding box volume. Later medium takes precedence when volumes are the same.
+        std::vector<uint32_t> order(objs.size());
+        for (int i = 0; i < objs.size(); ++i)
+            order[i] = i;
+        std::sort(order.begin(), order.end(), [&objs](uint32_t a, uint32_t b) {
+            float volA = objs[a]->bounds().volume();
+            float volB = objs[b]->bounds().volume();
+            if (volA != volB)
+                return volA > volB;
+            return a < b;
+        });
+        m_priorities.resize(objs.size());
+        for (int i = 0; i < order.size(); ++i)
+            m_priorities[order[i]] = i;
+        
+        m_bvh = new MediumBVH(m_objLists);
         
         std::vector<uint32_t> lightIndices;
         std::vector<float> lightImportances;
@@ -248,7 +379,7 @@ namespace SLR {
         
         m_numLights = (uint32_t)lightImportances.size();
         m_lightList = new const MediumObject*[m_numLights];
-        m_lightDist1D = new DiscreteDistribution1D(lightImportances);
+        m_lightDist1D = new DiscreteAliasDistribution1D(lightImportances);
         
         for (int i = 0; i < m_numLights; ++i) {
             uint32_t objIdx = lightIndices[i];
@@ -259,6 +390,7 @@ namespace SLR {
     }
     
     MediumObjectAggregate::~MediumObjectAggregate() {
+        delete m_bvh;
         delete m_lightDist1D;
         delete[] m_lightList;
     }
@@ -283,67 +415,139 @@ namespace SLR {
         *prob *= cProb;
     }
     
-    // TODO: consider overlap volumes, nesting volumes, numerical precision (e.g. volumes that their boundaries are very close each other).
-    bool MediumObjectAggregate::interact(const Ray &ray, const RaySegment &segment, const WavelengthSamples &wls, LightPathSampler &pathSampler,
-                                         MediumInteraction* mi, SampledSpectrum* medThroughput, bool* singleWavelength) const {        
-        *medThroughput = SampledSpectrum::One;
-        *singleWavelength = false;
+    void MediumObjectAggregate::enterMedium(MediumStack* stack, uint32_t objIdx) const {
+        uint32_t pos = stack->depth;
+        for (int i = 0; i < stack->depth; ++i) {
+            if (stack->objIndices[i] == objIdx)
+                return;
+            if (m_priorities[stack->objIndices[i]] > m_priorities[objIdx] && pos == stack->depth)
+                pos = i;
+        }
+        // JP: 入れ子が深すぎる場合は最も優先度の低い媒質を捨てる。新しい媒質自体が最も低い場合は追加しない。
+        //     リリースビルドでも配列の範囲外に書き込まないよう明示的に確認する。
+        // EN: drop the lowest-priority medium when nesting is too deep. Don't push the new medium when it is the lowest itself.
+        //     Check explicitly so as not to write outside the array even in release builds.
+        if (stack->depth >= MaxNestingDepth) {
+            static std::atomic<bool> s_reported(false);
+            if (!s_reported.exchange(true))
+                printf("MediumObjectAggregate: medium nesting is too deep (> %u), lowest-priority media are ignored.\n", MaxNestingDepth);
+            if (pos == 0)
+                return;
+            for (int i = 0; i < stack->depth - 1; ++i)
+                stack->objIndices[i] = stack->objIndices[i + 1];
+            --stack->depth;
+            --pos;
+        }
+        for (int i = stack->depth; i > pos; --i)
+            stack->objIndices[i] = stack->objIndices[i - 1];
+        stack->objIndices[pos] = objIdx;
+        ++stack->depth;
+    }
+    
+    void MediumObjectAggregate::exitMedium(MediumStack* stack, uint32_t objIdx) const {
+        // JP: 数値誤差で入っていない媒質から出る場合は無視する。
+        // EN: ignore exiting from a medium not entered due to numerical error.
+        for (int i = 0; i < stack->depth; ++i) {
+            if (stack->objIndices[i] != objIdx)
+                continue;
+            for (int j = i; j < stack->depth - 1; ++j)
+                stack->objIndices[j] = stack->objIndices[j + 1];
+            --stack->depth;
+            return;
+        }
+    }
+    
+    // JP: レイを媒質境界で区切り、各区間についてfunc(現在の媒質, 区間)を呼ぶ。媒質外の区間では媒質はnullptrとなる。
+    //     funcがfalseを返した場合は走査を打ち切ってtrueを返す。
+    // EN: split a ray at medium boundaries, and call func(current medium, interval) for each interval. The medium is nullptr for intervals outside media.
+    //     This aborts the traversal and returns true when func returns false.
+    template <typename Func>
+    bool MediumObjectAggregate::traverseMediumSegments(const Ray &ray, const RaySegment &segment, Func func) const {
         RaySegment isectRange = segment;
         
+        MediumStack stack;
         Point3D currentPoint = ray.org + isectRange.distMin * ray.dir;
-        // The following process is logically the same as:
-        // curMedia = m_accelerator->queryCurrentMedia(currentPoint);
-        const MediumObject* curMedium = nullptr;
-        for (int i = 0; i < m_objLists.size(); ++i) {
-            if (m_objLists[i]->contains(currentPoint, ray.time))
-                curMedium = m_objLists[i];
-        }
+        m_bvh->queryContaining(currentPoint, ray.time, [this, &stack](uint32_t objIdx) {
+            enterMedium(&stack, objIdx);
+        });
         
+        MediumBVH::BoundaryEvent events[MaxNestingDepth];
         while (true) {
-            const MediumObject* nextMedium = nullptr;
+            const MediumObject* curMedium = stack.depth > 0 ? m_objLists[stack.objIndices[stack.depth - 1]] : nullptr;
+            
             float distToNextBoundary = INFINITY;
-            // The following process is logically the same as:
-            // nextMedium = m_accelerator->queryNextMedia(ray, &distToNextBoundary);
-            for (int i = 0; i < m_objLists.size(); ++i) {
-                float distToBoundary = INFINITY;
-                bool enter;
-                if (m_objLists[i]->intersectBoundary(ray, isectRange, &distToBoundary, &enter)) {
-                    if (distToBoundary < distToNextBoundary) {
-                        distToNextBoundary = distToBoundary;
-                        nextMedium = enter ? m_objLists[i] : nullptr;
-                    }
-                }
-            }
-            if (curMedium && nextMedium)
-                curMedium = nullptr;
+            uint32_t numEvents;
+            if (!m_bvh->queryNextBoundaries(ray, isectRange, &distToNextBoundary, events, &numEvents, MaxNestingDepth))
+                distToNextBoundary = INFINITY;
             distToNextBoundary = std::min(distToNextBoundary, segment.distMax);
             if (std::isinf(distToNextBoundary))
                 return false;
             
-            bool hit = false;
             if (curMedium) {
-                SampledSpectrum curMedThroughput;
-                bool curSingleWavelength;
-                hit = curMedium->interact(ray, RaySegment(isectRange.distMin, distToNextBoundary), wls, pathSampler, mi, &curMedThroughput, &curSingleWavelength);
-                *medThroughput *= curMedThroughput;
-                *singleWavelength |= curSingleWavelength;
-            }
-            if (hit) {
-                if (m_objToLightMap.count(curMedium) > 0) {
-                    uint32_t lightIdx = m_objToLightMap.at(curMedium);
-                    mi->setLightProb(m_lightDist1D->evaluatePMF(lightIdx) * mi->getLightProb());
-                }
-                return true;
+                if (!func(curMedium, RaySegment(isectRange.distMin, distToNextBoundary)))
+                    return true;
             }
             
             if (distToNextBoundary == segment.distMax)
                 return false;
             
-            isectRange.distMin = distToNextBoundary * (1.0f + Ray::Epsilon);
-            curMedium = nextMedium;
+            for (int i = 0; i < numEvents; ++i) {
+                if (events[i].enter)
+                    enterMedium(&stack, events[i].objIndex);
+                else
+                    exitMedium(&stack, events[i].objIndex);
+            }
+            isectRange.distMin = MediumBVH::distanceAfterBoundary(distToNextBoundary);
         }
         
         SLRAssert(false, "This code path should never be executed.");
+        return false;
+    }
+    
+    bool MediumObjectAggregate::queryInteraction(const Ray &ray, float dist, MediumInteraction* mi) const {
+        MediumStack stack;
+        m_bvh->queryContaining(ray.org + dist * ray.dir, ray.time, [this, &stack](uint32_t objIdx) {
+            enterMedium(&stack, objIdx);
+        });
+        if (stack.depth == 0)
+            return false;
+        
+        const MediumObject* medium = m_objLists[stack.objIndices[stack.depth - 1]];
+        if (!medium->queryInteraction(ray, dist, mi))
+            return false;
+        
+        if (m_objToLightMap.count(medium) > 0) {
+            uint32_t lightIdx = m_objToLightMap.at(medium);
+            mi->setLightProb(m_lightDist1D->evaluatePMF(lightIdx) * mi->getLightProb());
+            mi->scaleLightProbForOrigin(m_lightDist1D->evaluatePMF(lightIdx));
+        }
+        return true;
+    }
+    
+    bool MediumObjectAggregate::interact(const Ray &ray, const RaySegment &segment, const WavelengthSamples &wls, LightPathSampler &pathSampler,
+                                         MediumInteraction* mi, SampledSpectrum* medThroughput, bool* singleWavelength) const {
+        *medThroughput = SampledSpectrum::One;
+        *singleWavelength = false;
+        
+        const MediumObject* hitMedium = nullptr;
+        traverseMediumSegments(ray, segment, [&](const MediumObject* curMedium, const RaySegment &curSegment) {
+            SampledSpectrum curMedThroughput;
+            bool curSingleWavelength;
+            bool hit = curMedium->interact(ray, curSegment, wls, pathSampler, mi, &curMedThroughput, &curSingleWavelength);
+            *medThroughput *= curMedThroughput;
+            *singleWavelength |= curSingleWavelength;
+            if (hit)
+                hitMedium = curMedium;
+            return !hit;
+        });
+        if (!hitMedium)
+            return false;
+        
+        if (m_objToLightMap.count(hitMedium) > 0) {
+            uint32_t lightIdx = m_objToLightMap.at(hitMedium);
+            mi->setLightProb(m_lightDist1D->evaluatePMF(lightIdx) * mi->getLightProb());
+            mi->scaleLightProbForOrigin(m_lightDist1D->evaluatePMF(lightIdx));
+        }
         return true;
     }
     
@@ -351,52 +555,13 @@ namespace SLR {
                                                                  bool* singleWavelength) const {
         SampledSpectrum transmittance = SampledSpectrum::One;
         *singleWavelength = false;
-        RaySegment isectRange = segment;
         
-        Point3D currentPoint = ray.org + isectRange.distMin * ray.dir;
-        // The following process is logically the same as:
-        // curMedia = m_accelerator->queryCurrentMedia(currentPoint);
-        const MediumObject* curMedium = nullptr;
-        for (int i = 0; i < m_objLists.size(); ++i) {
-            if (m_objLists[i]->contains(currentPoint, ray.time))
-                curMedium = m_objLists[i];
-        }
-        
-        while (true) {
-            const MediumObject* nextMedium = nullptr;
-            float distToNextBoundary = INFINITY;
-            // The following process is logically the same as:
-            // nextMedium = m_accelerator->queryNextMedia(ray, &distToNextBoundary);
-            for (int i = 0; i < m_objLists.size(); ++i) {
-                float distToBoundary = INFINITY;
-                bool enter;
-                if (m_objLists[i]->intersectBoundary(ray, isectRange, &distToBoundary, &enter)) {
-                    if (distToBoundary < distToNextBoundary) {
-                        distToNextBoundary = distToBoundary;
-                        nextMedium = enter ? m_objLists[i] : nullptr;
-                    }
-                }
-            }
-            if (curMedium && nextMedium)
-                curMedium = nullptr;
-            distToNextBoundary = std::min(distToNextBoundary, segment.distMax);
-            if (std::isinf(distToNextBoundary))
-                return transmittance;
-            
-            if (curMedium) {
-                SampledSpectrum curTransmittance;
-                bool curSingleWavelength;
-                curTransmittance = curMedium->evaluateTransmittance(ray, RaySegment(isectRange.distMin, distToNextBoundary), wls, pathSampler, &curSingleWavelength);
-                transmittance *= curTransmittance;
-                *singleWavelength |= curSingleWavelength;
-            }
-            
-            if (distToNextBoundary == segment.distMax)
-                break;
-            
-            isectRange.distMin = distToNextBoundary * (1.0f + Ray::Epsilon);
-            curMedium = nextMedium;
-        }
+        traverseMediumSegments(ray, segment, [&](const MediumObject* curMedium, const RaySegment &curSegment) {
+            bool curSingleWavelength;
+            transmittance *= curMedium->evaluateTransmittance(ray, curSegment, wls, pathSampler, &curSingleWavelength);
+            *singleWavelength |= curSingleWavelength;
+            return true;
+        });
         
         return transmittance;
     }
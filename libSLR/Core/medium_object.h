@@ -57,6 +57,7 @@ namespace SLR {
     class SLR_API MediumObject : public Object {
     public:
         virtual bool isEmitting() const = 0;
+        virtual bool isHomogeneous() const { return false; }
         virtual float importance() const = 0;
         virtual void selectLight(float u, float time, VolumetricLight* light, float* prob) const = 0;
         
@@ -76,6 +77,9 @@ namespace SLR {
         
         virtual bool contains(const Point3D &p, float time) const = 0;
         virtual bool intersectBoundary(const Ray &ray, const RaySegment &segment, float* distToBoundary, bool* enter) const = 0;
+        // JP: レイ上の距離distの点における相互作用を(サンプリングせずに)作る。点が媒質外の場合はfalseを返す。
+        // EN: make an interaction at the point of the distance dist on a ray (without sampling). This returns false when the point is outside the medium.
+        virtual bool queryInteraction(const Ray &ray, float dist, MediumInteraction* mi) const = 0;
         virtual bool interact(const Ray &ray, const RaySegment &segment, const WavelengthSamples &wls, LightPathSampler &pathSampler,
                               MediumInteraction* mi, SampledSpectrum* medThroughput, bool* singleWavelength) const = 0;
         virtual SampledSpectrum evaluateTransmittance(const Ray &ray, const RaySegment &segment, const WavelengthSamples &wls, LightPathSampler &pathSampler, bool* singleWavelength) const = 0;
@@ -108,6 +112,7 @@ namespace SLR {
         // MediumObject's methods
         
         bool isEmitting() const override;
+        bool isHomogeneous() const override { return m_medium->isHomogeneous(); }
         float importance() const override;
         void selectLight(float u, float time, VolumetricLight* light, float* prob) const override;
         
@@ -124,6 +129,7 @@ namespace SLR {
         bool intersectBoundary(const Ray &ray, const RaySegment &segment, float* distToBoundary, bool* enter) const override {
             return m_medium->intersectBoundary(ray, segment, distToBoundary, enter);
         }
+        bool queryInteraction(const Ray &ray, float dist, MediumInteraction* mi) const override;
         bool interact(const Ray &ray, const RaySegment &segment, const WavelengthSamples &wls, LightPathSampler &pathSampler,
                       MediumInteraction* mi, SampledSpectrum* medThroughput, bool* singleWavelength) const override;
         SampledSpectrum evaluateTransmittance(const Ray &ray, const RaySegment &segment, const WavelengthSamples &wls, LightPathSampler &pathSampler, bool* singleWavelength) const override;
@@ -156,9 +162,11 @@ namespace SLR {
         bool isEmitting() const override;
         float importance() const override;
         void selectLight(float u, float time, VolumetricLight* light, float* prob) const override;
+        bool isHomogeneous() const override { return m_medObj->isHomogeneous(); }
         
         bool contains(const Point3D &p, float time) const override;
         bool intersectBoundary(const Ray &ray, const RaySegment &segment, float* distToBoundary, bool* enter) const override;
+        bool queryInteraction(const Ray &ray, float dist, MediumInteraction* mi) const override;
         bool interact(const Ray &ray, const RaySegment &segment, const WavelengthSamples &wls, LightPathSampler &pathSampler,
                       MediumInteraction* mi, SampledSpectrum* medThroughput, bool* singleWavelength) const override;
         SampledSpectrum evaluateTransmittance(const Ray &ray, const RaySegment &segment, const WavelengthSamples &wls, LightPathSampler &pathSampler, bool* singleWavelength) const override;
@@ -171,13 +179,38 @@ namespace SLR {
     
     
     
+    // JP: 境界メッシュで囲まれた媒質。
+    //     一様で発光しない媒質が不透明な可視の境界に囲まれている場合、内部の散乱点から境界までのランダムウォークを
+    //     シーン全体の交差判定や媒質集合の走査を介さずに、専用の境界の加速構造だけを使って局所的に行える。
+    //     これは境界の内側に他の面や媒質が無い場合に限られ、シーン構築時にcheckEnclosure()で確認する。
+    // EN: medium enclosed by a boundary mesh.
+    //     When a homogeneous non-emitting medium is enclosed by an opaque visible boundary,
+    //     a random walk from a scattering point inside to the boundary can be performed locally using only the dedicated acceleration structure of the boundary
+    //     without going through the scene-wide intersection and the medium aggregate traversal.
+    //     This is limited to the case where there are no other surfaces or media inside the boundary, which is checked by checkEnclosure() at scene building.
     class SLR_API EnclosedMediumObject : public MediumObject {
         const MediumObject* m_medObj;
         const SurfaceObject* m_boundary;
         const StaticTransform m_medToSurfTF;
+        bool m_allowsLocalRandomWalk;
     public:
-        EnclosedMediumObject(const MediumObject* medObj, const SurfaceObject* boundary, const StaticTransform medToSurfTF) :
-        m_medObj(medObj), m_boundary(boundary), m_medToSurfTF(medToSurfTF) { }
+        EnclosedMediumObject(const MediumObject* medObj, const SurfaceObject* boundary, const StaticTransform medToSurfTF, bool boundaryIsVisible = false);
+        
+        bool allowsLocalRandomWalk() const { return m_allowsLocalRandomWalk; }
+        
+        // JP: 境界を構成しない面や他の媒質が境界の内側に入り込み得る場合は局所的なランダムウォークを無効化する。
+        //     バウンディングボックスによる保守的な判定を行う。
+        // EN: disable local random walk when surfaces which don't form the boundary or other media can be inside the boundary.
+        //     This performs a conservative test using bounding boxes.
+        void checkEnclosure(const std::vector<SurfaceObject*> &boundaryObjs, const MediumObject* sceneMedObj,
+                            const std::vector<SurfaceObject*> &surfObjs, const std::vector<MediumObject*> &medObjs);
+        
+        // JP: 内部の点から出たレイについて、次の散乱点もしくは境界との交差をシーンを介さずに求める。
+        //     境界が見つからない場合(数値誤差による漏れ)はfalseを返し、呼び出し側はシーン全体での問い合わせに戻る必要がある。
+        // EN: find the next scattering point or the intersection with the boundary for a ray from a point inside without going through the scene.
+        //     This returns false when the boundary is not found (leak due to numerical error), and the caller needs to fall back to the scene-wide query.
+        bool interactLocally(const Ray &ray, const RaySegment &segment, const WavelengthSamples &wls, LightPathSampler &pathSampler, ArenaAllocator &mem,
+                             Interaction** interact, SampledSpectrum* medThroughput, bool* singleWavelength) const;
         
         // ----------------------------------------------------------------
         // Object's methods
@@ -195,9 +228,11 @@ namespace SLR {
         void selectLight(float u, float time, VolumetricLight* light, float* prob) const override {
             m_medObj->selectLight(u, time, light, prob);
         }
+        bool isHomogeneous() const override { return m_medObj->isHomogeneous(); }
         
         bool contains(const Point3D &p, float time) const override;
         bool intersectBoundary(const Ray &ray, const RaySegment &segment, float* distToBoundary, bool* enter) const override;
+        bool queryInteraction(const Ray &ray, float dist, MediumInteraction* mi) const override;
         bool interact(const Ray &ray, const RaySegment &segment, const WavelengthSamples &wls, LightPathSampler &pathSampler,
                       MediumInteraction* mi, SampledSpectrum* medThroughput, bool* singleWavelength) const override;
         SampledSpectrum evaluateTransmittance(const Ray &ray, const RaySegment &segment, const WavelengthSamples &wls, LightPathSampler &pathSampler, bool* singleWavelength) const override;
@@ -208,18 +243,46 @@ namespace SLR {
     
     
     
+    // JP: 重なりや入れ子を持つ媒質の集合。
+    //     レイごとに現在内側にいる媒質のスタックを保持し、境界を跨ぐたびに更新する。
+    //     複数の媒質が重なる領域では境界ボックスの体積が小さい(内側にあるとみなせる)媒質を優先する。
+    // EN: set of media possibly overlapping or nested.
+    //     This holds a per-ray stack of media the ray is currently inside, and updates it at each boundary crossing.
+    //     A medium with smaller bounding box volume (can be regarded as inner) takes precedence in regions where multiple media overlap.
     class SLR_API MediumObjectAggregate : public MediumObject {
-//        Accelerator* m_accelerator;
+        static const uint32_t MaxNestingDepth = 16;
+        
+        // JP: 優先度の昇順に並べた、レイが内側にいる媒質のスタック。
+        // EN: stack of media the ray is inside, sorted in ascending order of priority.
+        struct MediumStack {
+            uint32_t objIndices[MaxNestingDepth];
+            uint32_t depth;
+            
+            MediumStack() : depth(0) { }
+        };
+        
         BoundingBox3D m_bounds;
         std::vector<const MediumObject*> m_objLists;
+        std::vector<uint32_t> m_priorities;
+        MediumBVH* m_bvh;
         const MediumObject** m_lightList;
         std::map<const MediumObject*, uint32_t> m_objToLightMap;
         uint32_t m_numLights;
-        DiscreteDistribution1D* m_lightDist1D;
+        DiscreteAliasDistribution1D* m_lightDist1D;
+        bool m_allHomogeneous;
+        
+        void enterMedium(MediumStack* stack, uint32_t objIdx) const;
+        void exitMedium(MediumStack* stack, uint32_t objIdx) const;
+        template <typename Func>
+        bool traverseMediumSegments(const Ray &ray, const RaySegment &segment, Func func) const;
     public:
         MediumObjectAggregate(const std::vector<MediumObject*> &objs);
         ~MediumObjectAggregate();
         
+        // JP: 全ての媒質が均質な場合、透過率と自由行程の確率密度は閉じた形で求まる。
+        // EN: when all the media are homogeneous, transmittance and free-path probability density are obtained in closed form.
+        bool allHomogeneous() const { return m_allHomogeneous; }
+        
         // ----------------------------------------------------------------
         // Object's methods
         
@@ -241,6 +304,7 @@ namespace SLR {
         bool intersectBoundary(const Ray &ray, const RaySegment &segment, float* distToBoundary, bool* enter) const override {
             return m_bounds.intersectBoundary(ray, segment, distToBoundary, enter);
         }
+        bool queryInteraction(const Ray &ray, float dist, MediumInteraction* mi) const override;
         bool interact(const Ray &ray, const RaySegment &segment, const WavelengthSamples &wls, LightPathSampler &pathSampler,
                       MediumInteraction* mi, SampledSpectrum* medThroughput, bool* singleWavelength) const override;
         SampledSpectrum evaluateTransmittance(const Ray &ray, const RaySegment &segment, const WavelengthSamples &wls, LightPathSampler &pathSampler, bool* singleWavelength) const override;
@@ -16,6 +16,7 @@
 #include "../Accelerator/StandardBVH.h"
 #include "../Accelerator/SBVH.h"
 #include "../Accelerator/QBVH.h"
+#include "../Accelerator/LightBVH.h"
 #include "../SurfaceShape/InfiniteSphereSurfaceShape.h"
 #include "../BSDF/basic_bsdfs.h"
 #include "../SurfaceMaterial/IBLEmitterSurfaceProperty.h"
@@ -50,6 +51,12 @@ namespace SLR {
     
     
     
+    LightBounds SurfaceObject::lightBounds() const {
+        return LightBounds(bounds(), Vector3D::Ez, -1.0f, 0.0f, importance());
+    }
+    
+    
+    
     bool SingleSurfaceObject::isEmitting() const {
         return m_material->isEmitting();
     }
@@ -63,6 +70,15 @@ namespace SLR {
         *prob = 1.0f;
     }
     
+    LightBounds SingleSurfaceObject::lightBounds() const {
+        // JP: 面光源は法線周りの半球に放射すると見なす。
+        // EN: regard a surface light as emitting into the hemisphere around its normal.
+        Vector3D axis;
+        float cosThetaO;
+        m_surface->normalCone(&axis, &cosThetaO);
+        return LightBounds(m_surface->bounds(), axis, cosThetaO, 0.0f, importance());
+    }
+    
     SampledSpectrum SingleSurfaceObject::sample(const StaticTransform &transform,
                                                 const LightPosQuery &query, const SurfaceLightPosSample &smp, SurfaceLightPosQueryResult* result) const {
         m_surface->sample(smp.uPos[0], smp.uPos[1], &result->surfPt, &result->areaPDF, &result->posType);
@@ -118,6 +134,7 @@ namespace SLR {
         }
         si->setObject(this);
         si->setLightProb(isEmitting() ? 1.0f : 0.0f);
+        si->setLightProbForOrigin(isEmitting() ? 1.0f : 0.0f);
 #ifdef DEBUG
         if (Accelerator::traceTraverse) {
             debugPrintf("%sfound: %g, %g\n",
@@ -306,6 +323,41 @@ namespace SLR {
         light->applyTransformFromLeft(tf);
     }
     
+    void TransformedSurfaceObject::selectLightForPoint(const Point3D &shdP, float u, float time, SurfaceLight* light, float* prob) const {
+        StaticTransform tf;
+        m_transform->sample(time, &tf);
+        m_surfObj->selectLightForPoint(invert(tf) * shdP, u, time, light, prob);
+        light->applyTransformFromLeft(tf);
+    }
+    
+    LightBounds TransformedSurfaceObject::lightBounds() const {
+        LightBounds ret = m_surfObj->lightBounds();
+        ret.bbox = bounds();
+        
+        // JP: 静的な相似変換の場合のみ法線コーンを保持できる。
+        // EN: the normal cone can be kept only for a static similarity transform.
+        bool keepCone = false;
+        if (m_transform->isStatic()) {
+            StaticTransform tf;
+            m_transform->sample(0.0f, &tf);
+            Vector3D ex = tf * Vector3D::Ex;
+            Vector3D ey = tf * Vector3D::Ey;
+            Vector3D ez = tf * Vector3D::Ez;
+            float sqLen = ex.sqLength();
+            const float tol = 1e-4f * sqLen;
+            keepCone = (sqLen > 0 &&
+                        std::fabs(ey.sqLength() - sqLen) < tol && std::fabs(ez.sqLength() - sqLen) < tol &&
+                        std::fabs(dot(ex, ey)) < tol && std::fabs(dot(ey, ez)) < tol && std::fabs(dot(ez, ex)) < tol);
+            if (keepCone)
+                ret.axis = normalize(tf * ret.axis);
+        }
+        if (!keepCone) {
+            ret.axis = Vector3D::Ez;
+            ret.cosThetaO = -1.0f;
+        }
+        return ret;
+    }
+    
     bool TransformedSurfaceObject::contains(const Point3D &p, float time) const {
         StaticTransform sampledTF;
         m_transform->sample(time, &sampledTF);
@@ -388,19 +440,23 @@ namespace SLR {
         
         m_numLights = (uint32_t)lightImportances.size();
         m_lightList = new const SurfaceObject*[m_numLights];
-        m_lightDist1D = new DiscreteDistribution1D(lightImportances);
+        m_lightDist1D = new DiscreteAliasDistribution1D(lightImportances);
         
+        std::vector<LightBounds> lightBoundsList(m_numLights);
         for (int i = 0; i < m_numLights; ++i) {
             uint32_t objIdx = lightIndices[i];
             const SurfaceObject* light = objs[objIdx];
             m_lightList[i] = light;
             m_objToLightMap[light] = i;
+            lightBoundsList[i] = light->lightBounds();
         }
+        m_lightBVH = new LightBVH(lightBoundsList);
     }
     
     SurfaceObjectAggregate::~SurfaceObjectAggregate() {
         delete m_accelerator;
         
+        delete m_lightBVH;
         delete m_lightDist1D;
         delete[] m_lightList;
     };
@@ -425,6 +481,20 @@ namespace SLR {
         *prob *= cProb;
     }
     
+    void SurfaceObjectAggregate::selectLightForPoint(const Point3D &shdP, float u, float time, SurfaceLight* light, float* prob) const {
+        uint32_t lIdx = m_lightBVH->sample(shdP, u, prob, &u);
+        const SurfaceObject* obj = m_lightList[lIdx];
+        float cProb;
+        obj->selectLightForPoint(shdP, u, time, light, &cProb);
+        *prob *= cProb;
+    }
+    
+    LightBounds SurfaceObjectAggregate::lightBounds() const {
+        if (m_numLights == 0)
+            return LightBounds();
+        return m_lightBVH->rootBounds();
+    }
+    
     float SurfaceObjectAggregate::costForIntersect() const {
         return m_accelerator->costForIntersect();
     }
@@ -464,6 +534,7 @@ namespace SLR {
         if (m_objToLightMap.count(hitObj) > 0) {
             uint32_t lightIdx = m_objToLightMap.at(hitObj);
             si->setLightProb(m_lightDist1D->evaluatePMF(lightIdx) * si->getLightProb());
+            si->deferLightProbForOrigin(m_lightBVH, ray.org, lightIdx);
         }
 #ifdef DEBUG
         if (Accelerator::traceTraverse) {
@@ -59,6 +59,12 @@ namespace SLR {
         virtual bool isEmitting() const = 0;
         virtual float importance() const = 0;
         virtual void selectLight(float u, float time, SurfaceLight* light, float* prob) const = 0;
+        // JP: シェーディング点を考慮して光源を選択する。デフォルトでは位置を無視する。
+        // EN: select a light taking a shading point into account. Ignore the position by default.
+        virtual void selectLightForPoint(const Point3D &shdP, float u, float time, SurfaceLight* light, float* prob) const {
+            selectLight(u, time, light, prob);
+        }
+        virtual LightBounds lightBounds() const;
         
         virtual SampledSpectrum sample(const StaticTransform &transform,
                                        const LightPosQuery &query, const SurfaceLightPosSample &smp, SurfaceLightPosQueryResult* result) const {
@@ -121,6 +127,7 @@ namespace SLR {
         bool isEmitting() const override;
         float importance() const override;
         void selectLight(float u, float time, SurfaceLight* light, float* prob) const override;
+        LightBounds lightBounds() const override;
         
         SampledSpectrum sample(const StaticTransform &transform,
                                const LightPosQuery &query, const SurfaceLightPosSample &smp, SurfaceLightPosQueryResult* result) const override;
@@ -221,6 +228,8 @@ namespace SLR {
         bool isEmitting() const override;
         float importance() const override;
         void selectLight(float u, float time, SurfaceLight* light, float* prob) const override;
+        void selectLightForPoint(const Point3D &shdP, float u, float time, SurfaceLight* light, float* prob) const override;
+        LightBounds lightBounds() const override;
         
         float costForIntersect() const override { return m_surfObj->costForIntersect(); }
         bool contains(const Point3D &p, float time) const override;
@@ -239,7 +248,8 @@ namespace SLR {
         const SurfaceObject** m_lightList;
         std::map<const SurfaceObject*, uint32_t> m_objToLightMap;
         uint32_t m_numLights;
-        DiscreteDistribution1D* m_lightDist1D;
+        DiscreteAliasDistribution1D* m_lightDist1D;
+        LightBVH* m_lightBVH;
     public:
         SurfaceObjectAggregate(std::vector<SurfaceObject*> &objs);
         ~SurfaceObjectAggregate();
@@ -258,6 +268,8 @@ namespace SLR {
         bool isEmitting() const override;
         float importance() const override;
         void selectLight(float u, float time, SurfaceLight* light, float* prob) const override;
+        void selectLightForPoint(const Point3D &shdP, float u, float time, SurfaceLight* light, float* prob) const override;
+        LightBounds lightBounds() const override;
         
         float costForIntersect() const override;
         bool contains(const Point3D &p, float time) const override;
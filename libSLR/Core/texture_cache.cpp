@@ -0,0 +1,215 @@
+//
+//  texture_cache.cpp
+//
+//  Created by 渡部 心 on 2017/06/30.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#include "texture_cache.h"
+
+#include <thread>
+#include <cstring>
+
+namespace SLR {
+    TextureCache::~TextureCache() {
+        for (TexturePage* page : m_residentPages)
+            free(page->data.exchange(nullptr));
+    }
+    
+    TextureCache &TextureCache::instance() {
+        static TextureCache s_instance(0);
+        return s_instance;
+    }
+    
+    void TextureCache::setBudget(size_t budget) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_budget = budget;
+        evictPages(0);
+    }
+    
+    size_t TextureCache::residentSize() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        return m_residentSize;
+    }
+    
+    void TextureCache::evictPages(size_t requiredSize) {
+        // JP: 参照ビットが立っているページはビットを下ろして一周分猶予を与え、立っていないページを追い出す。
+        //     並行して参照され続ける場合に回り続けないよう、走査は二周までに制限する。
+        // EN: give pages with the reference bit a grace of one revolution by clearing the bit, and evict pages without it.
+        //     Limit the scan to two revolutions so as not to keep rotating when pages are accessed concurrently.
+        size_t numScans = 2 * m_residentPages.size();
+        while (m_residentSize + requiredSize > m_budget && !m_residentPages.empty() && numScans-- > 0) {
+            if (m_clockHand >= m_residentPages.size())
+                m_clockHand = 0;
+            TexturePage* page = m_residentPages[m_clockHand];
+            if (page->referenced.exchange(false)) {
+                ++m_clockHand;
+                continue;
+            }
+            
+            // JP: dataを先にnullptrにすることで新たなreaderを締め出し、既にテクセルを読んでいるreaderの完了を待ってから解放する。
+            // EN: shut out new readers by setting nullptr to "data" first, then free it after waiting for readers already reading texels.
+            uint8_t* data = page->data.exchange(nullptr);
+            while (page->numReaders.load() > 0)
+                std::this_thread::yield();
+            free(data);
+            m_residentSize -= page->image->pageSize();
+            
+            m_residentPages[m_clockHand] = m_residentPages.back();
+            m_residentPages.pop_back();
+        }
+    }
+    
+    void TextureCache::requestPage(TexturePage* page) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (page->data.load() != nullptr)
+            return;
+        if (page->loading) {
+            m_pageLoaded.wait(lock, [page]() { return !page->loading; });
+            return;
+        }
+        page->loading = true;
+        
+        // JP: ファイルの読み込みはロックの外で行い、他のページへのアクセスを妨げない。
+        // EN: read the file outside the lock so as not to block access to other pages.
+        lock.unlock();
+        const size_t pageSize = page->image->pageSize();
+        uint8_t* data = (uint8_t*)malloc(pageSize);
+        if (!page->image->readPage(*page, data)) {
+            // JP: 読み込みに失敗した場合は未初期化の内容を公開しないように0で埋める(黒として扱われる)。
+            // EN: fill with zeros (treated as black) so as not to publish uninitialized content when reading failed.
+            printf("Failed to read a texture page. The page is filled with zeros.\n");
+            memset(data, 0, pageSize);
+        }
+        lock.lock();
+        
+        evictPages(pageSize);
+        page->referenced.store(true);
+        page->data.store(data);
+        m_residentPages.push_back(page);
+        m_residentSize += pageSize;
+        
+        page->loading = false;
+        m_pageLoaded.notify_all();
+    }
+    
+    void TextureCache::releasePages(TexturePage* pages, uint32_t numPages) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for (int i = 0; i < (int)m_residentPages.size(); ) {
+            TexturePage* page = m_residentPages[i];
+            if (page >= pages && page < pages + numPages) {
+                free(page->data.exchange(nullptr));
+                m_residentSize -= page->image->pageSize();
+                m_residentPages[i] = m_residentPages.back();
+                m_residentPages.pop_back();
+            }
+            else {
+                ++i;
+            }
+        }
+        m_clockHand = 0;
+    }
+    
+    
+    
+    static bool seekFile(FILE* fp, uint64_t offset) {
+#if defined(SLR_Platform_Windows)
+        return _fseeki64(fp, (int64_t)offset, SEEK_SET) == 0;
+#else
+        return fseeko(fp, (off_t)offset, SEEK_SET) == 0;
+#endif
+    }
+    
+    PagedImage2D::PagedImage2D(const std::string &filePath, TextureCache* cache) :
+    m_cache(cache), m_fp(nullptr), m_base(this), m_numPagesX(0), m_numPages(0) {
+        m_width = m_height = 0;
+        
+        // JP: ヘッダーとミップレベルの記述の検証にはメモリーマップを使い、ページはファイルから個別に読み込む。
+        // EN: use memory mapping to validate the header and the descriptions of mip levels, and read pages individually from the file.
+        std::vector<TiledTextureFileLevel> levels;
+        {
+            TiledTextureFile file(filePath);
+            if (!file.isValid())
+                return;
+            m_colorFormat = file.format();
+            m_spType = file.spectrumType();
+            for (int i = 0; i < file.numLevels(); ++i)
+                levels.push_back(file.level(i));
+        }
+        m_fp = fopen(filePath.c_str(), "rb");
+        if (!m_fp)
+            return;
+        
+        for (int i = 1; i < levels.size(); ++i)
+            m_mipLevels.push_back(new PagedImage2D(this, levels[i]));
+        initializePages(levels[0]);
+    }
+    
+    PagedImage2D::PagedImage2D(const PagedImage2D* base, const TiledTextureFileLevel &level) :
+    m_cache(base->m_cache), m_fp(nullptr), m_base(base), m_numPagesX(0), m_numPages(0) {
+        m_colorFormat = base->m_colorFormat;
+        m_spType = base->m_spType;
+        initializePages(level);
+    }
+    
+    void PagedImage2D::initializePages(const TiledTextureFileLevel &level) {
+        m_width = level.width;
+        m_height = level.height;
+        m_stride = sizesOfColorFormats[(uint32_t)m_colorFormat];
+        m_pageSize = m_stride * PageWidth * PageWidth;
+        m_numPagesX = level.numPagesX;
+        m_numPages = level.numPagesX * level.numPagesY;
+        m_pages.reset(new TexturePage[m_numPages]);
+        for (int i = 0; i < m_numPages; ++i) {
+            TexturePage &page = m_pages[i];
+            page.data.store(nullptr);
+            page.numReaders.store(0);
+            page.referenced.store(false);
+            page.loading = false;
+            page.image = this;
+            page.fileOffset = level.offset + m_pageSize * i;
+        }
+    }
+    
+    PagedImage2D::~PagedImage2D() {
+        for (int i = 0; i < m_mipLevels.size(); ++i)
+            delete m_mipLevels[i];
+        if (m_pages)
+            m_cache->releasePages(m_pages.get(), m_numPages);
+        if (m_fp)
+            fclose(m_fp);
+    }
+    
+    bool PagedImage2D::readPage(const TexturePage &page, uint8_t* data) const {
+        std::unique_lock<std::mutex> lock(m_base->m_fileMutex);
+        return seekFile(m_base->m_fp, page.fileOffset) && fread(data, 1, m_pageSize, m_base->m_fp) == m_pageSize;
+    }
+    
+    const void* PagedImage2D::getInternal(uint32_t x, uint32_t y) const {
+        static thread_local uint8_t s_texelSlots[NumTexelSlots][16];
+        static thread_local uint32_t s_texelSlotIndex = 0;
+        
+        TexturePage &page = m_pages[(y >> LogPageWidth) * m_numPagesX + (x >> LogPageWidth)];
+        
+        // JP: readerの数を先に増やしてからdataを読むことで、追い出し側がreaderの完了を待たずに解放することを防ぐ。
+        // EN: increment the number of readers before reading "data" to prevent the evicting side from freeing it without waiting for the reader.
+        uint8_t* data;
+        while (true) {
+            page.numReaders.fetch_add(1);
+            data = page.data.load();
+            if (data)
+                break;
+            page.numReaders.fetch_sub(1);
+            m_cache->requestPage(&page);
+        }
+        if (!page.referenced.load(std::memory_order_relaxed))
+            page.referenced.store(true, std::memory_order_relaxed);
+        
+        uint8_t* slot = s_texelSlots[s_texelSlotIndex];
+        s_texelSlotIndex = (s_texelSlotIndex + 1) % NumTexelSlots;
+        std::memcpy(slot, data + m_stride * ((y & localMask) * PageWidth + (x & localMask)), m_stride);
+        page.numReaders.fetch_sub(1);
+        
+        return slot;
+    }
+}
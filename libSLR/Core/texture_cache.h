@@ -0,0 +1,125 @@
+//
+//  texture_cache.h
+//
+//  Created by 渡部 心 on 2017/06/30.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#ifndef __SLR_texture_cache__
+#define __SLR_texture_cache__
+
+#include "../defines.h"
+#include "../declarations.h"
+#include "tiled_texture_file.h"
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+namespace SLR {
+    // JP: テクスチャーキャッシュに読み込まれる単位。
+    //     dataは読み込まれていない、もしくは追い出された場合はnullptrで、readerがテクセルを読んでいる間は解放されない。
+    // EN: unit loaded into the texture cache.
+    //     "data" is nullptr when the page has not been loaded or has been evicted, and it is not freed while readers are reading texels.
+    struct TexturePage {
+        std::atomic<uint8_t*> data;
+        std::atomic<uint32_t> numReaders;
+        std::atomic<bool> referenced;
+        bool loading;
+        const PagedImage2D* image;
+        uint64_t fileOffset;
+    };
+    
+    
+    
+    // JP: ページ単位でテクスチャーを必要に応じて読み込み、常駐するバイト数を予算内に保つキャッシュ。
+    //     読み込み済みページの参照はロックを取らず、追い出しはページの参照ビットを使ったクロックアルゴリズム(LRUの近似)で行う。
+    //     読み込み中のページが予算に加わるまでの間、一時的に予算を超えることがある。
+    // EN: cache which loads textures on demand in pages and keeps the number of resident bytes within the budget.
+    //     Access to loaded pages takes no lock, and eviction is done by the clock algorithm (an approximation of LRU) using reference bits of pages.
+    //     The resident size can temporarily exceed the budget until pages being loaded are accounted.
+    class SLR_API TextureCache {
+        std::mutex m_mutex;
+        std::condition_variable m_pageLoaded;
+        std::vector<TexturePage*> m_residentPages;
+        size_t m_clockHand;
+        size_t m_budget;
+        size_t m_residentSize;
+        
+        void evictPages(size_t requiredSize);
+        
+        TextureCache(const TextureCache &) = delete;
+        TextureCache &operator=(const TextureCache &) = delete;
+    public:
+        TextureCache(size_t budget) : m_clockHand(0), m_budget(budget), m_residentSize(0) { }
+        ~TextureCache();
+        
+        // JP: 予算が0の場合、シーングラフは画像を全て常駐させる。
+        // EN: the scene graph makes all images resident when the budget is 0.
+        static TextureCache &instance();
+        
+        void setBudget(size_t budget);
+        size_t budget() const { return m_budget; }
+        size_t residentSize();
+        
+        // JP: ページが読み込まれていなければ読み込む。他のスレッドが読み込み中の場合はその完了を待つ。
+        // EN: load the page if it has not been loaded. This waits for completion if another thread is loading it.
+        void requestPage(TexturePage* page);
+        // JP: 画像の破棄時に、その画像のページをキャッシュから取り除く。
+        // EN: remove pages of an image from the cache when the image is destroyed.
+        void releasePages(TexturePage* pages, uint32_t numPages);
+    };
+    
+    
+    
+    // JP: タイル化テクスチャーファイル(TiledTextureFile)のページを、参照された時点でテクスチャーキャッシュを通じて読み込む画像。
+    //     getInternal()は読んだテクセルをスレッドごとのリングバッファーにコピーして返すため、
+    //     返された参照は同じスレッドでNumTexelSlots回テクセルを読むまで有効である。
+    // EN: image which loads pages of a tiled texture file (TiledTextureFile) through the texture cache when they are accessed.
+    //     getInternal() copies the texel to a per-thread ring buffer and returns it,
+    //     so the returned reference is valid until the same thread reads texels NumTexelSlots times.
+    class SLR_API PagedImage2D : public Image2D {
+    public:
+        static const uint32_t NumTexelSlots = 16;
+    
+    private:
+        static const uint32_t LogPageWidth = TiledTextureFile::LogPageWidth;
+        static const uint32_t PageWidth = TiledTextureFile::PageWidth;
+        static const uint32_t localMask = PageWidth - 1;
+        
+        TextureCache* m_cache;
+        FILE* m_fp;
+        mutable std::mutex m_fileMutex;
+        const PagedImage2D* m_base;
+        size_t m_stride;
+        size_t m_pageSize;
+        uint32_t m_numPagesX;
+        uint32_t m_numPages;
+        std::unique_ptr<TexturePage[]> m_pages;
+        std::vector<PagedImage2D*> m_mipLevels;
+        
+        const void* getInternal(uint32_t x, uint32_t y) const override;
+        void setInternal(uint32_t x, uint32_t y, const void* data, size_t size) override {
+            SLRAssert(false, "PagedImage2D is read-only.");
+        }
+        
+        PagedImage2D(const PagedImage2D* base, const TiledTextureFileLevel &level);
+        void initializePages(const TiledTextureFileLevel &level);
+        
+        friend class TextureCache;
+        size_t pageSize() const { return m_pageSize; }
+        bool readPage(const TexturePage &page, uint8_t* data) const;
+    public:
+        PagedImage2D(const std::string &filePath, TextureCache* cache);
+        ~PagedImage2D();
+        
+        bool isValid() const { return m_numPages > 0; }
+        
+        uint32_t numMipLevels() const override { return 1 + (uint32_t)m_mipLevels.size(); }
+        const Image2D* getMipLevel(uint32_t level) const override {
+            SLRAssert(level < numMipLevels(), "\"level\" is out of range.");
+            return level == 0 ? this : m_mipLevels[level - 1];
+        }
+    };
+}
+
+#endif /* __SLR_texture_cache__ */
@@ -0,0 +1,79 @@
+//
+//  texture_evaluation_cache.h
+//
+//  Created by 渡部 心 on 2017/07/08.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#ifndef __SLR_texture_evaluation_cache__
+#define __SLR_texture_evaluation_cache__
+
+#include "../defines.h"
+#include "../declarations.h"
+#include "../BasicTypes/Point3D.h"
+#include <cstring>
+
+namespace SLR {
+    // JP: シェーディング点ごとのテクスチャー評価結果のキャッシュ。
+    //     テクスチャーノード(もしくは複数のテクスチャーが共有する計算)とマップ後の座標をキーとし、
+    //     マテリアルグラフ内で共有された部分グラフを1つのヒットにつき一度だけ評価するために使う。
+    //     BSDFの生成ごとにアリーナから確保されるため、明示的なリセットは不要。
+    // EN: cache of texture evaluation results per shading point.
+    //     It is keyed by a texture node (or computation shared by multiple textures) and the mapped coordinate,
+    //     and is used to evaluate shared subgraphs in a material graph only once per hit.
+    //     It is allocated from the arena for each BSDF creation, so explicit reset is unnecessary.
+    class TextureEvaluationCache {
+        static const uint32_t NumEntries = 8;
+        static const uint32_t MaxValueSize = 16;
+        
+        struct Entry {
+            const void* node;
+            Point3D p;
+            float param;
+            uint8_t value[MaxValueSize];
+        };
+        
+        Entry m_entries[NumEntries];
+        uint32_t m_numEntries;
+        uint32_t m_nextSlot;
+        
+        const Entry* findEntry(const void* node, const Point3D &p, float param) const {
+            for (int i = 0; i < m_numEntries; ++i) {
+                const Entry &entry = m_entries[i];
+                if (entry.node == node && entry.p == p && entry.param == param)
+                    return &entry;
+            }
+            return nullptr;
+        }
+    public:
+        TextureEvaluationCache() : m_numEntries(0), m_nextSlot(0) { }
+        
+        // JP: paramはキーの一部となる追加の値(例えば周波数)。
+        // EN: param is an additional value as a part of the key (e.g. frequency).
+        template <typename T>
+        bool find(const void* node, const Point3D &p, float param, T* value) const {
+            static_assert(sizeof(T) <= MaxValueSize, "The value type is too large to be cached.");
+            const Entry* entry = findEntry(node, p, param);
+            if (!entry)
+                return false;
+            std::memcpy(value, entry->value, sizeof(T));
+            return true;
+        }
+        
+        // JP: 満杯の場合は最も古いエントリーを置き換える。
+        // EN: replace the oldest entry when full.
+        template <typename T>
+        void insert(const void* node, const Point3D &p, float param, const T &value) {
+            static_assert(sizeof(T) <= MaxValueSize, "The value type is too large to be cached.");
+            Entry &entry = m_entries[m_nextSlot];
+            entry.node = node;
+            entry.p = p;
+            entry.param = param;
+            std::memcpy(entry.value, &value, sizeof(T));
+            m_nextSlot = (m_nextSlot + 1) % NumEntries;
+            m_numEntries = std::min(m_numEntries + 1, NumEntries);
+        }
+    };
+}
+
+#endif /* __SLR_texture_evaluation_cache__ */
@@ -24,6 +24,11 @@ namespace SLR {
         virtual Point3D map(const MediumPoint &medPt) const {
             return medPt.getPosition();
         }
+        // JP: 画素座標に関するマップ後の座標の微分。テクスチャーのフィルタリングに使用する。
+        // EN: derivatives of the mapped coordinates with respect to the pixel coordinates used for texture filtering.
+        virtual void mapDifferentials(const SurfacePoint &surfPt, TexCoord2D* dTexCoordDx, TexCoord2D* dTexCoordDy) const {
+            surfPt.getTextureCoordinateDifferentials(dTexCoordDx, dTexCoordDy);
+        }
     };
     
     class SLR_API Texture3DMapping {
@@ -57,6 +62,11 @@ namespace SLR {
                            (pos.y + m_offsetY) * m_scaleY,
                            0.0f);
         }
+        void mapDifferentials(const SurfacePoint &surfPt, TexCoord2D* dTexCoordDx, TexCoord2D* dTexCoordDy) const override {
+            surfPt.getTextureCoordinateDifferentials(dTexCoordDx, dTexCoordDy);
+            *dTexCoordDx = TexCoord2D(dTexCoordDx->u * m_scaleX, dTexCoordDx->v * m_scaleY);
+            *dTexCoordDy = TexCoord2D(dTexCoordDy->u * m_scaleX, dTexCoordDy->v * m_scaleY);
+        }
     };
     
     class SLR_API OffsetAndScale3DMapping : public Texture3DMapping {
@@ -0,0 +1,174 @@
+//
+//  tiled_texture_file.cpp
+//
+//  Created by 渡部 心 on 2017/07/01.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#include "tiled_texture_file.h"
+
+#include <sys/stat.h>
+
+namespace SLR {
+    bool TiledTextureFileKey::getModificationTime(const std::string &filePath, uint64_t* mtime) {
+#if defined(SLR_Platform_Windows)
+        struct _stat64 st;
+        if (_stat64(filePath.c_str(), &st) != 0)
+            return false;
+#else
+        struct stat st;
+        if (stat(filePath.c_str(), &st) != 0)
+            return false;
+#endif
+        *mtime = (uint64_t)st.st_mtime;
+        return true;
+    }
+    
+    
+    
+    const char TiledTextureFile::Magic[4] = {'S', 'L', 'R', 'T'};
+    
+    uint32_t TiledTextureFile::flagsForKey(const TiledTextureFileKey &key) {
+        uint32_t flags = 0;
+        if (key.gammaCorrection)
+            flags |= Flag_GammaCorrection;
+#ifdef SLR_Use_Spectral_Representation
+        flags |= Flag_SpectralRepresentation;
+#endif
+        return flags;
+    }
+    
+    bool TiledTextureFile::write(const std::string &filePath, const Image2D &image, const TiledTextureFileKey &key) {
+        const size_t stride = sizesOfColorFormats[(uint32_t)image.format()];
+        const size_t pageSize = stride * PageWidth * PageWidth;
+        
+        TiledTextureFileHeader header;
+        std::copy(Magic, Magic + 4, header.magic);
+        header.version = Version;
+        header.headerSize = sizeof(TiledTextureFileHeader);
+        header.colorFormat = (uint32_t)image.format();
+        header.spectrumType = (uint32_t)image.spectrumType();
+        header.numLevels = image.numMipLevels();
+        header.logPageWidth = LogPageWidth;
+        header.storeMode = (uint32_t)key.storeMode;
+        header.flags = flagsForKey(key);
+        header.sourcePathLength = (uint32_t)key.sourcePath.size();
+        header.sourceModificationTime = key.sourceModificationTime;
+        
+        std::vector<TiledTextureFileLevel> levels(header.numLevels);
+        uint64_t endOfLevel = sizeof(TiledTextureFileHeader) + sizeof(TiledTextureFileLevel) * header.numLevels + header.sourcePathLength;
+        for (int i = 0; i < header.numLevels; ++i) {
+            const Image2D* mipLevel = image.getMipLevel(i);
+            TiledTextureFileLevel &level = levels[i];
+            level.width = mipLevel->width();
+            level.height = mipLevel->height();
+            level.numPagesX = (level.width + PageWidth - 1) >> LogPageWidth;
+            level.numPagesY = (level.height + PageWidth - 1) >> LogPageWidth;
+            level.offset = (endOfLevel + PageAlignment - 1) / PageAlignment * PageAlignment;
+            endOfLevel = level.offset + pageSize * level.numPagesX * level.numPagesY;
+        }
+        
+        // JP: 書き込み中のファイルや書きかけのファイルが有効なキャッシュとして読まれないよう、一時ファイルに書いてから置き換える。
+        // EN: write to a temporary file and then replace, so that a file being written or partially written is not read as a valid cache.
+        AtomicFileWriter writer(filePath);
+        if (!writer.isValid())
+            return false;
+        FILE* fp = writer.file();
+        bool success = fwrite(&header, sizeof(header), 1, fp) == 1;
+        success &= fwrite(levels.data(), sizeof(TiledTextureFileLevel), levels.size(), fp) == levels.size();
+        success &= fwrite(key.sourcePath.data(), 1, key.sourcePath.size(), fp) == key.sourcePath.size();
+        uint64_t curOffset = sizeof(TiledTextureFileHeader) + sizeof(TiledTextureFileLevel) * header.numLevels + header.sourcePathLength;
+        
+        std::vector<uint8_t> pageData(pageSize);
+        for (int i = 0; i < header.numLevels && success; ++i) {
+            const Image2D* mipLevel = image.getMipLevel(i);
+            const TiledTextureFileLevel &level = levels[i];
+            
+            std::vector<uint8_t> padding(level.offset - curOffset, 0);
+            success &= fwrite(padding.data(), 1, padding.size(), fp) == padding.size();
+            for (uint32_t py = 0; py < level.numPagesY; ++py) {
+                for (uint32_t px = 0; px < level.numPagesX; ++px) {
+                    std::fill(pageData.begin(), pageData.end(), 0);
+                    uint32_t width = std::min(PageWidth, level.width - (px << LogPageWidth));
+                    uint32_t height = std::min(PageWidth, level.height - (py << LogPageWidth));
+                    for (uint32_t ly = 0; ly < height; ++ly)
+                        for (uint32_t lx = 0; lx < width; ++lx)
+                            mipLevel->copyTexel((px << LogPageWidth) + lx, (py << LogPageWidth) + ly, pageData.data() + stride * (ly * PageWidth + lx));
+                    success &= fwrite(pageData.data(), 1, pageSize, fp) == pageSize;
+                }
+            }
+            curOffset = level.offset + pageSize * level.numPagesX * level.numPagesY;
+        }
+        
+        // JP: 失敗時は一時ファイルがwriterの破棄で削除され、既存のファイルはそのまま残る。
+        // EN: on failure, the temporary file is removed when the writer is destroyed, and the existing file is left as is.
+        if (!success)
+            return false;
+        
+        return writer.commit();
+    }
+    
+    TiledTextureFile::TiledTextureFile(const std::string &filePath) : m_file(filePath), m_header(nullptr), m_levels(nullptr) {
+        if (!m_file.isValid() || m_file.size() < sizeof(TiledTextureFileHeader))
+            return;
+        
+        const TiledTextureFileHeader* header = (const TiledTextureFileHeader*)m_file.data();
+        if (!std::equal(Magic, Magic + 4, header->magic) || header->version != Version || header->headerSize != sizeof(TiledTextureFileHeader) ||
+            header->colorFormat >= (uint32_t)ColorFormat::Num || header->logPageWidth != LogPageWidth || header->numLevels == 0)
+            return;
+        
+        // JP: 各領域がファイルに収まっていることを確認する。
+        // EN: make sure that each region fits in the file.
+        const uint64_t endOfDescriptions = sizeof(TiledTextureFileHeader) + sizeof(TiledTextureFileLevel) * header->numLevels + header->sourcePathLength;
+        if (endOfDescriptions > m_file.size())
+            return;
+        const TiledTextureFileLevel* levels = (const TiledTextureFileLevel*)(m_file.data() + sizeof(TiledTextureFileHeader));
+        const size_t pageSize = sizesOfColorFormats[header->colorFormat] * PageWidth * PageWidth;
+        for (int i = 0; i < header->numLevels; ++i) {
+            const TiledTextureFileLevel &level = levels[i];
+            if (level.width == 0 || level.height == 0 ||
+                level.numPagesX != (level.width + PageWidth - 1) >> LogPageWidth ||
+                level.numPagesY != (level.height + PageWidth - 1) >> LogPageWidth ||
+                level.offset % PageAlignment != 0 || level.offset < endOfDescriptions ||
+                level.offset + pageSize * level.numPagesX * level.numPagesY > m_file.size())
+                return;
+        }
+        
+        m_header = header;
+        m_levels = levels;
+    }
+    
+    bool TiledTextureFile::matches(const TiledTextureFileKey &key) const {
+        if (!isValid())
+            return false;
+        const char* sourcePath = (const char*)(m_levels + m_header->numLevels);
+        return (m_header->sourceModificationTime == key.sourceModificationTime &&
+                m_header->storeMode == (uint32_t)key.storeMode &&
+                m_header->spectrumType == (uint32_t)key.spectrumType &&
+                m_header->flags == flagsForKey(key) &&
+                key.sourcePath.compare(0, std::string::npos, sourcePath, m_header->sourcePathLength) == 0);
+    }
+    
+    
+    
+    MappedTiledImage2D::MappedTiledImage2D(const std::shared_ptr<const TiledTextureFile> &file) : MappedTiledImage2D(file, 0) {
+        for (int i = 1; i < m_file->numLevels(); ++i)
+            m_mipLevels.push_back(new MappedTiledImage2D(m_file, i));
+    }
+    
+    MappedTiledImage2D::MappedTiledImage2D(const std::shared_ptr<const TiledTextureFile> &file, uint32_t level) :
+    Image2D(file->level(level).width, file->level(level).height, file->format(), file->spectrumType()), m_file(file) {
+        SLRAssert(m_file->isValid(), "The tiled texture file is invalid.");
+        m_data = m_file->levelData(level);
+        m_stride = sizesOfColorFormats[(uint32_t)m_colorFormat];
+        m_numPagesX = m_file->level(level).numPagesX;
+        m_directData = m_data;
+        m_log2TileWidth = TiledTextureFile::LogPageWidth;
+        m_numTilesX = m_numPagesX;
+    }
+    
+    MappedTiledImage2D::~MappedTiledImage2D() {
+        for (int i = 0; i < m_mipLevels.size(); ++i)
+            delete m_mipLevels[i];
+    }
+}
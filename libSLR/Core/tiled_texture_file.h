@@ -0,0 +1,133 @@
+//
+//  tiled_texture_file.h
+//
+//  Created by 渡部 心 on 2017/07/01.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#ifndef __SLR_tiled_texture_file__
+#define __SLR_tiled_texture_file__
+
+#include "../defines.h"
+#include "../declarations.h"
+#include "../Helper/MappedFile.h"
+#include "image_2d.h"
+
+namespace SLR {
+    // JP: タイル化テクスチャーファイルのヘッダー。値はリトルエンディアンで格納される。
+    //     ヘッダーの後にミップレベルの記述と元画像のパスが続き、各レベルのページはページ境界に揃えて行優先で並ぶ。
+    //     ページはPageWidth^2テクセルを行優先で保持し、画像の端のページも同じサイズを持つ。
+    // EN: header of a tiled texture file. Values are stored in little endian.
+    //     Descriptions of mip levels and the path of the source image follow the header,
+    //     and pages of each level are placed in row-major order aligned to a page boundary.
+    //     A page holds PageWidth^2 texels in row-major order, and pages at the image border also have the same size.
+    struct TiledTextureFileHeader {
+        char magic[4];
+        uint32_t version;
+        uint32_t headerSize;
+        uint32_t colorFormat;
+        uint32_t spectrumType;
+        uint32_t numLevels;
+        uint32_t logPageWidth;
+        uint32_t storeMode;
+        uint32_t flags;
+        uint32_t sourcePathLength;
+        uint64_t sourceModificationTime;
+    };
+    
+    struct TiledTextureFileLevel {
+        uint32_t width, height;
+        uint32_t numPagesX, numPagesY;
+        uint64_t offset;
+    };
+    
+    // JP: 変換済みのファイルが元画像と読み込みパラメターに対応しているかを判定するためのキー。
+    // EN: key to determine whether a converted file corresponds to the source image and the load parameters.
+    struct TiledTextureFileKey {
+        std::string sourcePath;
+        uint64_t sourceModificationTime;
+        ImageStoreMode storeMode;
+        SpectrumType spectrumType;
+        bool gammaCorrection;
+        
+        static bool getModificationTime(const std::string &filePath, uint64_t* mtime);
+    };
+    
+    
+    
+    // JP: 最終的な格納形式に変換・タイル化済みのミップマップをメモリーマップで読み込む版付きのファイル。
+    //     各ページをそのまま参照できるため、読み込み時のスペクトルへのアップサンプリングや変換が不要になる。
+    // EN: versioned file, loaded by memory mapping, of a mipmap already converted to the final storage format and tiled.
+    //     Each page can be referred to as is, eliminating spectral upsampling and conversion at loading.
+    class SLR_API TiledTextureFile {
+        MappedFile m_file;
+        const TiledTextureFileHeader* m_header;
+        const TiledTextureFileLevel* m_levels;
+        
+        enum Flag : uint32_t {
+            Flag_GammaCorrection = 1 << 0,
+            Flag_SpectralRepresentation = 1 << 1,
+        };
+        static uint32_t flagsForKey(const TiledTextureFileKey &key);
+    public:
+        static const char Magic[4];
+        static const uint32_t Version = 2;
+        static const uint32_t LogPageWidth = 6;
+        static const uint32_t PageWidth = 1 << LogPageWidth;
+        static const uint32_t PageAlignment = 4096;
+        
+        // JP: 画像の全ミップレベルをキーと共に書き出す。
+        // EN: write all the mip levels of an image with the key.
+        static bool write(const std::string &filePath, const Image2D &image, const TiledTextureFileKey &key);
+        
+        TiledTextureFile(const std::string &filePath);
+        
+        bool isValid() const { return m_header != nullptr; }
+        // JP: 元画像のパス、更新時刻、格納モード等がキーと一致するか。
+        // EN: whether the path, the modification time, the store mode and so on of the source image match the key.
+        bool matches(const TiledTextureFileKey &key) const;
+        
+        ColorFormat format() const { return (ColorFormat)m_header->colorFormat; }
+        SpectrumType spectrumType() const { return (SpectrumType)m_header->spectrumType; }
+        uint32_t numLevels() const { return m_header->numLevels; }
+        const TiledTextureFileLevel &level(uint32_t index) const { return m_levels[index]; }
+        const uint8_t* levelData(uint32_t index) const { return m_file.data() + m_levels[index].offset; }
+    };
+    
+    
+    
+    // JP: タイル化テクスチャーファイルをメモリーマップしたまま参照する常駐画像。
+    // EN: resident image referring to a memory-mapped tiled texture file as is.
+    class SLR_API MappedTiledImage2D : public Image2D {
+        static const uint32_t localMask = TiledTextureFile::PageWidth - 1;
+        
+        std::shared_ptr<const TiledTextureFile> m_file;
+        const uint8_t* m_data;
+        size_t m_stride;
+        uint32_t m_numPagesX;
+        std::vector<MappedTiledImage2D*> m_mipLevels;
+        
+        const void* getInternal(uint32_t x, uint32_t y) const override {
+            const uint32_t LogPageWidth = TiledTextureFile::LogPageWidth;
+            const uint32_t PageWidth = TiledTextureFile::PageWidth;
+            uint32_t page = (y >> LogPageWidth) * m_numPagesX + (x >> LogPageWidth);
+            return m_data + m_stride * (((size_t)page << (2 * LogPageWidth)) + (y & localMask) * PageWidth + (x & localMask));
+        }
+        void setInternal(uint32_t x, uint32_t y, const void* data, size_t size) override {
+            SLRAssert(false, "MappedTiledImage2D is read-only.");
+        }
+        
+        MappedTiledImage2D(const std::shared_ptr<const TiledTextureFile> &file, uint32_t level);
+    public:
+        MappedTiledImage2D(const std::shared_ptr<const TiledTextureFile> &file);
+        ~MappedTiledImage2D();
+        
+        uint32_t numMipLevels() const override { return 1 + (uint32_t)m_mipLevels.size(); }
+        const Image2D* getMipLevel(uint32_t level) const override {
+            SLRAssert(level < numMipLevels(), "\"level\" is out of range.");
+            return level == 0 ? this : m_mipLevels[level - 1];
+        }
+    };
+}
+
+#endif /* __SLR_tiled_texture_file__ */
@@ -0,0 +1,114 @@
+//
+//  MappedFile.cpp
+//
+//  Created by 渡部 心 on 2017/06/23.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#include "MappedFile.h"
+
+#if !defined(SLR_Platform_Windows)
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <fcntl.h>
+#   include <unistd.h>
+#endif
+#include <atomic>
+
+namespace SLR {
+#if defined(SLR_Platform_Windows)
+    MappedFile::MappedFile(const std::string &filePath) : m_data(nullptr), m_size(0), m_fileHandle(INVALID_HANDLE_VALUE), m_mappingHandle(nullptr) {
+        m_fileHandle = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (m_fileHandle == INVALID_HANDLE_VALUE)
+            return;
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(m_fileHandle, &fileSize) || fileSize.QuadPart == 0)
+            return;
+        m_mappingHandle = CreateFileMappingA(m_fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (m_mappingHandle == nullptr)
+            return;
+        m_data = (const uint8_t*)MapViewOfFile(m_mappingHandle, FILE_MAP_READ, 0, 0, 0);
+        if (m_data)
+            m_size = (size_t)fileSize.QuadPart;
+    }
+    
+    MappedFile::~MappedFile() {
+        if (m_data)
+            UnmapViewOfFile(m_data);
+        if (m_mappingHandle)
+            CloseHandle(m_mappingHandle);
+        if (m_fileHandle != INVALID_HANDLE_VALUE)
+            CloseHandle(m_fileHandle);
+    }
+#else
+    MappedFile::MappedFile(const std::string &filePath) : m_data(nullptr), m_size(0) {
+        int fd = open(filePath.c_str(), O_RDONLY);
+        if (fd < 0)
+            return;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* addr = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (addr != MAP_FAILED) {
+                m_data = (const uint8_t*)addr;
+                m_size = (size_t)st.st_size;
+            }
+        }
+        // JP: マップはファイル記述子を閉じた後も有効なまま残る。
+        // EN: the mapping remains valid after closing the file descriptor.
+        close(fd);
+    }
+    
+    MappedFile::~MappedFile() {
+        if (m_data)
+            munmap((void*)m_data, m_size);
+    }
+#endif
+    
+    
+    
+    AtomicFileWriter::AtomicFileWriter(const std::string &targetPath) : m_targetPath(targetPath), m_fp(nullptr) {
+#if defined(SLR_Platform_Windows)
+        static std::atomic<uint32_t> s_counter(0);
+        m_tempPath = targetPath + "." + std::to_string(GetCurrentProcessId()) + "." + std::to_string(s_counter++) + ".tmp";
+        m_fp = fopen(m_tempPath.c_str(), "wb");
+#else
+        std::vector<char> tempPath(targetPath.begin(), targetPath.end());
+        const char suffix[] = ".XXXXXX";
+        tempPath.insert(tempPath.end(), suffix, suffix + sizeof(suffix));
+        int fd = mkstemp(tempPath.data());
+        if (fd < 0)
+            return;
+        m_tempPath = tempPath.data();
+        // JP: mkstempは所有者のみ読める権限で作るので、通常のファイルと同じ権限にする。
+        // EN: mkstemp creates the file readable only by the owner, so give it the same permissions as a regular file.
+        fchmod(fd, 0644);
+        m_fp = fdopen(fd, "wb");
+        if (!m_fp) {
+            close(fd);
+            remove(m_tempPath.c_str());
+        }
+#endif
+    }
+    
+    AtomicFileWriter::~AtomicFileWriter() {
+        if (m_fp) {
+            fclose(m_fp);
+            remove(m_tempPath.c_str());
+        }
+    }
+    
+    bool AtomicFileWriter::commit() {
+        if (!m_fp)
+            return false;
+        bool success = fclose(m_fp) == 0;
+        m_fp = nullptr;
+#if defined(SLR_Platform_Windows)
+        success = success && MoveFileExA(m_tempPath.c_str(), m_targetPath.c_str(), MOVEFILE_REPLACE_EXISTING);
+#else
+        success = success && rename(m_tempPath.c_str(), m_targetPath.c_str()) == 0;
+#endif
+        if (!success)
+            remove(m_tempPath.c_str());
+        return success;
+    }
+}
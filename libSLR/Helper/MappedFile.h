@@ -0,0 +1,63 @@
+//
+//  MappedFile.h
+//
+//  Created by 渡部 心 on 2017/06/23.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#ifndef __SLR_MappedFile__
+#define __SLR_MappedFile__
+
+#include "../defines.h"
+
+namespace SLR {
+    // JP: 読み込み専用でメモリーマップしたファイル。
+    //     内容はOSのページキャッシュから必要に応じて読み込まれ、複数のプロセス間で共有される。
+    // EN: read-only memory-mapped file.
+    //     The contents are loaded on demand from the OS page cache, and are shared between multiple processes.
+    class SLR_API MappedFile {
+        const uint8_t* m_data;
+        size_t m_size;
+#if defined(SLR_Platform_Windows)
+        void* m_fileHandle;
+        void* m_mappingHandle;
+#endif
+        
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+    public:
+        MappedFile(const std::string &filePath);
+        ~MappedFile();
+        
+        bool isValid() const { return m_data != nullptr; }
+        const uint8_t* data() const { return m_data; }
+        size_t size() const { return m_size; }
+    };
+    
+    
+    
+    // JP: 対象と同じディレクトリーの一意な一時ファイルに書き込み、commit()で対象を置き換える。
+    //     置き換えはrenameで行うので、以前のファイルをマップしている他のプロセスは古い内容を読み続けられる。
+    // EN: writes to a unique temporary file in the same directory as the target, and replaces the target by commit().
+    //     The replacement is done by rename, so other processes mapping the previous file can keep reading the old contents.
+    class SLR_API AtomicFileWriter {
+        std::string m_targetPath;
+        std::string m_tempPath;
+        FILE* m_fp;
+        
+        AtomicFileWriter(const AtomicFileWriter &) = delete;
+        AtomicFileWriter &operator=(const AtomicFileWriter &) = delete;
+    public:
+        AtomicFileWriter(const std::string &targetPath);
+        ~AtomicFileWriter();
+        
+        bool isValid() const { return m_fp != nullptr; }
+        FILE* file() const { return m_fp; }
+        
+        // JP: 一時ファイルを閉じて対象へ移す。失敗時は一時ファイルを削除し、対象はそのまま残る。
+        // EN: close the temporary file and move it to the target. On failure, the temporary file is removed and the target is left as is.
+        bool commit();
+    };
+}
+
+#endif /* __SLR_MappedFile__ */
@@ -0,0 +1,66 @@
+//
+//  ParallelFor.cpp
+//
+//  Created by 渡部 心 on 2017/06/30.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#include "ParallelFor.h"
+#include "ThreadPool.h"
+#include <atomic>
+
+namespace SLR {
+    static ThreadPool &sharedWorkerPool() {
+        static ThreadPool s_pool;
+        return s_pool;
+    }
+    
+    struct ParallelForState {
+        std::function<void(uint32_t)> func;
+        uint32_t numItems;
+        std::atomic<uint32_t> nextItem;
+        uint32_t numDoneItems;
+        std::mutex mutex;
+        std::condition_variable condVar;
+        
+        ParallelForState(uint32_t _numItems, const std::function<void(uint32_t)> &_func) :
+        func(_func), numItems(_numItems), nextItem(0), numDoneItems(0) {}
+        
+        void process() {
+            uint32_t numProcessed = 0;
+            for (uint32_t item = nextItem++; item < numItems; item = nextItem++) {
+                func(item);
+                ++numProcessed;
+            }
+            if (numProcessed == 0)
+                return;
+            
+            std::lock_guard<std::mutex> lock(mutex);
+            numDoneItems += numProcessed;
+            if (numDoneItems == numItems)
+                condVar.notify_all();
+        }
+    };
+    
+    void parallelFor(uint32_t numItems, const std::function<void(uint32_t)> &func) {
+        if (numItems == 0)
+            return;
+        
+        // JP: 全要素を取り終えた後に開始したジョブは何もせずに抜けるので、状態はジョブと共有して寿命を延ばす。
+        // EN: jobs starting after all items have been taken exit doing nothing, so share the state with jobs to extend its lifetime.
+        auto state = std::make_shared<ParallelForState>(numItems, func);
+        ThreadPool &pool = sharedWorkerPool();
+        uint32_t numHelpers = std::min(numItems - 1, pool.numThreads());
+        for (uint32_t i = 0; i < numHelpers; ++i) {
+            pool.enqueue([state](uint32_t threadID) {
+                state->process();
+            });
+        }
+        
+        state->process();
+        
+        std::unique_lock<std::mutex> lock(state->mutex);
+        while (state->numDoneItems < numItems)
+            state->condVar.wait(lock);
+    }
+}
@@ -0,0 +1,21 @@
+//
+//  ParallelFor.h
+//
+//  Created by 渡部 心 on 2017/06/30.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#ifndef __SLR_ParallelFor__
+#define __SLR_ParallelFor__
+
+#include "../defines.h"
+
+namespace SLR {
+    // JP: [0, numItems)の各要素についてfuncをプロセス全体で共有するワーカースレッド群で並列に実行し、全て終わるまで待つ。
+    //     呼び出し元のスレッドも要素を処理するので、ワーカースレッドや画像の読み込みスレッドから呼んでもデッドロックしない。
+    // EN: execute func for each item in [0, numItems) in parallel on the worker threads shared in the whole process, and wait until all finish.
+    //     The calling thread also processes items, so this doesn't deadlock even when called from a worker thread or an image loader thread.
+    SLR_API void parallelFor(uint32_t numItems, const std::function<void(uint32_t)> &func);
+}
+
+#endif /* __SLR_ParallelFor__ */
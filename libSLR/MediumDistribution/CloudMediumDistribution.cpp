@@ -45,23 +45,67 @@ namespace SLR {
 //        
 //        return total;
         
+        // JP: 各オクターブを別々のレーンとしてまとめて評価する。余ったレーンは最初のオクターブを繰り返す。
+        // EN: evaluate octaves together, each as a separate lane. Remaining lanes repeat the first octave.
+        Point3DTemplate<RealType> ps[BatchWidth];
+        RealType frequencies[BatchWidth];
+        RealType closestSqDistances[BatchWidth];
+        uint32_t hashesOfClosest[BatchWidth];
+        uint32_t closestFPIndices[BatchWidth];
+        std::fill(ps, ps + BatchWidth, p);
+        
         RealType total = 0;
+        RealType frequency = m_initialFrequency;
+        RealType variation = m_initialVariation;
+        RealType sumAmp = 0.0f;
+        for (uint32_t i = 0; i < m_numOctaves; i += BatchWidth) {
+            uint32_t numLanes = std::min(m_numOctaves - i, (uint32_t)BatchWidth);
+            for (int j = 0; j < BatchWidth; ++j) {
+                if (j < numLanes) {
+                    frequencies[j] = frequency;
+                    frequency *= m_frequencyMultiplier;
+                }
+                else {
+                    frequencies[j] = frequencies[0];
+                }
+            }
+            m_primaryNoiseGen.evaluateBatch(ps, frequencies, closestSqDistances, hashesOfClosest, closestFPIndices);
+            for (int j = 0; j < numLanes; ++j) {
+                total += (1 - closestSqDistances[j]) * variation;
+                
+                sumAmp += variation;
+                variation *= m_persistence;
+            }
+        }
+        
+        return std::max<RealType>(total / sumAmp, 0.0f);
+    }
+    
+    template <typename RealType>
+    void LayeredWorleyNoiseGeneratorTemplate<RealType>::evaluateBatch(const Point3DTemplate<RealType> ps[BatchWidth], RealType values[BatchWidth]) const {
+        RealType totals[BatchWidth];
+        RealType frequencies[BatchWidth];
+        RealType closestSqDistances[BatchWidth];
+        uint32_t hashesOfClosest[BatchWidth];
+        uint32_t closestFPIndices[BatchWidth];
+        std::fill(totals, totals + BatchWidth, 0);
+        
         RealType frequency = m_initialFrequency;
         RealType variation = m_initialVariation;
         RealType sumAmp = 0.0f;
         for (int i = 0; i < m_numOctaves; ++i) {
-            RealType closestSqDistance;
-            uint32_t hashOfClosest;
-            uint32_t closestFPIdx;
-            m_primaryNoiseGen.evaluate(p, frequency, &closestSqDistance, &hashOfClosest, &closestFPIdx);
-            total += (1 - closestSqDistance) * variation;
+            std::fill(frequencies, frequencies + BatchWidth, frequency);
+            m_primaryNoiseGen.evaluateBatch(ps, frequencies, closestSqDistances, hashesOfClosest, closestFPIndices);
+            for (int j = 0; j < BatchWidth; ++j)
+                totals[j] += (1 - closestSqDistances[j]) * variation;
             
             sumAmp += variation;
             variation *= m_persistence;
             frequency *= m_frequencyMultiplier;
         }
         
-        return std::max<RealType>(total / sumAmp, 0.0f);
+        for (int j = 0; j < BatchWidth; ++j)
+            values[j] = std::max<RealType>(totals[j] / sumAmp, 0.0f);
     }
     
     template class SLR_API LayeredWorleyNoiseGeneratorTemplate<float>;
@@ -77,6 +121,15 @@ namespace SLR {
     const float CloudMediumDistribution::CloudBaseAltitude = 1500;
     const float CloudMediumDistribution::CloudTopAltitude = 5000;
     
+    const float CloudMediumDistribution::BakeTolerance = 1.0f / 256;
+    
+    static const float MinimumDensity = 1.0f / (8e+4f * 0.1f);
+    
+    // JP: x:100km x z:100km を基準とする。
+    static const float DefaultWeatherScale = 1e-5f;
+    static const float DefaultBaseShapeScale = 5.314f * 1e-5f * 10;
+    static const float DefaultErosionScale = 5.739f * 1e-4f * 10;
+    
     // For debug visualization.
     void CloudMediumDistribution::exportBMPs() const {
 //        LayeredWorleyNoiseGeneratorTemplate<float> layeredWorleyGen(3, 10.0f, 8.0f, 1.0f, 2.0f, 0.5f);
@@ -141,7 +194,12 @@ namespace SLR {
             printf("done.\n");
         };
         
-        const auto export3DData = [this](const std::string &fileName, std::function<float(const Point3D &p)> func, uint32_t resX, uint32_t resY, uint32_t resZ) {
+        // JP: 3Dデータはノイズの評価が支配的なので、X方向に並ぶNoiseBatchWidth個の点をまとめて評価する。
+        //     端数のレーンは行の最後の点を繰り返す。
+        // EN: Noise evaluation dominates 3D data generation, so evaluate NoiseBatchWidth points along X at once.
+        //     Remaining lanes repeat the last point of the row.
+        const auto export3DData = [this](const std::string &fileName, std::function<void(const Point3D* ps, float* values)> batchFunc, 
+                                         uint32_t resX, uint32_t resY, uint32_t resZ) {
             printf("write to %s\n", fileName.c_str());
             fflush(stdout);
             FILE* fp = fopen(fileName.c_str(), "wb");
@@ -157,10 +215,17 @@ namespace SLR {
                 float pz = (float)iz / (resZ - 1);
                 for (int iy = 0; iy < resY; ++iy) {
                     float py = (float)iy / (resY - 1);
-                    for (int ix = 0; ix < resX; ++ix) {
-                        float px = (float)ix / (resX - 1);
-                        Point3D p(px, py, pz);
-                        zSlice[resX * iy + ix] = func(p);
+                    for (int ix = 0; ix < resX; ix += NoiseBatchWidth) {
+                        uint32_t numLanes = std::min(resX - ix, NoiseBatchWidth);
+                        Point3D ps[NoiseBatchWidth];
+                        float values[NoiseBatchWidth];
+                        for (int j = 0; j < NoiseBatchWidth; ++j) {
+                            float px = (float)(ix + std::min(j, (int)numLanes - 1)) / (resX - 1);
+                            ps[j] = Point3D(px, py, pz);
+                        }
+                        batchFunc(ps, values);
+                        for (int j = 0; j < numLanes; ++j)
+                            zSlice[resX * iy + ix + j] = values[j];
                     }
                 }
                 fwrite(zSlice, sizeof(float), resX * resY, fp);
@@ -177,8 +242,8 @@ namespace SLR {
         
         export2DData(name + "_coverage", std::bind(&CloudMediumDistribution::calcCoverage, this, std::placeholders::_1), WeatherNumX, WeatherNumZ);
         export2DData(name + "_cloud_type", std::bind(&CloudMediumDistribution::calcCloudType, this, std::placeholders::_1), WeatherNumX, WeatherNumZ);
-        export3DData(name + "_base_shape", std::bind(&CloudMediumDistribution::calcBaseShape, this, std::placeholders::_1), LowResNumX, LowResNumY, LowResNumZ);
-        export3DData(name + "_erosion", std::bind(&CloudMediumDistribution::calcErosion, this, std::placeholders::_1), HighResNumX, HighResNumY, HighResNumZ);
+        export3DData(name + "_base_shape", std::bind(&CloudMediumDistribution::calcBaseShapes, this, std::placeholders::_1, std::placeholders::_2), LowResNumX, LowResNumY, LowResNumZ);
+        export3DData(name + "_erosion", std::bind(&CloudMediumDistribution::calcErosions, this, std::placeholders::_1, std::placeholders::_2), HighResNumX, HighResNumY, HighResNumZ);
     }
     
     float CloudMediumDistribution::calcCoverage(const Point3D &position) const {
@@ -229,6 +294,24 @@ namespace SLR {
         return erosion;
     }
     
+    void CloudMediumDistribution::calcBaseShapes(const Point3D positions[NoiseBatchWidth], float values[NoiseBatchWidth]) const {
+        Point3D floorPositions[NoiseBatchWidth];
+        float floorValues[NoiseBatchWidth];
+        for (int i = 0; i < NoiseBatchWidth; ++i)
+            floorPositions[i] = positions[i] + Vector3D(3, -5, 2);
+        m_baseShapeGenerator.evaluateBatch(positions, values);
+        m_baseShapeExtraGenerator.evaluateBatch(floorPositions, floorValues);
+        for (int i = 0; i < NoiseBatchWidth; ++i)
+            values[i] = remap(values[i], -floorValues[i], 1.0f, 0.0f, 1.0f);
+    }
+    
+    void CloudMediumDistribution::calcErosions(const Point3D positions[NoiseBatchWidth], float values[NoiseBatchWidth]) const {
+        Point3D offsetPositions[NoiseBatchWidth];
+        for (int i = 0; i < NoiseBatchWidth; ++i)
+            offsetPositions[i] = positions[i] + Vector3D(5.0f, 3.0f, 2.0f);
+        m_erosionGenerator.evaluateBatch(offsetPositions, values);
+    }
+    
     float CloudMediumDistribution::calcHeightGradient(float cloudType, float h) const {
         // [0, 1] => [1500, 2750]
         const float stratusGrad[] = {1525, 1562.5, 1612.5, 1637.5}; // 0.02f, 0.05f, 0.09f, 0.11f
@@ -259,37 +342,33 @@ namespace SLR {
             param.x > 1 || param.y > 1 || param.z > 1)
             return 0.0f;
         
+        if (m_bakedDensity)
+            return m_bakedDensity->evaluate(param);
+        
         Point3D position = (m_region.minP + (m_region.maxP - m_region.minP) * param) / m_featureScale;
         
 #if defined(CLOUD_GENERATION)
         SLRAssert_NotImplemented();
         return 1.0f;
 #else
-        const float minimumDensity = 1.0f / (8e+4f * 0.1f);
-        
-        // JP: x:100km x z:100km を基準とする。
-        const float DefaultWeatherScale = 1e-5f;
-        const float DefaultBaseShapeScale = 5.314f * 1e-5f * 10;
-        const float DefaultErosionScale = 5.739f * 1e-4f * 10;
-        
         float baseShape = m_baseShape.evaluate(DefaultBaseShapeScale * position.x, 
                                                DefaultBaseShapeScale * position.y, 
                                                DefaultBaseShapeScale * position.z);
         if (baseShape <= 0.0f)
-            return minimumDensity;
+            return MinimumDensity;
         
         float cloudType = m_cloudType.evaluate(DefaultWeatherScale * position.x, 
                                                DefaultWeatherScale * position.z);
         float heightGradient = calcHeightGradient(cloudType * 0.666f, position.y);
         baseShape *= heightGradient;
         if (baseShape <= 0.0f)
-            return minimumDensity;
+            return MinimumDensity;
         
         float coverage = m_coverage.evaluate(DefaultWeatherScale * position.x, 
                                              DefaultWeatherScale * position.z);
         float ret = saturate(remap(baseShape, 1 - coverage, 1.0f, 0.0f, 1.0f)) * coverage;
         if (ret <= 0.0f)
-            return minimumDensity;
+            return MinimumDensity;
         
         float erosion = m_erosion.evaluate(DefaultErosionScale * position.x, 
                                            DefaultErosionScale * position.y, 
@@ -298,7 +377,7 @@ namespace SLR {
         erosion = erosion * (1 - heightFrac) + (1 - erosion) * heightFrac;
         ret = saturate(remap(ret, erosion * 0.2f, 1.0f, 0.0f, 1.0f));
         
-        return std::max(enhanceLower(ret, 0.5f, 0.2f), minimumDensity);
+        return std::max(enhanceLower(ret, 0.5f, 0.2f), MinimumDensity);
         
 //        const auto produceSliceImage = [this](const std::string &filename, std::function<float(float, float, float)> func, uint32_t iy, uint32_t resX, uint32_t resY, uint32_t resZ, float gamma) {
 //            uint32_t byteWidth = resX * 3 + resX % 4;
@@ -367,6 +446,272 @@ namespace SLR {
 #endif
     }
     
+    void CloudMediumDistribution::calcDensities(const Point3D* params, uint32_t numPoints, float* densities) const {
+#if defined(CLOUD_GENERATION)
+        for (int i = 0; i < numPoints; ++i)
+            densities[i] = calcDensity(params[i]);
+#else
+        if (m_bakedDensity) {
+            for (int i = 0; i < numPoints; ++i)
+                densities[i] = calcDensity(params[i]);
+            return;
+        }
+        
+        // JP: calcDensity()の各段階を全点について評価してから次の段階に進む。
+        //     互いに独立なグリッドの参照が重なってメモリーアクセスの待ちを隠せるうえ、後の段階は生き残った点についてのみ評価する。
+        // EN: evaluate each stage of calcDensity() for all the points before proceeding to the next stage.
+        //     Independent grid lookups overlap to hide memory access latency, and later stages are evaluated only for surviving points.
+        for (int base = 0; base < numPoints; base += DensityBatchSize) {
+            uint32_t numInBatch = std::min(numPoints - base, DensityBatchSize);
+            const Point3D* batchParams = params + base;
+            float* batchDensities = densities + base;
+            
+            Point3D positions[DensityBatchSize];
+            float values[DensityBatchSize];
+            uint32_t indices[DensityBatchSize];
+            uint32_t numActive = 0;
+            for (int i = 0; i < numInBatch; ++i) {
+                const Point3D &param = batchParams[i];
+                if (param.x < 0 || param.y < 0 || param.z < 0 ||
+                    param.x > 1 || param.y > 1 || param.z > 1) {
+                    batchDensities[i] = 0.0f;
+                    continue;
+                }
+                batchDensities[i] = MinimumDensity;
+                positions[i] = (m_region.minP + (m_region.maxP - m_region.minP) * param) / m_featureScale;
+                indices[numActive++] = i;
+            }
+            
+            uint32_t numSurvived = 0;
+            for (int j = 0; j < numActive; ++j) {
+                uint32_t i = indices[j];
+                const Point3D &position = positions[i];
+                values[i] = m_baseShape.evaluate(DefaultBaseShapeScale * position.x, 
+                                                 DefaultBaseShapeScale * position.y, 
+                                                 DefaultBaseShapeScale * position.z);
+                if (values[i] > 0.0f)
+                    indices[numSurvived++] = i;
+            }
+            numActive = numSurvived;
+            
+            numSurvived = 0;
+            for (int j = 0; j < numActive; ++j) {
+                uint32_t i = indices[j];
+                const Point3D &position = positions[i];
+                float cloudType = m_cloudType.evaluate(DefaultWeatherScale * position.x, 
+                                                       DefaultWeatherScale * position.z);
+                float baseShape = values[i] * calcHeightGradient(cloudType * 0.666f, position.y);
+                if (baseShape <= 0.0f)
+                    continue;
+                
+                float coverage = m_coverage.evaluate(DefaultWeatherScale * position.x, 
+                                                     DefaultWeatherScale * position.z);
+                values[i] = saturate(remap(baseShape, 1 - coverage, 1.0f, 0.0f, 1.0f)) * coverage;
+                if (values[i] > 0.0f)
+                    indices[numSurvived++] = i;
+            }
+            numActive = numSurvived;
+            
+            for (int j = 0; j < numActive; ++j) {
+                uint32_t i = indices[j];
+                const Point3D &position = positions[i];
+                float erosion = m_erosion.evaluate(DefaultErosionScale * position.x, 
+                                                   DefaultErosionScale * position.y, 
+                                                   DefaultErosionScale * position.z);
+                float heightFrac = saturate((position.y - CloudBaseAltitude) / (CloudTopAltitude - CloudBaseAltitude));
+                erosion = erosion * (1 - heightFrac) + (1 - erosion) * heightFrac;
+                float ret = saturate(remap(values[i], erosion * 0.2f, 1.0f, 0.0f, 1.0f));
+                batchDensities[i] = std::max(enhanceLower(ret, 0.5f, 0.2f), MinimumDensity);
+            }
+        }
+#endif
+    }
+    
+    float CloudMediumDistribution::calcDensityBound(const Point3D &paramMin, const Point3D &paramMax) const {
+#if defined(CLOUD_GENERATION)
+        SLRAssert_NotImplemented();
+        return 1.0f;
+#else
+        Point3D posMin = (m_region.minP + (m_region.maxP - m_region.minP) * paramMin) / m_featureScale;
+        Point3D posMax = (m_region.minP + (m_region.maxP - m_region.minP) * paramMax) / m_featureScale;
+        
+        // JP: calcDensity()に渡す雲の種類は2/3未満なので積乱雲の分布は使われず、高さの勾配は(1512.5, 2750)の外では0になる。
+        //     内側では勾配の上限1を使う。
+        // EN: the cloud type passed in calcDensity() is less than 2/3, so the cumulonimbus profile is not used
+        //     and the height gradient is 0 outside (1512.5, 2750). The upper bound 1 of the gradient is used inside.
+        if (posMax.y <= 1512.5f || posMin.y >= 2750.0f)
+            return MinimumDensity;
+        
+        const double lo[3] = {DefaultBaseShapeScale * posMin.x, DefaultBaseShapeScale * posMin.y, DefaultBaseShapeScale * posMin.z};
+        const double hi[3] = {DefaultBaseShapeScale * posMax.x, DefaultBaseShapeScale * posMax.y, DefaultBaseShapeScale * posMax.z};
+        float baseShape = m_baseShape.maxValue(lo, hi);
+        if (baseShape <= 0.0f)
+            return MinimumDensity;
+        
+        float coverage = m_coverage.maxValue(DefaultWeatherScale * posMin.x, DefaultWeatherScale * posMax.x, 
+                                             DefaultWeatherScale * posMin.z, DefaultWeatherScale * posMax.z);
+        
+        // JP: saturate(remap(b, 1 - c, 1, 0, 1)) * c = clamp(b + c - 1, 0, c) はbとcに対して単調増加。
+        //     侵食は値を下げるだけなので無視でき、enhanceLower()も単調増加。
+        // EN: saturate(remap(b, 1 - c, 1, 0, 1)) * c = clamp(b + c - 1, 0, c) is monotonically increasing with respect to b and c.
+        //     Erosion only decreases the value so that it can be ignored, and enhanceLower() is also monotonically increasing.
+        float ret = std::clamp(baseShape + coverage - 1, 0.0f, coverage);
+        if (ret <= 0.0f)
+            return MinimumDensity;
+        
+        return std::max(enhanceLower(std::min(ret, 1.0f), 0.5f, 0.2f), MinimumDensity);
+#endif
+    }
+    
+    void CloudMediumDistribution::setupMajorantGrid(const std::string &cacheFileName) {
+        const uint32_t numCells[3] = {MajorantNumX, MajorantNumY, MajorantNumZ};
+        const uint32_t numTotalCells = MajorantNumX * MajorantNumY * MajorantNumZ;
+        const float extent[3] = {(float)MajorantNumX, (float)MajorantNumY, (float)MajorantNumZ};
+        Vector3D regionExtent = m_region.maxP - m_region.minP;
+        m_worldToMajorantCell = Vector3D(MajorantNumX / regionExtent.x, MajorantNumY / regionExtent.y, MajorantNumZ / regionExtent.z);
+        
+        // JP: 領域と特徴スケールが一致する場合はキャッシュされたセルの上限値を使う。
+        //     キャッシュは雲のデータファイルの内容を区別しないので、それらを作り直した場合は削除する必要がある。
+        // EN: use cached cell bounds when the region and the feature scale match.
+        //     The cache does not distinguish contents of the cloud data files, so it needs to be deleted when they are regenerated.
+        const float key[7] = {m_region.minP.x, m_region.minP.y, m_region.minP.z, m_region.maxP.x, m_region.maxP.y, m_region.maxP.z, m_featureScale};
+        std::vector<float> cellBounds;
+        FILE* fp = fopen(cacheFileName.c_str(), "rb");
+        if (fp) {
+            uint32_t cachedNumCells[3];
+            float cachedKey[7];
+            if (fread(cachedNumCells, sizeof(uint32_t), 3, fp) == 3 && fread(cachedKey, sizeof(float), 7, fp) == 7 &&
+                std::equal(numCells, numCells + 3, cachedNumCells) && std::equal(key, key + 7, cachedKey)) {
+                cellBounds.resize(numTotalCells);
+                if (fread(cellBounds.data(), sizeof(float), numTotalCells, fp) != numTotalCells)
+                    cellBounds.clear();
+            }
+            fclose(fp);
+        }
+        
+        bool cached = !cellBounds.empty();
+        std::function<float(uint32_t, uint32_t, uint32_t)> cellBound;
+        if (cached) {
+            cellBound = [&cellBounds](uint32_t x, uint32_t y, uint32_t z) {
+                return cellBounds[(MajorantNumY * z + y) * MajorantNumX + x];
+            };
+        }
+        else {
+            cellBound = [this](uint32_t x, uint32_t y, uint32_t z) {
+                Point3D paramMin((float)x / MajorantNumX, (float)y / MajorantNumY, (float)z / MajorantNumZ);
+                Point3D paramMax((float)(x + 1) / MajorantNumX, (float)(y + 1) / MajorantNumY, (float)(z + 1) / MajorantNumZ);
+                return calcDensityBound(paramMin, paramMax);
+            };
+        }
+        m_majorantGrid = new MajorantGrid(MajorantNumX, MajorantNumY, MajorantNumZ, extent, cellBound);
+        
+        if (!cached) {
+            fp = fopen(cacheFileName.c_str(), "wb");
+            if (fp) {
+                fwrite(numCells, sizeof(uint32_t), 3, fp);
+                fwrite(key, sizeof(float), 7, fp);
+                for (int z = 0; z < MajorantNumZ; ++z) {
+                    for (int y = 0; y < MajorantNumY; ++y) {
+                        for (int x = 0; x < MajorantNumX; ++x) {
+                            float value = m_majorantGrid->cellValue(0, x, y, z);
+                            fwrite(&value, sizeof(float), 1, fp);
+                        }
+                    }
+                }
+                fclose(fp);
+            }
+        }
+        
+        // JP: 密度の評価はノイズテクスチャーの参照を複数回含むのでセルの走査より十分に重い。
+        // EN: density evaluation involves multiple noise texture lookups, so it is much heavier than traversing a cell.
+        float maxBase_sigma_e = 0.0f;
+        for (int i = 0; i < NumStrataForStorage; ++i)
+            maxBase_sigma_e = std::max(maxBase_sigma_e, m_majorantExtinctionCoefficient[i] / m_maxDensity);
+        float cellWidth = (regionExtent.x / MajorantNumX + regionExtent.y / MajorantNumY + regionExtent.z / MajorantNumZ) / 3;
+        m_majorantGrid->selectLevel(maxBase_sigma_e * cellWidth, 1.0f, 10.0f);
+    }
+    
+    void CloudMediumDistribution::setupBakedDensity(const std::string &cacheFileName, uint32_t resolution) {
+        SLRAssert(resolution >= 2, "Bake resolution must be at least 2.");
+        Vector3D regionExtent = m_region.maxP - m_region.minP;
+        m_worldToBakedVoxel = Vector3D((resolution - 1) / regionExtent.x, (resolution - 1) / regionExtent.y, (resolution - 1) / regionExtent.z);
+        
+        // JP: 領域、特徴スケール、解像度と許容誤差が一致する場合はキャッシュを使う。
+        // EN: use the cache when the region, the feature scale, the resolution and the tolerance match.
+        const float key[9] = {m_region.minP.x, m_region.minP.y, m_region.minP.z, m_region.maxP.x, m_region.maxP.y, m_region.maxP.z, 
+                              m_featureScale, (float)resolution, BakeTolerance};
+        FILE* fp = fopen(cacheFileName.c_str(), "rb");
+        if (fp) {
+            float cachedKey[9];
+            if (fread(cachedKey, sizeof(float), 9, fp) == 9 && std::equal(key, key + 9, cachedKey))
+                m_bakedDensity = SparseDensityGrid::read(fp);
+            fclose(fp);
+            if (m_bakedDensity)
+                return;
+        }
+        
+        // JP: 疎なグリッドはタイルごとに並列に構築され、各ボクセルで手続き的な密度を評価する。
+        // EN: the sparse grid is built in parallel for each tile, and evaluates the procedural density at each voxel.
+        printf("bake cloud density: %u^3 ...", resolution);
+        fflush(stdout);
+        SparseDensityGrid* grid = new SparseDensityGrid(resolution, resolution, resolution, [this, resolution](uint32_t x, uint32_t y, uint32_t z) {
+            Point3D param((float)x / (resolution - 1), (float)y / (resolution - 1), (float)z / (resolution - 1));
+            return calcDensity(param);
+        }, BakeTolerance);
+        printf("done (%.1f MB).\n", grid->memorySize() / (1024.0f * 1024.0f));
+        
+        fp = fopen(cacheFileName.c_str(), "wb");
+        if (fp) {
+            bool success = fwrite(key, sizeof(float), 9, fp) == 9 && grid->write(fp);
+            fclose(fp);
+            if (!success)
+                remove(cacheFileName.c_str());
+        }
+        
+        m_bakedDensity = grid;
+    }
+    
+    // JP: majorantグリッド(焼き込んだ場合は疎なグリッドの階層)に沿って仮の衝突点を順にサンプルし、onCollision(距離, majorant)を呼ぶ。
+    //     majorantは制御密度を差し引いた残差に対するもの。onCollisionがfalseを返した距離、もしくはtMaxを返す。
+    // EN: sample tentative collisions in order along the majorant grid (the hierarchy of the sparse grid when baked) and call onCollision(distance, majorant).
+    //     The majorant is for the residual after subtracting the control density. This returns the distance where onCollision returned false, or tMax.
+    float CloudMediumDistribution::trackMajorants(const Ray &ray, float tMin, float tMax, float base_sigma_e, float controlDensity, FreePathSampler &sampler,
+                                                  const std::function<bool(float, float)> &onCollision) const {
+        float stoppedDistance = tMax;
+        float opticalDepth = -std::log(sampler.getSample());
+        const auto processInterval = [&](float t0, float t1, float maxDensity) {
+            float majorant = base_sigma_e * (maxDensity - controlDensity);
+            if (majorant <= 0.0f)
+                return true;
+            float t = t0;
+            while (true) {
+                float intervalDepth = (t1 - t) * majorant;
+                if (opticalDepth >= intervalDepth) {
+                    opticalDepth -= intervalDepth;
+                    return true;
+                }
+                t += opticalDepth / majorant;
+                if (!onCollision(t, majorant)) {
+                    stoppedDistance = t;
+                    return false;
+                }
+                opticalDepth = -std::log(sampler.getSample());
+            }
+        };
+        
+        if (m_bakedDensity) {
+            Point3D voxelOrg((ray.org - m_region.minP) * m_worldToBakedVoxel);
+            Vector3D voxelDir = ray.dir * m_worldToBakedVoxel;
+            m_bakedDensity->traverseMajorants(voxelOrg, voxelDir, tMin, tMax, processInterval);
+        }
+        else {
+            Point3D cellOrg((ray.org - m_region.minP) * m_worldToMajorantCell);
+            Vector3D cellDir = ray.dir * m_worldToMajorantCell;
+            m_majorantGrid->traverse(cellOrg, cellDir, tMin, tMax, processInterval);
+        }
+        return stoppedDistance;
+    }
+    
     bool CloudMediumDistribution::subdivide(Allocator* mem, MediumDistribution** fragments, uint32_t* numFragments) const {
         SLRAssert_NotImplemented();
         return true;
@@ -379,37 +724,41 @@ namespace SLR {
         
         SampledSpectrum base_sigma_e = m_base_sigma_e->evaluate(wls);
         
-        // delta tracking to sample free path.
-        float majorantSelected = majorantExtinctionCoefficientAtWavelength(wls.selectedWavelength());
+        // JP: 全波長の消散係数の上限をmajorantとするspectral trackingで自由行程をサンプルする。
+        // EN: sample free path by spectral tracking with the upper bound of extinction coefficients of all the wavelengths as the majorant.
         *singleWavelength = false;
-        bool hit = false;
-        float extCoeffSelected = 0.0f;
-        float hitDistance = segment.distMax;
-        FloatSum sampledDistance = segment.distMin;
-        sampledDistance += -std::log(sampler.getSample()) / majorantSelected;
-        while (sampledDistance < segment.distMax) {
-            Point3D queryPoint = ray.org + sampledDistance * ray.dir;
-            Point3D param;
-            m_region.calculateLocalCoordinates(queryPoint, &param);
-            float density = calcDensity(param);
-            SampledSpectrum extCoeff = base_sigma_e * density;
-            float probRealCollision = extCoeff[wls.selectedLambdaIndex] / majorantSelected;
-            if (sampler.getSample() < probRealCollision) {
-                *mi = MediumInteraction(ray.time, sampledDistance, queryPoint, normalize(ray.dir), param.x, param.y, param.z);
-                hit = true;
-                extCoeffSelected = extCoeff[wls.selectedLambdaIndex];
-                hitDistance = sampledDistance;
-                break;
-            }
-            sampledDistance += -std::log(sampler.getSample()) / majorantSelected;
-            
-            // TODO: handle out of boundary.
+        SampledSpectrum weight = SampledSpectrum::One;
+        float maxBase_sigma_e = base_sigma_e.maxValue();
+        if (wls.wavelengthSelected()) {
+            weight = SampledSpectrum::Zero;
+            weight[wls.selectedLambdaIndex] = 1.0f;
+            maxBase_sigma_e = base_sigma_e[wls.selectedLambdaIndex];
         }
-        
-        // estimate Monte Carlo throughput T(s, wl_j)/p(s, wl_i) by ratio tracking.
-        *medThroughput = SampledSpectrum::One;
-        if (hit)
-            *medThroughput /= extCoeffSelected;
+        bool hit = false;
+        trackMajorants(ray, segment.distMin, segment.distMax, maxBase_sigma_e, 0.0f, sampler, 
+                       [&](float dist, float majorant) {
+                           Point3D queryPoint = ray.org + dist * ray.dir;
+                           Point3D param;
+                           m_region.calculateLocalCoordinates(queryPoint, &param);
+                           SampledSpectrum extCoeff = base_sigma_e * calcDensity(param);
+                           SampledSpectrum nullCoeff = SampledSpectrum(majorant) - extCoeff;
+                           float realWeight = (weight * extCoeff).avgValue();
+                           float nullWeight = (weight * nullCoeff).avgValue();
+                           if (realWeight + nullWeight <= 0.0f) {
+                               weight = SampledSpectrum::Zero;
+                               return false;
+                           }
+                           float probRealCollision = realWeight / (realWeight + nullWeight);
+                           if (sampler.getSample() < probRealCollision) {
+                               *mi = MediumInteraction(ray.time, dist, queryPoint, normalize(ray.dir), param.x, param.y, param.z);
+                               hit = true;
+                               weight /= majorant * probRealCollision;
+                               return false;
+                           }
+                           weight *= nullCoeff / (majorant * (1 - probRealCollision));
+                           return true;
+                       });
+        *medThroughput = weight;
         
         return hit;
     }
@@ -421,27 +770,69 @@ namespace SLR {
         
         SampledSpectrum base_sigma_e = m_base_sigma_e->evaluate(wls);
         
-        // estimate transmittance by ratio tracking.
+        // JP: 密度の下限MinimumDensityを制御密度とするresidual ratio tracking。残差のmajorantを全波長で共有する。
+        // EN: residual ratio tracking with the lower bound of density MinimumDensity as the control density. The residual majorant is shared by all the wavelengths.
         *singleWavelength = false;
-        SampledSpectrum transmittance = SampledSpectrum::One;
-        
-        float majorantSelected = majorantExtinctionCoefficientAtWavelength(wls.selectedWavelength());
-        FloatSum sampledDistance = segment.distMin;
-        sampledDistance += -std::log(sampler.getSample()) / majorantSelected;
-        while (sampledDistance < segment.distMax) {
-            Point3D queryPoint = ray.org + sampledDistance * ray.dir;
-            Point3D param;
-            m_region.calculateLocalCoordinates(queryPoint, &param);
-            float density = calcDensity(param);
-            SampledSpectrum extCoeff = base_sigma_e * density;
-            float probRealCollision = extCoeff[wls.selectedLambdaIndex] / majorantSelected;
-            if (probRealCollision >= 1.0f) {
-                transmittance = SampledSpectrum::Zero;
-                break;
-            }
-            transmittance *= (1.0f - probRealCollision);
-            sampledDistance += -std::log(sampler.getSample()) / majorantSelected;
+        SampledSpectrum mask = SampledSpectrum::One;
+        if (wls.wavelengthSelected()) {
+            mask = SampledSpectrum::Zero;
+            mask[wls.selectedLambdaIndex] = 1.0f;
         }
+        float maxBase_sigma_e = (base_sigma_e * mask).maxValue();
+        
+        float tMin = segment.distMin;
+        float tMax = segment.distMax;
+        Point3D localOrg(ray.org - m_region.minP);
+        Vector3D regionExtent = m_region.maxP - m_region.minP;
+        const float extent[3] = {regionExtent.x, regionExtent.y, regionExtent.z};
+        float controlLength = clipByBox(localOrg, ray.dir, extent, &tMin, &tMax) ? (tMax - tMin) : 0.0f;
+        SampledSpectrum controlTransmittance = exp(-base_sigma_e * (MinimumDensity * controlLength));
+        
+        // JP: ratio trackingでは仮の衝突点で歩みが終わらないので、いくつかまとめてから消散係数を一括で評価し、
+        //     順に透過率の推定とロシアンルーレットを適用する。打ち切られた場合、まとめた残りの衝突点は使われない。
+        // EN: tentative collisions don't end the walk in ratio tracking, so gather several of them, evaluate their extinction coefficients at once,
+        //     then apply transmittance estimation and Russian roulette in order. Remaining gathered collisions are not used when terminated.
+        const uint32_t CollisionBatchSize = DensityBatchSize;
+        Point3D params[CollisionBatchSize];
+        float majorants[CollisionBatchSize];
+        uint32_t numCollisions = 0;
+        SampledSpectrum controlCoeff = base_sigma_e * MinimumDensity;
+        SampledSpectrum transmittance = mask;
+        const auto processCollisions = [&]() {
+            SampledSpectrum extCoeffs[CollisionBatchSize];
+            evaluateExtinctionCoefficients(params, numCollisions, wls, extCoeffs);
+            uint32_t numProcessed = numCollisions;
+            numCollisions = 0;
+            for (int i = 0; i < numProcessed; ++i) {
+                SampledSpectrum residualCoeff = extCoeffs[i] - controlCoeff;
+                transmittance *= SampledSpectrum::One - residualCoeff / majorants[i];
+                
+                const float RRThreshold = 0.1f;
+                float estimate = (transmittance * controlTransmittance).maxValue();
+                if (estimate < RRThreshold) {
+                    if (sampler.getSample() < estimate) {
+                        transmittance /= estimate;
+                    }
+                    else {
+                        transmittance = SampledSpectrum::Zero;
+                        return false;
+                    }
+                }
+            }
+            return true;
+        };
+        trackMajorants(ray, segment.distMin, segment.distMax, maxBase_sigma_e, MinimumDensity, sampler, 
+                       [&](float dist, float majorant) {
+                           Point3D queryPoint = ray.org + dist * ray.dir;
+                           m_region.calculateLocalCoordinates(queryPoint, &params[numCollisions]);
+                           majorants[numCollisions] = majorant;
+                           if (++numCollisions < CollisionBatchSize)
+                               return true;
+                           return processCollisions();
+                       });
+        if (numCollisions > 0)
+            processCollisions();
+        transmittance *= controlTransmittance;
         SLRAssert(transmittance.allFinite() && !transmittance.hasNegative(), "Invalid transmittance value.");
         
         return transmittance;
@@ -459,6 +850,18 @@ namespace SLR {
         return density * m_base_sigma_e->evaluate(wls);
     }
     
+    void CloudMediumDistribution::evaluateExtinctionCoefficients(const Point3D* params, uint32_t numPoints, const WavelengthSamples &wls,
+                                                                 SampledSpectrum* values) const {
+        SampledSpectrum base_sigma_e = m_base_sigma_e->evaluate(wls);
+        float densities[DensityBatchSize];
+        for (int i = 0; i < numPoints; i += DensityBatchSize) {
+            uint32_t numInBatch = std::min(numPoints - i, DensityBatchSize);
+            calcDensities(params + i, numInBatch, densities);
+            for (int j = 0; j < numInBatch; ++j)
+                values[i + j] = densities[j] * base_sigma_e;
+        }
+    }
+    
     SampledSpectrum CloudMediumDistribution::evaluateAlbedo(const Point3D &param, const WavelengthSamples &wls) const {
         if (param.x < 0 || param.y < 0 || param.z < 0 ||
             param.x > 1 || param.y > 1 || param.z > 1)
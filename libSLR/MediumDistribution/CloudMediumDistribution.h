@@ -12,6 +12,8 @@
 #include "../declarations.h"
 #include "../Core/geometry.h"
 #include "../Core/distributions.h"
+#include "MajorantGrid.h"
+#include "SparseDensityGrid.h"
 
 namespace SLR {
     template <typename RealType>
@@ -25,12 +27,18 @@ namespace SLR {
         int32_t m_repeat;
         
     public:
+        static const uint32_t BatchWidth = WorleyNoise3DGeneratorTemplate<RealType>::BatchWidth;
+        
         LayeredWorleyNoiseGeneratorTemplate(uint32_t numOctaves, RealType initialFrequency, RealType initialVariation, 
                                             RealType frequencyMultiplier, RealType persistence, int32_t repeat) : 
         m_primaryNoiseGen(repeat), m_numOctaves(numOctaves), m_initialFrequency(initialFrequency), m_initialVariation(initialVariation),
         m_persistence(persistence), m_frequencyMultiplier(frequencyMultiplier) { } 
         
         RealType evaluate(const Point3DTemplate<RealType> &p) const;
+        
+        // JP: BatchWidth個の点をまとめて評価する。1点の評価ではオクターブを各レーンに割り当てる。
+        // EN: evaluate BatchWidth points at once. Evaluation of a single point assigns octaves to lanes.
+        void evaluateBatch(const Point3DTemplate<RealType> ps[BatchWidth], RealType values[BatchWidth]) const;
     };
     
     
@@ -41,6 +49,9 @@ namespace SLR {
         LayeredWorleyNoiseGeneratorTemplate<RealType> m_worleyGen;
         
     public:
+        static const uint32_t BatchWidth = MultiOctavePerlinNoise3DGeneratorTemplate<RealType>::BatchWidth;
+        static_assert(BatchWidth == LayeredWorleyNoiseGeneratorTemplate<RealType>::BatchWidth, "Batch widths of Perlin and Worley noise are assumed to be the same.");
+        
         PerlinWorleyNoiseGeneratorTemplate(uint32_t numOctaves, RealType initialFrequency, RealType initialAmplitude, RealType initialVariation, 
                                            RealType frequencyMultiplier, RealType persistence, int32_t repeat) :
         m_perlinGen(numOctaves, initialFrequency, initialAmplitude, true, frequencyMultiplier, persistence, repeat), 
@@ -54,6 +65,15 @@ namespace SLR {
             return remap<RealType>(m_perlinGen.evaluate(p), 1.0f * (1 - m_worleyGen.evaluate(p)), 1.0, 0.0, 1.0); // Nubis-like
         }
         
+        void evaluateBatch(const Point3DTemplate<RealType> ps[BatchWidth], RealType values[BatchWidth]) const {
+            RealType perlinValues[BatchWidth];
+            RealType worleyValues[BatchWidth];
+            m_perlinGen.evaluateBatch(ps, perlinValues);
+            m_worleyGen.evaluateBatch(ps, worleyValues);
+            for (int i = 0; i < BatchWidth; ++i)
+                values[i] = remap<RealType>(perlinValues[i], 1.0f * (1 - worleyValues[i]), 1.0, 0.0, 1.0);
+        }
+        
         RealType getSupValue() const {
 //            return 0.75f * m_perlinGen.getSupValue() + 0.25f;
             return m_perlinGen.getSupValue();
@@ -74,6 +94,8 @@ namespace SLR {
         LayeredWorleyNoiseGeneratorTemplate<float> m_baseShapeExtraGenerator;
         LayeredWorleyNoiseGeneratorTemplate<float> m_erosionGenerator;
         
+        static const uint32_t NoiseBatchWidth = PerlinWorleyNoiseGeneratorTemplate<float>::BatchWidth;
+        static const uint32_t DensityBatchSize = 8;
         static const float CloudBaseAltitude;
         static const float CloudTopAltitude;
         static const uint32_t WeatherNumX = 256;
@@ -84,6 +106,37 @@ namespace SLR {
         static const uint32_t HighResNumX = 32;
         static const uint32_t HighResNumY = 32;
         static const uint32_t HighResNumZ = 32;
+        static const uint32_t MajorantNumX = 128;
+        static const uint32_t MajorantNumY = 32;
+        static const uint32_t MajorantNumZ = 128;
+        static const float BakeTolerance;
+        
+        // JP: fmodで周期的に参照されるグリッドにおいて、座標範囲[u0, u1]の補間に関わる頂点のインデックス範囲(最大2つ)を求める。
+        // EN: calculate index ranges (at most two) of vertices involved in interpolation over the coordinate range [u0, u1]
+        //     for a grid periodically accessed via fmod.
+        static uint32_t calcWrappedIndexRanges(double u0, double u1, uint32_t num, uint32_t ranges[2][2]) {
+            // JP: 浮動小数点の誤差を考慮して1頂点分広げる。
+            // EN: widen by one vertex to account for floating point errors.
+            double margin = 1.0 / (num - 1);
+            u0 -= margin;
+            u1 += margin;
+            if (u1 - u0 >= 1.0) {
+                ranges[0][0] = 0;
+                ranges[0][1] = num - 1;
+                return 1;
+            }
+            double base = std::floor(u0);
+            u0 -= base;
+            u1 -= base;
+            ranges[0][0] = (uint32_t)(u0 * (num - 1));
+            ranges[0][1] = std::min((uint32_t)(std::min(u1, 1.0) * (num - 1)) + 1, num - 1);
+            if (u1 <= 1.0)
+                return 1;
+            ranges[1][0] = 0;
+            ranges[1][1] = std::min((uint32_t)((u1 - 1.0) * (num - 1)) + 1, num - 1);
+            return 2;
+        }
+        
 #if !defined(CLOUD_GENERATION)
         struct Float2DGrid {
             uint32_t numX, numZ;
@@ -140,10 +193,26 @@ namespace SLR {
                         wuz * (wlx * data[numX * uz + lx] + 
                                wux * data[numX * uz + ux])); 
             }
+            
+            // JP: 座標範囲内における補間値の上限。
+            // EN: upper bound of interpolated values in the coordinate range.
+            float maxValue(double x0, double x1, double z0, double z1) const {
+                uint32_t xRanges[2][2], zRanges[2][2];
+                uint32_t numXRanges = calcWrappedIndexRanges(x0, x1, numX, xRanges);
+                uint32_t numZRanges = calcWrappedIndexRanges(z0, z1, numZ, zRanges);
+                float ret = -INFINITY;
+                for (int rz = 0; rz < numZRanges; ++rz)
+                    for (uint32_t iz = zRanges[rz][0]; iz <= zRanges[rz][1]; ++iz)
+                        for (int rx = 0; rx < numXRanges; ++rx)
+                            for (uint32_t ix = xRanges[rx][0]; ix <= xRanges[rx][1]; ++ix)
+                                ret = std::max(ret, data[numX * iz + ix]);
+                return ret;
+            }
         };
         struct Float3DGrid {
             uint32_t numX, numY, numZ;
             float** data;
+            float maxData;
             
             Float3DGrid() : data(nullptr) { }
             ~Float3DGrid() {
@@ -173,10 +242,13 @@ namespace SLR {
                 fread(&numZ, sizeof(uint32_t), 1, fp);
                 
                 data = new float*[numZ];
+                maxData = -INFINITY;
                 for (int iz = 0; iz < numZ; ++iz) {
                     float* &ySlice = data[iz];
                     ySlice = new float[numX * numY];
                     fread(ySlice, sizeof(float), numX * numY, fp);
+                    for (int i = 0; i < numX * numY; ++i)
+                        maxData = std::max(maxData, ySlice[i]);
                 }
                 
                 fclose(fp);
@@ -215,6 +287,35 @@ namespace SLR {
                                wuy * (wlx * data[uz][numX * uy + lx] + 
                                       wux * data[uz][numX * uy + ux]))); 
             }
+            
+            // JP: 座標範囲内における補間値の上限。範囲が広い場合はグリッド全体の最大値を返す。
+            // EN: upper bound of interpolated values in the coordinate range. This returns the maximum of the whole grid when the range is large.
+            float maxValue(const double lo[3], const double hi[3]) const {
+                const uint32_t MaxNumLookups = 4096;
+                uint32_t ranges[3][2][2];
+                uint32_t numRanges[3];
+                const uint32_t num[3] = {numX, numY, numZ};
+                uint32_t numLookups = 1;
+                for (int i = 0; i < 3; ++i) {
+                    numRanges[i] = calcWrappedIndexRanges(lo[i], hi[i], num[i], ranges[i]);
+                    uint32_t numIndices = 0;
+                    for (int r = 0; r < numRanges[i]; ++r)
+                        numIndices += ranges[i][r][1] - ranges[i][r][0] + 1;
+                    numLookups *= numIndices;
+                }
+                if (numLookups > MaxNumLookups)
+                    return maxData;
+                
+                float ret = -INFINITY;
+                for (int rz = 0; rz < numRanges[2]; ++rz)
+                    for (uint32_t iz = ranges[2][rz][0]; iz <= ranges[2][rz][1]; ++iz)
+                        for (int ry = 0; ry < numRanges[1]; ++ry)
+                            for (uint32_t iy = ranges[1][ry][0]; iy <= ranges[1][ry][1]; ++iy)
+                                for (int rx = 0; rx < numRanges[0]; ++rx)
+                                    for (uint32_t ix = ranges[0][rx][0]; ix <= ranges[0][rx][1]; ++ix)
+                                        ret = std::max(ret, data[iz][numX * iy + ix]);
+                return ret;
+            }
         };
         
         float m_maxDensity;
@@ -223,6 +324,10 @@ namespace SLR {
         Float3DGrid m_baseShape;
         Float3DGrid m_erosion;
 #endif
+        MajorantGrid* m_majorantGrid;
+        Vector3D m_worldToMajorantCell;
+        const SparseDensityGrid* m_bakedDensity;
+        Vector3D m_worldToBakedVoxel;
         
         void exportBMPs() const;
         void saveToFile(const std::string &name) const;
@@ -230,16 +335,28 @@ namespace SLR {
         float calcCloudType(const Point3D &param) const;
         float calcBaseShape(const Point3D &param) const;
         float calcErosion(const Point3D &param) const;
+        void calcBaseShapes(const Point3D params[NoiseBatchWidth], float values[NoiseBatchWidth]) const;
+        void calcErosions(const Point3D params[NoiseBatchWidth], float values[NoiseBatchWidth]) const;
         float calcHeightGradient(float cloudType, float h) const;
         float calcDensity(const Point3D &param) const;
+        void calcDensities(const Point3D* params, uint32_t numPoints, float* densities) const;
+        float calcDensityBound(const Point3D &paramMin, const Point3D &paramMax) const;
+        void setupMajorantGrid(const std::string &cacheFileName);
+        void setupBakedDensity(const std::string &cacheFileName, uint32_t resolution);
+        float trackMajorants(const Ray &ray, float tMin, float tMax, float base_sigma_e, float controlDensity, FreePathSampler &sampler,
+                             const std::function<bool(float, float)> &onCollision) const;
     public:
-        CloudMediumDistribution(const BoundingBox3D &region, float featureScale, float density, uint32_t rngSeed) : 
+        // JP: bakeResolutionが0でない場合は各軸にその数のボクセルを持つ疎なグリッドに密度を焼き込み、描画時は3線形補間で参照する。
+        // EN: when bakeResolution is not 0, the density is baked into a sparse grid with that number of voxels along each axis,
+        //     and it is looked up with trilinear interpolation at render time.
+        CloudMediumDistribution(const BoundingBox3D &region, float featureScale, float density, uint32_t rngSeed, uint32_t bakeResolution = 0) : 
         m_region(Point3D(region.minP.x, 0 * featureScale, region.minP.z), Point3D(region.maxP.x, 5000 * featureScale, region.maxP.z)),
         m_featureScale(featureScale), 
         m_coverageGenerator(5, 10.0f, 1.0f, true, 2.0f, 0.5f, 1), 
         m_baseShapeGenerator(3, 8.0f, 1.0f, 1.0f, 2.0f, 0.5f, 1),
         m_baseShapeExtraGenerator(5, 8.0f, 1.0f, 2.0f, 0.5f, 1),
-        m_erosionGenerator(3, 4.0f, 1.0f, 2.0f, 0.5f, 1) {
+        m_erosionGenerator(3, 4.0f, 1.0f, 2.0f, 0.5f, 1), 
+        m_majorantGrid(nullptr), m_bakedDensity(nullptr) {
             float sigma_e_values[] = {0.1f * density, 0.1f * density};
             m_base_sigma_e = new RegularContinuousSpectrum(WavelengthLowBound, WavelengthHighBound, sigma_e_values, 2);
             float albedo_values[] = {0.999f, 0.999f};
@@ -275,9 +392,22 @@ namespace SLR {
             m_base_sigma_e->calcBounds(NumStrataForStorage, m_majorantExtinctionCoefficient.data());
             for (int i = 0; i < NumStrataForStorage; ++i)
                 m_majorantExtinctionCoefficient[i] *= m_maxDensity;
+            
+            if (bakeResolution > 0) {
+                char cacheFileName[256];
+                sprintf(cacheFileName, "cloud_density_%u", bakeResolution);
+                setupBakedDensity(cacheFileName, bakeResolution);
+            }
+            else {
+                setupMajorantGrid("cloud_majorant");
+            }
 #endif
         }
         ~CloudMediumDistribution() {
+            if (m_bakedDensity)
+                delete m_bakedDensity;
+            if (m_majorantGrid)
+                delete m_majorantGrid;
             delete m_albedo;
             delete m_base_sigma_e;
         }
@@ -301,6 +431,7 @@ namespace SLR {
                                               bool* singleWavelength) const override;
         void calculateMediumPoint(const MediumInteraction &mi, MediumPoint* medPt) const override;
         SampledSpectrum evaluateExtinctionCoefficient(const Point3D &param, const WavelengthSamples &wls) const override;
+        void evaluateExtinctionCoefficients(const Point3D* params, uint32_t numPoints, const WavelengthSamples &wls, SampledSpectrum* values) const override;
         SampledSpectrum evaluateAlbedo(const Point3D &param, const WavelengthSamples &wls) const override;
         float volume() const override { return m_region.volume(); }
         void sample(float u0, float u1, float u2, MediumPoint* medPt, float* volumePDF) const override;
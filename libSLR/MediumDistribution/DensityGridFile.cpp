@@ -0,0 +1,116 @@
+//
+//  DensityGridFile.cpp
+//
+//  Created by 渡部 心 on 2017/06/23.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#include "DensityGridFile.h"
+
+#include "DensityGridMediumDistribution.h"
+
+namespace SLR {
+    const char DensityGridFile::Magic[4] = {'S', 'L', 'R', 'G'};
+    
+    bool DensityGridFile::isDensityGridFile(const std::string &filePath) {
+        FILE* fp = fopen(filePath.c_str(), "rb");
+        if (!fp)
+            return false;
+        char magic[4];
+        bool ret = fread(magic, 1, sizeof(magic), fp) == sizeof(magic) && std::equal(magic, magic + 4, Magic);
+        fclose(fp);
+        return ret;
+    }
+    
+    bool DensityGridFile::write(const std::string &filePath, const std::vector<std::vector<float>> &density_grid, uint32_t numX, uint32_t numY, uint32_t numZ) {
+        SLRAssert(density_grid.size() == numZ, "The number of z-slices does not match.");
+        
+        DensityGridFileHeader header;
+        std::copy(Magic, Magic + 4, header.magic);
+        header.version = Version;
+        header.headerSize = sizeof(DensityGridFileHeader);
+        header.numX = numX;
+        header.numY = numY;
+        header.numZ = numZ;
+        header.reserved = 0;
+        
+        header.minDensity = INFINITY;
+        header.maxDensity = -INFINITY;
+        std::vector<const float*> slices(numZ);
+        for (int z = 0; z < numZ; ++z) {
+            SLRAssert(density_grid[z].size() == numX * numY, "The number of elements of a z-slice does not match.");
+            slices[z] = density_grid[z].data();
+            for (int i = 0; i < numX * numY; ++i) {
+                header.minDensity = std::min(header.minDensity, slices[z][i]);
+                header.maxDensity = std::max(header.maxDensity, slices[z][i]);
+            }
+        }
+        
+        uint32_t svNum[3];
+        float* superVoxels;
+        float* maximumDifferences;
+        DensityGridMediumDistribution::calcSuperVoxels(slices.data(), numX, numY, numZ, 0.0f, svNum, &superVoxels, &maximumDifferences);
+        header.svNumX = svNum[0];
+        header.svNumY = svNum[1];
+        header.svNumZ = svNum[2];
+        const uint64_t numSuperVoxels = (uint64_t)svNum[0] * (uint64_t)svNum[1] * (uint64_t)svNum[2];
+        const uint64_t LengthOfCompensationCells = (uint64_t)(svNum[0] - 1) * (uint64_t)(svNum[1] - 1) * (uint64_t)(svNum[2] - 1);
+        float* cellMinDensities;
+        float* cellMaxDensities;
+        DensityGridMediumDistribution::calcSuperVoxelCellBounds(slices.data(), numX, numY, numZ, svNum, &cellMinDensities, &cellMaxDensities);
+        
+        header.superVoxelsOffset = sizeof(DensityGridFileHeader);
+        header.maximumDifferencesOffset = header.superVoxelsOffset + sizeof(float) * numSuperVoxels;
+        header.cellMinDensitiesOffset = header.maximumDifferencesOffset + sizeof(float) * LengthOfCompensationCells;
+        header.cellMaxDensitiesOffset = header.cellMinDensitiesOffset + sizeof(float) * LengthOfCompensationCells;
+        uint64_t endOfMajorants = header.cellMaxDensitiesOffset + sizeof(float) * LengthOfCompensationCells;
+        header.densityOffset = (endOfMajorants + DensityAlignment - 1) / DensityAlignment * DensityAlignment;
+        
+        bool success = false;
+        FILE* fp = fopen(filePath.c_str(), "wb");
+        if (fp) {
+            success = fwrite(&header, sizeof(header), 1, fp) == 1;
+            success &= fwrite(superVoxels, sizeof(float), numSuperVoxels, fp) == numSuperVoxels;
+            success &= fwrite(maximumDifferences, sizeof(float), LengthOfCompensationCells, fp) == LengthOfCompensationCells;
+            success &= fwrite(cellMinDensities, sizeof(float), LengthOfCompensationCells, fp) == LengthOfCompensationCells;
+            success &= fwrite(cellMaxDensities, sizeof(float), LengthOfCompensationCells, fp) == LengthOfCompensationCells;
+            std::vector<uint8_t> padding(header.densityOffset - endOfMajorants, 0);
+            success &= fwrite(padding.data(), 1, padding.size(), fp) == padding.size();
+            for (int z = 0; z < numZ; ++z)
+                success &= fwrite(slices[z], sizeof(float), (size_t)numX * numY, fp) == (size_t)numX * numY;
+            fclose(fp);
+        }
+        
+        delete[] cellMaxDensities;
+        delete[] cellMinDensities;
+        delete[] maximumDifferences;
+        delete[] superVoxels;
+        
+        return success;
+    }
+    
+    DensityGridFile::DensityGridFile(const std::string &filePath) : m_file(filePath), m_header(nullptr) {
+        if (!m_file.isValid() || m_file.size() < sizeof(DensityGridFileHeader))
+            return;
+        
+        const DensityGridFileHeader* header = at<DensityGridFileHeader>(0);
+        if (!std::equal(Magic, Magic + 4, header->magic) || header->version != Version || header->headerSize != sizeof(DensityGridFileHeader))
+            return;
+        
+        // JP: 各領域がファイルに収まっていることを確認する。
+        // EN: make sure that each region fits in the file.
+        const uint64_t numSuperVoxels = (uint64_t)header->svNumX * (uint64_t)header->svNumY * (uint64_t)header->svNumZ;
+        const uint64_t LengthOfCompensationCells = (uint64_t)(header->svNumX - 1) * (uint64_t)(header->svNumY - 1) * (uint64_t)(header->svNumZ - 1);
+        const uint64_t numVoxels = (uint64_t)header->numX * header->numY * header->numZ;
+        if (header->numX < 2 || header->numY < 2 || header->numZ < 2 ||
+            header->svNumX < 2 || header->svNumY < 2 || header->svNumZ < 2 ||
+            header->superVoxelsOffset + sizeof(float) * numSuperVoxels > m_file.size() ||
+            header->maximumDifferencesOffset + sizeof(float) * LengthOfCompensationCells > m_file.size() ||
+            header->cellMinDensitiesOffset + sizeof(float) * LengthOfCompensationCells > m_file.size() ||
+            header->cellMaxDensitiesOffset + sizeof(float) * LengthOfCompensationCells > m_file.size() ||
+            header->densityOffset + sizeof(float) * numVoxels > m_file.size())
+            return;
+        
+        m_header = header;
+    }
+}
@@ -0,0 +1,78 @@
+//
+//  DensityGridFile.h
+//
+//  Created by 渡部 心 on 2017/06/23.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#ifndef __SLR_DensityGridFile__
+#define __SLR_DensityGridFile__
+
+#include "../defines.h"
+#include "../declarations.h"
+#include "../Helper/MappedFile.h"
+
+namespace SLR {
+    // JP: 密度グリッドファイルのヘッダー。値はリトルエンディアンで格納される。
+    //     密度はページ境界に揃えたz-sliceの並び(各sliceはnumX * numYのfloat)で、マップした領域をそのまま参照できる。
+    // EN: header of a density grid file. Values are stored in little endian.
+    //     Densities are a sequence of z-slices (each slice is numX * numY floats) aligned to a page boundary,
+    //     so the mapped region can be referred to as is.
+    struct DensityGridFileHeader {
+        char magic[4];
+        uint32_t version;
+        uint32_t headerSize;
+        uint32_t numX, numY, numZ;
+        float minDensity, maxDensity;
+        uint32_t svNumX, svNumY, svNumZ;
+        uint32_t reserved;
+        uint64_t superVoxelsOffset;
+        uint64_t maximumDifferencesOffset;
+        uint64_t cellMinDensitiesOffset;
+        uint64_t cellMaxDensitiesOffset;
+        uint64_t densityOffset;
+    };
+    
+    
+    
+    // JP: メモリーマップで読み込む版付きの密度グリッドファイル。
+    //     最大・最小の密度、スーパーボクセルのmajorantとセルごとの密度の範囲を事前計算して格納しておき、読み込み時の走査を不要にする。
+    // EN: versioned density grid file loaded by memory mapping.
+    //     The maximum and minimum densities, super voxel majorants and density ranges per cell are precomputed and stored to eliminate scans at loading.
+    class SLR_API DensityGridFile {
+        MappedFile m_file;
+        const DensityGridFileHeader* m_header;
+        
+        template <typename T>
+        const T* at(uint64_t offset) const {
+            return (const T*)(m_file.data() + offset);
+        }
+    public:
+        static const char Magic[4];
+        static const uint32_t Version = 2;
+        static const uint32_t DensityAlignment = 4096;
+        
+        static bool isDensityGridFile(const std::string &filePath);
+        static bool write(const std::string &filePath, const std::vector<std::vector<float>> &density_grid, uint32_t numX, uint32_t numY, uint32_t numZ);
+        
+        DensityGridFile(const std::string &filePath);
+        
+        bool isValid() const { return m_header != nullptr; }
+        uint32_t numX() const { return m_header->numX; }
+        uint32_t numY() const { return m_header->numY; }
+        uint32_t numZ() const { return m_header->numZ; }
+        float minDensity() const { return m_header->minDensity; }
+        float maxDensity() const { return m_header->maxDensity; }
+        const float* slice(uint32_t z) const {
+            return at<float>(m_header->densityOffset) + (size_t)m_header->numX * m_header->numY * z;
+        }
+        
+        uint32_t numSuperVoxels(int axis) const { return (&m_header->svNumX)[axis]; }
+        const float* superVoxels() const { return at<float>(m_header->superVoxelsOffset); }
+        const float* maximumDifferences() const { return at<float>(m_header->maximumDifferencesOffset); }
+        const float* superVoxelCellMinDensities() const { return at<float>(m_header->cellMinDensitiesOffset); }
+        const float* superVoxelCellMaxDensities() const { return at<float>(m_header->cellMaxDensitiesOffset); }
+    };
+}
+
+#endif /* __SLR_DensityGridFile__ */
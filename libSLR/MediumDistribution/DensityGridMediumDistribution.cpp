@@ -8,152 +8,312 @@
 #include "DensityGridMediumDistribution.h"
 
 #include "../Core/light_path_sampler.h"
+#include "DensityGridFile.h"
+#include "MajorantGrid.h"
+#include "../Helper/ThreadPool.h"
 
 #define UseSuperVoxels
 #define UseRatioTracking
+#define UseSpectralTracking
+#define UseResidualRatioTracking
 
 namespace SLR {
-    float DensityGridMediumDistribution::calcDensityInSuperVoxels(const Point3D &param) const {
+    DensityGridMediumDistribution::DensityGridMediumDistribution(const BoundingBox3D &region, const AssetSpectrum* base_sigma_s, const AssetSpectrum* base_sigma_e, 
+                                                                 const DensityGridFile* file) :
+    m_region(region), m_base_sigma_s(base_sigma_s), m_base_sigma_e(base_sigma_e), 
+    m_numX(file->numX()), m_numY(file->numY()), m_numZ(file->numZ()) {
+        // JP: 密度はマップされたファイルを直接参照し、最大値、スーパーボクセルとそのセルの密度の範囲はファイルに格納された値を使う。
+        //     読み込み時にボクセルのデータには触れない。
+        // EN: densities directly refer to the mapped file, and the maximum value, super voxels and density ranges of their cells are taken from values stored in the file.
+        //     Voxel data are not touched at loading.
+        m_density_grid = new const float*[m_numZ];
+        for (int z = 0; z < m_numZ; ++z)
+            m_density_grid[z] = file->slice(z);
+        
+        m_maxDensity = file->maxDensity();
+        m_base_sigma_e->calcBounds(NumStrataForStorage, m_majorantExtinctionCoefficient.data());
+        for (int i = 0; i < NumStrataForStorage; ++i)
+            m_majorantExtinctionCoefficient[i] *= m_maxDensity;
+        
+        m_svNumX = file->numSuperVoxels(0);
+        m_svNumY = file->numSuperVoxels(1);
+        m_svNumZ = file->numSuperVoxels(2);
+        const uint64_t numSuperVoxels = (uint64_t)m_svNumX * (uint64_t)m_svNumY * (uint64_t)m_svNumZ;
+        const uint64_t LengthOfCompensationCells = (uint64_t)(m_svNumX - 1) * (uint64_t)(m_svNumY - 1) * (uint64_t)(m_svNumZ - 1);
+        m_superVoxels = new float[numSuperVoxels];
+        m_maximumDifferences = new float[LengthOfCompensationCells];
+        std::copy(file->superVoxels(), file->superVoxels() + numSuperVoxels, m_superVoxels);
+        std::copy(file->maximumDifferences(), file->maximumDifferences() + LengthOfCompensationCells, m_maximumDifferences);
+        m_superVoxelWidth = (m_region.maxP - m_region.minP) / Vector3D(m_svNumX - 1, m_svNumY - 1, m_svNumZ - 1);
+        m_svCellMinDensities = new float[LengthOfCompensationCells];
+        m_svCellMaxDensities = new float[LengthOfCompensationCells];
+        std::copy(file->superVoxelCellMinDensities(), file->superVoxelCellMinDensities() + LengthOfCompensationCells, m_svCellMinDensities);
+        std::copy(file->superVoxelCellMaxDensities(), file->superVoxelCellMaxDensities() + LengthOfCompensationCells, m_svCellMaxDensities);
+    }
+    
+    float DensityGridMediumDistribution::calcDensityInSuperVoxels(const float* superVoxels, const float* maximumDifferences, uint32_t svNumX, uint32_t svNumY, uint32_t svNumZ, 
+                                                                  const Point3D &param) {
         if (param.x < 0 || param.y < 0 || param.z < 0 ||
             param.x > 1 || param.y > 1 || param.z > 1)
             return 0.0f;
         
-        uint32_t lx = std::min((uint32_t)(param.x * (m_svNumX - 1)), m_svNumX - 1);
-        uint32_t ux = std::min(lx + 1, m_svNumX - 1);
-        uint32_t ly = std::min((uint32_t)(param.y * (m_svNumY - 1)), m_svNumY - 1);
-        uint32_t uy = std::min(ly + 1, m_svNumY - 1);
-        uint32_t lz = std::min((uint32_t)(param.z * (m_svNumZ - 1)), m_svNumZ - 1);
-        uint32_t uz = std::min(lz + 1, m_svNumZ - 1);
-        float wux = param.x * (m_svNumX - 1) - lx;
+        uint32_t lx = std::min((uint32_t)(param.x * (svNumX - 1)), svNumX - 1);
+        uint32_t ux = std::min(lx + 1, svNumX - 1);
+        uint32_t ly = std::min((uint32_t)(param.y * (svNumY - 1)), svNumY - 1);
+        uint32_t uy = std::min(ly + 1, svNumY - 1);
+        uint32_t lz = std::min((uint32_t)(param.z * (svNumZ - 1)), svNumZ - 1);
+        uint32_t uz = std::min(lz + 1, svNumZ - 1);
+        float wux = param.x * (svNumX - 1) - lx;
         float wlx = 1 - wux;
-        float wuy = param.y * (m_svNumY - 1) - ly;
+        float wuy = param.y * (svNumY - 1) - ly;
         float wly = 1 - wuy;
-        float wuz = param.z * (m_svNumZ - 1) - lz;
+        float wuz = param.z * (svNumZ - 1) - lz;
         float wlz = 1 - wuz;
-        float density = (m_superVoxels[m_svNumX * m_svNumY * lz + m_svNumX * ly + lx] * wlz * wly * wlx +
-                         m_superVoxels[m_svNumX * m_svNumY * lz + m_svNumX * ly + ux] * wlz * wly * wux +
-                         m_superVoxels[m_svNumX * m_svNumY * lz + m_svNumX * uy + lx] * wlz * wuy * wlx +
-                         m_superVoxels[m_svNumX * m_svNumY * lz + m_svNumX * uy + ux] * wlz * wuy * wux +
-                         m_superVoxels[m_svNumX * m_svNumY * uz + m_svNumX * ly + lx] * wuz * wly * wlx +
-                         m_superVoxels[m_svNumX * m_svNumY * uz + m_svNumX * ly + ux] * wuz * wly * wux +
-                         m_superVoxels[m_svNumX * m_svNumY * uz + m_svNumX * uy + lx] * wuz * wuy * wlx +
-                         m_superVoxels[m_svNumX * m_svNumY * uz + m_svNumX * uy + ux] * wuz * wuy * wux);
-        uint32_t diffCellIdx = (m_svNumX - 1) * (m_svNumY - 1) * std::min(lz, m_svNumZ - 2) + (m_svNumX - 1) * std::min(ly, m_svNumY - 2) + std::min(lx, m_svNumX - 2);
-        return density + m_maximumDifferences[diffCellIdx];
+        float density = (superVoxels[svNumX * svNumY * lz + svNumX * ly + lx] * wlz * wly * wlx +
+                         superVoxels[svNumX * svNumY * lz + svNumX * ly + ux] * wlz * wly * wux +
+                         superVoxels[svNumX * svNumY * lz + svNumX * uy + lx] * wlz * wuy * wlx +
+                         superVoxels[svNumX * svNumY * lz + svNumX * uy + ux] * wlz * wuy * wux +
+                         superVoxels[svNumX * svNumY * uz + svNumX * ly + lx] * wuz * wly * wlx +
+                         superVoxels[svNumX * svNumY * uz + svNumX * ly + ux] * wuz * wly * wux +
+                         superVoxels[svNumX * svNumY * uz + svNumX * uy + lx] * wuz * wuy * wlx +
+                         superVoxels[svNumX * svNumY * uz + svNumX * uy + ux] * wuz * wuy * wux);
+        uint32_t diffCellIdx = (svNumX - 1) * (svNumY - 1) * std::min(lz, svNumZ - 2) + (svNumX - 1) * std::min(ly, svNumY - 2) + std::min(lx, svNumX - 2);
+        return density + maximumDifferences[diffCellIdx];
     };
     
     void DensityGridMediumDistribution::setupSuperVoxels() {
-        m_svNumX = std::max(m_numX / 16, 4u);
-        m_svNumY = std::max(m_numY / 16, 4u);
-        m_svNumZ = std::max(m_numZ / 16, 4u);
+        float maxBase_sigma_e = 0.0f;
+        if (m_maxDensity > 0) {
+            for (int i = 0; i < NumStrataForStorage; ++i)
+                maxBase_sigma_e = std::max(maxBase_sigma_e, m_majorantExtinctionCoefficient[i] / m_maxDensity);
+        }
+        Vector3D extent = m_region.maxP - m_region.minP;
+        float voxelWidth = (extent.x / (m_numX - 1) + extent.y / (m_numY - 1) + extent.z / (m_numZ - 1)) / 3;
         
-        m_superVoxels = new float[m_svNumX * m_svNumY * m_svNumZ];
-        const uint32_t LengthOfCompensationCells = (m_svNumX - 1) * (m_svNumY - 1) * (m_svNumZ - 1);
-        m_maximumDifferences = new float[LengthOfCompensationCells];
-        float* maximumDifferences = new float[LengthOfCompensationCells];
-        std::fill(m_maximumDifferences, m_maximumDifferences + LengthOfCompensationCells, 0.0f);
-        std::fill(maximumDifferences, maximumDifferences + LengthOfCompensationCells, 0.0f);
+        uint32_t svNum[3];
+        calcSuperVoxels(m_density_grid, m_numX, m_numY, m_numZ, maxBase_sigma_e * voxelWidth, svNum, &m_superVoxels, &m_maximumDifferences);
+        m_svNumX = svNum[0];
+        m_svNumY = svNum[1];
+        m_svNumZ = svNum[2];
         m_superVoxelWidth = (m_region.maxP - m_region.minP) / Vector3D(m_svNumX - 1, m_svNumY - 1, m_svNumZ - 1);
+        calcSuperVoxelCellBounds(m_density_grid, m_numX, m_numY, m_numZ, svNum, &m_svCellMinDensities, &m_svCellMaxDensities);
+    }
+    
+    // JP: 各スーパーボクセルのセルが覆うボクセルの最小・最大の密度を求める。3線形補間値はこの範囲に収まる。
+    //     最小値はresidual ratio trackingの制御密度、最大値はspectral trackingのmajorantに使われる。
+    // EN: calculate the minimum and maximum densities of voxels covered by each super voxel cell. Trilinearly interpolated values fall in this range.
+    //     The minimum is used as the control density for residual ratio tracking, and the maximum is used as the majorant for spectral tracking.
+    void DensityGridMediumDistribution::calcSuperVoxelCellBounds(const float* const* density_grid, uint32_t numX, uint32_t numY, uint32_t numZ, const uint32_t svNum[3], 
+                                                                 float** minDensities, float** maxDensities) {
+        const uint32_t svNumX = svNum[0], svNumY = svNum[1], svNumZ = svNum[2];
+        const uint32_t numCells = (svNumX - 1) * (svNumY - 1) * (svNumZ - 1);
+        float* cellMinDensities = *minDensities = new float[numCells];
+        float* cellMaxDensities = *maxDensities = new float[numCells];
+        
+        ThreadPool threadPool;
+        for (int svCellZ = 0; svCellZ < svNumZ - 1; ++svCellZ) {
+            threadPool.enqueue([=](uint32_t threadID) {
+                uint32_t liz = (uint32_t)std::floor((float)svCellZ / (svNumZ - 1) * (numZ - 1));
+                uint32_t uiz = std::min((uint32_t)std::ceil((float)(svCellZ + 1) / (svNumZ - 1) * (numZ - 1)), numZ - 1);
+                for (int svCellY = 0; svCellY < svNumY - 1; ++svCellY) {
+                    uint32_t liy = (uint32_t)std::floor((float)svCellY / (svNumY - 1) * (numY - 1));
+                    uint32_t uiy = std::min((uint32_t)std::ceil((float)(svCellY + 1) / (svNumY - 1) * (numY - 1)), numY - 1);
+                    for (int svCellX = 0; svCellX < svNumX - 1; ++svCellX) {
+                        uint32_t lix = (uint32_t)std::floor((float)svCellX / (svNumX - 1) * (numX - 1));
+                        uint32_t uix = std::min((uint32_t)std::ceil((float)(svCellX + 1) / (svNumX - 1) * (numX - 1)), numX - 1);
+                        
+                        float minDensity = INFINITY;
+                        float maxDensity = -INFINITY;
+                        for (uint32_t iz = liz; iz <= uiz; ++iz) {
+                            for (uint32_t iy = liy; iy <= uiy; ++iy) {
+                                for (uint32_t ix = lix; ix <= uix; ++ix) {
+                                    float density = density_grid[iz][numX * iy + ix];
+                                    minDensity = std::min(minDensity, density);
+                                    maxDensity = std::max(maxDensity, density);
+                                }
+                            }
+                        }
+                        uint32_t svCellIndex = (svNumX - 1) * (svNumY - 1) * svCellZ + (svNumX - 1) * svCellY + svCellX;
+                        cellMinDensities[svCellIndex] = minDensity;
+                        cellMaxDensities[svCellIndex] = maxDensity;
+                    }
+                }
+            });
+        }
+        threadPool.wait();
+    }
+    
+    // JP: レイに沿ってスーパーボクセルのセルを順に列挙する。func(セルのインデックス, t0, t1)がfalseを返すと走査を打ち切る。
+    // EN: enumerate super voxel cells in order along a ray. The traversal is aborted when func(cell index, t0, t1) returns false.
+    template <typename Func>
+    void DensityGridMediumDistribution::traverseSuperVoxelCells(const Ray &ray, float tMin, float tMax, Func func) const {
+        Point3D org((ray.org - m_region.minP) / m_superVoxelWidth);
+        Vector3D dir = ray.dir / m_superVoxelWidth;
+        const float extent[3] = {(float)(m_svNumX - 1), (float)(m_svNumY - 1), (float)(m_svNumZ - 1)};
+        if (!clipByBox(org, dir, extent, &tMin, &tMax))
+            return;
+        
+        const int32_t lo[3] = {0, 0, 0};
+        const int32_t hi[3] = {(int32_t)m_svNumX - 2, (int32_t)m_svNumY - 2, (int32_t)m_svNumZ - 2};
+        traverseUniformGrid(org, dir, 1.0f, lo, hi, tMin, tMax, [&](const int32_t idx[3], float t0, float t1) {
+            return func((m_svNumX - 1) * (m_svNumY - 1) * idx[2] + (m_svNumX - 1) * idx[1] + idx[0], t0, t1);
+        });
+    }
+    
+    void DensityGridMediumDistribution::calcSuperVoxels(const float* const* density_grid, uint32_t numX, uint32_t numY, uint32_t numZ, float collisionsPerVoxel, 
+                                                        uint32_t svNum[3], float** superVoxels, float** maximumDifferences) {
+        const uint32_t num[3] = {numX, numY, numZ};
+        if (collisionsPerVoxel > 0) {
+            // JP: 4^3ボクセルを最小のセルとするmajorantグリッドを作り、コストモデルが選んだレベルのセル幅をスーパーボクセルの幅とする。
+            //     スーパーボクセルの走査は密度の評価に比べて安いので相対コストを1:2とする。
+            // EN: make a majorant grid whose finest cell is 4^3 voxels, and use the cell width of the level selected by the cost model as the super voxel width.
+            //     Traversing a super voxel is cheaper than evaluating a density, so the relative cost is set to 1:2.
+            const uint32_t FinestCellWidth = 4;
+            uint32_t numCells[3];
+            float extent[3];
+            for (int i = 0; i < 3; ++i) {
+                numCells[i] = (num[i] - 1 + FinestCellWidth - 1) / FinestCellWidth;
+                extent[i] = (float)(num[i] - 1) / FinestCellWidth;
+            }
+            MajorantGrid majorantGrid(numCells[0], numCells[1], numCells[2], extent, [&](uint32_t cx, uint32_t cy, uint32_t cz) {
+                float maxValue = 0.0f;
+                for (uint32_t z = cz * FinestCellWidth; z <= std::min((cz + 1) * FinestCellWidth, numZ - 1); ++z)
+                    for (uint32_t y = cy * FinestCellWidth; y <= std::min((cy + 1) * FinestCellWidth, numY - 1); ++y)
+                        for (uint32_t x = cx * FinestCellWidth; x <= std::min((cx + 1) * FinestCellWidth, numX - 1); ++x)
+                            maxValue = std::max(maxValue, density_grid[z][numX * y + x]);
+                return maxValue;
+            });
+            uint32_t level = majorantGrid.selectLevel(collisionsPerVoxel * FinestCellWidth, 1.0f, 2.0f);
+            uint32_t svWidth = FinestCellWidth << level;
+            for (int i = 0; i < 3; ++i)
+                svNum[i] = std::max((num[i] - 1 + svWidth - 1) / svWidth + 1, 4u);
+        }
+        else {
+            for (int i = 0; i < 3; ++i)
+                svNum[i] = std::max(num[i] / 16, 4u);
+        }
+        const uint32_t svNumX = svNum[0];
+        const uint32_t svNumY = svNum[1];
+        const uint32_t svNumZ = svNum[2];
+        
+        float* svValues = *superVoxels = new float[svNumX * svNumY * svNumZ];
+        const uint32_t LengthOfCompensationCells = (svNumX - 1) * (svNumY - 1) * (svNumZ - 1);
+        float* svMaximumDifferences = *maximumDifferences = new float[LengthOfCompensationCells];
+        float* tempMaximumDifferences = new float[LengthOfCompensationCells];
+        std::fill(svMaximumDifferences, svMaximumDifferences + LengthOfCompensationCells, 0.0f);
+        std::fill(tempMaximumDifferences, tempMaximumDifferences + LengthOfCompensationCells, 0.0f);
         
         // JP: スーパーボクセルの角においてオリジナルの値を評価してスーパーボクセルの値を初期化する。
         // EN: initialize super voxel values by original values evaluated at the corners of super voxels.
-        for (int siz = 0; siz < m_svNumZ; ++siz) {
-            float pz = (float)siz / (m_svNumZ - 1);
-            for (int siy = 0; siy < m_svNumY; ++siy) {
-                float py = (float)siy / (m_svNumY - 1); 
-                for (int six = 0; six < m_svNumX; ++six) {
-                    float px = (float)six / (m_svNumX - 1);
-                    uint32_t idx = siz * m_svNumY * m_svNumX + siy * m_svNumX + six;
-                    m_superVoxels[idx] = calcDensity(Point3D(px, py, pz));
-                }
+        {
+            ThreadPool threadPool;
+            for (int siz = 0; siz < svNumZ; ++siz) {
+                threadPool.enqueue([=](uint32_t threadID) {
+                    float pz = (float)siz / (svNumZ - 1);
+                    for (int siy = 0; siy < svNumY; ++siy) {
+                        float py = (float)siy / (svNumY - 1); 
+                        for (int six = 0; six < svNumX; ++six) {
+                            float px = (float)six / (svNumX - 1);
+                            uint32_t idx = siz * svNumY * svNumX + siy * svNumX + six;
+                            svValues[idx] = calcDensity(density_grid, numX, numY, numZ, Point3D(px, py, pz));
+                        }
+                    }
+                });
             }
+            threadPool.wait();
         }
 
         // JP: 各スーパーボクセルにおける最大の差を計算して、スーパーボクセル中のmajorant extinctionが
         //     upper-boundingになるようにする。
         // EN: calculate maximum difference for each super voxel to make sure that 
         //     the majorant extinction in the super voxel is upper bounding.
-        for (int svCellZ = 0; svCellZ < m_svNumZ - 1; ++svCellZ) {
-            float lpz = (float)svCellZ / (m_svNumZ - 1);
-            float upz = (float)(svCellZ + 1) / (m_svNumZ - 1);
-            uint32_t liz = (uint32_t)std::floor(lpz * (m_numZ - 1));
-            uint32_t uiz = (uint32_t)std::ceil(upz * (m_numZ - 1));
-            
-            for (int svCellY = 0; svCellY < m_svNumY - 1; ++svCellY) {
-                float lpy = (float)svCellY / (m_svNumY - 1);
-                float upy = (float)(svCellY + 1) / (m_svNumY - 1);
-                uint32_t liy = (uint32_t)std::floor(lpy * (m_numY - 1));
-                uint32_t uiy = (uint32_t)std::ceil(upy * (m_numY - 1));
-                
-                for (int svCellX = 0; svCellX < m_svNumX - 1; ++svCellX) {
-                    float lpx = (float)svCellX / (m_svNumX - 1);
-                    float upx = (float)(svCellX + 1) / (m_svNumX - 1);
-                    uint32_t lix = (uint32_t)std::floor(lpx * (m_numX - 1));
-                    uint32_t uix = (uint32_t)std::ceil(upx * (m_numX - 1));
+        {
+            ThreadPool threadPool;
+            for (int svCellZ = 0; svCellZ < svNumZ - 1; ++svCellZ) {
+                threadPool.enqueue([=](uint32_t threadID) {
+                    float lpz = (float)svCellZ / (svNumZ - 1);
+                    float upz = (float)(svCellZ + 1) / (svNumZ - 1);
+                    uint32_t liz = (uint32_t)std::floor(lpz * (numZ - 1));
+                    uint32_t uiz = (uint32_t)std::ceil(upz * (numZ - 1));
                     
-                    float maxDiff = 0;
-                    for (int iz = liz; iz <= uiz; ++iz) {
-                        float pz = (float)iz / (m_numZ - 1);
-                        for (int iy = liy; iy <= uiy; ++iy) {
-                            float py = (float)iy / (m_numY - 1);
-                            for (int ix = lix; ix <= uix; ++ix) {
-                                float px = (float)ix / (m_numX - 1);
-                                if (iz > liz && iz < uiz && iy > liy && iy < uiy && ix > lix && ix < uix) {
-                                    // JP: オリジナルの値のサンプル点における差を計算する。
-                                    // EN: calculate the difference at the sampling point of original values. 
-                                    Point3D p(px, py, pz);
-                                    float actualDensity = m_density_grid[iz][m_numX * iy + ix];
-                                    float coarseDensity = calcDensityInSuperVoxels(p);
-                                    float diff = actualDensity - coarseDensity;
-                                    maxDiff = std::max(maxDiff, diff);   
-                                }
-                                else {
-                                    // JP: 補間されたオリジナルの値がスーパーボクセル境界でスーパーボクセルの値を超える可能性がある。
-                                    // EN: There is a possibility that an interpolated original value exceeds that of super voxel values at super voxel boundaries.
-                                    int zBase = iz;
-                                    int yBase = iy;
-                                    int xBase = ix;
-                                    int numZIterations = (iz > liz && iz < uiz) ? 1 : 2;
-                                    int numYIterations = (iy > liy && iy < uiy) ? 1 : 2;
-                                    int numXIterations = (ix > lix && ix < uix) ? 1 : 2;
-                                    if (numZIterations == 2)
-                                        zBase = iz == liz ? liz : uiz - 1;
-                                    if (numYIterations == 2)
-                                        yBase = iy == liy ? liy : uiy - 1;
-                                    if (numXIterations == 2)
-                                        xBase = ix == lix ? lix : uix - 1;
-                                    for (int diz = 0; diz < numZIterations; ++diz) {
-                                        int iiz = zBase + diz;
-                                        float ppz = std::clamp((float)iiz / (m_numZ - 1), lpz, upz);
-                                        for (int diy = 0; diy < numYIterations; ++diy) {
-                                            int iiy = yBase + diy;
-                                            float ppy = std::clamp((float)iiy / (m_numY - 1), lpy, upy);
-                                            for (int dix = 0; dix < numXIterations; ++dix) {
-                                                int iix = xBase + dix;
-                                                float ppx = std::clamp((float)iix / (m_numX - 1), lpx, upx);
-                                                Point3D p(ppx, ppy, ppz);
-                                                float actualDensity = calcDensity(p);
-                                                float coarseDensity = calcDensityInSuperVoxels(p);
-                                                float diff = actualDensity - coarseDensity;
-                                                maxDiff = std::max(maxDiff, diff);
+                    for (int svCellY = 0; svCellY < svNumY - 1; ++svCellY) {
+                        float lpy = (float)svCellY / (svNumY - 1);
+                        float upy = (float)(svCellY + 1) / (svNumY - 1);
+                        uint32_t liy = (uint32_t)std::floor(lpy * (numY - 1));
+                        uint32_t uiy = (uint32_t)std::ceil(upy * (numY - 1));
+                        
+                        for (int svCellX = 0; svCellX < svNumX - 1; ++svCellX) {
+                            float lpx = (float)svCellX / (svNumX - 1);
+                            float upx = (float)(svCellX + 1) / (svNumX - 1);
+                            uint32_t lix = (uint32_t)std::floor(lpx * (numX - 1));
+                            uint32_t uix = (uint32_t)std::ceil(upx * (numX - 1));
+                            
+                            float maxDiff = 0;
+                            for (int iz = liz; iz <= uiz; ++iz) {
+                                float pz = (float)iz / (numZ - 1);
+                                for (int iy = liy; iy <= uiy; ++iy) {
+                                    float py = (float)iy / (numY - 1);
+                                    for (int ix = lix; ix <= uix; ++ix) {
+                                        float px = (float)ix / (numX - 1);
+                                        if (iz > liz && iz < uiz && iy > liy && iy < uiy && ix > lix && ix < uix) {
+                                            // JP: オリジナルの値のサンプル点における差を計算する。
+                                            // EN: calculate the difference at the sampling point of original values. 
+                                            Point3D p(px, py, pz);
+                                            float actualDensity = density_grid[iz][numX * iy + ix];
+                                            float coarseDensity = calcDensityInSuperVoxels(svValues, svMaximumDifferences, svNumX, svNumY, svNumZ, p);
+                                            float diff = actualDensity - coarseDensity;
+                                            maxDiff = std::max(maxDiff, diff);   
+                                        }
+                                        else {
+                                            // JP: 補間されたオリジナルの値がスーパーボクセル境界でスーパーボクセルの値を超える可能性がある。
+                                            // EN: There is a possibility that an interpolated original value exceeds that of super voxel values at super voxel boundaries.
+                                            int zBase = iz;
+                                            int yBase = iy;
+                                            int xBase = ix;
+                                            int numZIterations = (iz > liz && iz < uiz) ? 1 : 2;
+                                            int numYIterations = (iy > liy && iy < uiy) ? 1 : 2;
+                                            int numXIterations = (ix > lix && ix < uix) ? 1 : 2;
+                                            if (numZIterations == 2)
+                                                zBase = iz == liz ? liz : uiz - 1;
+                                            if (numYIterations == 2)
+                                                yBase = iy == liy ? liy : uiy - 1;
+                                            if (numXIterations == 2)
+                                                xBase = ix == lix ? lix : uix - 1;
+                                            for (int diz = 0; diz < numZIterations; ++diz) {
+                                                int iiz = zBase + diz;
+                                                float ppz = std::clamp((float)iiz / (numZ - 1), lpz, upz);
+                                                for (int diy = 0; diy < numYIterations; ++diy) {
+                                                    int iiy = yBase + diy;
+                                                    float ppy = std::clamp((float)iiy / (numY - 1), lpy, upy);
+                                                    for (int dix = 0; dix < numXIterations; ++dix) {
+                                                        int iix = xBase + dix;
+                                                        float ppx = std::clamp((float)iix / (numX - 1), lpx, upx);
+                                                        Point3D p(ppx, ppy, ppz);
+                                                        float actualDensity = calcDensity(density_grid, numX, numY, numZ, p);
+                                                        float coarseDensity = calcDensityInSuperVoxels(svValues, svMaximumDifferences, svNumX, svNumY, svNumZ, p);
+                                                        float diff = actualDensity - coarseDensity;
+                                                        maxDiff = std::max(maxDiff, diff);
+                                                    }
+                                                }
                                             }
                                         }
                                     }
                                 }
                             }
+                            
+                            uint32_t svCellIndex = (svNumX - 1) * (svNumY - 1) * svCellZ + (svNumX - 1) * svCellY + svCellX;
+                            tempMaximumDifferences[svCellIndex] = maxDiff;
+                            SLRAssert(svCellIndex < LengthOfCompensationCells, "Invalid index.");
+                            SLRAssert(maxDiff >= 0, "maximum difference must be greater than or equal to 0.");
                         }
                     }
-                    
-                    uint32_t svCellIndex = (m_svNumX - 1) * (m_svNumY - 1) * svCellZ + (m_svNumX - 1) * svCellY + svCellX;
-                    maximumDifferences[svCellIndex] = maxDiff;
-                    SLRAssert(svCellIndex < LengthOfCompensationCells, "Invalid index.");
-                    SLRAssert(maxDiff >= 0, "maximum difference must be greater than or equal to 0.");
-                }
+                });
             }
+            threadPool.wait();
         }
 
-        std::copy(maximumDifferences, maximumDifferences + LengthOfCompensationCells, m_maximumDifferences);
-        delete[] maximumDifferences;
+        std::copy(tempMaximumDifferences, tempMaximumDifferences + LengthOfCompensationCells, svMaximumDifferences);
+        delete[] tempMaximumDifferences;
 
 //        // sanity check
 //        printf("start sanity check.\n");
@@ -366,31 +526,31 @@ namespace SLR {
         return true;
     }
 
-    float DensityGridMediumDistribution::calcDensity(const Point3D &param) const {
+    float DensityGridMediumDistribution::calcDensity(const float* const* density_grid, uint32_t numX, uint32_t numY, uint32_t numZ, const Point3D &param) {
         if (param.x < 0 || param.y < 0 || param.z < 0 ||
             param.x > 1 || param.y > 1 || param.z > 1)
             return 0.0f;
         
-        uint32_t lx = std::min((uint32_t)(param.x * (m_numX - 1)), m_numX - 1);
-        uint32_t ux = std::min(lx + 1, m_numX - 1);
-        uint32_t ly = std::min((uint32_t)(param.y * (m_numY - 1)), m_numY - 1);
-        uint32_t uy = std::min(ly + 1, m_numY - 1);
-        uint32_t lz = std::min((uint32_t)(param.z * (m_numZ - 1)), m_numZ - 1);
-        uint32_t uz = std::min(lz + 1, m_numZ - 1);
-        float wux = param.x * (m_numX - 1) - lx;
+        uint32_t lx = std::min((uint32_t)(param.x * (numX - 1)), numX - 1);
+        uint32_t ux = std::min(lx + 1, numX - 1);
+        uint32_t ly = std::min((uint32_t)(param.y * (numY - 1)), numY - 1);
+        uint32_t uy = std::min(ly + 1, numY - 1);
+        uint32_t lz = std::min((uint32_t)(param.z * (numZ - 1)), numZ - 1);
+        uint32_t uz = std::min(lz + 1, numZ - 1);
+        float wux = param.x * (numX - 1) - lx;
         float wlx = 1 - wux;
-        float wuy = param.y * (m_numY - 1) - ly;
+        float wuy = param.y * (numY - 1) - ly;
         float wly = 1 - wuy;
-        float wuz = param.z * (m_numZ - 1) - lz;
+        float wuz = param.z * (numZ - 1) - lz;
         float wlz = 1 - wuz;
-        float density = (m_density_grid[lz][m_numX * ly + lx] * wlz * wly * wlx +
-                         m_density_grid[lz][m_numX * ly + ux] * wlz * wly * wux +
-                         m_density_grid[lz][m_numX * uy + lx] * wlz * wuy * wlx +
-                         m_density_grid[lz][m_numX * uy + ux] * wlz * wuy * wux +
-                         m_density_grid[uz][m_numX * ly + lx] * wuz * wly * wlx +
-                         m_density_grid[uz][m_numX * ly + ux] * wuz * wly * wux +
-                         m_density_grid[uz][m_numX * uy + lx] * wuz * wuy * wlx +
-                         m_density_grid[uz][m_numX * uy + ux] * wuz * wuy * wux);
+        float density = (density_grid[lz][numX * ly + lx] * wlz * wly * wlx +
+                         density_grid[lz][numX * ly + ux] * wlz * wly * wux +
+                         density_grid[lz][numX * uy + lx] * wlz * wuy * wlx +
+                         density_grid[lz][numX * uy + ux] * wlz * wuy * wux +
+                         density_grid[uz][numX * ly + lx] * wuz * wly * wlx +
+                         density_grid[uz][numX * ly + ux] * wuz * wly * wux +
+                         density_grid[uz][numX * uy + lx] * wuz * wuy * wlx +
+                         density_grid[uz][numX * uy + ux] * wuz * wuy * wux);
         return density;
     }
     
@@ -406,7 +566,60 @@ namespace SLR {
         
         SampledSpectrum base_sigma_e = m_base_sigma_e->evaluate(wls);
         
-#if defined(UseSuperVoxels)
+#if defined(UseSpectralTracking)
+        // References
+        // Spectral and Decomposition Tracking for Rendering Heterogeneous Volumes
+        
+        // JP: 全波長の消散係数の上限をmajorantとして自由行程をサンプルし、全ての波長を生かしたまま追跡する。
+        //     実衝突と仮の衝突は経路のスループットで重み付けした平均の係数に比例して選ぶ。
+        // EN: sample free path with the upper bound of extinction coefficients of all the wavelengths as the majorant, keeping all the wavelengths alive.
+        //     A real or null collision is chosen proportionally to the coefficients averaged with weights of the path throughput.
+        *singleWavelength = false;
+        SampledSpectrum weight = SampledSpectrum::One;
+        float maxBase_sigma_e = base_sigma_e.maxValue();
+        if (wls.wavelengthSelected()) {
+            weight = SampledSpectrum::Zero;
+            weight[wls.selectedLambdaIndex] = 1.0f;
+            maxBase_sigma_e = base_sigma_e[wls.selectedLambdaIndex];
+        }
+        bool hit = false;
+        traverseSuperVoxelCells(ray, segment.distMin, segment.distMax, [&](uint32_t cellIndex, float t0, float t1) {
+            float majorant = maxBase_sigma_e * m_svCellMaxDensities[cellIndex];
+            if (majorant <= 0.0f)
+                return true;
+            float t = t0;
+            while (true) {
+                t += -std::log(sampler.getSample()) / majorant;
+                if (t >= t1)
+                    return true;
+                
+                Point3D queryPoint = ray.org + t * ray.dir;
+                Point3D param;
+                m_region.calculateLocalCoordinates(queryPoint, &param);
+                SampledSpectrum extCoeff = base_sigma_e * calcDensity(param);
+                SampledSpectrum nullCoeff = SampledSpectrum(majorant) - extCoeff;
+                float realWeight = (weight * extCoeff).avgValue();
+                float nullWeight = (weight * nullCoeff).avgValue();
+                if (realWeight + nullWeight <= 0.0f) {
+                    weight = SampledSpectrum::Zero;
+                    return false;
+                }
+                float probRealCollision = realWeight / (realWeight + nullWeight);
+                if (sampler.getSample() < probRealCollision) {
+                    hit = true;
+                    *mi = MediumInteraction(ray.time, t, queryPoint, normalize(ray.dir), param.x, param.y, param.z);
+                    // JP: 消散係数は呼び出し側で掛けられる。
+                    // EN: the extinction coefficient is multiplied by the caller.
+                    weight /= majorant * probRealCollision;
+                    return false;
+                }
+                weight *= nullCoeff / (majorant * (1 - probRealCollision));
+            }
+        });
+        *medThroughput = weight;
+        
+        return hit;
+#elif defined(UseSuperVoxels)
         // initialize 3D DDA process.
         const uint32_t MaxVoxelIndices[3] = {m_svNumX - 2, m_svNumY - 2, m_svNumZ - 2};
         Point3D initialPoint = ray.org + segment.distMin * ray.dir;
@@ -581,7 +794,58 @@ namespace SLR {
         
         SampledSpectrum base_sigma_e = m_base_sigma_e->evaluate(wls);
         
-#if defined(UseSuperVoxels)
+#if defined(UseResidualRatioTracking)
+        // References
+        // Residual Ratio Tracking for Estimating Attenuation in Participating Media
+        
+        // JP: 各セルの最小密度を制御密度として、その光学的厚さは解析的に求め、残差のみをratio trackingで推定する。
+        //     残差のmajorantを全波長で共有して1回の走査で全ての波長の透過率を推定する。
+        // EN: use the minimum density of each cell as the control density, compute its optical depth analytically, 
+        //     and estimate only the residual by ratio tracking.
+        //     The residual majorant is shared by all the wavelengths so that a single traversal estimates transmittances of all the wavelengths.
+        *singleWavelength = false;
+        SampledSpectrum mask = SampledSpectrum::One;
+        if (wls.wavelengthSelected()) {
+            mask = SampledSpectrum::Zero;
+            mask[wls.selectedLambdaIndex] = 1.0f;
+        }
+        float maxBase_sigma_e = (base_sigma_e * mask).maxValue();
+        SampledSpectrum residualTransmittance = mask;
+        SampledSpectrum controlOpticalDepth = SampledSpectrum::Zero;
+        traverseSuperVoxelCells(ray, segment.distMin, segment.distMax, [&](uint32_t cellIndex, float t0, float t1) {
+            float controlDensity = m_svCellMinDensities[cellIndex];
+            controlOpticalDepth += base_sigma_e * (controlDensity * (t1 - t0));
+            float residualMajorant = maxBase_sigma_e * (m_svCellMaxDensities[cellIndex] - controlDensity);
+            if (residualMajorant <= 0.0f)
+                return true;
+            float t = t0;
+            while (true) {
+                t += -std::log(sampler.getSample()) / residualMajorant;
+                if (t >= t1)
+                    return true;
+                
+                Point3D queryPoint = ray.org + t * ray.dir;
+                Point3D param;
+                m_region.calculateLocalCoordinates(queryPoint, &param);
+                SampledSpectrum residualCoeff = base_sigma_e * (calcDensity(param) - controlDensity);
+                residualTransmittance *= SampledSpectrum::One - residualCoeff / residualMajorant;
+                
+                const float RRThreshold = 0.1f;
+                float estimate = (residualTransmittance * exp(-controlOpticalDepth)).maxValue();
+                if (estimate < RRThreshold) {
+                    if (sampler.getSample() < estimate) {
+                        residualTransmittance /= estimate;
+                    }
+                    else {
+                        residualTransmittance = SampledSpectrum::Zero;
+                        return false;
+                    }
+                }
+            }
+        });
+        
+        return residualTransmittance * exp(-controlOpticalDepth);
+#elif defined(UseSuperVoxels)
         // initialize 3D DDA process.
         const uint32_t MaxVoxelIndices[3] = {m_svNumX - 2, m_svNumY - 2, m_svNumZ - 2};
         Point3D initialPoint = ray.org + segment.distMin * ray.dir;
@@ -729,6 +993,7 @@ namespace SLR {
 #   endif
 #endif
         
+#if !defined(UseResidualRatioTracking)
         // estimate transmittance by ratio tracking.
         *singleWavelength = false;
         SampledSpectrum transmittance = SampledSpectrum::Zero;
@@ -741,6 +1006,7 @@ namespace SLR {
         }
         
         return transmittance;
+#endif
     }
     
     void DensityGridMediumDistribution::calculateMediumPoint(const MediumInteraction &mi, MediumPoint* medPt) const {
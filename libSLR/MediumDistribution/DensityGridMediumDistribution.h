@@ -26,16 +26,41 @@ namespace SLR {
         float* m_maximumDifferences;
         uint32_t m_svNumX, m_svNumY, m_svNumZ;
         Vector3D m_superVoxelWidth;
+        float* m_svCellMinDensities;
+        float* m_svCellMaxDensities;
         
-        float calcDensityInSuperVoxels(const Point3D &param) const;
+        static float calcDensityInSuperVoxels(const float* superVoxels, const float* maximumDifferences, uint32_t svNumX, uint32_t svNumY, uint32_t svNumZ, 
+                                              const Point3D &param);
+        float calcDensityInSuperVoxels(const Point3D &param) const {
+            return calcDensityInSuperVoxels(m_superVoxels, m_maximumDifferences, m_svNumX, m_svNumY, m_svNumZ, param);
+        }
         void setupSuperVoxels();
+        template <typename Func>
+        void traverseSuperVoxelCells(const Ray &ray, float tMin, float tMax, Func func) const;
         bool traverseSuperVoxels(const Ray &ray, const RaySegment &segment, FreePathSampler &sampler, float base_sigma_e, 
                                  const int32_t step[3], const float delta_t[3], const int32_t outsideIndices[3],   
                                  float max_t[3], int32_t superVoxel[3], 
                                  float* sampledDistance, float* majorantAtScattering) const;
         
-        float calcDensity(const Point3D &param) const;
+        static float calcDensity(const float* const* density_grid, uint32_t numX, uint32_t numY, uint32_t numZ, const Point3D &param);
+        float calcDensity(const Point3D &param) const {
+            return calcDensity(m_density_grid, m_numX, m_numY, m_numZ, param);
+        }
     public:
+        // JP: 密度グリッドからスーパーボクセルの値と最大の差を計算する。密度グリッドファイルの書き出しにも使われる。
+        //     collisionsPerVoxelは密度1の媒質中をボクセル幅だけ進む際の仮の衝突数。
+        //     正の場合はmajorantグリッドのコストモデルで解像度を選び、0以下の場合は固定の解像度を使う。
+        // EN: calculate super voxel values and maximum differences from a density grid. This is also used to write a density grid file.
+        //     collisionsPerVoxel is the number of tentative collisions while advancing a voxel width in the medium with density 1.
+        //     When it is positive, the resolution is selected by the cost model of a majorant grid, otherwise the fixed resolution is used.
+        static void calcSuperVoxels(const float* const* density_grid, uint32_t numX, uint32_t numY, uint32_t numZ, float collisionsPerVoxel, 
+                                    uint32_t svNum[3], float** superVoxels, float** maximumDifferences);
+        // JP: スーパーボクセルのセルごとの密度の範囲を求める。密度グリッドファイルの書き出しにも使われる。
+        // EN: calculate the density range of each super voxel cell. This is also used to write a density grid file.
+        static void calcSuperVoxelCellBounds(const float* const* density_grid, uint32_t numX, uint32_t numY, uint32_t numZ, const uint32_t svNum[3], 
+                                             float** minDensities, float** maxDensities);
+        
+
         DensityGridMediumDistribution(const BoundingBox3D &region, const AssetSpectrum* base_sigma_s, const AssetSpectrum* base_sigma_e, const std::vector<std::vector<float>> &density_grid,
                                       uint32_t numX, uint32_t numY, uint32_t numZ) :
         m_region(region), m_base_sigma_s(base_sigma_s), m_base_sigma_e(base_sigma_e), 
@@ -58,7 +83,10 @@ namespace SLR {
             
             setupSuperVoxels();
         }
+        DensityGridMediumDistribution(const BoundingBox3D &region, const AssetSpectrum* base_sigma_s, const AssetSpectrum* base_sigma_e, const DensityGridFile* file);
         ~DensityGridMediumDistribution() {
+            delete[] m_svCellMaxDensities;
+            delete[] m_svCellMinDensities;
             delete[] m_maximumDifferences;
             delete[] m_superVoxels;
             delete[] m_density_grid;
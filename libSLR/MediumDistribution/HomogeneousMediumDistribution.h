@@ -30,6 +30,7 @@ namespace SLR {
             index = std::clamp(index, 0, (int)NumStrataForStorage - 1);
             return m_majorantExtinctionCoefficient[index];
         }
+        bool isHomogeneous() const override { return true; }
         
         bool subdivide(Allocator* mem, MediumDistribution** fragments, uint32_t* numFragments) const override { return false; }
         
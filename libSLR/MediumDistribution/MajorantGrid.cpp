@@ -0,0 +1,95 @@
+//
+//  MajorantGrid.cpp
+//
+//  Created by 渡部 心 on 2017/06/24.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#include "MajorantGrid.h"
+
+#include "../BasicTypes/CompensatedSum.h"
+#include "../Helper/ThreadPool.h"
+
+namespace SLR {
+    MajorantGrid::MajorantGrid(uint32_t numX, uint32_t numY, uint32_t numZ, const float extent[3],
+                               const std::function<float(uint32_t, uint32_t, uint32_t)> &cellBound) : m_selectedLevel(0) {
+        m_extent[0] = extent[0];
+        m_extent[1] = extent[1];
+        m_extent[2] = extent[2];
+        
+        // JP: 最も細かいレベルをzスライスごとに並列に評価する。
+        // EN: evaluate the finest level in parallel for each z-slice.
+        m_levels.emplace_back();
+        {
+            Level &finest = m_levels.back();
+            finest.numCells[0] = numX;
+            finest.numCells[1] = numY;
+            finest.numCells[2] = numZ;
+            finest.maxima.resize(numX * numY * numZ);
+            
+            ThreadPool threadPool;
+            for (int z = 0; z < numZ; ++z) {
+                threadPool.enqueue([&finest, &cellBound, numX, numY, z](uint32_t threadID) {
+                    float* slice = finest.maxima.data() + numX * numY * z;
+                    for (int y = 0; y < numY; ++y)
+                        for (int x = 0; x < numX; ++x)
+                            slice[numX * y + x] = cellBound(x, y, z);
+                });
+            }
+            threadPool.wait();
+        }
+        
+        // JP: 2x2x2のセルの最大値を取って粗いレベルを作る。
+        // EN: make coarser levels by taking the maximum of 2x2x2 cells.
+        while (m_levels.back().numCells[0] > 1 || m_levels.back().numCells[1] > 1 || m_levels.back().numCells[2] > 1) {
+            const Level &fine = m_levels.back();
+            Level coarse;
+            for (int i = 0; i < 3; ++i)
+                coarse.numCells[i] = (fine.numCells[i] + 1) / 2;
+            coarse.maxima.resize(coarse.numCells[0] * coarse.numCells[1] * coarse.numCells[2]);
+            
+            ThreadPool threadPool;
+            for (int z = 0; z < coarse.numCells[2]; ++z) {
+                threadPool.enqueue([&fine, &coarse, z](uint32_t threadID) {
+                    for (int y = 0; y < coarse.numCells[1]; ++y) {
+                        for (int x = 0; x < coarse.numCells[0]; ++x) {
+                            float maxValue = 0.0f;
+                            for (int fz = 2 * z; fz < std::min(2 * z + 2, (int)fine.numCells[2]); ++fz)
+                                for (int fy = 2 * y; fy < std::min(2 * y + 2, (int)fine.numCells[1]); ++fy)
+                                    for (int fx = 2 * x; fx < std::min(2 * x + 2, (int)fine.numCells[0]); ++fx)
+                                        maxValue = std::max(maxValue, fine.at(fx, fy, fz));
+                            coarse.maxima[(coarse.numCells[1] * z + y) * coarse.numCells[0] + x] = maxValue;
+                        }
+                    }
+                });
+            }
+            threadPool.wait();
+            
+            m_levels.push_back(std::move(coarse));
+        }
+        
+        for (int l = 0; l < m_levels.size(); ++l) {
+            Level &level = m_levels[l];
+            FloatSum sum = 0.0f;
+            for (int i = 0; i < level.maxima.size(); ++i)
+                sum += level.maxima[i];
+            level.average = sum.result / level.maxima.size();
+        }
+    }
+    
+    uint32_t MajorantGrid::selectLevel(float collisionsPerUnitValue, float traversalCost, float lookupCost, uint32_t maxLevel) {
+        // JP: 一様な方向のレイは単位長さあたり平均して各軸につき1/2 / 幅のセル境界を横切る。
+        // EN: a ray with a uniform direction crosses 1/2 / width cell boundaries per unit length on average for each axis.
+        float minCost = INFINITY;
+        maxLevel = std::min(maxLevel, numLevels() - 1);
+        for (int l = 0; l <= maxLevel; ++l) {
+            float cellWidth = (float)(1 << l);
+            float cost = traversalCost * 1.5f / cellWidth + lookupCost * collisionsPerUnitValue * m_levels[l].average;
+            if (cost < minCost) {
+                minCost = cost;
+                m_selectedLevel = l;
+            }
+        }
+        return m_selectedLevel;
+    }
+}
@@ -0,0 +1,145 @@
+//
+//  MajorantGrid.h
+//
+//  Created by 渡部 心 on 2017/06/24.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#ifndef __SLR_MajorantGrid__
+#define __SLR_MajorantGrid__
+
+#include "../defines.h"
+#include "../declarations.h"
+#include "../BasicTypes/Point3D.h"
+#include "../BasicTypes/Vector3D.h"
+
+namespace SLR {
+    // JP: 3次元の一様グリッドのDDA。[lo, hi]のセル範囲に制限する。
+    //     funcがfalseを返すと走査を打ち切る。
+    // EN: DDA for a 3D uniform grid limited to the cell range [lo, hi].
+    //     The traversal is aborted when func returns false.
+    template <typename Func>
+    bool traverseUniformGrid(const Point3D &org, const Vector3D &dir, float cellWidth, const int32_t lo[3], const int32_t hi[3],
+                             float tMin, float tMax, Func func) {
+        Point3D p = org + tMin * dir;
+        int32_t idx[3];
+        int32_t step[3];
+        float tNext[3];
+        float tDelta[3];
+        for (int i = 0; i < 3; ++i) {
+            idx[i] = std::min(std::max((int32_t)std::floor(p[i] / cellWidth), lo[i]), hi[i]);
+            if (dir[i] > 0) {
+                step[i] = 1;
+                tNext[i] = ((idx[i] + 1) * cellWidth - org[i]) / dir[i];
+                tDelta[i] = cellWidth / dir[i];
+            }
+            else if (dir[i] < 0) {
+                step[i] = -1;
+                tNext[i] = (idx[i] * cellWidth - org[i]) / dir[i];
+                tDelta[i] = -cellWidth / dir[i];
+            }
+            else {
+                step[i] = 0;
+                tNext[i] = INFINITY;
+                tDelta[i] = INFINITY;
+            }
+        }
+        
+        float t0 = tMin;
+        while (t0 < tMax) {
+            int axis = tNext[0] < tNext[1] ? (tNext[0] < tNext[2] ? 0 : 2) : (tNext[1] < tNext[2] ? 1 : 2);
+            float t1 = std::min(std::max(tNext[axis], t0), tMax);
+            if (!func(idx, t0, t1))
+                return false;
+            t0 = t1;
+            idx[axis] += step[axis];
+            if (idx[axis] < lo[axis] || idx[axis] > hi[axis])
+                break;
+            tNext[axis] += tDelta[axis];
+        }
+        return true;
+    }
+    
+    // JP: 区間[tMin, tMax]を[0, extent]^3の箱で切り取る。
+    // EN: clip the interval [tMin, tMax] by the box [0, extent]^3.
+    inline bool clipByBox(const Point3D &org, const Vector3D &dir, const float extent[3], float* tMin, float* tMax) {
+        for (int i = 0; i < 3; ++i) {
+            if (dir[i] == 0) {
+                if (org[i] < 0 || org[i] > extent[i])
+                    return false;
+                continue;
+            }
+            float invDir = 1.0f / dir[i];
+            float tNear = (0 - org[i]) * invDir;
+            float tFar = (extent[i] - org[i]) * invDir;
+            if (tNear > tFar)
+                std::swap(tNear, tFar);
+            *tMin = std::max(*tMin, tNear);
+            *tMax = std::min(*tMax, tFar);
+        }
+        return *tMin < *tMax;
+    }
+    
+    
+    
+    // JP: 区分的に一定なmajorantを保持する最大値のミップ階層。
+    //     最も細かいレベルのセルの上限値から並列に構築し、自由行程サンプリングのコストモデルで走査に用いるレベルを選ぶ。
+    //     座標は最も細かいセルの幅を1とする単位で表す。
+    // EN: mip hierarchy of maxima holding piecewise constant majorants.
+    //     This is built in parallel from upper bounds of the finest cells,
+    //     and a level used for traversal is selected by a cost model of free-path sampling.
+    //     Coordinates are represented in units where the width of the finest cell is 1.
+    class SLR_API MajorantGrid {
+        struct Level {
+            uint32_t numCells[3];
+            std::vector<float> maxima;
+            float average;
+            
+            float at(uint32_t x, uint32_t y, uint32_t z) const {
+                return maxima[(numCells[1] * z + y) * numCells[0] + x];
+            }
+        };
+        
+        std::vector<Level> m_levels;
+        float m_extent[3];
+        uint32_t m_selectedLevel;
+    public:
+        // JP: extentはこのグリッドが覆う領域の大きさ(最も細かいセル単位)。セル数×1より小さくても良い。
+        // EN: extent is the size of the region covered by this grid (in the finest cells). It can be smaller than the number of cells.
+        MajorantGrid(uint32_t numX, uint32_t numY, uint32_t numZ, const float extent[3],
+                     const std::function<float(uint32_t, uint32_t, uint32_t)> &cellBound);
+        
+        uint32_t numLevels() const { return (uint32_t)m_levels.size(); }
+        uint32_t numCells(uint32_t level, int axis) const { return m_levels[level].numCells[axis]; }
+        float cellValue(uint32_t level, uint32_t x, uint32_t y, uint32_t z) const { return m_levels[level].at(x, y, z); }
+        float averageValue(uint32_t level) const { return m_levels[level].average; }
+        float maxValue() const { return m_levels.back().maxima[0]; }
+        
+        // JP: 単位長さあたりのコスト = セル走査のコスト × 横切るセル数 + 密度評価のコスト × 仮の衝突数 を最小化するレベルを選ぶ。
+        //     collisionsPerUnitValueは最も細かいセル幅を進む際の、値1あたりの仮の衝突数。
+        // EN: select a level minimizing cost per unit length = traversal cost * crossed cells + lookup cost * tentative collisions.
+        //     collisionsPerUnitValue is the number of tentative collisions per value 1 while advancing the width of the finest cell.
+        uint32_t selectLevel(float collisionsPerUnitValue, float traversalCost, float lookupCost, uint32_t maxLevel = UINT32_MAX);
+        void setLevel(uint32_t level) { m_selectedLevel = std::min(level, numLevels() - 1); }
+        uint32_t selectedLevel() const { return m_selectedLevel; }
+        
+        // JP: 選択したレベルにおいてレイに沿って一定のmajorantを持つ区間を順に列挙する。
+        //     func(t0, t1, majorant)がfalseを返すと走査を打ち切る。
+        // EN: enumerate intervals with constant majorant in order along a ray at the selected level.
+        //     The traversal is aborted when func(t0, t1, majorant) returns false.
+        template <typename Func>
+        void traverse(const Point3D &org, const Vector3D &dir, float tMin, float tMax, Func func) const {
+            if (!clipByBox(org, dir, m_extent, &tMin, &tMax))
+                return;
+            
+            const Level &level = m_levels[m_selectedLevel];
+            const int32_t lo[3] = {0, 0, 0};
+            const int32_t hi[3] = {(int32_t)level.numCells[0] - 1, (int32_t)level.numCells[1] - 1, (int32_t)level.numCells[2] - 1};
+            traverseUniformGrid(org, dir, (float)(1 << m_selectedLevel), lo, hi, tMin, tMax, [&](const int32_t idx[3], float t0, float t1) {
+                return func(t0, t1, level.at(idx[0], idx[1], idx[2]));
+            });
+        }
+    };
+}
+
+#endif /* __SLR_MajorantGrid__ */
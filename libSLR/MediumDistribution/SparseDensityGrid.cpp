@@ -0,0 +1,251 @@
+//
+//  SparseDensityGrid.cpp
+//
+//  Created by 渡部 心 on 2017/06/22.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#include "SparseDensityGrid.h"
+
+#include "../Helper/ThreadPool.h"
+
+namespace SLR {
+    void SparseDensityGrid::buildTile(uint32_t tx, uint32_t ty, uint32_t tz, const std::function<float(uint32_t, uint32_t, uint32_t)> &getVoxel, float tolerance,
+                                      std::vector<Node>* brickNodes, std::vector<float>* brickData, Node* tile) const {
+        brickNodes->resize(TileVolume);
+        
+        bool allConstant = true;
+        float tileMaxValue = 0.0f;
+        std::array<float, BrickVolume> voxels;
+        for (int lbz = 0; lbz < TileWidth; ++lbz) {
+            for (int lby = 0; lby < TileWidth; ++lby) {
+                for (int lbx = 0; lbx < TileWidth; ++lbx) {
+                    Node &brick = (*brickNodes)[(lbz * TileWidth + lby) * TileWidth + lbx];
+                    uint32_t bIdx[3] = {tx * TileWidth + lbx, ty * TileWidth + lby, tz * TileWidth + lbz};
+                    if (bIdx[0] >= m_numBricks[0] || bIdx[1] >= m_numBricks[1] || bIdx[2] >= m_numBricks[2]) {
+                        brick.childIndex = ConstantNode;
+                        brick.value = 0.0f;
+                        brick.maxValue = 0.0f;
+                        continue;
+                    }
+                    
+                    // JP: 格子外のボクセルは端の値で埋めて一定値の判定を妨げないようにする。
+                    // EN: fill voxels outside the grid with edge values so that they do not disturb constant detection.
+                    float minValue = INFINITY;
+                    float maxValue = -INFINITY;
+                    for (int lz = 0; lz < BrickWidth; ++lz) {
+                        uint32_t z = std::min(bIdx[2] * BrickWidth + lz, m_numVoxels[2] - 1);
+                        for (int ly = 0; ly < BrickWidth; ++ly) {
+                            uint32_t y = std::min(bIdx[1] * BrickWidth + ly, m_numVoxels[1] - 1);
+                            for (int lx = 0; lx < BrickWidth; ++lx) {
+                                uint32_t x = std::min(bIdx[0] * BrickWidth + lx, m_numVoxels[0] - 1);
+                                float value = getVoxel(x, y, z);
+                                voxels[(lz * BrickWidth + ly) * BrickWidth + lx] = value;
+                                minValue = std::min(minValue, value);
+                                maxValue = std::max(maxValue, value);
+                            }
+                        }
+                    }
+                    
+                    // JP: ブリックが覆うセルの補間値は隣のブリックの境界のボクセルにも依存する。
+                    // EN: interpolated values in the cells covered by the brick also depend on boundary voxels of neighboring bricks.
+                    float majorant = maxValue;
+                    uint32_t endIdx[3];
+                    for (int i = 0; i < 3; ++i)
+                        endIdx[i] = (bIdx[i] + 1) * BrickWidth;
+                    for (uint32_t z = bIdx[2] * BrickWidth; z <= std::min(endIdx[2], m_numVoxels[2] - 1); ++z) {
+                        for (uint32_t y = bIdx[1] * BrickWidth; y <= std::min(endIdx[1], m_numVoxels[1] - 1); ++y) {
+                            for (uint32_t x = bIdx[0] * BrickWidth; x <= std::min(endIdx[0], m_numVoxels[0] - 1); ++x) {
+                                if (x < endIdx[0] && y < endIdx[1] && z < endIdx[2])
+                                    continue;
+                                majorant = std::max(majorant, getVoxel(x, y, z));
+                            }
+                        }
+                    }
+                    
+                    if (maxValue - minValue <= tolerance) {
+                        brick.childIndex = ConstantNode;
+                        brick.value = 0.5f * (minValue + maxValue);
+                    }
+                    else {
+                        brick.childIndex = (uint32_t)(brickData->size() / BrickVolume);
+                        brick.value = 0.0f;
+                        brickData->insert(brickData->end(), voxels.begin(), voxels.end());
+                    }
+                    // JP: 一定値で近似した値は元の値から高々tolerance / 2だけずれる。
+                    // EN: a value approximated by a constant deviates at most tolerance / 2 from the original value.
+                    brick.maxValue = majorant + 0.5f * tolerance;
+                    
+                    const Node &firstBrick = (*brickNodes)[0];
+                    allConstant &= brick.childIndex == ConstantNode && brick.value == firstBrick.value;
+                    tileMaxValue = std::max(tileMaxValue, brick.maxValue);
+                }
+            }
+        }
+        
+        tile->value = (*brickNodes)[0].value;
+        tile->maxValue = tileMaxValue;
+        if (allConstant) {
+            tile->childIndex = ConstantNode;
+            brickNodes->clear();
+            brickData->clear();
+        }
+        else {
+            tile->childIndex = 0;
+        }
+    }
+    
+    SparseDensityGrid::SparseDensityGrid(uint32_t numX, uint32_t numY, uint32_t numZ, const std::function<float(uint32_t, uint32_t, uint32_t)> &getVoxel, float tolerance) {
+        SLRAssert(numX >= 2 && numY >= 2 && numZ >= 2, "Grid resolution must be at least 2 in each axis.");
+        m_numVoxels[0] = numX;
+        m_numVoxels[1] = numY;
+        m_numVoxels[2] = numZ;
+        for (int i = 0; i < 3; ++i) {
+            m_numBricks[i] = (m_numVoxels[i] + BrickWidth - 1) / BrickWidth;
+            m_numTiles[i] = (m_numBricks[i] + TileWidth - 1) / TileWidth;
+        }
+        
+        uint32_t numTiles = m_numTiles[0] * m_numTiles[1] * m_numTiles[2];
+        m_tiles.resize(numTiles);
+        
+        // JP: タイルごとに並列に構築し、最後に連結する。
+        // EN: build each tile in parallel, then concatenate them.
+        std::vector<std::vector<Node>> tileBrickNodes(numTiles);
+        std::vector<std::vector<float>> tileBrickData(numTiles);
+        ThreadPool threadPool;
+        for (int tz = 0; tz < m_numTiles[2]; ++tz) {
+            for (int ty = 0; ty < m_numTiles[1]; ++ty) {
+                for (int tx = 0; tx < m_numTiles[0]; ++tx) {
+                    uint32_t tileIdx = (m_numTiles[1] * tz + ty) * m_numTiles[0] + tx;
+                    threadPool.enqueue([this, tx, ty, tz, tileIdx, &getVoxel, tolerance, &tileBrickNodes, &tileBrickData](uint32_t threadID) {
+                        buildTile(tx, ty, tz, getVoxel, tolerance, &tileBrickNodes[tileIdx], &tileBrickData[tileIdx], &m_tiles[tileIdx]);
+                    });
+                }
+            }
+        }
+        threadPool.wait();
+        
+        m_maxValue = 0.0f;
+        uint32_t numNonConstantTiles = 0;
+        uint32_t numBricksInData = 0;
+        for (int i = 0; i < numTiles; ++i) {
+            Node &tile = m_tiles[i];
+            m_maxValue = std::max(m_maxValue, tile.maxValue);
+            if (tile.childIndex == ConstantNode)
+                continue;
+            
+            tile.childIndex = numNonConstantTiles++;
+            uint32_t dataOffset = numBricksInData;
+            for (int j = 0; j < TileVolume; ++j) {
+                Node &brick = tileBrickNodes[i][j];
+                if (brick.childIndex != ConstantNode)
+                    brick.childIndex += dataOffset;
+            }
+            numBricksInData += (uint32_t)(tileBrickData[i].size() / BrickVolume);
+            m_brickNodes.insert(m_brickNodes.end(), tileBrickNodes[i].begin(), tileBrickNodes[i].end());
+            m_brickData.insert(m_brickData.end(), tileBrickData[i].begin(), tileBrickData[i].end());
+            std::vector<Node>().swap(tileBrickNodes[i]);
+            std::vector<float>().swap(tileBrickData[i]);
+        }
+    }
+    
+    bool SparseDensityGrid::write(FILE* fp) const {
+        const uint64_t sizes[3] = {m_tiles.size(), m_brickNodes.size(), m_brickData.size()};
+        bool success = true;
+        success &= fwrite(m_numVoxels, sizeof(uint32_t), 3, fp) == 3;
+        success &= fwrite(&m_maxValue, sizeof(float), 1, fp) == 1;
+        success &= fwrite(sizes, sizeof(uint64_t), 3, fp) == 3;
+        success &= fwrite(m_tiles.data(), sizeof(Node), sizes[0], fp) == sizes[0];
+        success &= fwrite(m_brickNodes.data(), sizeof(Node), sizes[1], fp) == sizes[1];
+        success &= fwrite(m_brickData.data(), sizeof(float), sizes[2], fp) == sizes[2];
+        return success;
+    }
+    
+    SparseDensityGrid* SparseDensityGrid::read(FILE* fp) {
+        SparseDensityGrid* grid = new SparseDensityGrid();
+        uint64_t sizes[3];
+        if (fread(grid->m_numVoxels, sizeof(uint32_t), 3, fp) != 3 ||
+            fread(&grid->m_maxValue, sizeof(float), 1, fp) != 1 ||
+            fread(sizes, sizeof(uint64_t), 3, fp) != 3) {
+            delete grid;
+            return nullptr;
+        }
+        for (int i = 0; i < 3; ++i) {
+            grid->m_numBricks[i] = (grid->m_numVoxels[i] + BrickWidth - 1) / BrickWidth;
+            grid->m_numTiles[i] = (grid->m_numBricks[i] + TileWidth - 1) / TileWidth;
+        }
+        if (sizes[0] != grid->m_numTiles[0] * grid->m_numTiles[1] * grid->m_numTiles[2] ||
+            sizes[1] % TileVolume != 0 || sizes[2] % BrickVolume != 0) {
+            delete grid;
+            return nullptr;
+        }
+        grid->m_tiles.resize(sizes[0]);
+        grid->m_brickNodes.resize(sizes[1]);
+        grid->m_brickData.resize(sizes[2]);
+        if (fread(grid->m_tiles.data(), sizeof(Node), sizes[0], fp) != sizes[0] ||
+            fread(grid->m_brickNodes.data(), sizeof(Node), sizes[1], fp) != sizes[1] ||
+            fread(grid->m_brickData.data(), sizeof(float), sizes[2], fp) != sizes[2]) {
+            delete grid;
+            return nullptr;
+        }
+        return grid;
+    }
+    
+    float SparseDensityGrid::evaluate(const Point3D &param) const {
+        if (param.x < 0 || param.y < 0 || param.z < 0 ||
+            param.x > 1 || param.y > 1 || param.z > 1)
+            return 0.0f;
+        
+        const uint32_t numX = m_numVoxels[0], numY = m_numVoxels[1], numZ = m_numVoxels[2];
+        uint32_t lx = std::min((uint32_t)(param.x * (numX - 1)), numX - 1);
+        uint32_t ux = std::min(lx + 1, numX - 1);
+        uint32_t ly = std::min((uint32_t)(param.y * (numY - 1)), numY - 1);
+        uint32_t uy = std::min(ly + 1, numY - 1);
+        uint32_t lz = std::min((uint32_t)(param.z * (numZ - 1)), numZ - 1);
+        uint32_t uz = std::min(lz + 1, numZ - 1);
+        float wux = param.x * (numX - 1) - lx;
+        float wlx = 1 - wux;
+        float wuy = param.y * (numY - 1) - ly;
+        float wly = 1 - wuy;
+        float wuz = param.z * (numZ - 1) - lz;
+        float wlz = 1 - wuz;
+        
+        float v[8];
+        if ((lx >> LogBrickWidth) == (ux >> LogBrickWidth) &&
+            (ly >> LogBrickWidth) == (uy >> LogBrickWidth) &&
+            (lz >> LogBrickWidth) == (uz >> LogBrickWidth)) {
+            // JP: 8近傍が同じブリックに収まる場合はノードの探索を1回で済ませる。
+            // EN: look up the node only once when all the 8 neighbors are in the same brick.
+            const Node &node = brickNode(lx >> LogBrickWidth, ly >> LogBrickWidth, lz >> LogBrickWidth);
+            if (node.childIndex == ConstantNode)
+                return node.value;
+            const float* data = &m_brickData[BrickVolume * node.childIndex];
+            const uint32_t mask = BrickWidth - 1;
+            const uint32_t ox[2] = {lx & mask, ux & mask};
+            const uint32_t oy[2] = {(ly & mask) * BrickWidth, (uy & mask) * BrickWidth};
+            const uint32_t oz[2] = {(lz & mask) * BrickWidth * BrickWidth, (uz & mask) * BrickWidth * BrickWidth};
+            for (int i = 0; i < 8; ++i)
+                v[i] = data[oz[(i >> 2) & 1] + oy[(i >> 1) & 1] + ox[i & 1]];
+        }
+        else {
+            v[0] = voxel(lx, ly, lz);
+            v[1] = voxel(ux, ly, lz);
+            v[2] = voxel(lx, uy, lz);
+            v[3] = voxel(ux, uy, lz);
+            v[4] = voxel(lx, ly, uz);
+            v[5] = voxel(ux, ly, uz);
+            v[6] = voxel(lx, uy, uz);
+            v[7] = voxel(ux, uy, uz);
+        }
+        
+        float density = (v[0] * wlz * wly * wlx +
+                         v[1] * wlz * wly * wux +
+                         v[2] * wlz * wuy * wlx +
+                         v[3] * wlz * wuy * wux +
+                         v[4] * wuz * wly * wlx +
+                         v[5] * wuz * wly * wux +
+                         v[6] * wuz * wuy * wlx +
+                         v[7] * wuz * wuy * wux);
+        return density;
+    }
+}
@@ -0,0 +1,131 @@
+//
+//  SparseDensityGrid.h
+//
+//  Created by 渡部 心 on 2017/06/22.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#ifndef __SLR_SparseDensityGrid__
+#define __SLR_SparseDensityGrid__
+
+#include "../defines.h"
+#include "../declarations.h"
+#include "../BasicTypes/Point3D.h"
+#include "../BasicTypes/Vector3D.h"
+#include "MajorantGrid.h"
+
+namespace SLR {
+    // References
+    // VDB: High-Resolution Sparse Volumes with Dynamic Topology
+    
+    // JP: 8^3ボクセルのブリックと16^3ブリックのタイルから成る2階層の疎なボリューム。
+    //     一定値のブリック・タイルはデータを持たず値だけを保持する。
+    //     各ノードは自身が覆うセルの補間値の上限(majorant)を保持し、レイに沿った階層的なDDAで空の領域を読み飛ばせる。
+    //     ボクセル値は密なグリッドと同じく頂点に置かれ、ボクセル座標[0, n - 1]がパラメター座標[0, 1]に対応する。
+    // EN: two-level sparse volume consisting of bricks of 8^3 voxels and tiles of 16^3 bricks.
+    //     Constant bricks and tiles hold only a value without data.
+    //     Each node holds an upper bound (majorant) of the interpolated value over the cells it covers,
+    //     and hierarchical DDA along a ray can skip empty regions.
+    //     Voxel values are placed at vertices as with the dense grid, voxel coordinates [0, n - 1] correspond to parameter coordinates [0, 1].
+    class SLR_API SparseDensityGrid {
+    public:
+        static const uint32_t LogBrickWidth = 3;
+        static const uint32_t BrickWidth = 1 << LogBrickWidth;
+        static const uint32_t BrickVolume = BrickWidth * BrickWidth * BrickWidth;
+        static const uint32_t LogTileWidth = 4; // in bricks
+        static const uint32_t TileWidth = 1 << LogTileWidth;
+        static const uint32_t TileVolume = TileWidth * TileWidth * TileWidth;
+        static const uint32_t TileWidthInVoxels = BrickWidth * TileWidth;
+        static const uint32_t ConstantNode = UINT32_MAX;
+    
+    private:
+        // JP: childIndexがConstantNodeの場合はvalueで埋め尽くされている。
+        //     タイルのchildIndexはm_brickNodes中の先頭(TileVolume単位)、ブリックのchildIndexはm_brickData中の先頭(BrickVolume単位)を指す。
+        // EN: the node is filled with "value" when childIndex is ConstantNode.
+        //     childIndex of a tile points the head in m_brickNodes (in TileVolume), and that of a brick points the head in m_brickData (in BrickVolume).
+        struct Node {
+            uint32_t childIndex;
+            float value;
+            float maxValue;
+        };
+        
+        uint32_t m_numVoxels[3];
+        uint32_t m_numBricks[3];
+        uint32_t m_numTiles[3];
+        std::vector<Node> m_tiles;
+        std::vector<Node> m_brickNodes;
+        std::vector<float> m_brickData;
+        float m_maxValue;
+        
+        const Node &brickNode(uint32_t bx, uint32_t by, uint32_t bz) const {
+            const Node &tile = m_tiles[(m_numTiles[1] * (bz >> LogTileWidth) + (by >> LogTileWidth)) * m_numTiles[0] + (bx >> LogTileWidth)];
+            if (tile.childIndex == ConstantNode)
+                return tile;
+            const uint32_t mask = TileWidth - 1;
+            return m_brickNodes[TileVolume * tile.childIndex + (((bz & mask) << LogTileWidth) + (by & mask)) * TileWidth + (bx & mask)];
+        }
+        
+        void buildTile(uint32_t tx, uint32_t ty, uint32_t tz, const std::function<float(uint32_t, uint32_t, uint32_t)> &getVoxel, float tolerance,
+                       std::vector<Node>* brickNodes, std::vector<float>* brickData, Node* tile) const;
+        
+        SparseDensityGrid() { }
+    public:
+        SparseDensityGrid(uint32_t numX, uint32_t numY, uint32_t numZ, const std::function<float(uint32_t, uint32_t, uint32_t)> &getVoxel, float tolerance = 0.0f);
+        
+        // JP: 構築済みの階層をそのままファイルに書き出す、または読み込む。読み込みに失敗した場合はnullptrを返す。
+        // EN: write the built hierarchy as is to a file, or read it. Reading returns nullptr on failure.
+        bool write(FILE* fp) const;
+        static SparseDensityGrid* read(FILE* fp);
+        
+        uint32_t numVoxels(int axis) const { return m_numVoxels[axis]; }
+        float maxValue() const { return m_maxValue; }
+        size_t memorySize() const {
+            return sizeof(Node) * (m_tiles.size() + m_brickNodes.size()) + sizeof(float) * m_brickData.size();
+        }
+        
+        float voxel(uint32_t x, uint32_t y, uint32_t z) const {
+            const Node &node = brickNode(x >> LogBrickWidth, y >> LogBrickWidth, z >> LogBrickWidth);
+            if (node.childIndex == ConstantNode)
+                return node.value;
+            const uint32_t mask = BrickWidth - 1;
+            return m_brickData[BrickVolume * node.childIndex + (((z & mask) << LogBrickWidth) + (y & mask)) * BrickWidth + (x & mask)];
+        }
+        
+        // JP: パラメター座標[0, 1]^3における3線形補間値。範囲外では0を返す。
+        // EN: trilinearly interpolated value at parameter coordinates [0, 1]^3. This returns 0 outside the range.
+        float evaluate(const Point3D &param) const;
+        
+        // JP: ボクセル座標で表したレイに沿って一定のmajorantを持つ区間を順に列挙する。
+        //     func(t0, t1, majorant)がfalseを返すと走査を打ち切る。
+        // EN: enumerate intervals with constant majorant in order along a ray represented in voxel coordinates.
+        //     The traversal is aborted when func(t0, t1, majorant) returns false.
+        template <typename Func>
+        void traverseMajorants(const Point3D &org, const Vector3D &dir, float tMin, float tMax, Func func) const {
+            // clip the segment by the grid domain [0, n - 1]^3.
+            const float extent[3] = {(float)(m_numVoxels[0] - 1), (float)(m_numVoxels[1] - 1), (float)(m_numVoxels[2] - 1)};
+            if (!clipByBox(org, dir, extent, &tMin, &tMax))
+                return;
+            
+            const int32_t tileLo[3] = {0, 0, 0};
+            const int32_t tileHi[3] = {(int32_t)m_numTiles[0] - 1, (int32_t)m_numTiles[1] - 1, (int32_t)m_numTiles[2] - 1};
+            traverseUniformGrid(org, dir, (float)TileWidthInVoxels, tileLo, tileHi, tMin, tMax, [&](const int32_t tileIdx[3], float t0, float t1) {
+                const Node &tile = m_tiles[(m_numTiles[1] * tileIdx[2] + tileIdx[1]) * m_numTiles[0] + tileIdx[0]];
+                if (tile.childIndex == ConstantNode || tile.maxValue == 0.0f)
+                    return func(t0, t1, tile.maxValue);
+                
+                const Node* bricks = &m_brickNodes[TileVolume * tile.childIndex];
+                int32_t brickLo[3], brickHi[3];
+                for (int i = 0; i < 3; ++i) {
+                    brickLo[i] = tileIdx[i] * TileWidth;
+                    brickHi[i] = std::min(brickLo[i] + (int32_t)TileWidth, (int32_t)m_numBricks[i]) - 1;
+                }
+                return traverseUniformGrid(org, dir, (float)BrickWidth, brickLo, brickHi, t0, t1, [&](const int32_t brickIdx[3], float bt0, float bt1) {
+                    const Node &brick = bricks[(((brickIdx[2] - brickLo[2]) << LogTileWidth) + (brickIdx[1] - brickLo[1])) * TileWidth + (brickIdx[0] - brickLo[0])];
+                    return func(bt0, bt1, brick.maxValue);
+                });
+            });
+        }
+    };
+}
+
+#endif /* __SLR_SparseDensityGrid__ */
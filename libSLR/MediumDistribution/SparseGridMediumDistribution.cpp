@@ -0,0 +1,184 @@
+//
+//  SparseGridMediumDistribution.cpp
+//
+//  Created by 渡部 心 on 2017/06/22.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#include "SparseGridMediumDistribution.h"
+
+#include "../Core/light_path_sampler.h"
+
+namespace SLR {
+    // JP: グリッドの区分的に一定なmajorantに沿って仮の衝突点を順にサンプルし、onCollision(距離, majorant)を呼ぶ。
+    //     区間を跨ぐ際は残りの光学的厚さを持ち越す。onCollisionがfalseを返した距離、もしくはtMaxを返す。
+    // EN: sample tentative collisions in order along the piecewise constant majorants of the grid and call onCollision(distance, majorant).
+    //     The remaining optical depth is carried over across intervals. This returns the distance where onCollision returned false, or tMax.
+    float SparseGridMediumDistribution::trackMajorants(const Point3D &org, const Vector3D &dir, float tMin, float tMax, float base_sigma_e, FreePathSampler &sampler,
+                                                       const std::function<bool(float, float)> &onCollision) const {
+        float stoppedDistance = tMax;
+        float opticalDepth = -std::log(sampler.getSample());
+        m_grid->traverseMajorants(org, dir, tMin, tMax, [&](float t0, float t1, float maxDensity) {
+            float majorant = base_sigma_e * maxDensity;
+            if (majorant <= 0.0f)
+                return true;
+            float t = t0;
+            while (true) {
+                float intervalDepth = (t1 - t) * majorant;
+                if (opticalDepth >= intervalDepth) {
+                    opticalDepth -= intervalDepth;
+                    return true;
+                }
+                t += opticalDepth / majorant;
+                if (!onCollision(t, majorant)) {
+                    stoppedDistance = t;
+                    return false;
+                }
+                opticalDepth = -std::log(sampler.getSample());
+            }
+        });
+        return stoppedDistance;
+    }
+    
+    bool SparseGridMediumDistribution::subdivide(Allocator* mem, MediumDistribution** fragments, uint32_t* numFragments) const {
+        SLRAssert_NotImplemented();
+        return true;
+    }
+    
+    bool SparseGridMediumDistribution::interact(const Ray &ray, const RaySegment &segment, const WavelengthSamples &wls, LightPathSampler &pathSampler,
+                                                MediumInteraction *mi, SampledSpectrum *medThroughput, bool* singleWavelength) const {
+        SLRAssert(std::isfinite(segment.distMax), "distanceLimit must be a finite value.");
+        FreePathSampler &sampler = pathSampler.getFreePathSampler();
+        
+        SampledSpectrum base_sigma_e = m_base_sigma_e->evaluate(wls);
+        Point3D voxelOrg;
+        Vector3D voxelDir;
+        toVoxelSpace(ray, &voxelOrg, &voxelDir);
+        
+        // delta tracking to sample free path.
+        bool hit = false;
+        float extCoeffAtScattering = 0.0f;
+        float sampledDistance = trackMajorants(voxelOrg, voxelDir, segment.distMin, segment.distMax, base_sigma_e[wls.selectedLambdaIndex], sampler,
+                                               [&](float dist, float majorant) {
+                                                   Point3D queryPoint = ray.org + dist * ray.dir;
+                                                   Point3D param;
+                                                   m_region.calculateLocalCoordinates(queryPoint, &param);
+                                                   float extCoeff = base_sigma_e[wls.selectedLambdaIndex] * m_grid->evaluate(param);
+                                                   float probRealCollision = extCoeff / majorant;
+                                                   if (sampler.getSample() < probRealCollision) {
+                                                       hit = true;
+                                                       *mi = MediumInteraction(ray.time, dist, queryPoint, normalize(ray.dir), param.x, param.y, param.z);
+                                                       extCoeffAtScattering = extCoeff;
+                                                       return false;
+                                                   }
+                                                   return true;
+                                               });
+        
+        // estimate Monte Carlo throughput T(s, wl_j)/p(s, wl_i) by ratio tracking.
+        *singleWavelength = false;
+        if (wls.wavelengthSelected()) {
+            *medThroughput = SampledSpectrum::Zero;
+            (*medThroughput)[wls.selectedLambdaIndex] = 1.0f;
+        }
+        else {
+            SampledSpectrum mcThroughput = SampledSpectrum::One;
+            for (int wl = 0; wl < WavelengthSamples::NumComponents; ++wl) {
+                if (wl == wls.selectedLambdaIndex)
+                    continue;
+                
+                trackMajorants(voxelOrg, voxelDir, segment.distMin, sampledDistance, base_sigma_e[wl], sampler,
+                               [&](float dist, float majorant) {
+                                   Point3D queryPoint = ray.org + dist * ray.dir;
+                                   Point3D param;
+                                   m_region.calculateLocalCoordinates(queryPoint, &param);
+                                   SampledSpectrum extCoeff = base_sigma_e * m_grid->evaluate(param);
+                                   float probRealCollision = (extCoeff[wl] - extCoeff[wls.selectedLambdaIndex]) / majorant;
+                                   mcThroughput[wl] *= (1.0f - probRealCollision);
+                                   return true;
+                               });
+            }
+            *medThroughput = mcThroughput;
+        }
+        if (hit)
+            *medThroughput /= extCoeffAtScattering;
+        
+        return hit;
+    }
+    
+    SampledSpectrum SparseGridMediumDistribution::evaluateTransmittance(const Ray &ray, const RaySegment &segment, const WavelengthSamples &wls, LightPathSampler &pathSampler,
+                                                                        bool* singleWavelength) const {
+        SLRAssert(std::isfinite(segment.distMax), "distanceLimit must be a finite value.");
+        FreePathSampler &sampler = pathSampler.getFreePathSampler();
+        
+        SampledSpectrum base_sigma_e = m_base_sigma_e->evaluate(wls);
+        Point3D voxelOrg;
+        Vector3D voxelDir;
+        toVoxelSpace(ray, &voxelOrg, &voxelDir);
+        
+        // Ratio Tracking
+        const auto estimateTransmittance = [&, this](int wl) {
+            float transmittance = 1.0f;
+            trackMajorants(voxelOrg, voxelDir, segment.distMin, segment.distMax, base_sigma_e[wl], sampler,
+                           [&](float dist, float majorant) {
+                               Point3D queryPoint = ray.org + dist * ray.dir;
+                               Point3D param;
+                               m_region.calculateLocalCoordinates(queryPoint, &param);
+                               float extCoeff = base_sigma_e[wl] * m_grid->evaluate(param);
+                               float probRealCollision = extCoeff / majorant;
+                               transmittance *= (1.0f - probRealCollision);
+                               
+                               const float RRThreshold = 0.1f;
+                               if (transmittance < RRThreshold) {
+                                   if (sampler.getSample() < transmittance) {
+                                       transmittance = 1.0f;
+                                   }
+                                   else {
+                                       transmittance = 0.0f;
+                                       return false;
+                                   }
+                               }
+                               return true;
+                           });
+            
+            return transmittance;
+        };
+        
+        *singleWavelength = false;
+        SampledSpectrum transmittance = SampledSpectrum::Zero;
+        if (wls.wavelengthSelected()) {
+            transmittance[wls.selectedLambdaIndex] = estimateTransmittance(wls.selectedLambdaIndex);
+        }
+        else {
+            for (int wl = 0; wl < WavelengthSamples::NumComponents; ++wl)
+                transmittance[wl] = estimateTransmittance(wl);
+        }
+        
+        return transmittance;
+    }
+    
+    void SparseGridMediumDistribution::calculateMediumPoint(const MediumInteraction &mi, MediumPoint* medPt) const {
+        ReferenceFrame shadingFrame(mi.getIncomingDirection());
+        *medPt = MediumPoint(mi, false, shadingFrame);
+    }
+    
+    SampledSpectrum SparseGridMediumDistribution::evaluateExtinctionCoefficient(const Point3D &param, const WavelengthSamples &wls) const {
+        float density = m_grid->evaluate(param);
+        return density * m_base_sigma_e->evaluate(wls);
+    }
+    
+    SampledSpectrum SparseGridMediumDistribution::evaluateAlbedo(const Point3D &param, const WavelengthSamples &wls) const {
+        if (param.x < 0 || param.y < 0 || param.z < 0 ||
+            param.x > 1 || param.y > 1 || param.z > 1)
+            return SampledSpectrum::Zero;
+        
+        return m_base_sigma_s->evaluate(wls).safeDivide(m_base_sigma_e->evaluate(wls));
+    }
+    
+    void SparseGridMediumDistribution::sample(float u0, float u1, float u2, MediumPoint *medPt, float *volumePDF) const {
+        SLRAssert_NotImplemented();
+    }
+    
+    float SparseGridMediumDistribution::evaluateVolumePDF(const MediumPoint &medPt) const {
+        return 1.0f / volume();
+    }
+}
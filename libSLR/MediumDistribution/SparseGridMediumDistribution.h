@@ -0,0 +1,75 @@
+//
+//  SparseGridMediumDistribution.h
+//
+//  Created by 渡部 心 on 2017/06/22.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#ifndef __SLR_SparseGridMediumDistribution__
+#define __SLR_SparseGridMediumDistribution__
+
+#include "../defines.h"
+#include "../declarations.h"
+#include "../Core/geometry.h"
+#include "SparseDensityGrid.h"
+
+namespace SLR {
+    // JP: 疎な密度グリッドによる媒質。
+    //     グリッドの階層が持つ区分的に一定なmajorantを使ってdelta/ratio trackingを行い、空の領域を一度に読み飛ばす。
+    // EN: medium by a sparse density grid.
+    //     This performs delta/ratio tracking using piecewise constant majorants of the grid hierarchy to skip empty regions at once.
+    class SparseGridMediumDistribution : public MediumDistribution {
+        std::array<float, NumStrataForStorage> m_majorantExtinctionCoefficient;
+        BoundingBox3D m_region;
+        const AssetSpectrum* m_base_sigma_s;
+        const AssetSpectrum* m_base_sigma_e;
+        const SparseDensityGrid* m_grid;
+        Vector3D m_worldToVoxel;
+        
+        void toVoxelSpace(const Ray &ray, Point3D* org, Vector3D* dir) const {
+            *org = Point3D((ray.org - m_region.minP) * m_worldToVoxel);
+            *dir = ray.dir * m_worldToVoxel;
+        }
+        float trackMajorants(const Point3D &org, const Vector3D &dir, float tMin, float tMax, float base_sigma_e, FreePathSampler &sampler,
+                             const std::function<bool(float, float)> &onCollision) const;
+    public:
+        SparseGridMediumDistribution(const BoundingBox3D &region, const AssetSpectrum* base_sigma_s, const AssetSpectrum* base_sigma_e, const SparseDensityGrid* grid) :
+        m_region(region), m_base_sigma_s(base_sigma_s), m_base_sigma_e(base_sigma_e), m_grid(grid) {
+            Vector3D extent = m_region.maxP - m_region.minP;
+            m_worldToVoxel = Vector3D((m_grid->numVoxels(0) - 1) / extent.x, (m_grid->numVoxels(1) - 1) / extent.y, (m_grid->numVoxels(2) - 1) / extent.z);
+            
+            m_base_sigma_e->calcBounds(NumStrataForStorage, m_majorantExtinctionCoefficient.data());
+            for (int i = 0; i < NumStrataForStorage; ++i)
+                m_majorantExtinctionCoefficient[i] *= m_grid->maxValue();
+        }
+        ~SparseGridMediumDistribution() {
+            delete m_grid;
+        }
+        
+        float majorantExtinctionCoefficientAtWavelength(float wl) const override {
+            int index = (wl - WavelengthLowBound) / (WavelengthHighBound - WavelengthLowBound) * NumStrataForStorage;
+            index = std::clamp(index, 0, (int)NumStrataForStorage - 1);
+            return m_majorantExtinctionCoefficient[index];
+        }
+        
+        bool subdivide(Allocator* mem, MediumDistribution** fragments, uint32_t* numFragments) const override;
+        
+        BoundingBox3D bounds() const override { return m_region; }
+        bool contains(const Point3D &p) const override { return m_region.contains(p); }
+        bool intersectBoundary(const Ray &ray, const RaySegment &segment, float* distToBoundary, bool* enter) const override {
+            return m_region.intersectBoundary(ray, segment, distToBoundary, enter);
+        }
+        bool interact(const Ray &ray, const RaySegment &segment, const WavelengthSamples &wls, LightPathSampler &pathSampler,
+                      MediumInteraction* mi, SampledSpectrum* medThroughput, bool* singleWavelength) const override;
+        SampledSpectrum evaluateTransmittance(const Ray &ray, const RaySegment &segment, const WavelengthSamples &wls, LightPathSampler &pathSampler,
+                                              bool* singleWavelength) const override;
+        void calculateMediumPoint(const MediumInteraction &mi, MediumPoint* medPt) const override;
+        SampledSpectrum evaluateExtinctionCoefficient(const Point3D &param, const WavelengthSamples &wls) const override;
+        SampledSpectrum evaluateAlbedo(const Point3D &param, const WavelengthSamples &wls) const override;
+        float volume() const override { return m_region.volume(); }
+        void sample(float u0, float u1, float u2, MediumPoint* medPt, float* volumePDF) const override;
+        float evaluateVolumePDF(const MediumPoint& medPt) const override;
+    };
+}
+
+#endif /* __SLR_SparseGridMediumDistribution__ */
@@ -19,127 +19,7 @@
 #include "../Core/directional_distribution_functions.h"
 
 namespace SLR {
-    void KDTree::initialize(uint64_t expectedSize) {
-        m_numStored = 0;
-        
-        m_ptrParticles.clear();
-        m_ptrParticles.reserve(expectedSize);
-        
-        m_ptrParticles.push_back(NULL);
-        
-        m_BBox = BoundingBox3D();
-    }
-    
-    void KDTree::balance() {
-        if (m_numStored > 1) {
-            std::vector<Particle*> balancedList(m_numStored + 1);
-            balanceSegment(balancedList, 1, 1, m_numStored);
-            std::copy(balancedList.begin(), balancedList.end(), m_ptrParticles.begin());
-        }
-        
-        m_numHalfStored = m_numStored / 2 - 1;
-    }
-    
-    void KDTree::balanceSegment(std::vector<Particle*> &balanced, uint32_t index, uint32_t start, uint32_t end) {
-        int median = 1;
-        // medianを整列する領域の長さの半分に最も近い2のべき乗とする。（この段階では完全にそうはならない）
-        // length: 383, median: 128(128)
-        // length: 384, median: 128(128, 256)
-        // length: 385, median: 128(256)
-        // length: 511, median: 128(256)
-        // length: 512, median: 256(256)
-        // length: 513, median: 256(256)
-        // length: 640, median: 256(256)
-        // length: 768, median: 256(256, 512)
-        // length: 800, median: 256(512)
-        while ((4 * median) <= (end - start + 1))
-            median += median;
-        
-        // medianを領域の長さの半分に最も近い2のべき乗にして、適切なオフセットを加える。
-        // start: 1, end: 383, median: end - 128 + 1: 255
-        // start: 1, end: 384, median: 256 + start - 1: 256
-        // start: 1, end: 385, median: 256 + start - 1: 256
-        // start: 1, end: 511, median: 256 + start - 1: 256
-        // start: 1, end: 512, median: end - 256 + 1: 257
-        // start: 1, end: 513, median: end - 256 + 1: 258
-        // start: 1, end: 640, median: end - 256 + 1: 485
-        // start: 1, end: 768, median: 512 + start - 1: 512
-        // start: 1, end: 800, median: 512 + start - 1: 512
-        // length : 8 ~ 11: end-, 12 ~ 15: +start,
-        //         16 ~ 23: end-, 24 ~ 31: +start,
-        //         32 ~ 47: end-, 48 ~ 63: +start,
-        //         2^n ~ 2^n + 2^(n-1) - 1: end-
-        //         2^n + 2^(n-1) ~ 2^(n+1) - 1: +start
-        if ((3 * median) <= (end - start + 1)) {
-            median += median;
-            median += start - 1;
-        }
-        else {
-            median = end - median + 1;
-        }
-        
-        BoundingBox3D::Axis axis = m_BBox.widestAxis();
-        
-        // axis軸においてメディアンとなる値より小さい値を前に、大きい値を後ろに並べる。
-        auto compareFunc = [&axis](Particle* p0, Particle* p1) { return p0->position[axis] < p1->position[axis]; };
-        std::nth_element(m_ptrParticles.begin() + start, m_ptrParticles.begin() + median, m_ptrParticles.begin() + end + 1, compareFunc);
-        
-        balanced[index] = m_ptrParticles[median];
-        balanced[index]->plane = axis;
-        
-        // balance the left side segment.
-        if (start < median) {
-            if (start < median - 1) {
-                const float tmp = m_BBox.maxP[axis];
-                m_BBox.maxP[axis] = balanced[index]->position[axis];
-                balanceSegment(balanced, 2 * index, start, median - 1);
-                m_BBox.maxP[axis] = tmp;
-            }
-            else {
-                balanced[2 * index] = m_ptrParticles[start];
-            }
-        }
-        
-        // balance the right side segment.
-        if (median < end) {
-            if (median + 1 < end) {
-                const float tmp = m_BBox.minP[axis];
-                m_BBox.minP[axis] = balanced[index]->position[axis];
-                balanceSegment(balanced, 2 * index + 1, median + 1, end);
-                m_BBox.minP[axis] = tmp;
-            }
-            else {
-                balanced[2 * index + 1] = m_ptrParticles[end];
-            }
-        }
-    }
-    
-    void KDTree::locateParticlesInternal(uint32_t index, const Point3D &queryPos, float radius2, std::vector<Particle*> &particlesFound) const {
-        Particle* p = m_ptrParticles[index];
-        
-        // Recursively search.
-        if (index < m_numHalfStored) {
-            float vDist = queryPos[p->plane] - p->position[p->plane];
-            if (vDist > 0.0) {
-                locateParticlesInternal(2 * index + 1, queryPos, radius2, particlesFound);
-                if (vDist * vDist < radius2)
-                    locateParticlesInternal(2 * index, queryPos, radius2, particlesFound);
-            }
-            else {
-                locateParticlesInternal(2 * index, queryPos, radius2, particlesFound);
-                if (vDist * vDist < radius2)
-                    locateParticlesInternal(2 * index + 1, queryPos, radius2, particlesFound);
-            }
-        }
-        
-        // store the particle if it is in the search radius.
-        if (sqDistance(queryPos, p->position) < radius2)
-            particlesFound.push_back(p);
-    }
-    
-    
     void AMCMCPPMRenderer::HitpointMap::initialize(uint32_t numThreads, uint32_t numPixels) {
-        KDTree::initialize(numPixels * 3);
         m_numThreads = numThreads;
         m_points.resize(m_numThreads);
         for (int i = 0; i < m_numThreads; ++i) {
@@ -155,23 +35,11 @@ namespace SLR {
     }
     
     void AMCMCPPMRenderer::HitpointMap::build() {
-        for (int i = 0; i < m_numThreads; ++i) {
-            for (int j = 0; j < m_points[i].size(); ++j) {
-                m_ptrParticles.push_back(&(m_points[i][j]));
-                m_BBox.unify(m_points[i][j].position);
-            }
-            m_numStored += m_points[i].size();
-        }
-        balance();
-    }
-    
-    void AMCMCPPMRenderer::HitpointMap::queryHitpoints(const Point3D &pos, const Normal3D &gn, float radius, std::vector<Particle*> &pointsFound) const {
-        locateParticles(pos, radius * radius, pointsFound);
-        for (int i = 0; i < pointsFound.size(); ++i) {
-            Hitpoint &hp = *(Hitpoint*)pointsFound[i];
-            if (dot(Vector3D(gn), Vector3D(hp.gNormal)) < 0.707)
-                pointsFound[i] = nullptr;
-        }
+        m_storedPoints.clear();
+        for (int i = 0; i < m_numThreads; ++i)
+            m_storedPoints.insert(m_storedPoints.end(), m_points[i].begin(), m_points[i].end());
+        m_tree.build((uint32_t)m_storedPoints.size(), [this](uint32_t idx) { return m_storedPoints[idx].position; }, m_numThreads);
+        m_tree.reorderPayload(&m_storedPoints);
     }
     
     
@@ -640,7 +508,6 @@ namespace SLR {
         float initY = alpha.luminance();
         uint32_t pathLength = 0;
         
-        std::vector<Particle*> hitpoints;
         while (true) {
             ++pathLength;
             Intersection isect;
@@ -652,12 +519,8 @@ namespace SLR {
             // FIXME: should I consider the delta check using hitpoint's BSDF?
             BSDF* bsdf = surfPt.createBSDF(wls, mem);
             if (bsdf->hasNonDelta()) {
-                hpMap->queryHitpoints(surfPt.p, surfPt.gNormal, radius, hitpoints);
                 float kernelWeight = 1.0f / (M_PI * radius * radius);
-                for (int i = 0; i < hitpoints.size(); ++i) {
-                    if (!hitpoints[i])
-                        continue;
-                    Hitpoint &hp = *(Hitpoint*)hitpoints[i];
+                hpMap->queryHitpoints(surfPt.p, surfPt.gNormal, radius, [&](const Hitpoint &hp) {
                     Vector3D dirIn_sn = hp.shadingFrame.toLocal(-ray.dir);
                     Normal3D gNorm_sn = hp.shadingFrame.toLocal(hp.gNormal);
                     BSDFQuery queryBSDF(dirIn_sn, gNorm_sn, wls.selectedLambda);
@@ -667,7 +530,7 @@ namespace SLR {
                               contribution.toString().c_str());
                     results.emplace_back(hp.imgX, hp.imgY, contribution);
                     I = 1.0;
-                }
+                });
             }
             
             Vector3D dirIn_sn = surfPt.shadingFrame.toLocal(-ray.dir);
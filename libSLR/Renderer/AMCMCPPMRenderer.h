@@ -15,39 +15,12 @@
 #include "../Core/geometry.h"
 #include "../Core/RandomNumberGenerator.h"
 #include "../Core/directional_distribution_functions.h"
+#include "../Accelerator/PointKDTree.h"
 
 namespace SLR {
-    struct SLR_API Particle {
-        Point3D position;
-        BoundingBox3D::Axis plane;
-        Particle() { };
-        Particle(const Point3D &pos) : position(pos) { };
-    };
-    
-    class SLR_API KDTree {
-    protected:
-        BoundingBox3D m_BBox;
-        uint32_t m_numStored;
-        uint32_t m_numHalfStored;
-        
-        std::vector<Particle*> m_ptrParticles;
-        
-        void balanceSegment(std::vector<Particle*> &balanced, uint32_t index, uint32_t start, uint32_t end);
-        void locateParticlesInternal(uint32_t index, const Point3D &queryPos, float radius2, std::vector<Particle*> &particlesFound) const;
-    public:
-        void initialize(uint64_t expectedSize);
-        uint32_t numStored() const { return m_numStored; };
-        void balance();
-        void locateParticles(const Point3D &queryPos, float radius2, std::vector<Particle*> &particlesFound) const {
-            particlesFound.clear();
-            if (m_numStored < 1)
-                return;
-            locateParticlesInternal(1, queryPos, radius2, particlesFound);
-        };
-    };
-    
     class SLR_API AMCMCPPMRenderer : public Renderer {
-        struct Hitpoint : public Particle {
+        struct Hitpoint {
+            Point3D position;
             float imgX, imgY;
             Normal3D gNormal;
             Vector3D dirOut_sn;
@@ -56,11 +29,13 @@ namespace SLR {
             ReferenceFrame shadingFrame;
             
             Hitpoint(float px, float py, const Point3D &pos, const Normal3D &gn, const Vector3D &dirO_sn, const SampledSpectrum &w, const BSDF* f, const ReferenceFrame &frame) :
-            Particle(pos), imgX(px), imgY(py), gNormal(gn), dirOut_sn(dirO_sn), weight(w), bsdf(f), shadingFrame(frame) { };
+            position(pos), imgX(px), imgY(py), gNormal(gn), dirOut_sn(dirO_sn), weight(w), bsdf(f), shadingFrame(frame) { };
         };
         
-        class HitpointMap : public KDTree {
+        class HitpointMap {
             std::vector<std::vector<Hitpoint>> m_points;
+            std::vector<Hitpoint> m_storedPoints;
+            PointKDTree m_tree;
             uint32_t m_numThreads;
         public:
             HitpointMap() {};
@@ -71,7 +46,15 @@ namespace SLR {
                        const SampledSpectrum &weight, const Point3D &pos, const Normal3D &gn, const Vector3D &dir_sn,
                        const BSDF* f, const ReferenceFrame &frame);
             void build();
-            void queryHitpoints(const Point3D &pos, const Normal3D &gn_sn, float radius, std::vector<Particle*> &pointsFound) const;
+            template <typename ProcessHitpoint>
+            void queryHitpoints(const Point3D &pos, const Normal3D &gn, float radius, ProcessHitpoint process) const {
+                m_tree.queryRadius(pos, radius, [this, &gn, &process](uint32_t idx, float sqDist) {
+                    const Hitpoint &hp = m_storedPoints[idx];
+                    if (dot(Vector3D(gn), Vector3D(hp.gNormal)) < 0.707)
+                        return;
+                    process(hp);
+                });
+            }
         };
         
         struct PrimarySample {
@@ -227,7 +210,7 @@ namespace SLR {
     public:
         AMCMCPPMRenderer(uint32_t numPhotonsPerPass, uint32_t numPasses);
         void render(const Scene &scene, const RenderSettings &settings) const override;
-    };    
+    };
 }
 
 #endif
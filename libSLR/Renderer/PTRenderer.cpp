@@ -17,9 +17,14 @@
 #include "../RNG/XORShiftRNG.h"
 #include "../Scene/Scene.h"
 #include "../Helper/ThreadPool.h"
+#include "PathGuiding.h"
 
 namespace SLR {
-    PTRenderer::PTRenderer(uint32_t spp) : m_samplesPerPixel(spp) {
+    // JP: パスガイディング有効時に学習済みの分布から方向をサンプルする確率。
+    // EN: probability to sample a direction from the learned distribution when path guiding is enabled.
+    static const float GuidingSampleProb = 0.5f;
+    
+    PTRenderer::PTRenderer(uint32_t spp, bool pathGuiding) : m_samplesPerPixel(spp), m_pathGuiding(pathGuiding) {
         
     }
     
@@ -42,6 +47,15 @@ namespace SLR {
         job.mems = mems;
         job.pathSamplers = samplers;
         
+        // JP: 空間方向の分布はシーンを包む立方体上で学習する。
+        // EN: learn the spatial-directional distribution over the cube enclosing the scene.
+        SDTree* guidingTree = nullptr;
+        if (m_pathGuiding) {
+            Vector3D halfExtent(scene.getWorldRadius());
+            guidingTree = new SDTree(BoundingBox3D(scene.getWorldCenter() - halfExtent, scene.getWorldCenter() + halfExtent));
+        }
+        job.guidingTree = guidingTree;
+        
         job.camera = camera;
         job.sensor = sensor;
         job.timeStart = settings.getFloat(RenderSettingItem::TimeStart);
@@ -53,7 +67,7 @@ namespace SLR {
         
         sensor->init(job.imageWidth, job.imageHeight);
         
-        printf("Path Tracing: %u[spp]\n", m_samplesPerPixel);
+        printf("Path Tracing%s: %u[spp]\n", m_pathGuiding ? " with Path Guiding" : "", m_samplesPerPixel);
         ProgressReporter reporter;
         job.reporter = &reporter;
         
@@ -88,6 +102,11 @@ namespace SLR {
                 ++imgIdx;
                 if ((s + 1) == m_samplesPerPixel)
                     break;
+                
+                // JP: 学習の反復は描画画像の出力と同じく2倍ずつ長くする。
+                // EN: training iterations are doubled in length as with the image exports.
+                if (guidingTree)
+                    guidingTree->refine(numThreads);
                 exportPass += exportPass;
                 snprintf(nextTitle, sizeof(nextTitle), "To %5uspp", exportPass);
                 reporter.pushJob(nextTitle, (exportPass >> 1) * sensor->numTileX() * sensor->numTileY());
@@ -96,6 +115,7 @@ namespace SLR {
         reporter.popJob();
         reporter.finish();
         
+        delete guidingTree;
         delete[] samplers;
         delete[] mems;
     }
@@ -121,7 +141,16 @@ namespace SLR {
                 SampledSpectrum We1 = idf->sample(WeSample, &WeResult);
                 
                 Ray ray(lensResult.surfPt.getPosition(), lensResult.surfPt.fromLocal(WeResult.dirLocal), time);
-                SampledSpectrum C = contribution(*scene, wls, ray, pathSampler, mem);
+                
+                // JP: 画素座標に関するレイ微分。レンズ上の位置は画素座標に依存しない。
+                // EN: ray differentials with respect to the pixel coordinates. The position on the lens doesn't depend on the pixel coordinates.
+                RayDifferential rayDiff;
+                Vector3D dDdu0, dDdu1;
+                if (idf->calculateDirectionDerivatives(WeResult.dirLocal, &dDdu0, &dDdu1))
+                    rayDiff = RayDifferential(Vector3D::Zero, Vector3D::Zero,
+                                              lensResult.surfPt.fromLocal(dDdu0) / imageWidth, lensResult.surfPt.fromLocal(dDdu1) / imageHeight);
+                
+                SampledSpectrum C = contribution(*scene, wls, ray, rayDiff, pathSampler, mem);
                 SLRAssert(C.hasNaN() == false && C.hasInf() == false && C.hasNegative() == false,
                           "Unexpected value detected: %s\n"
                           "pix: (%f, %f)", C.toString().c_str(), p.x, p.y);
@@ -138,9 +167,12 @@ namespace SLR {
         reporter->update();
     }
     
-    SampledSpectrum PTRenderer::Job::contribution(const Scene &scene, const WavelengthSamples &initWLs, const Ray &initRay, IndependentLightPathSampler &pathSampler, ArenaAllocator &mem) const {
+    SampledSpectrum PTRenderer::Job::contribution(const Scene &scene, const WavelengthSamples &initWLs, const Ray &initRay, const RayDifferential &initRayDiff,
+                                                 IndependentLightPathSampler &pathSampler, ArenaAllocator &mem) const {
         WavelengthSamples wls = initWLs;
         Ray ray = initRay;
+        RayDifferential rayDiff = initRayDiff;
+        Vector3D dPdx, dPdy;
         RaySegment segment;
         SurfacePoint surfPt;
         SampledSpectrum alpha = SampledSpectrum::One;
@@ -148,10 +180,30 @@ namespace SLR {
         SampledSpectrumSum sp(SampledSpectrum::Zero);
         uint32_t pathLength = 0;
         
+        // JP: パスガイディングの学習用に、各頂点で得られた入射放射輝度の推定値を蓄積する。
+        // EN: accumulate estimates of incident radiance at each vertex to train path guiding.
+        struct GuidingVertex {
+            Point3D position;
+            Vector3D dirIn;
+            float throughput;
+            float dirPDF;
+            float radiance;
+        };
+        const uint32_t MaxPathLength = 100;
+        GuidingVertex guidingVertices[MaxPathLength];
+        uint32_t numGuidingVertices = 0;
+        auto addContribution = [&](const SampledSpectrum &contribution) {
+            sp += contribution;
+            float importance = contribution.importance(wls.selectedLambdaIndex);
+            for (int i = 0; i < numGuidingVertices; ++i)
+                guidingVertices[i].radiance += importance / guidingVertices[i].throughput;
+        };
+        
         SurfaceInteraction si;
         if (!scene.intersect(ray, segment, pathSampler, &si))
             return SampledSpectrum::Zero;
         si.calculateSurfacePoint(&surfPt);
+        surfPt.applyRayDifferential(ray, rayDiff, &dPdx, &dPdy);
         
         Vector3D dirOut_sn = surfPt.toLocal(-ray.dir);
         if (surfPt.isEmitting()) {
@@ -161,20 +213,25 @@ namespace SLR {
         }
         if (surfPt.atInfinity())
             return sp;
-
+        
         while (true) {
             ++pathLength;
-            if (pathLength >= 100)
+            if (pathLength >= MaxPathLength)
                 break;
             Normal3D gNorm_sn = surfPt.getLocalGeometricNormal();
             BSDF* bsdf = surfPt.createBSDF(wls, mem);
             BSDFQuery fsQuery(dirOut_sn, gNorm_sn, wls.selectedLambdaIndex);
             
+            // JP: デルタ成分を持たないBSDFに対してのみ学習済みの分布とBSDFを混合してサンプルする。
+            // EN: mix the learned distribution with the BSDF only for BSDFs without delta components.
+            bool guidable = guidingTree && !bsdf->hasDelta();
+            const DirectionalQuadtree* guideDist = guidable ? guidingTree->getSamplingDistribution(surfPt.getPosition()) : nullptr;
+            
             // Next Event Estimation (explicit light sampling)
             if (bsdf->hasNonDelta()) {
                 SurfaceLight light;
                 float lightProb;
-                scene.selectSurfaceLight(pathSampler.getLightSelectionSample(), ray.time, &light, &lightProb);
+                scene.selectSurfaceLight(surfPt.getPosition(), pathSampler.getLightSelectionSample(), ray.time, &light, &lightProb);
                 SLRAssert(std::isfinite(lightProb), "lightProb: unexpected value detected: %f", lightProb);
                 
                 LightPosQuery lpQuery(ray.time, wls);
@@ -196,7 +253,10 @@ namespace SLR {
                     
                     SampledSpectrum fs = bsdf->evaluate(fsQuery, shadowDir_sn);
                     float cosLight = lpResult.surfPt.calcCosTerm(-shadowDir);
-                    float bsdfPDF = bsdf->evaluatePDF(fsQuery, shadowDir_sn) * cosLight / dist2;
+                    float dirPDF = bsdf->evaluatePDF(fsQuery, shadowDir_sn);
+                    if (guideDist)
+                        dirPDF = (1 - GuidingSampleProb) * dirPDF + GuidingSampleProb * guideDist->evaluatePDF(shadowDir);
+                    float bsdfPDF = dirPDF * cosLight / dist2;
                     
                     float MISWeight = 1.0f;
                     if (!lpResult.posType.isDelta() && !std::isinf(lpResult.areaPDF))
@@ -204,14 +264,33 @@ namespace SLR {
                     SLRAssert(MISWeight <= 1.0f, "Invalid MIS weight: %g", MISWeight);
                     
                     float G = fractionalVisibility * absDot(shadowDir_sn, gNorm_sn) * cosLight / dist2;
-                    sp += alpha * Le * fs * (G * MISWeight / lightPDF);
+                    addContribution(alpha * Le * fs * (G * MISWeight / lightPDF));
                     SLRAssert(std::isfinite(G), "G: unexpected value detected: %f", G);
                 }
             }
             
-            // get a next direction by sampling BSDF.
+            // get a next direction by sampling BSDF or the learned distribution.
             BSDFQueryResult fsResult;
-            SampledSpectrum fs = bsdf->sample(fsQuery, pathSampler.getBSDFSample(), &fsResult);
+            SampledSpectrum fs;
+            if (guideDist) {
+                BSDFSample guideSample = pathSampler.getBSDFSample();
+                float guidePDF;
+                if (guideSample.uComponent < GuidingSampleProb) {
+                    Vector3D guidedDir = guideDist->sample(guideSample.uDir[0], guideSample.uDir[1], &guidePDF);
+                    fsResult.dirLocal = surfPt.toLocal(guidedDir);
+                    fsResult.sampledType = DirectionType();
+                    fs = bsdf->evaluate(fsQuery, fsResult.dirLocal);
+                    fsResult.dirPDF = bsdf->evaluatePDF(fsQuery, fsResult.dirLocal);
+                }
+                else {
+                    fs = bsdf->sample(fsQuery, pathSampler.getBSDFSample(), &fsResult);
+                    guidePDF = guideDist->evaluatePDF(surfPt.fromLocal(fsResult.dirLocal));
+                }
+                fsResult.dirPDF = (1 - GuidingSampleProb) * fsResult.dirPDF + GuidingSampleProb * guidePDF;
+            }
+            else {
+                fs = bsdf->sample(fsQuery, pathSampler.getBSDFSample(), &fsResult);
+            }
             if (fs == SampledSpectrum::Zero || fsResult.dirPDF == 0.0f)
                 break;
             if (fsResult.sampledType.isDispersive() && !wls.wavelengthSelected()) {
@@ -224,6 +303,22 @@ namespace SLR {
                       alpha.toString().c_str(), pathLength, absDot(fsResult.dirLocal, gNorm_sn), fsResult.dirPDF);
             
             Vector3D dirIn = surfPt.fromLocal(fsResult.dirLocal);
+            if (guidable) {
+                GuidingVertex &vertex = guidingVertices[numGuidingVertices];
+                vertex.position = surfPt.getPosition();
+                vertex.dirIn = dirIn;
+                vertex.throughput = alpha.importance(wls.selectedLambdaIndex);
+                vertex.dirPDF = fsResult.dirPDF;
+                vertex.radiance = 0.0f;
+                if (vertex.throughput > 0)
+                    ++numGuidingVertices;
+            }
+            // JP: レイ微分は鏡面反射・屈折を通してのみ追跡する。
+            // EN: ray differentials are tracked only through specular reflection or refraction.
+            if (fsResult.sampledType.isDelta())
+                rayDiff = surfPt.calcSpecularRayDifferential(ray, rayDiff, dPdx, dPdy, dirIn);
+            else
+                rayDiff = RayDifferential();
             ray = Ray(surfPt.getPosition(), dirIn, ray.time);
             segment = RaySegment(Ray::Epsilon);
             
@@ -232,6 +327,7 @@ namespace SLR {
             if (!scene.intersect(ray, segment, pathSampler, &si))
                 break;
             si.calculateSurfacePoint(&surfPt);
+            surfPt.applyRayDifferential(ray, rayDiff, &dPdx, &dPdy);
             
             dirOut_sn = surfPt.toLocal(-ray.dir);
             
@@ -242,7 +338,7 @@ namespace SLR {
                 EDF* edf = surfPt.createEDF(wls, mem);
                 SampledSpectrum Le = surfPt.emittance(wls) * edf->evaluate(EDFQuery(), dirOut_sn);
                 float dist2 = surfPt.getSquaredDistance(ray.org);
-                float lightPDF = si.getLightProb() * surfPt.evaluateAreaPDF() * dist2 / surfPt.calcCosTerm(ray.dir);
+                float lightPDF = si.getLightProbForOrigin() * surfPt.evaluateAreaPDF() * dist2 / surfPt.calcCosTerm(ray.dir);
                 SLRAssert(Le.allFinite(), "Le: unexpected value detected: %s", Le.toString().c_str());
                 SLRAssert(!std::isnan(lightPDF)/* && !std::isinf(lightPDF)*/, "lightPDF: unexpected value detected: %f", lightPDF);
                 
@@ -251,7 +347,7 @@ namespace SLR {
                     MISWeight = (bsdfPDF * bsdfPDF) / (lightPDF * lightPDF + bsdfPDF * bsdfPDF);
                 SLRAssert(MISWeight <= 1.0f, "Invalid MIS weight: %g", MISWeight);
                 
-                sp += alpha * Le * MISWeight;
+                addContribution(alpha * Le * MISWeight);
             }
             if (surfPt.atInfinity())
                 break;
@@ -264,6 +360,11 @@ namespace SLR {
                 break;
         }
         
+        for (int i = 0; i < numGuidingVertices; ++i) {
+            const GuidingVertex &vertex = guidingVertices[i];
+            guidingTree->record(vertex.position, vertex.dirIn, vertex.radiance / vertex.dirPDF);
+        }
+        
         return sp;
     }
 }
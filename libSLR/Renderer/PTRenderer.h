@@ -19,6 +19,7 @@ namespace SLR {
             
             ArenaAllocator* mems;
             IndependentLightPathSampler* pathSamplers;
+            SDTree* guidingTree;
             
             const Camera* camera;
             ImageSensor* sensor;
@@ -34,12 +35,14 @@ namespace SLR {
             ProgressReporter* reporter;
             
             void kernel(uint32_t threadID);
-            SampledSpectrum contribution(const Scene &scene, const WavelengthSamples &initWLs, const Ray &initRay, IndependentLightPathSampler &pathSampler, ArenaAllocator &mem) const;
+            SampledSpectrum contribution(const Scene &scene, const WavelengthSamples &initWLs, const Ray &initRay, const RayDifferential &initRayDiff,
+                                         IndependentLightPathSampler &pathSampler, ArenaAllocator &mem) const;
         };
         
         uint32_t m_samplesPerPixel;
+        bool m_pathGuiding;
     public:
-        PTRenderer(uint32_t spp);
+        PTRenderer(uint32_t spp, bool pathGuiding = false);
         void render(const Scene &scene, const RenderSettings &settings) const override;
     };    
 }
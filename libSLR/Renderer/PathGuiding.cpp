@@ -0,0 +1,261 @@
+//
+//  PathGuiding.cpp
+//
+//  Created by 渡部 心 on 2017/06/17.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#include "PathGuiding.h"
+
+#include "../Helper/ThreadPool.h"
+
+namespace SLR {
+    static inline void atomicAdd(std::atomic<float>* dst, float value) {
+        float cur = dst->load(std::memory_order_relaxed);
+        while (!dst->compare_exchange_weak(cur, cur + value, std::memory_order_relaxed));
+    }
+    
+    static inline void directionToCanonical(const Vector3D &dir, float* u, float* v) {
+        float phi = std::atan2(dir.y, dir.x);
+        if (phi < 0)
+            phi += 2 * M_PI;
+        *u = std::min(std::max(0.5f * (dir.z + 1), 0.0f), 0.99999994f);
+        *v = std::min(std::max(phi / float(2 * M_PI), 0.0f), 0.99999994f);
+    }
+    
+    static inline Vector3D canonicalToDirection(float u, float v) {
+        float cosTheta = 2 * u - 1;
+        float sinTheta = std::sqrt(std::max(1 - cosTheta * cosTheta, 0.0f));
+        float phi = 2 * M_PI * v;
+        return Vector3D(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta);
+    }
+    
+    
+    
+    void DirectionalQuadtree::record(const Vector3D &dir, float value) {
+        if (!std::isfinite(value) || value <= 0)
+            return;
+        float u, v;
+        directionToCanonical(dir, &u, &v);
+        uint32_t nodeIdx = 0;
+        while (true) {
+            Node &node = m_nodes[nodeIdx];
+            uint32_t qu = u >= 0.5f;
+            uint32_t qv = v >= 0.5f;
+            uint32_t q = qu + 2 * qv;
+            atomicAdd(&node.sums[q], value);
+            if (node.children[q] == 0)
+                break;
+            u = 2 * u - qu;
+            v = 2 * v - qv;
+            nodeIdx = node.children[q];
+        }
+    }
+    
+    Vector3D DirectionalQuadtree::sample(float u0, float u1, float* dirPDF) const {
+        float pdfUV = 1.0f;
+        float offsetU = 0.0f, offsetV = 0.0f;
+        float size = 1.0f;
+        uint32_t nodeIdx = 0;
+        while (true) {
+            const Node &node = m_nodes[nodeIdx];
+            float s[4] = {node.sums[0], node.sums[1], node.sums[2], node.sums[3]};
+            float total = s[0] + s[1] + s[2] + s[3];
+            if (total <= 0)
+                break;
+            
+            // JP: まずv方向の半分を選び、次にその中でu方向の半分を選ぶ。
+            // EN: choose a half in v first, then choose a half in u within it.
+            uint32_t qv = 0;
+            float probLowerV = (s[0] + s[1]) / total;
+            if (u1 < probLowerV) {
+                u1 = std::min(u1 / probLowerV, 0.99999994f);
+            }
+            else {
+                u1 = std::min((u1 - probLowerV) / (1 - probLowerV), 0.99999994f);
+                qv = 1;
+            }
+            float rowTotal = s[2 * qv] + s[2 * qv + 1];
+            uint32_t qu = 0;
+            float probLowerU = s[2 * qv] / rowTotal;
+            if (u0 < probLowerU) {
+                u0 = std::min(u0 / probLowerU, 0.99999994f);
+            }
+            else {
+                u0 = std::min((u0 - probLowerU) / (1 - probLowerU), 0.99999994f);
+                qu = 1;
+            }
+            uint32_t q = qu + 2 * qv;
+            
+            pdfUV *= 4 * s[q] / total;
+            size *= 0.5f;
+            offsetU += size * qu;
+            offsetV += size * qv;
+            if (node.children[q] == 0)
+                break;
+            nodeIdx = node.children[q];
+        }
+        
+        *dirPDF = pdfUV / (4 * M_PI);
+        return canonicalToDirection(offsetU + size * u0, offsetV + size * u1);
+    }
+    
+    float DirectionalQuadtree::evaluatePDF(const Vector3D &dir) const {
+        float u, v;
+        directionToCanonical(dir, &u, &v);
+        float pdfUV = 1.0f;
+        uint32_t nodeIdx = 0;
+        while (true) {
+            const Node &node = m_nodes[nodeIdx];
+            float total = node.total();
+            if (total <= 0)
+                break;
+            uint32_t qu = u >= 0.5f;
+            uint32_t qv = v >= 0.5f;
+            uint32_t q = qu + 2 * qv;
+            pdfUV *= 4 * node.sums[q] / total;
+            if (node.children[q] == 0 || pdfUV == 0)
+                break;
+            u = 2 * u - qu;
+            v = 2 * v - qv;
+            nodeIdx = node.children[q];
+        }
+        return pdfUV / (4 * M_PI);
+    }
+    
+    uint32_t DirectionalQuadtree::buildNode(const DirectionalQuadtree &src, int32_t srcNodeIdx, float srcEnergy, float threshold, uint32_t depth, uint32_t maxDepth) {
+        uint32_t nodeIdx = (uint32_t)m_nodes.size();
+        m_nodes.emplace_back();
+        for (int q = 0; q < 4; ++q) {
+            // JP: 元の木に子が無い場合はエネルギーが均等に分布していると見なす。
+            // EN: regard the energy as uniformly distributed when the source tree does not have a child.
+            int32_t srcChildIdx = -1;
+            float energy = 0.25f * srcEnergy;
+            if (srcNodeIdx >= 0) {
+                const Node &srcNode = src.m_nodes[srcNodeIdx];
+                energy = srcNode.sums[q];
+                srcChildIdx = srcNode.children[q] ? srcNode.children[q] : -1;
+            }
+            if (energy > threshold && depth < maxDepth) {
+                uint32_t childIdx = buildNode(src, srcChildIdx, energy, threshold, depth + 1, maxDepth);
+                m_nodes[nodeIdx].children[q] = childIdx;
+            }
+        }
+        return nodeIdx;
+    }
+    
+    void DirectionalQuadtree::rebuild(const DirectionalQuadtree &src, float threshold, uint32_t maxDepth) {
+        float total = src.total();
+        if (total <= 0) {
+            // JP: 記録が無い場合は構造を保ったまま値だけクリアする。
+            // EN: keep the structure and clear only the values when nothing was recorded.
+            for (int i = 0; i < m_nodes.size(); ++i)
+                for (int q = 0; q < 4; ++q)
+                    m_nodes[i].sums[q] = 0.0f;
+            return;
+        }
+        m_nodes.clear();
+        buildNode(src, 0, total, threshold * total, 1, maxDepth);
+    }
+    
+    
+    
+    SDTree::SDTree(const BoundingBox3D &bounds) : m_bounds(bounds), m_iteration(0) {
+        Node root;
+        root.children[0] = root.children[1] = 0;
+        root.leafIndex = 0;
+        root.axis = 0;
+        root.isLeaf = true;
+        m_nodes.push_back(root);
+        m_leaves.emplace_back(new Leaf());
+    }
+    
+    const SDTree::Leaf &SDTree::findLeaf(const Point3D &p) const {
+        Vector3D d = p - m_bounds.minP;
+        Vector3D extent = m_bounds.maxP - m_bounds.minP;
+        float np[3] = {
+            std::min(std::max(d.x / extent.x, 0.0f), 1.0f),
+            std::min(std::max(d.y / extent.y, 0.0f), 1.0f),
+            std::min(std::max(d.z / extent.z, 0.0f), 1.0f)
+        };
+        uint32_t nodeIdx = 0;
+        while (!m_nodes[nodeIdx].isLeaf) {
+            const Node &node = m_nodes[nodeIdx];
+            float &x = np[node.axis];
+            if (x < 0.5f) {
+                x = 2 * x;
+                nodeIdx = node.children[0];
+            }
+            else {
+                x = 2 * x - 1;
+                nodeIdx = node.children[1];
+            }
+        }
+        return *m_leaves[m_nodes[nodeIdx].leafIndex];
+    }
+    
+    void SDTree::subdivide(uint32_t nodeIdx, uint32_t sampleThreshold) {
+        if (!m_nodes[nodeIdx].isLeaf) {
+            uint32_t c0 = m_nodes[nodeIdx].children[0];
+            uint32_t c1 = m_nodes[nodeIdx].children[1];
+            subdivide(c0, sampleThreshold);
+            subdivide(c1, sampleThreshold);
+            return;
+        }
+        
+        uint32_t leafIdx = m_nodes[nodeIdx].leafIndex;
+        uint32_t numSamples = m_leaves[leafIdx]->numSamples;
+        if (numSamples <= sampleThreshold)
+            return;
+        
+        // JP: 葉を分割し、子は親の方向分布と半分の標本数を引き継ぐ。
+        // EN: split the leaf, the children inherit the parent's directional distribution and half of the sample count.
+        m_leaves[leafIdx]->numSamples = numSamples / 2;
+        uint32_t newLeafIdx = (uint32_t)m_leaves.size();
+        m_leaves.emplace_back(new Leaf(*m_leaves[leafIdx]));
+        
+        uint8_t childAxis = (m_nodes[nodeIdx].axis + 1) % 3;
+        uint32_t childIndices[2];
+        uint32_t leafIndices[2] = {leafIdx, newLeafIdx};
+        for (int i = 0; i < 2; ++i) {
+            Node child;
+            child.children[0] = child.children[1] = 0;
+            child.leafIndex = leafIndices[i];
+            child.axis = childAxis;
+            child.isLeaf = true;
+            childIndices[i] = (uint32_t)m_nodes.size();
+            m_nodes.push_back(child);
+        }
+        Node &node = m_nodes[nodeIdx];
+        node.isLeaf = false;
+        node.children[0] = childIndices[0];
+        node.children[1] = childIndices[1];
+        
+        subdivide(childIndices[0], sampleThreshold);
+        subdivide(childIndices[1], sampleThreshold);
+    }
+    
+    void SDTree::refine(uint32_t numThreads) {
+        const uint32_t SpatialThresholdCoeff = 12000;
+        const float DirectionalThreshold = 0.01f;
+        const uint32_t MaxDirectionalDepth = 20;
+        
+        // JP: 標本数の閾値は反復ごとに√2倍する。
+        // EN: the sample count threshold is scaled by √2 every iteration.
+        uint32_t sampleThreshold = (uint32_t)(SpatialThresholdCoeff * std::pow(2.0f, 0.5f * m_iteration));
+        subdivide(0, sampleThreshold);
+        
+        ThreadPool threadPool(numThreads);
+        for (int i = 0; i < m_leaves.size(); ++i) {
+            Leaf* leaf = m_leaves[i].get();
+            threadPool.enqueue([leaf, DirectionalThreshold, MaxDirectionalDepth](uint32_t threadID) {
+                leaf->sampling = leaf->building;
+                leaf->building.rebuild(leaf->sampling, DirectionalThreshold, MaxDirectionalDepth);
+                leaf->numSamples = 0;
+            });
+        }
+        threadPool.wait();
+        
+        ++m_iteration;
+    }
+}
@@ -0,0 +1,123 @@
+//
+//  PathGuiding.h
+//
+//  Created by 渡部 心 on 2017/06/17.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#ifndef __SLR_PathGuiding__
+#define __SLR_PathGuiding__
+
+#include "../defines.h"
+#include "../declarations.h"
+#include "../BasicTypes/BoundingBox3D.h"
+
+#include <atomic>
+
+namespace SLR {
+    // References
+    // Practical Path Guiding for Efficient Light-Transport Simulation
+    
+    // JP: 入射放射輝度の方向分布を表す四分木。
+    //     方向は(cosθ, φ)の円柱座標を通して[0, 1)^2に面積保存的に写像される。
+    // EN: quadtree representing a directional distribution of incident radiance.
+    //     Directions are mapped to [0, 1)^2 area-preservingly through cylindrical coordinates (cosθ, φ).
+    class SLR_API DirectionalQuadtree {
+        struct Node {
+            std::atomic<float> sums[4];
+            uint32_t children[4];
+            
+            Node() {
+                for (int i = 0; i < 4; ++i) {
+                    sums[i] = 0.0f;
+                    children[i] = 0;
+                }
+            }
+            Node(const Node &node) {
+                for (int i = 0; i < 4; ++i) {
+                    sums[i] = node.sums[i].load(std::memory_order_relaxed);
+                    children[i] = node.children[i];
+                }
+            }
+            Node &operator=(const Node &node) {
+                for (int i = 0; i < 4; ++i) {
+                    sums[i] = node.sums[i].load(std::memory_order_relaxed);
+                    children[i] = node.children[i];
+                }
+                return *this;
+            }
+            
+            float total() const {
+                return sums[0] + sums[1] + sums[2] + sums[3];
+            }
+        };
+        
+        std::vector<Node> m_nodes;
+        
+        uint32_t buildNode(const DirectionalQuadtree &src, int32_t srcNodeIdx, float srcEnergy, float threshold, uint32_t depth, uint32_t maxDepth);
+    public:
+        DirectionalQuadtree() : m_nodes(1) {}
+        
+        void record(const Vector3D &dir, float value);
+        
+        float total() const { return m_nodes[0].total(); }
+        Vector3D sample(float u0, float u1, float* dirPDF) const;
+        float evaluatePDF(const Vector3D &dir) const;
+        
+        // JP: 構造をsrcのエネルギー分布に合わせて細分化・統合し、記録値をクリアする。
+        // EN: subdivide and merge the structure according to the energy distribution of src, then clear the recorded values.
+        void rebuild(const DirectionalQuadtree &src, float threshold, uint32_t maxDepth);
+    };
+    
+    
+    
+    // JP: 空間を二分木で、各葉における方向分布を四分木で表すSD-tree。
+    //     描画中はbuilding側に並列に記録し、パスの間にsampling側と入れ替えて細分化する。
+    // EN: SD-tree representing space by a binary tree and the directional distribution in each leaf by a quadtree.
+    //     Samples are recorded to the building side in parallel during rendering,
+    //     then swapped with the sampling side and refined between passes.
+    class SLR_API SDTree {
+        struct Node {
+            uint32_t children[2];
+            uint32_t leafIndex;
+            uint8_t axis;
+            bool isLeaf;
+        };
+        
+        struct Leaf {
+            DirectionalQuadtree sampling;
+            DirectionalQuadtree building;
+            std::atomic<uint32_t> numSamples;
+            
+            Leaf() : numSamples(0) {}
+            Leaf(const Leaf &leaf) : sampling(leaf.sampling), building(leaf.building), numSamples(leaf.numSamples.load()) {}
+        };
+        
+        BoundingBox3D m_bounds;
+        std::vector<Node> m_nodes;
+        std::vector<std::unique_ptr<Leaf>> m_leaves;
+        uint32_t m_iteration;
+        
+        const Leaf &findLeaf(const Point3D &p) const;
+        void subdivide(uint32_t nodeIdx, uint32_t sampleThreshold);
+    public:
+        SDTree(const BoundingBox3D &bounds);
+        
+        void record(const Point3D &p, const Vector3D &dir, float value) {
+            Leaf &leaf = const_cast<Leaf &>(findLeaf(p));
+            leaf.building.record(dir, value);
+            leaf.numSamples.fetch_add(1, std::memory_order_relaxed);
+        }
+        
+        // JP: 学習済みの分布が無い場合はnullptrを返す。
+        // EN: returns nullptr when there is no learned distribution.
+        const DirectionalQuadtree* getSamplingDistribution(const Point3D &p) const {
+            const DirectionalQuadtree &dist = findLeaf(p).sampling;
+            return dist.total() > 0 ? &dist : nullptr;
+        }
+        
+        void refine(uint32_t numThreads);
+    };
+}
+
+#endif /* __SLR_PathGuiding__ */
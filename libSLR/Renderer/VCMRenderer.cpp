@@ -0,0 +1,715 @@
+//
+//  VCMRenderer.cpp
+//
+//  Created by 渡部 心 on 2017/06/12.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#include "VCMRenderer.h"
+
+#include <atomic>
+
+#include "../MemoryAllocators/ArenaAllocator.h"
+#include "../Core/random_number_generator.h"
+#include "../Core/camera.h"
+#include "../Core/light_path_sampler.h"
+#include "../Core/ImageSensor.h"
+#include "../Core/RenderSettings.h"
+#include "../Core/ProgressReporter.h"
+#include "../RNG/XORShiftRNG.h"
+#include "../Scene/Scene.h"
+#include "../Helper/ThreadPool.h"
+
+namespace SLR {
+    // power heuristic
+    static inline float MIS(float x) {
+        return x * x;
+    }
+    
+    
+    
+    uint32_t VCMRenderer::PhotonHashGrid::calcCellIndex(const Point3D &p) const {
+        Vector3D d = (p - m_bbox.minP) * m_invCellSize;
+        return calcCellIndex((int32_t)std::floor(d.x), (int32_t)std::floor(d.y), (int32_t)std::floor(d.z));
+    }
+    
+    void VCMRenderer::PhotonHashGrid::build(const std::vector<Photon>* photonLists, uint32_t numLists, float radius, uint32_t numThreads) {
+        m_radius = radius;
+        m_sqRadius = radius * radius;
+        m_invCellSize = 1.0f / (2 * radius);
+        
+        std::vector<uint32_t> listOffsets(numLists + 1);
+        listOffsets[0] = 0;
+        m_bbox = BoundingBox3D();
+        for (int i = 0; i < numLists; ++i) {
+            listOffsets[i + 1] = listOffsets[i] + (uint32_t)photonLists[i].size();
+            for (int j = 0; j < photonLists[i].size(); ++j)
+                m_bbox.unify(photonLists[i][j].position);
+        }
+        uint32_t numPhotons = listOffsets[numLists];
+        
+        // JP: 総フォトン数以上の2のべき乗をセル数とする。
+        // EN: the number of cells is the smallest power of two not less than the total number of photons.
+        uint32_t numCells = 1;
+        while (numCells < numPhotons)
+            numCells <<= 1;
+        m_cellMask = numCells - 1;
+        
+        m_photons.resize(numPhotons);
+        m_cellEnds.resize(numCells);
+        if (numPhotons == 0) {
+            std::fill(m_cellEnds.begin(), m_cellEnds.end(), 0);
+            return;
+        }
+        
+        // JP: フォトンリストごとに並列にセルのインデックスを計算してセルごとのフォトン数を数える。
+        // EN: compute cell indices and count photons per cell in parallel over the photon lists.
+        std::vector<uint32_t> cellIndices(numPhotons);
+        std::unique_ptr<std::atomic<uint32_t>[]> cellCounters(new std::atomic<uint32_t>[numCells]);
+        for (int i = 0; i < numCells; ++i)
+            cellCounters[i] = 0;
+        {
+            ThreadPool threadPool(numThreads);
+            for (int i = 0; i < numLists; ++i) {
+                threadPool.enqueue([this, i, photonLists, &listOffsets, &cellIndices, &cellCounters](uint32_t threadID) {
+                    const std::vector<Photon> &photons = photonLists[i];
+                    uint32_t offset = listOffsets[i];
+                    for (int j = 0; j < photons.size(); ++j) {
+                        uint32_t cellIdx = calcCellIndex(photons[j].position);
+                        cellIndices[offset + j] = cellIdx;
+                        cellCounters[cellIdx].fetch_add(1, std::memory_order_relaxed);
+                    }
+                });
+            }
+            threadPool.wait();
+        }
+        
+        // JP: 累積和からセルの範囲を決定し、各カウンターを書き込み位置として再利用する。
+        // EN: determine cell ranges by prefix sum, then reuse the counters as scatter cursors.
+        uint32_t sum = 0;
+        for (int i = 0; i < numCells; ++i) {
+            uint32_t count = cellCounters[i];
+            cellCounters[i] = sum;
+            sum += count;
+            m_cellEnds[i] = sum;
+        }
+        
+        {
+            ThreadPool threadPool(numThreads);
+            for (int i = 0; i < numLists; ++i) {
+                threadPool.enqueue([this, i, photonLists, &listOffsets, &cellIndices, &cellCounters](uint32_t threadID) {
+                    const std::vector<Photon> &photons = photonLists[i];
+                    uint32_t offset = listOffsets[i];
+                    for (int j = 0; j < photons.size(); ++j) {
+                        uint32_t dstIdx = cellCounters[cellIndices[offset + j]].fetch_add(1, std::memory_order_relaxed);
+                        m_photons[dstIdx] = photons[j];
+                    }
+                });
+            }
+            threadPool.wait();
+        }
+    }
+    
+    template <typename ProcessPhoton>
+    void VCMRenderer::PhotonHashGrid::queryPhotons(const Point3D &p, ProcessPhoton process) const {
+        if (m_photons.empty())
+            return;
+        
+        // JP: セル幅は半径の2倍なので、クエリ位置が含まれるセルと各軸で近い側の隣接セルの計8セルを調べれば十分。
+        // EN: since the cell width is twice the radius, it is enough to look at 8 cells,
+        //     the cell containing the query position and its neighbors on the nearer side along each axis.
+        Vector3D d = (p - m_bbox.minP) * m_invCellSize;
+        Vector3D fd(std::floor(d.x), std::floor(d.y), std::floor(d.z));
+        int32_t ix[2] = {(int32_t)fd.x, (int32_t)fd.x + (d.x - fd.x < 0.5f ? -1 : 1)};
+        int32_t iy[2] = {(int32_t)fd.y, (int32_t)fd.y + (d.y - fd.y < 0.5f ? -1 : 1)};
+        int32_t iz[2] = {(int32_t)fd.z, (int32_t)fd.z + (d.z - fd.z < 0.5f ? -1 : 1)};
+        
+        uint32_t visitedCells[8];
+        uint32_t numVisited = 0;
+        for (int i = 0; i < 8; ++i) {
+            uint32_t cellIdx = calcCellIndex(ix[i & 0x01], iy[(i >> 1) & 0x01], iz[(i >> 2) & 0x01]);
+            
+            // JP: ハッシュの衝突で同じセルを二重に走査しないようにする。
+            // EN: avoid visiting the same cell twice due to hash collisions.
+            bool visited = false;
+            for (int j = 0; j < numVisited; ++j) {
+                if (visitedCells[j] == cellIdx) {
+                    visited = true;
+                    break;
+                }
+            }
+            if (visited)
+                continue;
+            visitedCells[numVisited++] = cellIdx;
+            
+            uint32_t start = cellIdx > 0 ? m_cellEnds[cellIdx - 1] : 0;
+            uint32_t end = m_cellEnds[cellIdx];
+            for (int j = start; j < end; ++j) {
+                const Photon &photon = m_photons[j];
+                if (sqDistance(photon.position, p) <= m_sqRadius)
+                    process(photon);
+            }
+        }
+    }
+    
+    
+    
+    VCMRenderer::VCMRenderer(uint32_t spp, float initialRadius, float radiusReductionAlpha) :
+    m_samplesPerPixel(spp), m_initialRadius(initialRadius), m_radiusReductionAlpha(radiusReductionAlpha) {
+    }
+    
+    void VCMRenderer::render(const Scene &scene, const RenderSettings &settings) const {
+        uint32_t numThreads = settings.getInt(RenderSettingItem::NumThreads);
+        XORShiftRNG topRand(settings.getInt(RenderSettingItem::RNGSeed));
+        ArenaAllocator* mems = new ArenaAllocator[numThreads];
+        IndependentLightPathSampler* samplers = new IndependentLightPathSampler[numThreads];
+        for (int i = 0; i < numThreads; ++i) {
+            new (mems + i) ArenaAllocator();
+            new (samplers + i) IndependentLightPathSampler(topRand.getUInt());
+        }
+        std::vector<Photon>* photonLists = new std::vector<Photon>[numThreads];
+        PhotonHashGrid photonGrid;
+        
+        const Camera* camera = scene.getCamera();
+        ImageSensor* sensor = camera->getSensor();
+        
+        Job job;
+        job.scene = &scene;
+        
+        job.mems = mems;
+        job.pathSamplers = samplers;
+        job.photonLists = photonLists;
+        job.photonGrid = &photonGrid;
+        
+        job.camera = camera;
+        job.sensor = sensor;
+        job.timeStart = settings.getFloat(RenderSettingItem::TimeStart);
+        job.timeEnd = settings.getFloat(RenderSettingItem::TimeEnd);
+        job.imageWidth = settings.getInt(RenderSettingItem::ImageWidth);
+        job.imageHeight = settings.getInt(RenderSettingItem::ImageHeight);
+        job.numPixelX = sensor->tileWidth();
+        job.numPixelY = sensor->tileHeight();
+        
+        sensor->init(job.imageWidth, job.imageHeight);
+        sensor->addSeparatedBuffers(numThreads);
+        
+        // JP: 1パスあたりの光源部分経路数は画素数と同じにする。
+        // EN: the number of light subpaths per pass is the same as the number of pixels.
+        const float numLightPaths = float(job.imageWidth) * job.imageHeight;
+        const float baseRadius = m_initialRadius * scene.getWorldRadius();
+        
+        printf("Vertex Connection and Merging: %u[spp], radius: %g\n", m_samplesPerPixel, baseRadius);
+        ProgressReporter reporter;
+        job.reporter = &reporter;
+        
+        reporter.pushJob("Rendering", m_samplesPerPixel * sensor->numTileX() * sensor->numTileY());
+        char nextTitle[32];
+        snprintf(nextTitle, sizeof(nextTitle), "To %5uspp", 1);
+        reporter.pushJob(nextTitle, 1 * sensor->numTileX() * sensor->numTileY());
+        uint32_t imgIdx = 0;
+        uint32_t exportPass = 1;
+        for (int s = 0; s < m_samplesPerPixel; ++s) {
+            // JP: パスごとにマージ半径を縮小する。
+            // EN: reduce the merging radius progressively.
+            float radius = baseRadius / std::pow(float(s + 1), 0.5f * (1 - m_radiusReductionAlpha));
+            float etaVCM = M_PI * radius * radius * numLightPaths;
+            job.MISVMWeightFactor = MIS(etaVCM);
+            job.MISVCWeightFactor = MIS(1.0f / etaVCM);
+            job.VMNormalization = 1.0f / etaVCM;
+            
+            // JP: フォトンの結合のため、1パス内の全経路で波長サンプルを共有する。
+            // EN: all the paths in a pass share the wavelength samples so that photons can be merged.
+            job.wls = WavelengthSamples::createWithEqualOffsets(topRand.getFloat0cTo1o(), topRand.getFloat0cTo1o(), &job.selectWLPDF);
+            job.wlHint = job.wls.selectedLambdaIndex;
+            
+            // photon tracing pass
+            for (int i = 0; i < numThreads; ++i)
+                photonLists[i].clear();
+            {
+                ThreadPool threadPool(numThreads);
+                for (int ty = 0; ty < sensor->numTileY(); ++ty) {
+                    for (int tx = 0; tx < sensor->numTileX(); ++tx) {
+                        job.basePixelX = tx * sensor->tileWidth();
+                        job.basePixelY = ty * sensor->tileHeight();
+                        threadPool.enqueue(std::bind(&Job::photonTracingKernel, job, std::placeholders::_1));
+                    }
+                }
+                threadPool.wait();
+            }
+            photonGrid.build(photonLists, numThreads, radius, numThreads);
+            
+            // eye subpath tracing pass
+            {
+                ThreadPool threadPool(numThreads);
+                for (int ty = 0; ty < sensor->numTileY(); ++ty) {
+                    for (int tx = 0; tx < sensor->numTileX(); ++tx) {
+                        job.basePixelX = tx * sensor->tileWidth();
+                        job.basePixelY = ty * sensor->tileHeight();
+                        threadPool.enqueue(std::bind(&Job::renderingKernel, job, std::placeholders::_1));
+                    }
+                }
+                threadPool.wait();
+            }
+            
+            if ((s + 1) == exportPass) {
+                reporter.popJob();
+                
+                reporter.beginOtherThreadPrint();
+                char filename[256];
+                sprintf(filename, "%03u.bmp", imgIdx);
+                double elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(reporter.elapsed()).count();
+                sensor->saveImage(filename, settings.getFloat(RenderSettingItem::Brightness) / (s + 1));
+                printf("%u samples: %s, %g[s], radius: %g\n", exportPass, filename, elapsed * 0.001f, radius);
+                reporter.endOtherThreadPrint();
+                
+                ++imgIdx;
+                if ((s + 1) == m_samplesPerPixel)
+                    break;
+                exportPass += exportPass;
+                snprintf(nextTitle, sizeof(nextTitle), "To %5uspp", exportPass);
+                reporter.pushJob(nextTitle, (exportPass >> 1) * sensor->numTileX() * sensor->numTileY());
+            }
+        }
+        reporter.popJob();
+        reporter.finish();
+        
+        delete[] photonLists;
+        delete[] samplers;
+        delete[] mems;
+    }
+    
+    void VCMRenderer::Job::photonTracingKernel(uint32_t threadID) {
+        ArenaAllocator &mem = mems[threadID];
+        IndependentLightPathSampler &pathSampler = pathSamplers[threadID];
+        std::vector<Photon> &photons = photonLists[threadID];
+        for (int ly = 0; ly < numPixelY; ++ly) {
+            for (int lx = 0; lx < numPixelX; ++lx) {
+                if (basePixelX + lx >= imageWidth || basePixelY + ly >= imageHeight)
+                    continue;
+                float time = pathSampler.getTimeSample(timeStart, timeEnd);
+                lightVertices.clear();
+                generateLightSubPath(time, pathSampler, mem, &photons);
+                
+                mem.reset();
+            }
+        }
+    }
+    
+    void VCMRenderer::Job::renderingKernel(uint32_t threadID) {
+        ArenaAllocator &mem = mems[threadID];
+        IndependentLightPathSampler &pathSampler = pathSamplers[threadID];
+        for (int ly = 0; ly < numPixelY; ++ly) {
+            for (int lx = 0; lx < numPixelX; ++lx) {
+                float time = pathSampler.getTimeSample(timeStart, timeEnd);
+                PixelPosition p = pathSampler.getPixelPositionSample(basePixelX + lx, basePixelY + ly);
+                
+                // JP: 接続用の光源部分経路を生成する。マージ用のフォトンとは独立に生成する。
+                // EN: generate a light subpath for vertex connection independently of the photons for merging.
+                lightVertices.clear();
+                generateLightSubPath(time, pathSampler, mem, nullptr);
+                
+                // sample a ray with its importances (spatial, directional) from the lens and its IDF.
+                LensPosQuery lensQuery(time, wls);
+                LensPosQueryResult lensResult;
+                IDFSample WeSample(p.x / imageWidth, p.y / imageHeight);
+                IDFQueryResult WeResult;
+                IDF* idf;
+                SampledSpectrum We0, We1;
+                Ray ray;
+                float epsilon;
+                camera->sampleRay(lensQuery, pathSampler.getLensPosSample(), WeSample, mem,
+                                  &lensResult, &We0, &idf, &WeResult, &We1, &ray, &epsilon);
+                const SurfacePoint &lensPt = lensResult.surfPt;
+                SampledSpectrum lensAlpha = We0 / (lensResult.areaPDF * selectWLPDF);
+                
+                // ----------------------------------------------------------------
+                // light tracing (connect light subpath vertices to the lens)
+                
+                for (int i = 0; i < lightVertices.size(); ++i) {
+                    const VCMVertex &lVtx = lightVertices[i];
+                    
+                    float dist2;
+                    Vector3D connectionVector = lVtx.surfPt.getDirectionFrom(lensPt.getPosition(), &dist2);
+                    float cosLightEnd = lVtx.surfPt.calcCosTerm(connectionVector);
+                    float cosLens = lensPt.calcCosTerm(connectionVector);
+                    
+                    Vector3D eConnectVector = lensPt.toLocal(connectionVector);
+                    SampledSpectrum We1Connect = idf->evaluate(eConnectVector);
+                    if (We1Connect == SampledSpectrum::Zero)
+                        continue;
+                    float cameraDirPDF = idf->evaluatePDF(eConnectVector);
+                    
+                    Vector3D lConnectVector = lVtx.surfPt.toLocal(-connectionVector);
+                    SampledSpectrum lRevDDF;
+                    SampledSpectrum lDDF = lVtx.ddf->evaluate(lConnectVector, &lRevDDF);
+                    float lRevDirPDF;
+                    lVtx.ddf->evaluatePDF(lConnectVector, &lRevDirPDF);
+                    
+                    float fractionalVisibility;
+                    if (!scene->testVisibility(lensPt, lVtx.surfPt, time, &fractionalVisibility))
+                        continue;
+                    
+                    float cameraAreaPDF = cameraDirPDF * cosLightEnd / dist2;
+                    float wLight = MIS(cameraAreaPDF) * (MISVMWeightFactor + lVtx.mis.dVCM + lVtx.mis.dVC * MIS(lRevDirPDF));
+                    float MISWeight = 1.0f / (wLight + 1.0f);
+                    if (!std::isfinite(MISWeight))
+                        continue;
+                    
+                    float G = fractionalVisibility * cosLens * cosLightEnd / dist2;
+                    SampledSpectrum contribution = MISWeight * lVtx.alpha * lDDF * G * We1Connect * lensAlpha;
+                    if (lVtx.lambdaSelected)
+                        contribution[wls.selectedLambdaIndex] *= WavelengthSamples::NumComponents;
+                    SLRAssert(contribution.allFinite() && !contribution.hasNegative(),
+                              "Unexpected value detected: %s\n"
+                              "pix: (%f, %f)", contribution.toString().c_str(), p.x, p.y);
+                    
+                    float hitPx, hitPy;
+                    idf->calculatePixel(eConnectVector, &hitPx, &hitPy);
+                    sensor->add(threadID, hitPx, hitPy, wls, contribution);
+                }
+                
+                // ----------------------------------------------------------------
+                
+                
+                
+                // ----------------------------------------------------------------
+                // eye subpath tracing
+                
+                WavelengthSamples eWLs = wls;
+                SampledSpectrum alpha = lensAlpha * We1 * (lensPt.calcCosTerm(ray.dir) / WeResult.dirPDF);
+                MISState eMIS;
+                eMIS.dVCM = MIS(1.0f / WeResult.dirPDF);
+                eMIS.dVC = 0.0f;
+                eMIS.dVM = 0.0f;
+                SampledSpectrumSum C(SampledSpectrum::Zero);
+                
+                RaySegment segment(epsilon);
+                SurfaceInteraction si;
+                SurfacePoint surfPt;
+                uint32_t pathLength = 0;
+                while (scene->intersect(ray, segment, pathSampler, &si)) {
+                    si.calculateSurfacePoint(&surfPt);
+                    ++pathLength;
+                    
+                    float dist2 = surfPt.getSquaredDistance(ray.org);
+                    float cosIn = surfPt.calcCosTerm(ray.dir);
+                    eMIS.dVCM *= MIS(dist2);
+                    eMIS.dVCM /= MIS(cosIn);
+                    eMIS.dVC /= MIS(cosIn);
+                    eMIS.dVM /= MIS(cosIn);
+                    
+                    Vector3D dirOut_sn = surfPt.toLocal(-ray.dir);
+                    Normal3D gNorm_sn = surfPt.getLocalGeometricNormal();
+                    
+                    // implicit path (zero light subpath vertices)
+                    if (surfPt.isEmitting()) {
+                        EDF* edf = surfPt.createEDF(eWLs, mem);
+                        SampledSpectrum Le = surfPt.emittance(eWLs) * edf->evaluate(EDFQuery(), dirOut_sn);
+                        
+                        float MISWeight = 1.0f;
+                        if (pathLength > 1) {
+                            float lightAreaPDF = si.getLightProb() * surfPt.evaluateAreaPDF();
+                            float emitDirPDF = edf->evaluatePDF(EDFQuery(), dirOut_sn);
+                            float wCamera = MIS(lightAreaPDF) * eMIS.dVCM + MIS(lightAreaPDF * emitDirPDF) * eMIS.dVC;
+                            MISWeight = 1.0f / (1.0f + wCamera);
+                        }
+                        if (std::isfinite(MISWeight)) {
+                            SampledSpectrum contribution = MISWeight * alpha * Le;
+                            if (eWLs.wavelengthSelected())
+                                contribution[eWLs.selectedLambdaIndex] *= WavelengthSamples::NumComponents;
+                            C += contribution;
+                        }
+                    }
+                    if (surfPt.atInfinity())
+                        break;
+                    
+                    BSDF* bsdf = surfPt.createBSDF(eWLs, mem);
+                    BSDFQuery fsQuery(dirOut_sn, gNorm_sn, eWLs.selectedLambdaIndex, DirectionType::All, true, false);
+                    
+                    if (bsdf->hasNonDelta()) {
+                        // ----------------------------------------------------------------
+                        // next event estimation (one light subpath vertex)
+                        
+                        {
+                            SurfaceLight light;
+                            float lightProb;
+                            scene->selectSurfaceLight(pathSampler.getLightSelectionSample(), time, &light, &lightProb);
+                            SLRAssert(std::isfinite(lightProb), "lightProb: unexpected value detected: %f", lightProb);
+                            
+                            LightPosQuery lpQuery(time, eWLs);
+                            SurfaceLightPosQueryResult lpResult;
+                            SampledSpectrum M = light.sample(lpQuery, pathSampler.getSurfaceLightPosSample(), &lpResult);
+                            
+                            float fractionalVisibility;
+                            if (scene->testVisibility(surfPt, lpResult.surfPt, time, &fractionalVisibility)) {
+                                float dist2;
+                                Vector3D shadowDir = lpResult.surfPt.getDirectionFrom(surfPt.getPosition(), &dist2);
+                                Vector3D shadowDir_l = lpResult.surfPt.toLocal(-shadowDir);
+                                Vector3D shadowDir_sn = surfPt.toLocal(shadowDir);
+                                
+                                EDF* edf = lpResult.surfPt.createEDF(eWLs, mem);
+                                SampledSpectrum Le = M * edf->evaluate(EDFQuery(), shadowDir_l);
+                                float lightAreaPDF = lightProb * lpResult.areaPDF;
+                                float emitDirPDF = edf->evaluatePDF(EDFQuery(), shadowDir_l);
+                                
+                                SampledSpectrum revFs;
+                                SampledSpectrum fs = bsdf->evaluate(fsQuery, shadowDir_sn, &revFs);
+                                float revDirPDF;
+                                float dirPDF = bsdf->evaluatePDF(fsQuery, shadowDir_sn, &revDirPDF);
+                                float cosLight = lpResult.surfPt.calcCosTerm(-shadowDir);
+                                float cosEye = surfPt.calcCosTerm(shadowDir);
+                                
+                                float wLight = 0.0f;
+                                if (!lpResult.posType.isDelta() && !std::isinf(lpResult.areaPDF))
+                                    wLight = MIS(dirPDF * cosLight / dist2 / lightAreaPDF);
+                                float wCamera = MIS(emitDirPDF * cosEye / dist2) * (MISVMWeightFactor + eMIS.dVCM + eMIS.dVC * MIS(revDirPDF));
+                                float MISWeight = 1.0f / (wLight + 1.0f + wCamera);
+                                
+                                float G = fractionalVisibility * cosEye * cosLight / dist2;
+                                SampledSpectrum contribution = MISWeight * alpha * fs * Le * (G / lightAreaPDF);
+                                if (contribution.allFinite()) {
+                                    if (eWLs.wavelengthSelected())
+                                        contribution[eWLs.selectedLambdaIndex] *= WavelengthSamples::NumComponents;
+                                    C += contribution;
+                                }
+                            }
+                        }
+                        
+                        // ----------------------------------------------------------------
+                        
+                        
+                        
+                        // ----------------------------------------------------------------
+                        // vertex connection (two or more light subpath vertices)
+                        
+                        for (int i = 0; i < lightVertices.size(); ++i) {
+                            const VCMVertex &lVtx = lightVertices[i];
+                            
+                            float connectDist2;
+                            Vector3D connectionVector = lVtx.surfPt.getDirectionFrom(surfPt.getPosition(), &connectDist2);
+                            float cosLightEnd = lVtx.surfPt.calcCosTerm(connectionVector);
+                            float cosEyeEnd = surfPt.calcCosTerm(connectionVector);
+                            
+                            Vector3D lConnectVector = lVtx.surfPt.toLocal(-connectionVector);
+                            SampledSpectrum lRevDDF;
+                            SampledSpectrum lDDF = lVtx.ddf->evaluate(lConnectVector, &lRevDDF);
+                            float lRevDirPDF;
+                            float lDirPDF = lVtx.ddf->evaluatePDF(lConnectVector, &lRevDirPDF);
+                            
+                            Vector3D eConnectVector = surfPt.toLocal(connectionVector);
+                            SampledSpectrum eRevDDF;
+                            SampledSpectrum eDDF = bsdf->evaluate(fsQuery, eConnectVector, &eRevDDF);
+                            float eRevDirPDF;
+                            float eDirPDF = bsdf->evaluatePDF(fsQuery, eConnectVector, &eRevDirPDF);
+                            
+                            SampledSpectrum connectionTerm = lDDF * eDDF;
+                            if (connectionTerm == SampledSpectrum::Zero)
+                                continue;
+                            
+                            float fractionalVisibility;
+                            if (!scene->testVisibility(surfPt, lVtx.surfPt, time, &fractionalVisibility))
+                                continue;
+                            
+                            float wLight = MIS(eDirPDF * cosLightEnd / connectDist2) * (MISVMWeightFactor + lVtx.mis.dVCM + lVtx.mis.dVC * MIS(lRevDirPDF));
+                            float wCamera = MIS(lDirPDF * cosEyeEnd / connectDist2) * (MISVMWeightFactor + eMIS.dVCM + eMIS.dVC * MIS(eRevDirPDF));
+                            float MISWeight = 1.0f / (wLight + 1.0f + wCamera);
+                            if (!std::isfinite(MISWeight))
+                                continue;
+                            
+                            float G = fractionalVisibility * cosEyeEnd * cosLightEnd / connectDist2;
+                            SampledSpectrum contribution = MISWeight * lVtx.alpha * connectionTerm * G * alpha;
+                            if (lVtx.lambdaSelected || eWLs.wavelengthSelected())
+                                contribution[wls.selectedLambdaIndex] *= WavelengthSamples::NumComponents;
+                            SLRAssert(contribution.allFinite() && !contribution.hasNegative(),
+                                      "Unexpected value detected: %s\n"
+                                      "pix: (%f, %f)", contribution.toString().c_str(), p.x, p.y);
+                            C += contribution;
+                        }
+                        
+                        // ----------------------------------------------------------------
+                        
+                        
+                        
+                        // ----------------------------------------------------------------
+                        // vertex merging
+                        
+                        {
+                            SampledSpectrumSum mergedSum(SampledSpectrum::Zero);
+                            photonGrid->queryPhotons(surfPt.getPosition(), [&](const Photon &photon) {
+                                Vector3D dirIn_sn = surfPt.toLocal(photon.dirIn);
+                                SampledSpectrum revFs;
+                                SampledSpectrum fs = bsdf->evaluate(fsQuery, dirIn_sn, &revFs);
+                                if (fs == SampledSpectrum::Zero)
+                                    return;
+                                float revDirPDF;
+                                float dirPDF = bsdf->evaluatePDF(fsQuery, dirIn_sn, &revDirPDF);
+                                
+                                float wLight = photon.dVCM * MISVCWeightFactor + photon.dVM * MIS(dirPDF);
+                                float wCamera = eMIS.dVCM * MISVCWeightFactor + eMIS.dVM * MIS(revDirPDF);
+                                float MISWeight = 1.0f / (wLight + 1.0f + wCamera);
+                                if (!std::isfinite(MISWeight))
+                                    return;
+                                
+                                SampledSpectrum contribution = MISWeight * fs * photon.alpha;
+                                if (photon.lambdaSelected || eWLs.wavelengthSelected())
+                                    contribution[wls.selectedLambdaIndex] *= WavelengthSamples::NumComponents;
+                                mergedSum += contribution;
+                            });
+                            C += alpha * mergedSum.result * VMNormalization;
+                        }
+                        
+                        // ----------------------------------------------------------------
+                    }
+                    
+                    // get a next direction by sampling BSDF.
+                    BSDFQueryResult fsResult;
+                    SampledSpectrum fs = bsdf->sample(fsQuery, pathSampler.getBSDFSample(), &fsResult);
+                    if (fs == SampledSpectrum::Zero || fsResult.dirPDF == 0.0f)
+                        break;
+                    if (fsResult.sampledType.isDispersive() && !eWLs.wavelengthSelected())
+                        eWLs.flags |= WavelengthSamples::WavelengthIsSelected;
+                    Vector3D vecIn = surfPt.fromLocal(fsResult.dirLocal);
+                    float cosOut = surfPt.calcCosTerm(vecIn);
+                    SampledSpectrum weight = fs * (cosOut / fsResult.dirPDF);
+                    
+                    // Russian roulette
+                    float RRProb = std::min(weight.importance(wlHint), 1.0f);
+                    if (pathSampler.getPathTerminationSample() < RRProb)
+                        weight /= RRProb;
+                    else
+                        break;
+                    
+                    updateMISState(cosOut, fsResult.dirPDF, fsResult.reverse.dirPDF, fsResult.sampledType.isDelta(), &eMIS);
+                    alpha *= weight;
+                    SLRAssert(alpha.allFinite(),
+                              "alpha: %s\nlength: %u, cos: %g, dirPDF: %g",
+                              alpha.toString().c_str(), pathLength, cosOut, fsResult.dirPDF);
+                    
+                    ray = Ray(surfPt.getPosition(), vecIn, time);
+                    segment = RaySegment(Ray::Epsilon);
+                    si = SurfaceInteraction();
+                }
+                
+                SampledSpectrum contribution = C.result;
+                SLRAssert(contribution.allFinite() && !contribution.hasNegative(),
+                          "Unexpected value detected: %s\n"
+                          "pix: (%f, %f)", contribution.toString().c_str(), p.x, p.y);
+                sensor->add(p.x, p.y, wls, contribution);
+                
+                // ----------------------------------------------------------------
+                
+                mem.reset();
+            }
+        }
+        reporter->update();
+    }
+    
+    void VCMRenderer::Job::generateLightSubPath(float time, IndependentLightPathSampler &pathSampler, ArenaAllocator &mem, std::vector<Photon>* photons) {
+        // select one light from all the lights in the scene.
+        float lightProb;
+        SurfaceLight light;
+        scene->selectSurfaceLight(pathSampler.getLightSelectionSample(), time, &light, &lightProb);
+        SLRAssert(std::isfinite(lightProb), "lightProb: unexpected value detected: %f", lightProb);
+        
+        // sample a ray with its radiance (emittance, EDF value) from the selected light.
+        LightPosQuery lightPosQuery(time, wls);
+        SurfaceLightPosQueryResult lightPosResult;
+        EDFQuery edfQuery;
+        EDFQueryResult edfResult;
+        EDF* edf;
+        SampledSpectrum Le0, Le1;
+        Ray ray;
+        float epsilon;
+        light.sampleRay(lightPosQuery, pathSampler.getSurfaceLightPosSample(), edfQuery, pathSampler.getEDFSample(), mem,
+                        &lightPosResult, &Le0, &edf, &edfResult, &Le1, &ray, &epsilon);
+        if (edfResult.dirPDF == 0.0f)
+            return;
+        
+        float lightAreaPDF = lightProb * lightPosResult.areaPDF;
+        float emissionPDF = lightAreaPDF * edfResult.dirPDF;
+        float cosLight = lightPosResult.surfPt.calcCosTerm(ray.dir);
+        
+        WavelengthSamples lWLs = wls;
+        SampledSpectrum alpha = Le0 * Le1 * (cosLight / emissionPDF);
+        MISState lMIS;
+        lMIS.dVCM = MIS(1.0f / edfResult.dirPDF);
+        // JP: 位置か方向がデルタ関数の光源は視点側からの経路で到達できない。
+        // EN: lights with a delta position or direction cannot be reached by eye subpaths.
+        lMIS.dVC = (lightPosResult.posType.isDelta() || edfResult.dirType.isDelta()) ? 0.0f : MIS(cosLight / emissionPDF);
+        lMIS.dVM = lMIS.dVC * MISVCWeightFactor;
+        
+        bool prevAtInfinity = lightPosResult.surfPt.atInfinity();
+        RaySegment segment(epsilon);
+        SurfaceInteraction si;
+        SurfacePoint surfPt;
+        while (scene->intersect(ray, segment, pathSampler, &si)) {
+            si.calculateSurfacePoint(&surfPt);
+            if (surfPt.atInfinity())
+                break;
+            
+            float cosIn = surfPt.calcCosTerm(ray.dir);
+            if (!prevAtInfinity)
+                lMIS.dVCM *= MIS(surfPt.getSquaredDistance(ray.org));
+            lMIS.dVCM /= MIS(cosIn);
+            lMIS.dVC /= MIS(cosIn);
+            lMIS.dVM /= MIS(cosIn);
+            
+            Vector3D dirOut_sn = surfPt.toLocal(-ray.dir);
+            Normal3D gNorm_sn = surfPt.getLocalGeometricNormal();
+            BSDF* bsdf = surfPt.createBSDF(lWLs, mem);
+            BSDFQuery fsQuery(dirOut_sn, gNorm_sn, lWLs.selectedLambdaIndex, DirectionType::All, true, true);
+            
+            if (bsdf->hasNonDelta()) {
+                if (photons)
+                    photons->emplace_back(surfPt.getPosition(), -ray.dir, alpha, lMIS, lWLs.wavelengthSelected());
+                else
+                    lightVertices.emplace_back(surfPt, mem.create<BSDFProxy>(bsdf, fsQuery), alpha, lMIS, lWLs.wavelengthSelected());
+            }
+            
+            BSDFQueryResult fsResult;
+            SampledSpectrum fs = bsdf->sample(fsQuery, pathSampler.getBSDFSample(), &fsResult);
+            if (fs == SampledSpectrum::Zero || fsResult.dirPDF == 0.0f)
+                break;
+            if (fsResult.sampledType.isDispersive() && !lWLs.wavelengthSelected())
+                lWLs.flags |= WavelengthSamples::WavelengthIsSelected;
+            Vector3D vecIn = surfPt.fromLocal(fsResult.dirLocal);
+            float cosOut = surfPt.calcCosTerm(vecIn);
+            SampledSpectrum weight = fs * (cosOut / fsResult.dirPDF);
+            
+            // Russian roulette
+            float RRProb = std::min(weight.importance(wlHint), 1.0f);
+            if (pathSampler.getPathTerminationSample() < RRProb)
+                weight /= RRProb;
+            else
+                break;
+            
+            updateMISState(cosOut, fsResult.dirPDF, fsResult.reverse.dirPDF, fsResult.sampledType.isDelta(), &lMIS);
+            alpha *= weight;
+            SLRAssert(weight.allFinite(),
+                      "weight: unexpected value detected:\nweight: %s\nfs: %s\ncos: %g, dirPDF: %g",
+                      weight.toString().c_str(), fs.toString().c_str(), cosOut, fsResult.dirPDF);
+            
+            ray = Ray(surfPt.getPosition(), vecIn, time);
+            segment = RaySegment(Ray::Epsilon);
+            prevAtInfinity = false;
+            si = SurfaceInteraction();
+        }
+    }
+    
+    // JP: 部分経路を1頂点延長したときの再帰的なMISの量の更新。
+    //     ロシアンルーレットの確率はどの戦略でも一貫して無視する。
+    // EN: update the recursive MIS quantities when extending a subpath by a vertex.
+    //     Russian roulette probabilities are consistently ignored by all the strategies.
+    void VCMRenderer::Job::updateMISState(float cosOut, float dirPDF, float revDirPDF, bool deltaSampled, MISState* mis) const {
+        if (deltaSampled) {
+            mis->dVCM = 0.0f;
+            mis->dVC *= MIS(cosOut);
+            mis->dVM *= MIS(cosOut);
+        }
+        else {
+            mis->dVC = MIS(cosOut / dirPDF) * (mis->dVC * MIS(revDirPDF) + mis->dVCM + MISVMWeightFactor);
+            mis->dVM = MIS(cosOut / dirPDF) * (mis->dVM * MIS(revDirPDF) + mis->dVCM * MISVCWeightFactor + 1.0f);
+            mis->dVCM = MIS(1.0f / dirPDF);
+        }
+    }
+}
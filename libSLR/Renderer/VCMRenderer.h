@@ -0,0 +1,149 @@
+//
+//  VCMRenderer.h
+//
+//  Created by 渡部 心 on 2017/06/12.
+//  Copyright (c) 2017年 渡部 心. All rights reserved.
+//
+
+#ifndef __SLR_VCMRenderer__
+#define __SLR_VCMRenderer__
+
+#include "../defines.h"
+#include "../declarations.h"
+#include "../Core/renderer.h"
+
+#include "../Core/geometry.h"
+#include "../Core/directional_distribution_functions.h"
+
+namespace SLR {
+    // Vertex Connection and Merging (a.k.a. Unified Path Sampling).
+    // Bidirectional path tracing combined with progressive photon density estimation (vertex merging) under MIS.
+    // Light vertices for merging are traced in a separate pass and stored in a flat hash grid
+    // whose merging radius is reduced over passes.
+    class SLR_API VCMRenderer : public Renderer {
+        struct DDFProxy {
+            virtual const void* getDDF() const = 0;
+            virtual SampledSpectrum evaluate(const Vector3D &dir_sn, SampledSpectrum* revVal) const = 0;
+            virtual float evaluatePDF(const Vector3D &dir_sn, float* revVal = nullptr) const = 0;
+        };
+        
+        struct BSDFProxy : public DDFProxy {
+            const BSDF* bsdf;
+            BSDFQuery query;
+            
+            BSDFProxy(const BSDF* _bsdf, const BSDFQuery &_query) : bsdf(_bsdf), query(_query) {}
+            const void* getDDF() const override { return bsdf; }
+            SampledSpectrum evaluate(const Vector3D &dir_sn, SampledSpectrum* revVal) const override {
+                return bsdf->evaluate(query, dir_sn, revVal);
+            }
+            float evaluatePDF(const Vector3D &dir_sn, float* revVal) const override {
+                return bsdf->evaluatePDF(query, dir_sn, revVal);
+            }
+        };
+        
+        // JP: 部分経路の頂点に付随する再帰的MISの量。
+        // EN: quantities for the recursive MIS weight computation carried along a subpath.
+        struct MISState {
+            float dVCM;
+            float dVC;
+            float dVM;
+        };
+        
+        // light subpath vertex used for vertex connection.
+        struct VCMVertex {
+            SurfacePoint surfPt;
+            const DDFProxy* ddf;
+            SampledSpectrum alpha;
+            MISState mis;
+            bool lambdaSelected;
+            VCMVertex(const SurfacePoint &_surfPt, const DDFProxy* _ddf, const SampledSpectrum &_alpha, const MISState &_mis, bool _lambdaSelected) :
+            surfPt(_surfPt), ddf(_ddf), alpha(_alpha), mis(_mis), lambdaSelected(_lambdaSelected) {}
+        };
+        
+        // light subpath vertex used for vertex merging.
+        struct Photon {
+            Point3D position;
+            Vector3D dirIn;
+            SampledSpectrum alpha;
+            float dVCM;
+            float dVM;
+            bool lambdaSelected;
+            Photon() {}
+            Photon(const Point3D &_position, const Vector3D &_dirIn, const SampledSpectrum &_alpha, const MISState &_mis, bool _lambdaSelected) :
+            position(_position), dirIn(_dirIn), alpha(_alpha), dVCM(_mis.dVCM), dVM(_mis.dVM), lambdaSelected(_lambdaSelected) {}
+        };
+        
+        // JP: 半径固定の近傍探索用のハッシュグリッド。
+        //     セルごとに連続するようにフォトンを並び替えて保持する。
+        // EN: hash grid for fixed-radius neighbor queries.
+        //     photons are stored reordered so that each cell occupies a contiguous range.
+        class PhotonHashGrid {
+            std::vector<Photon> m_photons;
+            std::vector<uint32_t> m_cellEnds;
+            BoundingBox3D m_bbox;
+            float m_radius;
+            float m_sqRadius;
+            float m_invCellSize;
+            uint32_t m_cellMask;
+            
+            uint32_t calcCellIndex(int32_t ix, int32_t iy, int32_t iz) const {
+                return (uint32_t(ix * 73856093) ^ uint32_t(iy * 19349663) ^ uint32_t(iz * 83492791)) & m_cellMask;
+            }
+            uint32_t calcCellIndex(const Point3D &p) const;
+        public:
+            PhotonHashGrid() : m_cellMask(0) {}
+            
+            void build(const std::vector<Photon>* photonLists, uint32_t numLists, float radius, uint32_t numThreads);
+            uint32_t numPhotons() const { return (uint32_t)m_photons.size(); }
+            
+            template <typename ProcessPhoton>
+            void queryPhotons(const Point3D &p, ProcessPhoton process) const;
+        };
+        
+        struct Job {
+            const Scene* scene;
+            
+            ArenaAllocator* mems;
+            IndependentLightPathSampler* pathSamplers;
+            std::vector<Photon>* photonLists;
+            const PhotonHashGrid* photonGrid;
+            
+            const Camera* camera;
+            ImageSensor* sensor;
+            float timeStart;
+            float timeEnd;
+            uint32_t imageWidth;
+            uint32_t imageHeight;
+            uint32_t numPixelX;
+            uint32_t numPixelY;
+            uint32_t basePixelX;
+            uint32_t basePixelY;
+            
+            WavelengthSamples wls;
+            float selectWLPDF;
+            float MISVMWeightFactor;
+            float MISVCWeightFactor;
+            float VMNormalization;
+            
+            // working area
+            int16_t wlHint;
+            std::vector<VCMVertex> lightVertices;
+            
+            ProgressReporter* reporter;
+            
+            void photonTracingKernel(uint32_t threadID);
+            void renderingKernel(uint32_t threadID);
+            void generateLightSubPath(float time, IndependentLightPathSampler &pathSampler, ArenaAllocator &mem, std::vector<Photon>* photons);
+            void updateMISState(float cosOut, float dirPDF, float revDirPDF, bool deltaSampled, MISState* mis) const;
+        };
+        
+        uint32_t m_samplesPerPixel;
+        float m_initialRadius;
+        float m_radiusReductionAlpha;
+    public:
+        VCMRenderer(uint32_t spp, float initialRadius, float radiusReductionAlpha);
+        void render(const Scene &scene, const RenderSettings &settings) const override;
+    };
+}
+
+#endif /* __SLR_VCMRenderer__ */
@@ -14,12 +14,46 @@
 #include "../Core/ImageSensor.h"
 #include "../Core/RenderSettings.h"
 #include "../Core/ProgressReporter.h"
+#include "../Core/medium_object.h"
 #include "../RNG/XORShiftRNG.h"
 #include "../Scene/Scene.h"
 #include "../Helper/ThreadPool.h"
 
 namespace SLR {
-    VolumetricPTRenderer::VolumetricPTRenderer(uint32_t spp) : m_samplesPerPixel(spp) {
+    // References
+    // Importance Sampling Techniques for Path Tracing in Participating Media
+    
+    // JP: レイ上の区間における光源位置からの等角サンプリング。距離はレイのパラメターで表す。
+    // EN: equiangular sampling from a light position on a segment of a ray. Distance is represented by the ray parameter.
+    static void calcEquiangularParameters(const Ray &ray, const RaySegment &segment, const Point3D &lightPos,
+                                          float* delta, float* D, float* thetaA, float* thetaB) {
+        float dirSqLength = ray.dir.sqLength();
+        *delta = dot(lightPos - ray.org, ray.dir) / dirSqLength;
+        *D = std::max(distance(lightPos, ray.org + *delta * ray.dir) / std::sqrt(dirSqLength), Ray::Epsilon);
+        *thetaA = std::atan2(segment.distMin - *delta, *D);
+        *thetaB = std::atan2(segment.distMax - *delta, *D);
+    }
+    
+    static float sampleEquiangular(const Ray &ray, const RaySegment &segment, const Point3D &lightPos, float u, float* PDF) {
+        float delta, D, thetaA, thetaB;
+        calcEquiangularParameters(ray, segment, lightPos, &delta, &D, &thetaA, &thetaB);
+        float theta = thetaA + u * (thetaB - thetaA);
+        float dist = std::clamp(delta + D * std::tan(theta), segment.distMin, segment.distMax);
+        *PDF = D / ((thetaB - thetaA) * (D * D + (dist - delta) * (dist - delta)));
+        return dist;
+    }
+    
+    static float evaluateEquiangularPDF(const Ray &ray, const RaySegment &segment, const Point3D &lightPos, float dist) {
+        if (dist < segment.distMin || dist > segment.distMax)
+            return 0.0f;
+        float delta, D, thetaA, thetaB;
+        calcEquiangularParameters(ray, segment, lightPos, &delta, &D, &thetaA, &thetaB);
+        return D / ((thetaB - thetaA) * (D * D + (dist - delta) * (dist - delta)));
+    }
+    
+    
+    
+    VolumetricPTRenderer::VolumetricPTRenderer(uint32_t spp, bool equiangularSampling) : m_samplesPerPixel(spp), m_equiangularSampling(equiangularSampling) {
         
     }
     
@@ -50,10 +84,11 @@ namespace SLR {
         job.imageHeight = settings.getInt(RenderSettingItem::ImageHeight);
         job.numPixelX = sensor->tileWidth();
         job.numPixelY = sensor->tileHeight();
+        job.equiangularSampling = m_equiangularSampling;
         
         sensor->init(job.imageWidth, job.imageHeight);
         
-        printf("Volumetric Path Tracing: %u[spp]\n", m_samplesPerPixel);
+        printf("Volumetric Path Tracing: %u[spp]%s\n", m_samplesPerPixel, m_equiangularSampling ? ", equiangular sampling" : "");
         ProgressReporter reporter;
         job.reporter = &reporter;
         
@@ -153,8 +188,36 @@ namespace SLR {
         bool singleWavelength;
         InteractionPoint* interPt;
         
+        // JP: カメラレイ上の媒質区間で等角サンプリングによる単一散乱を推定する。
+        //     自由行程サンプリングによる最初の散乱点での次イベント推定とは距離についてのMISで組み合わせる。
+        //     MISの重みには自由行程の確率密度が厳密に必要なので、それが閉じた形で求まる均質な媒質のみで行う。
+        // EN: estimate single scattering by equiangular sampling on the medium interval on the camera ray.
+        //     This is combined with next event estimation at the first scattering point by free-path sampling via MIS in distance.
+        //     MIS weights require the exact free-path probability density, so this is done only with homogeneous media where it is obtained in closed form.
+        RaySegment mediumSegment;
+        bool singleScatteringMIS = false;
+        if (equiangularSampling && scene.mediaAreHomogeneous()) {
+            SurfaceInteraction si;
+            float distToSurface = scene.intersect(ray, segment, pathSampler, &si) ? si.getDistance() : INFINITY;
+            singleScatteringMIS = scene.clipByMediumBounds(ray, RaySegment(segment.distMin, distToSurface), &mediumSegment) && std::isfinite(mediumSegment.distMax);
+            if (singleScatteringMIS)
+                sp += equiangularScattering(scene, wls, ray, segment, mediumSegment, pathSampler, mem);
+        }
+        
         if (!scene.interact(ray, segment, wls, pathSampler, mem, &interact, &medThroughput, &singleWavelength))
-            return SampledSpectrum::Zero;
+            return sp;
+        
+        // JP: 自由行程サンプリングで得た散乱点の、選択された波長における距離の確率密度。均質な媒質では透過率の評価は決定的。
+        // EN: probability density in distance of the scattering point by free-path sampling at the selected wavelength.
+        //     Evaluation of transmittance is deterministic in homogeneous media.
+        float freePathPDF = 0.0f;
+        singleScatteringMIS &= interact->inMedium();
+        if (singleScatteringMIS) {
+            bool curSingleWavelength;
+            SampledSpectrum transmittance = scene.evaluateMediumTransmittance(ray, RaySegment(segment.distMin, interact->getDistance()), wls, pathSampler, &curSingleWavelength);
+            InteractionPoint* firstPt = interact->createInteractionPoint(mem);
+            freePathPDF = firstPt->evaluateExtinctionCoefficient(wls)[wls.selectedLambdaIndex] * transmittance[wls.selectedLambdaIndex];
+        }
         
         if (singleWavelength && !wls.wavelengthSelected()) {
             medThroughput[wls.selectedLambdaIndex] *= WavelengthSamples::NumComponents;
@@ -182,11 +245,15 @@ namespace SLR {
             AbstractBDF* abdf = interPt->createAbstractBDF(wls, mem);
             ABDFQuery* abdfQuery = interPt->createABDFQuery(dirOut_local, wls.selectedLambdaIndex, DirectionType::All, false, false, mem);
             
+            // JP: 閉じた媒質の内部からの直接光は境界に遮られるので次イベント推定を省略する。
+            // EN: omit next event estimation since direct lighting from inside an enclosed medium is occluded by the boundary.
+            const EnclosedMediumObject* enclosure = interact->getEnclosure();
+            
             // Next Event Estimation (explicit light sampling)
-            if (abdf->hasNonDelta()) {
+            if (abdf->hasNonDelta() && !enclosure) {
                 Light* light;
                 float lightProb;
-                scene.selectLight(pathSampler.getLightSelectionSample(), ray.time, mem, &light, &lightProb);
+                scene.selectLight(interPt->getPosition(), pathSampler.getLightSelectionSample(), ray.time, mem, &light, &lightProb);
                 SLRAssert(std::isfinite(lightProb), "lightProb: unexpected value detected: %f", lightProb);
                 
                 LightPosQuery lpQuery(ray.time, wls);
@@ -216,8 +283,17 @@ namespace SLR {
                     float abdfPDF = abdf->evaluatePDF(abdfQuery, shadowDir_sn) * cosLight / dist2;
                     
                     float MISWeight = 1.0f;
-                    if (!lpResult->sampledPositionType().isDelta() && !std::isinf(lpResult->spatialPDF()))
+                    if (pathLength == 1 && singleScatteringMIS) {
+                        // JP: 単一散乱では光源サンプリングだけを使い(位相関数サンプリングによる陰的な寄与は加えない)、
+                        //     等角サンプリングとの距離についてのMISを行う。
+                        // EN: use only light sampling for single scattering (implicit contribution by phase function sampling is not added),
+                        //     and perform MIS in distance with equiangular sampling.
+                        float eqPDF = lightPt->atInfinity() ? 0.0f : evaluateEquiangularPDF(ray, mediumSegment, lightPt->getPosition(), interact->getDistance());
+                        MISWeight = (freePathPDF * freePathPDF) / (freePathPDF * freePathPDF + eqPDF * eqPDF);
+                    }
+                    else if (!lpResult->sampledPositionType().isDelta() && !std::isinf(lpResult->spatialPDF())) {
                         MISWeight = (lightPDF * lightPDF) / (lightPDF * lightPDF + abdfPDF * abdfPDF);
+                    }
                     SLRAssert(MISWeight <= 1.0f, "Invalid MIS weight: %g", MISWeight);
                     
                     float G = interPt->calcCosTerm(shadowDir) * cosLight / dist2;
@@ -245,7 +321,14 @@ namespace SLR {
             segment = RaySegment(Ray::Epsilon);
             
             // find a next intersection point.
-            if (!scene.interact(ray, segment, wls, pathSampler, mem, &interact, &medThroughput, &singleWavelength))
+            // JP: 閉じた媒質の内部では境界の加速構造だけを使って局所的にランダムウォークを続ける。
+            // EN: continue the random walk locally using only the acceleration structure of the boundary inside an enclosed medium.
+            bool found;
+            if (enclosure && enclosure->interactLocally(ray, segment, wls, pathSampler, mem, &interact, &medThroughput, &singleWavelength))
+                found = true;
+            else
+                found = scene.interact(ray, segment, wls, pathSampler, mem, &interact, &medThroughput, &singleWavelength);
+            if (!found)
                 break;
             
             if (singleWavelength && !wls.wavelengthSelected()) {
@@ -259,13 +342,13 @@ namespace SLR {
             dirOut_local = interPt->toLocal(-ray.dir);
             
             // implicit light sampling
-            if (interPt->isEmitting()) {
+            if (interPt->isEmitting() && !(pathLength == 1 && singleScatteringMIS)) {
                 float abdfPDF = abdfResult->dirPDF;
                 
                 EDF* edf = interPt->createEDF(wls, mem);
                 SampledSpectrum Le = interPt->emittance(wls) * edf->evaluate(EDFQuery(), dirOut_local);
                 float dist2 = interPt->getSquaredDistance(ray.org);
-                float lightPDF = interact->getLightProb() * interPt->evaluateSpatialPDF() * dist2 / interPt->calcCosTerm(ray.dir);
+                float lightPDF = interact->getLightProbForOrigin() * interPt->evaluateSpatialPDF() * dist2 / interPt->calcCosTerm(ray.dir);
                 SLRAssert(Le.allFinite(), "Le: unexpected value detected: %s", Le.toString().c_str());
                 SLRAssert(!std::isnan(lightPDF)/* && !std::isinf(lightPDF)*/, "lightPDF: unexpected value detected: %f", lightPDF);
                 
@@ -289,4 +372,61 @@ namespace SLR {
         
         return sp;
     }
+    
+    SampledSpectrum VolumetricPTRenderer::Job::equiangularScattering(const Scene &scene, const WavelengthSamples &wls, const Ray &ray, const RaySegment &segment, const RaySegment &mediumSegment,
+                                                                     IndependentLightPathSampler &pathSampler, ArenaAllocator &mem) const {
+        // JP: 散乱点が決まる前に光源を選ぶ必要があるので位置に依存しない選択を用いる。
+        // EN: use position-independent selection since a light needs to be selected before the scattering point is determined.
+        Light* light;
+        float lightProb;
+        scene.selectLight(pathSampler.getLightSelectionSample(), ray.time, mem, &light, &lightProb);
+        
+        LightPosQuery lpQuery(ray.time, wls);
+        LightPosQueryResult* lpResult;
+        SampledSpectrum emittance = light->sample(lpQuery, pathSampler, mem, &lpResult);
+        InteractionPoint* lightPt = lpResult->getInteractionPoint();
+        if (lightPt->atInfinity())
+            return SampledSpectrum::Zero;
+        
+        float eqPDF;
+        float dist = sampleEquiangular(ray, mediumSegment, lightPt->getPosition(), pathSampler.getFreePathSampler().getSample(), &eqPDF);
+        Interaction* interact;
+        if (!std::isfinite(eqPDF) || !scene.queryMediumInteraction(ray, dist, mem, &interact))
+            return SampledSpectrum::Zero;
+        InteractionPoint* interPt = interact->createInteractionPoint(mem);
+        
+        bool wavelengthSelected = wls.wavelengthSelected();
+        bool singleWavelength;
+        SampledSpectrum transmittance = scene.evaluateMediumTransmittance(ray, RaySegment(segment.distMin, dist), wls, pathSampler, &singleWavelength);
+        SampledSpectrum extCoeff = interPt->evaluateExtinctionCoefficient(wls);
+        float freePathPDF = extCoeff[wls.selectedLambdaIndex] * transmittance[wls.selectedLambdaIndex];
+        if (singleWavelength && !wavelengthSelected) {
+            transmittance[wls.selectedLambdaIndex] *= WavelengthSamples::NumComponents;
+            wavelengthSelected = true;
+        }
+        
+        SampledSpectrum visibility;
+        if (!scene.testVisibility(interPt, lightPt, ray.time, wls, pathSampler, &visibility, &singleWavelength))
+            return SampledSpectrum::Zero;
+        if (singleWavelength && !wavelengthSelected)
+            visibility[wls.selectedLambdaIndex] *= WavelengthSamples::NumComponents;
+        
+        float dist2;
+        Vector3D shadowDir = lightPt->getDirectionFrom(interPt->getPosition(), &dist2);
+        Vector3D shadowDir_l = lightPt->toLocal(-shadowDir);
+        Vector3D shadowDir_sn = interPt->toLocal(shadowDir);
+        
+        EDF* edf = lightPt->createEDF(wls, mem);
+        SampledSpectrum Le = lightPt->evaluateExtinctionCoefficient(wls) * emittance * edf->evaluate(EDFQuery(), shadowDir_l);
+        float lightPDF = lightProb * lpResult->spatialPDF();
+        SLRAssert(Le.allFinite(), "Le: unexpected value detected: %s", Le.toString().c_str());
+        
+        AbstractBDF* abdf = interPt->createAbstractBDF(wls, mem);
+        ABDFQuery* abdfQuery = interPt->createABDFQuery(interPt->toLocal(-ray.dir), wls.selectedLambdaIndex, DirectionType::All, false, false, mem);
+        SampledSpectrum abdfValue = abdf->evaluate(abdfQuery, shadowDir_sn);
+        
+        float MISWeight = (eqPDF * eqPDF) / (eqPDF * eqPDF + freePathPDF * freePathPDF);
+        float G = interPt->calcCosTerm(shadowDir) * lightPt->calcCosTerm(-shadowDir) / dist2;
+        return transmittance * extCoeff * visibility * Le * abdfValue * (G * MISWeight / (lightPDF * eqPDF));
+    }
 }
@@ -31,16 +31,26 @@ namespace SLR {
             uint32_t basePixelX;
             uint32_t basePixelY;
             
+            bool equiangularSampling;
+            
             ProgressReporter* reporter;
             
             void kernel(uint32_t threadID);
             SampledSpectrum contribution(const Scene &scene, const WavelengthSamples &initWLs, const Ray &initRay,
                                          IndependentLightPathSampler &pathSampler, ArenaAllocator &mem) const;
+            SampledSpectrum equiangularScattering(const Scene &scene, const WavelengthSamples &wls, const Ray &ray, const RaySegment &segment, const RaySegment &mediumSegment,
+                                                  IndependentLightPathSampler &pathSampler, ArenaAllocator &mem) const;
         };
         
         uint32_t m_samplesPerPixel;
+        bool m_equiangularSampling;
     public:
-        VolumetricPTRenderer(uint32_t spp);
+        // JP: equiangularSamplingが有効な場合、カメラレイ上の単一散乱を光源に対する等角サンプリングでも推定し、
+        //     自由行程サンプリングとMISで組み合わせる。自由行程の確率密度が閉じた形で求まらない非均質な媒質を含むシーンでは使われない。
+        // EN: when equiangularSampling is enabled, single scattering on camera rays is also estimated by equiangular sampling toward a light,
+        //     and combined with free-path sampling via MIS.
+        //     This is not used in scenes containing heterogeneous media where the free-path probability density is not obtained in closed form.
+        VolumetricPTRenderer(uint32_t spp, bool equiangularSampling = false);
         void render(const Scene &scene, const RenderSettings &settings) const override;
     };
 }
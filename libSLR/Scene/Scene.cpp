@@ -26,6 +26,11 @@ namespace SLR {
         m_mediumAggregate = sceneMem->create<MediumObjectAggregate>(renderingData.medObjs);
         m_envSphere = m_envNode ? renderingData.envObj : nullptr;
         
+        for (int i = 0; i < renderingData.enclosures.size(); ++i) {
+            const RenderingData::Enclosure &enclosure = renderingData.enclosures[i];
+            enclosure.medObj->checkEnclosure(*enclosure.boundaryObjs, enclosure.sceneMedObj, renderingData.surfObjs, renderingData.medObjs);
+        }
+        
         m_camera = renderingData.camera;
         if (m_camera)
             m_camera->setTransform(renderingData.camTransform);
@@ -51,12 +56,16 @@ namespace SLR {
             importances[1] = m_envSphere->importance();
         
         if (m_surfaceAggregate->intersect(ray, segment, pathSampler, si)) {
-            si->setLightProb(evaluateProbability(importances, 2, 0) * si->getLightProb());
+            float mixProb = evaluateProbability(importances, 2, 0);
+            si->setLightProb(mixProb * si->getLightProb());
+            si->scaleLightProbForOrigin(mixProb);
             return true;
         }
         if (m_envSphere) {
             if (m_envSphere->intersect(ray, segment, pathSampler, si)) {
-                si->setLightProb(evaluateProbability(importances, 2, 1) * si->getLightProb());
+                float mixProb = evaluateProbability(importances, 2, 1);
+                si->setLightProb(mixProb * si->getLightProb());
+                si->scaleLightProbForOrigin(mixProb);
                 return true;
             }
         }
@@ -74,18 +83,24 @@ namespace SLR {
         MediumInteraction mi;
         bool hitMedium = m_mediumAggregate->interact(ray, RaySegment(segment.distMin, si.getDistance()), wls, pathSampler, &mi, medThroughput, singleWavelength);
         if (hitMedium) {
-            mi.setLightProb(evaluateProbability(importances, 3, 1) * mi.getLightProb());
+            float mixProb = evaluateProbability(importances, 3, 1);
+            mi.setLightProb(mixProb * mi.getLightProb());
+            mi.scaleLightProbForOrigin(mixProb);
             *interact = mem.create<MediumInteraction>(mi);
             return true;
         }
         if (hitSurface) {
-            mi.setLightProb(evaluateProbability(importances, 3, 0) * mi.getLightProb());
+            float mixProb = evaluateProbability(importances, 3, 0);
+            si.setLightProb(mixProb * si.getLightProb());
+            si.scaleLightProbForOrigin(mixProb);
             *interact = mem.create<SurfaceInteraction>(si);
             return true;
         }
         if (m_envSphere) {
             if (m_envSphere->intersect(ray, segment, pathSampler, &si)) {
-                mi.setLightProb(evaluateProbability(importances, 3, 2) * mi.getLightProb());
+                float mixProb = evaluateProbability(importances, 3, 2);
+                si.setLightProb(mixProb * si.getLightProb());
+                si.scaleLightProbForOrigin(mixProb);
                 *interact = mem.create<SurfaceInteraction>(si);
                 return true;
             }
@@ -93,6 +108,49 @@ namespace SLR {
         return false;
     }
     
+    bool Scene::mediaAreHomogeneous() const {
+        return m_mediumAggregate->allHomogeneous();
+    }
+    
+    bool Scene::clipByMediumBounds(const Ray &ray, const RaySegment &segment, RaySegment* clipped) const {
+        BoundingBox3D bounds = m_mediumAggregate->bounds();
+        if (!bounds.isValid())
+            return false;
+        float dist0 = segment.distMin, dist1 = segment.distMax;
+        Vector3D invRayDir = ray.dir.reciprocal();
+        Vector3D tNear = (bounds.minP - ray.org) * invRayDir;
+        Vector3D tFar = (bounds.maxP - ray.org) * invRayDir;
+        for (int i = 0; i < 3; ++i) {
+            if (tNear[i] > tFar[i])
+                std::swap(tNear[i], tFar[i]);
+            dist0 = std::max(tNear[i], dist0);
+            dist1 = std::min(tFar[i], dist1);
+            if (dist0 > dist1)
+                return false;
+        }
+        *clipped = RaySegment(dist0, dist1);
+        return true;
+    }
+    
+    bool Scene::queryMediumInteraction(const Ray &ray, float dist, ArenaAllocator &mem, Interaction** interact) const {
+        MediumInteraction mi;
+        if (!m_mediumAggregate->queryInteraction(ray, dist, &mi))
+            return false;
+        float importances[3] = {m_surfaceAggregate->importance(), m_mediumAggregate->importance(), 0.0f};
+        if (m_envSphere)
+            importances[2] = m_envSphere->importance();
+        float mixProb = evaluateProbability(importances, 3, 1);
+        mi.setLightProb(mixProb * mi.getLightProb());
+        mi.scaleLightProbForOrigin(mixProb);
+        *interact = mem.create<MediumInteraction>(mi);
+        return true;
+    }
+    
+    SampledSpectrum Scene::evaluateMediumTransmittance(const Ray &ray, const RaySegment &segment, const WavelengthSamples &wls, LightPathSampler &pathSampler,
+                                                       bool* singleWavelength) const {
+        return m_mediumAggregate->evaluateTransmittance(ray, segment, wls, pathSampler, singleWavelength);
+    }
+    
     bool Scene::testVisibility(const SurfacePoint &shdP, const SurfacePoint &lightP, float time, float* fractionalVisibility) const {
         SLRAssert(shdP.atInfinity() == false, "Shading point must be in finite region.");
         Ray ray;
@@ -154,6 +212,26 @@ namespace SLR {
         }
     }
     
+    void Scene::selectSurfaceLight(const Point3D &shdP, float u, float time, SurfaceLight* light, float* prob) const {
+        if (m_envSphere) {
+            float sumImps = m_surfaceAggregate->importance() + m_envSphere->importance();
+            float su = sumImps * u;
+            if (su < m_surfaceAggregate->importance()) {
+                u = u / (m_surfaceAggregate->importance() / sumImps);
+                m_surfaceAggregate->selectLightForPoint(shdP, u, time, light, prob);
+                *prob *= m_surfaceAggregate->importance() / sumImps;
+            }
+            else {
+                u = (u - m_surfaceAggregate->importance()) / (m_envSphere->importance() / sumImps);
+                m_envSphere->selectLight(u, time, light, prob);
+                *prob *= m_envSphere->importance() / sumImps;
+            }
+        }
+        else {
+            m_surfaceAggregate->selectLightForPoint(shdP, u, time, light, prob);
+        }
+    }
+    
     void Scene::selectLight(float u, float time, ArenaAllocator &mem, Light** light, float *prob) const {
         float importances[3] = {m_surfaceAggregate->importance(), m_mediumAggregate->importance(), 0.0f};
         if (m_envSphere)
@@ -186,4 +264,39 @@ namespace SLR {
         }
         *prob *= prob1st;
     }
+    
+    void Scene::selectLight(const Point3D &shdP, float u, float time, ArenaAllocator &mem, Light** light, float* prob) const {
+        float importances[3] = {m_surfaceAggregate->importance(), m_mediumAggregate->importance(), 0.0f};
+        if (m_envSphere)
+            importances[2] = m_envSphere->importance();
+        float prob1st;
+        float sumImportances;
+        uint32_t idx = sampleDiscrete(importances, 3, u, &prob1st, &sumImportances, &u);
+        
+        // JP: 面光源のみシェーディング点を考慮して選択する。
+        // EN: only surface lights are selected taking the shading point into account.
+        switch (idx) {
+            case 0: {
+                SurfaceLight* surfLight = mem.create<SurfaceLight>();
+                m_surfaceAggregate->selectLightForPoint(shdP, u, time, surfLight, prob);
+                *light = surfLight;
+                break;
+            }
+            case 1: {
+                VolumetricLight* volLight = mem.create<VolumetricLight>();
+                m_mediumAggregate->selectLight(u, time, volLight, prob);
+                *light = volLight;
+                break;
+            }
+            case 2: {
+                SurfaceLight* surfLight = mem.create<SurfaceLight>();
+                m_envSphere->selectLight(u, time, surfLight, prob);
+                *light = surfLight;
+                break;
+            }
+            default:
+                break;
+        }
+        *prob *= prob1st;
+    }
 }
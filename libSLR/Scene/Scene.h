@@ -43,11 +43,20 @@ namespace SLR {
         bool intersect(const Ray &ray, const RaySegment &segment, LightPathSampler &pathSampler, SurfaceInteraction* si) const;
         bool interact(const Ray &ray, const RaySegment &segment, const WavelengthSamples &wls, LightPathSampler &pathSampler, ArenaAllocator &mem,
                       Interaction** interact, SampledSpectrum* medThroughput, bool* singleWavelength) const;
+        // JP: 面を考慮せずに媒質だけを扱う問い合わせ。
+        // EN: queries dealing only with media without considering surfaces.
+        bool mediaAreHomogeneous() const;
+        bool clipByMediumBounds(const Ray &ray, const RaySegment &segment, RaySegment* clipped) const;
+        bool queryMediumInteraction(const Ray &ray, float dist, ArenaAllocator &mem, Interaction** interact) const;
+        SampledSpectrum evaluateMediumTransmittance(const Ray &ray, const RaySegment &segment, const WavelengthSamples &wls, LightPathSampler &pathSampler,
+                                                    bool* singleWavelength) const;
         bool testVisibility(const SurfacePoint &shdP, const SurfacePoint &lightP, float time, float* fractionalVisibility) const;
         bool testVisibility(const InteractionPoint* shdP, const InteractionPoint* lightP, float time,
                             const WavelengthSamples &wls, LightPathSampler &pathSampler, SampledSpectrum* fractionalVisibility, bool* singleWavelength) const;
         void selectSurfaceLight(float u, float time, SurfaceLight* light, float* prob) const;
+        void selectSurfaceLight(const Point3D &shdP, float u, float time, SurfaceLight* light, float* prob) const;
         void selectLight(float u, float time, ArenaAllocator &mem, Light** light, float* prob) const;
+        void selectLight(const Point3D &shdP, float u, float time, ArenaAllocator &mem, Light** light, float* prob) const;
     };
 }
 
@@ -108,7 +108,8 @@ namespace SLR {
             m_enclosedMediumNode->createRenderingData(mem, nullptr, &subData);
             m_boundarySurfObj = mem->create<SurfaceObjectAggregate>(m_objs);
             m_enclosedMedObj = mem->create<EnclosedMediumObject>(subData.medObjs[0], m_boundarySurfObj,
-                                                                 m_mediumTransform ? *(StaticTransform*)m_mediumTransform : StaticTransform());
+                                                                 m_mediumTransform ? *(StaticTransform*)m_mediumTransform : StaticTransform(),
+                                                                 !m_onlyForBoundary);
             if (subTF && !m_appliedTFIsIdentity) {
                 m_TFMedObj = mem->create<TransformedMediumObject>(m_enclosedMedObj, m_mediumTransform);
                 data->medObjs.push_back(m_TFMedObj);
@@ -116,6 +117,7 @@ namespace SLR {
             else {
                 data->medObjs.push_back(m_enclosedMedObj);
             }
+            data->enclosures.push_back(RenderingData::Enclosure{m_enclosedMedObj, data->medObjs.back(), &m_objs});
         }
     }
     
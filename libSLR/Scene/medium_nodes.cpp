@@ -13,6 +13,8 @@
 #include "../MediumDistribution/HomogeneousMediumDistribution.h"
 #include "../MediumDistribution/GridMediumDistribution.h"
 #include "../MediumDistribution/DensityGridMediumDistribution.h"
+#include "../MediumDistribution/SparseGridMediumDistribution.h"
+#include "../MediumDistribution/DensityGridFile.h"
 #include "../MediumDistribution/VacuumMediumDistribution.h"
 #include "../MediumDistribution/CloudMediumDistribution.h"
 
@@ -43,6 +45,12 @@ namespace SLR {
         m_medium = new DensityGridMediumDistribution(region, base_sigma_s, base_sigma_e, density_grid, numX, numY, numZ);
     }
     
+    DensityGridMediumNode::DensityGridMediumNode(const BoundingBox3D &region, const AssetSpectrum* base_sigma_s, const AssetSpectrum* base_sigma_e, 
+                                                 const DensityGridFile* file, const MediumMaterial* material) :
+    m_material(material) {
+        m_medium = new DensityGridMediumDistribution(region, base_sigma_s, base_sigma_e, file);
+    }
+    
     DensityGridMediumNode::~DensityGridMediumNode() {
         delete m_medium;
     }
@@ -58,6 +66,40 @@ namespace SLR {
     
     
     
+    SparseGridMediumNode::SparseGridMediumNode(const BoundingBox3D &region, const AssetSpectrum* base_sigma_s, const AssetSpectrum* base_sigma_e, 
+                                               const std::vector<std::vector<float>> &density_grid, uint32_t numX, uint32_t numY, uint32_t numZ, const MediumMaterial* material) :
+    m_material(material) {
+        SparseDensityGrid* grid = new SparseDensityGrid(numX, numY, numZ, [&density_grid, numX](uint32_t x, uint32_t y, uint32_t z) {
+            return density_grid[z][numX * y + x];
+        });
+        m_medium = new SparseGridMediumDistribution(region, base_sigma_s, base_sigma_e, grid);
+    }
+    
+    SparseGridMediumNode::SparseGridMediumNode(const BoundingBox3D &region, const AssetSpectrum* base_sigma_s, const AssetSpectrum* base_sigma_e, 
+                                               const DensityGridFile* file, const MediumMaterial* material) :
+    m_material(material) {
+        uint32_t numX = file->numX();
+        SparseDensityGrid* grid = new SparseDensityGrid(numX, file->numY(), file->numZ(), [file, numX](uint32_t x, uint32_t y, uint32_t z) {
+            return file->slice(z)[numX * y + x];
+        });
+        m_medium = new SparseGridMediumDistribution(region, base_sigma_s, base_sigma_e, grid);
+    }
+    
+    SparseGridMediumNode::~SparseGridMediumNode() {
+        delete m_medium;
+    }
+    
+    void SparseGridMediumNode::createRenderingData(Allocator *mem, const Transform *subTF, RenderingData *data) {
+        m_obj = mem->create<SingleMediumObject>(m_medium, m_material);
+        data->medObjs.push_back(m_obj);
+    }
+    
+    void SparseGridMediumNode::destroyRenderingData(Allocator *mem) {
+        mem->destroy(m_obj);
+    }
+    
+    
+    
     GridMediumNode::GridMediumNode(const BoundingBox3D &region, const AssetSpectrum** sigma_s_grid, const AssetSpectrum** sigma_e_grid,
                                    uint32_t numX, uint32_t numY, uint32_t numZ, const MediumMaterial* material) :
     m_material(material) {
@@ -99,9 +141,9 @@ namespace SLR {
     
     
     
-    CloudMediumNode::CloudMediumNode(const BoundingBox3D &region, float featureScale, float density, uint32_t rngSeed, const MediumMaterial* material) :
+    CloudMediumNode::CloudMediumNode(const BoundingBox3D &region, float featureScale, float density, uint32_t rngSeed, uint32_t bakeResolution, const MediumMaterial* material) :
     m_material(material) {
-        m_medium = new CloudMediumDistribution(region, featureScale, density, rngSeed);
+        m_medium = new CloudMediumDistribution(region, featureScale, density, rngSeed, bakeResolution);
     }
     
     CloudMediumNode::~CloudMediumNode() {
@@ -38,6 +38,8 @@ namespace SLR {
     public:
         DensityGridMediumNode(const BoundingBox3D &region, const AssetSpectrum* base_sigma_s, const AssetSpectrum* base_sigma_e, 
                               const std::vector<std::vector<float>> &density_grid, uint32_t numX, uint32_t numY, uint32_t numZ, const MediumMaterial* material);
+        DensityGridMediumNode(const BoundingBox3D &region, const AssetSpectrum* base_sigma_s, const AssetSpectrum* base_sigma_e, 
+                              const DensityGridFile* file, const MediumMaterial* material);
         ~DensityGridMediumNode();
         
         bool isDirectlyTransformable() const override { return false; }
@@ -47,6 +49,25 @@ namespace SLR {
     
     
     
+    class SLR_API SparseGridMediumNode : public MediumNode {
+        SparseGridMediumDistribution* m_medium;
+        const MediumMaterial* m_material;
+        
+        SingleMediumObject* m_obj;
+    public:
+        SparseGridMediumNode(const BoundingBox3D &region, const AssetSpectrum* base_sigma_s, const AssetSpectrum* base_sigma_e, 
+                             const std::vector<std::vector<float>> &density_grid, uint32_t numX, uint32_t numY, uint32_t numZ, const MediumMaterial* material);
+        SparseGridMediumNode(const BoundingBox3D &region, const AssetSpectrum* base_sigma_s, const AssetSpectrum* base_sigma_e, 
+                             const DensityGridFile* file, const MediumMaterial* material);
+        ~SparseGridMediumNode();
+        
+        bool isDirectlyTransformable() const override { return false; }
+        void createRenderingData(Allocator* mem, const Transform* subTF, RenderingData *data) override;
+        void destroyRenderingData(Allocator* mem) override;
+    };
+    
+    
+    
     class SLR_API GridMediumNode : public MediumNode {
         GridMediumDistribution* m_medium;
         const MediumMaterial* m_material;
@@ -84,7 +105,7 @@ namespace SLR {
         
         SingleMediumObject* m_obj;
     public:
-        CloudMediumNode(const BoundingBox3D &region, float featureScale, float density, uint32_t rngSeed, const MediumMaterial* material);
+        CloudMediumNode(const BoundingBox3D &region, float featureScale, float density, uint32_t rngSeed, uint32_t bakeResolution, const MediumMaterial* material);
         ~CloudMediumNode();
         
         bool isDirectlyTransformable() const override { return false; }
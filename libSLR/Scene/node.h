@@ -15,9 +15,20 @@
 
 namespace SLR {
     struct SLR_API RenderingData {
+        // JP: 閉じた媒質と、シーンに登録されたその媒質のオブジェクト、境界を構成する面オブジェクト。
+        //     シーン構築の最後に境界の内側に他の面や媒質が無いかを確認するために使う。
+        // EN: an enclosed medium, its medium object registered to the scene and the surface objects forming the boundary.
+        //     These are used to check that there are no other surfaces or media inside the boundary at the end of scene building.
+        struct Enclosure {
+            EnclosedMediumObject* medObj;
+            const MediumObject* sceneMedObj;
+            const std::vector<SurfaceObject*>* boundaryObjs;
+        };
+        
         Scene* const scene;
         std::vector<SurfaceObject*> surfObjs;
         std::vector<MediumObject*> medObjs;
+        std::vector<Enclosure> enclosures;
         Camera* camera;
         const Transform* camTransform;
         InfiniteSphereSurfaceObject* envObj;
@@ -87,7 +98,7 @@ namespace SLR {
     protected:
         MediumNode* m_enclosedMediumNode;
         SurfaceObject* m_boundarySurfObj;
-        MediumObject* m_enclosedMedObj;
+        EnclosedMediumObject* m_enclosedMedObj;
         Transform* m_mediumTransform;
         TransformedMediumObject* m_TFMedObj;
     public:
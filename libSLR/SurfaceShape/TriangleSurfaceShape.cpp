@@ -344,6 +344,18 @@ namespace SLR {
         shadingFrame.y = cross(shadingFrame.z, shadingFrame.x);
         
         *surfPt = SurfacePoint(si, false, shadingFrame, m_texCoord0Dir);
+        
+        // JP: テクスチャーのフィルタリングのためにテクスチャー座標に関する位置の微分を設定する。
+        // EN: set derivatives of the position with respect to the texture coordinates for texture filtering.
+        Vector3D dP0 = v0.position - v2.position;
+        Vector3D dP1 = v1.position - v2.position;
+        TexCoord2D dTC0 = v0.texCoord - v2.texCoord;
+        TexCoord2D dTC1 = v1.texCoord - v2.texCoord;
+        float detTC = dTC0.u * dTC1.v - dTC0.v * dTC1.u;
+        if (detTC != 0) {
+            float invDetTC = 1.0f / detTC;
+            surfPt->setTextureCoordinateTangents(invDetTC * (dTC1.v * dP0 - dTC0.v * dP1), invDetTC * (dTC0.u * dP1 - dTC1.u * dP0));
+        }
     }
     
     float TriangleSurfaceShape::area() const {
@@ -419,4 +431,21 @@ namespace SLR {
         SLRAssert(u + v <= 1.0f, "Invalid parameters for a triangle.");
         return 1.0f / area();
     }
+    
+    void TriangleSurfaceShape::normalCone(Vector3D* axis, float* cosThetaO) const {
+        Vertex** v = m_matGroup->vertexReferences.get() + m_index;
+        Vector3D n[3] = {normalize((Vector3D)v[0]->normal), normalize((Vector3D)v[1]->normal), normalize((Vector3D)v[2]->normal)};
+        Vector3D sum = n[0] + n[1] + n[2];
+        if (sum.sqLength() == 0.0f) {
+            *axis = Vector3D::Ez;
+            *cosThetaO = -1.0f;
+            return;
+        }
+        *axis = normalize(sum);
+        *cosThetaO = std::min(std::min(dot(*axis, n[0]), dot(*axis, n[1])), dot(*axis, n[2]));
+        // JP: 補間された法線を包含するには凸なコーンである必要がある。
+        // EN: the cone needs to be convex to contain the interpolated normals.
+        if (*cosThetaO < 0.0f)
+            *cosThetaO = -1.0f;
+    }
 }
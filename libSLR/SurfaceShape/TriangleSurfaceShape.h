@@ -34,6 +34,7 @@ namespace SLR {
         float area() const override;
         void sample(float u0, float u1, SurfacePoint* surfPt, float* areaPDF, DirectionType* posType) const override;
         float evaluateAreaPDF(const SurfacePoint& surfPt) const override;
+        void normalCone(Vector3D* axis, float* cosThetaO) const override;
     };
 }
 
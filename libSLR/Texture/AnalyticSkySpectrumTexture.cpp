@@ -8,6 +8,7 @@
 #include "AnalyticSkySpectrumTexture.h"
 
 #include "../Core/distributions.h"
+#include "../Helper/ThreadPool.h"
 
 namespace SLR {
     class AnalyticSkySpectrumTexture::SunDiscContinuousDistribution2D : public ContinuousDistribution2D {
@@ -81,6 +82,8 @@ namespace SLR {
         }
 #endif
         m_sunDirection = Vector3D::fromPolarYUp(M_PI, M_PI / 2 - m_solarElevation);
+        
+        bakeSkyTable();
     }
     
     AnalyticSkySpectrumTexture::~AnalyticSkySpectrumTexture() {
@@ -98,30 +101,88 @@ namespace SLR {
             arhosekskymodelstate_free(m_skyModelStates[i]);
     }
     
+    void AnalyticSkySpectrumTexture::bakeSkyTable() {
+        m_skyTable.resize(SkyTableWidth * SkyTableHeight * NumChannels);
+        
+        // JP: 行ごとに並列にベイクする。地平線より下は0とする。
+        // EN: bake rows in parallel. Values below the horizon are zero.
+        ThreadPool threadPool;
+        for (int y = 0; y < SkyTableHeight; ++y) {
+            threadPool.enqueue([this, y](uint32_t threadID) {
+                float* row = m_skyTable.data() + SkyTableWidth * NumChannels * y;
+                float theta = M_PI * (y + 0.5f) / SkyTableHeight;
+                float mappedTheta = calcMappedTheta(theta);
+                if (mappedTheta >= M_PI / 2) {
+                    std::fill(row, row + SkyTableWidth * NumChannels, 0.0f);
+                    return;
+                }
+                for (int x = 0; x < SkyTableWidth; ++x) {
+                    float* values = row + NumChannels * x;
+                    Vector3D viewVec = Vector3D::fromPolarYUp(2 * M_PI * (x + 0.5f) / SkyTableWidth, theta);
+                    float gamma = std::acos(std::clamp(dot(viewVec, m_sunDirection), -1.0f, 1.0f));
+                    for (int i = 0; i < NumChannels; ++i) {
+#ifdef SLR_Use_Spectral_Representation
+                        values[i] = arhosekskymodel_radiance(m_skyModelStates[i], mappedTheta, gamma, SampledWavelengths[i]);
+#else
+                        values[i] = RadianceScale * arhosek_tristim_skymodel_radiance(m_skyModelStates[i], mappedTheta, gamma, i);
+#endif
+                        values[i] = std::max(values[i], 0.0f);
+                        SLRAssert(std::isfinite(values[i]), "Invalid value.");
+                    }
+                }
+            });
+        }
+        threadPool.wait();
+    }
+    
+    void AnalyticSkySpectrumTexture::fetchSkyTable(float u, float v, float* values) const {
+        // JP: 横方向は周期的、縦方向はクランプとしてテクセル中心間を補間する。
+        // EN: interpolate between texel centers with periodic horizontal and clamped vertical addressing.
+        float px = u * SkyTableWidth - 0.5f;
+        float py = std::clamp(v * SkyTableHeight - 0.5f, 0.0f, (float)(SkyTableHeight - 1));
+        float fx = std::floor(px);
+        float fy = std::floor(py);
+        float tx = px - fx;
+        float ty = py - fy;
+        int32_t x0 = (int32_t)fx % (int32_t)SkyTableWidth;
+        if (x0 < 0)
+            x0 += SkyTableWidth;
+        int32_t x1 = (x0 + 1) % SkyTableWidth;
+        int32_t y0 = (int32_t)fy;
+        int32_t y1 = std::min(y0 + 1, (int32_t)SkyTableHeight - 1);
+        
+        const float* v00 = &m_skyTable[NumChannels * (SkyTableWidth * y0 + x0)];
+        const float* v10 = &m_skyTable[NumChannels * (SkyTableWidth * y0 + x1)];
+        const float* v01 = &m_skyTable[NumChannels * (SkyTableWidth * y1 + x0)];
+        const float* v11 = &m_skyTable[NumChannels * (SkyTableWidth * y1 + x1)];
+        for (int i = 0; i < NumChannels; ++i)
+            values[i] = ((1 - tx) * v00[i] + tx * v10[i]) * (1 - ty) + ((1 - tx) * v01[i] + tx * v11[i]) * ty;
+    }
+    
     SampledSpectrum AnalyticSkySpectrumTexture::evaluate(const Point3D &p, const WavelengthSamples &wls) const {
         float theta = M_PI * p.y;
-        float mappedTheta = theta / (1 + m_extAngleOfHorizon / (M_PI / 2));
+        float mappedTheta = calcMappedTheta(theta);
         if (mappedTheta >= M_PI / 2)
             return SampledSpectrum::Zero;
-        Vector3D viewVec = Vector3D::fromPolarYUp(2 * M_PI * p.x, theta);
-        float gamma = std::acos(std::clamp(dot(viewVec, m_sunDirection), -1.0f, 1.0f));
         
-#ifdef SLR_Use_Spectral_Representation
         float sampledValues[NumChannels];
-        if (gamma < m_skyModelStates[0]->solar_radius) {
+#ifdef SLR_Use_Spectral_Representation
+        Vector3D viewVec = Vector3D::fromPolarYUp(2 * M_PI * p.x, theta);
+        if (dot(viewVec, m_sunDirection) > std::cos(m_skyModelStates[0]->solar_radius)) {
+            float gamma = std::acos(std::clamp(dot(viewVec, m_sunDirection), -1.0f, 1.0f));
             for (int i = 0; i < NumChannels; ++i)
                 sampledValues[i] = arhosekskymodel_solar_radiance(m_skyModelStates[i], theta, gamma, SampledWavelengths[i]);
         }
         else {
-            for (int i = 0; i < NumChannels; ++i)
-                sampledValues[i] = arhosekskymodel_radiance(m_skyModelStates[i], mappedTheta, gamma, SampledWavelengths[i]);
+            fetchSkyTable(p.x, p.y, sampledValues);
         }
         
         RegularContinuousSpectrum spectrum(SampledWavelengths[0], SampledWavelengths[NumChannels - 1], sampledValues, NumChannels);
 #else
+        fetchSkyTable(p.x, p.y, sampledValues);
         SampledSpectrum spectrum;
         for (int i = 0; i < NumChannels; ++i)
-            spectrum[i] = RadianceScale * arhosek_tristim_skymodel_radiance(m_skyModelStates[i], mappedTheta, gamma, i);
+            spectrum[i] = sampledValues[i];
 #endif
         SampledSpectrum ret = spectrum.evaluate(wls);
         ret = max(ret, 0.0f);
@@ -135,50 +196,68 @@ namespace SLR {
             delete m_distribution;
         }
         
-        // JP: 天空光の輝度分布と合計エネルギーを計算する。
-        // EN: calculate the luminance distribution of the sky dome and its total energy.
-        const uint32_t mapWidth = 1024;
-        const uint32_t mapHeight = 512;
-        FloatSum accSkyDomeEnergy = 0.0f;
-        std::function<float(uint32_t, uint32_t)> pickFunc = [this, &mapWidth, &mapHeight, &accSkyDomeEnergy](uint32_t x, uint32_t y) -> float {
-            float theta = M_PI * (y + 0.5f) / mapHeight;
-            float mappedTheta = theta / (1 + m_extAngleOfHorizon / (M_PI / 2));
-            if (mappedTheta >= M_PI / 2)
-                return 0.0f;
-            Vector3D viewVec = Vector3D::fromPolarYUp(2 * M_PI * (x + 0.5f) / mapWidth, mappedTheta);
-            float gamma = std::acos(std::clamp(dot(viewVec, m_sunDirection), -1.0f, 1.0f));
-            
+        // JP: ベイク済みのテーブルから天空光の輝度分布と合計エネルギーを計算する。
+        //     まずテーブルと同じ解像度で各テクセル中心の輝度を求める。
+        // EN: calculate the luminance distribution of the sky dome and its total energy from the baked table.
+        //     First, calculate the luminance at each texel center with the same resolution as the table.
+        const uint32_t mapWidth = SkyTableWidth;
+        const uint32_t mapHeight = SkyTableHeight;
+        std::vector<float> texelLuminances(mapWidth * mapHeight);
+        ThreadPool threadPool;
+        for (int y = 0; y < mapHeight; ++y) {
+            threadPool.enqueue([this, &texelLuminances, &mapWidth, y](uint32_t threadID) {
+                for (int x = 0; x < mapWidth; ++x) {
+                    const float* sampledValues = &m_skyTable[NumChannels * (mapWidth * y + x)];
+                    
 #ifdef SLR_Use_Spectral_Representation
-            float sampledValues[NumChannels];
-            for (int i = 0; i < NumChannels; ++i)
-                sampledValues[i] = arhosekskymodel_radiance(m_skyModelStates[i], mappedTheta, gamma, SampledWavelengths[i]);
-            
-            RegularContinuousSpectrum spectrum(SampledWavelengths[0], SampledWavelengths[NumChannels - 1], sampledValues, NumChannels);
-            
-            SpectrumStorage yStorage;
-            const uint32_t NumDetailSampling = 5;
-            for (int i = 0; i < NumDetailSampling; ++i) {
-                float wlPDF;
-                WavelengthSamples wls = WavelengthSamples::createWithEqualOffsets(0.5f, (float)i / NumDetailSampling, &wlPDF);
-                yStorage.add(wls, spectrum.evaluate(wls) / wlPDF);
-            }
-            
-            float luminance = yStorage.getValue().result.luminance() / NumDetailSampling;
+                    RegularContinuousSpectrum spectrum(SampledWavelengths[0], SampledWavelengths[NumChannels - 1], sampledValues, NumChannels);
+                    
+                    SpectrumStorage yStorage;
+                    const uint32_t NumDetailSampling = 5;
+                    for (int i = 0; i < NumDetailSampling; ++i) {
+                        float wlPDF;
+                        WavelengthSamples wls = WavelengthSamples::createWithEqualOffsets(0.5f, (float)i / NumDetailSampling, &wlPDF);
+                        yStorage.add(wls, spectrum.evaluate(wls) / wlPDF);
+                    }
+                    
+                    float luminance = yStorage.getValue().result.luminance() / NumDetailSampling;
 #else
-            SampledSpectrum spectrum;
-            for (int i = 0; i < NumChannels; ++i)
-                spectrum[i] = RadianceScale * arhosek_tristim_skymodel_radiance(m_skyModelStates[i], mappedTheta, gamma, i);
-            
-            float luminance = spectrum.luminance();
+                    SampledSpectrum spectrum;
+                    for (int i = 0; i < NumChannels; ++i)
+                        spectrum[i] = sampledValues[i];
+                    
+                    float luminance = spectrum.luminance();
 #endif
-            SLRAssert(std::isfinite(luminance), "Invalid area average value.");
-            float contribution = std::sin(M_PI * (y + 0.5f) / mapHeight) * luminance;
-            accSkyDomeEnergy += contribution;
-            
-            return contribution;
+                    SLRAssert(std::isfinite(luminance), "Invalid texel value.");
+                    texelLuminances[mapWidth * y + x] = luminance;
+                }
+            });
+        }
+        threadPool.wait();
+        
+        // JP: 評価値はテクセル中心間の双線形補間なので、テクセル内の評価値の平均を重み(1/8, 6/8, 1/8)の3x3フィルターで求める。
+        //     アドレッシングはfetchSkyTable()と同じく横方向は周期的、縦方向はクランプとする。
+        //     これにより地平線付近も含めて評価値が正の所では確率密度も正になる。
+        // EN: evaluated values are bilinear interpolation between texel centers,
+        //     so calculate the average of evaluated values in a texel by a 3x3 filter with weights (1/8, 6/8, 1/8).
+        //     Addressing is periodic horizontally and clamped vertically as in fetchSkyTable().
+        //     This makes the probability density positive wherever the evaluated value is positive, including around the horizon.
+        std::function<float(uint32_t, uint32_t)> pickFunc = [&texelLuminances, &mapWidth, &mapHeight](uint32_t x, uint32_t y) -> float {
+            const float weights[3] = {1.0f / 8, 6.0f / 8, 1.0f / 8};
+            float average = 0.0f;
+            for (int dy = -1; dy <= 1; ++dy) {
+                int32_t yy = std::clamp((int32_t)y + dy, 0, (int32_t)mapHeight - 1);
+                for (int dx = -1; dx <= 1; ++dx) {
+                    int32_t xx = ((int32_t)x + dx + (int32_t)mapWidth) % (int32_t)mapWidth;
+                    average += weights[dy + 1] * weights[dx + 1] * texelLuminances[mapWidth * yy + xx];
+                }
+            }
+            return std::sin(M_PI * (y + 0.5f) / mapHeight) * average;
         };
      
-        m_skyDomeDistribution = new RegularConstantContinuousDistribution2D(mapWidth, mapHeight, pickFunc);
+        // JP: 評価関数は並列に呼ばれ得る。
+        // EN: the pick function may be called in parallel.
+        m_skyDomeDistribution = new RegularConstantContinuousAliasDistribution2D(mapWidth, mapHeight, pickFunc);
 //        m_skyDomeDistribution->exportBMP("distribution.bmp", true);
         
 #ifdef SLR_Use_Spectral_Representation
@@ -222,7 +301,7 @@ namespace SLR {
                 sunDiscEnergy += solidAngle * luminance; 
             }
         }
-        float skyDomeEnergy = accSkyDomeEnergy * (2 * M_PI / mapWidth * M_PI / mapHeight);
+        float skyDomeEnergy = m_skyDomeDistribution->integral() * (2 * M_PI * M_PI);
         m_sunDiscDistribution = new SunDiscContinuousDistribution2D(m_sunDirection, m_solarRadius);
         
         std::array<const ContinuousDistribution2D*, 2> dists{m_skyDomeDistribution, m_sunDiscDistribution};
@@ -28,6 +28,8 @@ namespace SLR {
         static const uint32_t NumChannels;
         static const float RadianceScale;
 #endif
+        static const uint32_t SkyTableWidth = 1024;
+        static const uint32_t SkyTableHeight = 512;
         
         float m_solarRadius;
         float m_solarElevation;
@@ -42,9 +44,18 @@ namespace SLR {
         const Texture2DMapping* m_mapping;
         
         Vector3D m_sunDirection;
+        // JP: 太陽のディスクを除いた天空のラディアンスを正距円筒図法でテクセル中心ごとにベイクしたテーブル。
+        // EN: table of sky radiance excluding the sun disc baked at each texel center in equirectangular projection.
+        std::vector<float> m_skyTable;
         mutable ContinuousDistribution2D* m_distribution;
         mutable SunDiscContinuousDistribution2D* m_sunDiscDistribution;
-        mutable RegularConstantContinuousDistribution2D* m_skyDomeDistribution;
+        mutable RegularConstantContinuousAliasDistribution2D* m_skyDomeDistribution;
+        
+        float calcMappedTheta(float theta) const {
+            return theta / (1 + m_extAngleOfHorizon / (M_PI / 2));
+        }
+        void bakeSkyTable();
+        void fetchSkyTable(float u, float v, float* values) const;
     public:
         AnalyticSkySpectrumTexture(float solarRadius, float solarElevation, float turbidity, const AssetSpectrum* groundAlbedo, float extAngleOfHorizon, 
                                    const Texture2DMapping* mapping);
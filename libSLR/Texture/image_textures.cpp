@@ -9,269 +9,728 @@
 
 #include "../Core/distributions.h"
 #include "../Core/image_2d.h"
+#include "../Core/tiled_texture_file.h"
+#include "../BasicTypes/spectral_coefficient_table.h"
+#include "../Helper/ThreadPool.h"
+#include "../Helper/MappedFile.h"
 
 namespace SLR {
-    SampledSpectrum ImageSpectrumTexture::evaluate(const Point3D &p, const WavelengthSamples &wls) const {
-        float u = std::fmod(p.x, 1.0f);
-        float v = std::fmod(p.y, 1.0f);
-        u += u < 0 ? 1.0f : 0.0f;
-        v += v < 0 ? 1.0f : 0.0f;
-        uint32_t px = std::min((uint32_t)(m_data->width() * u), m_data->width() - 1);
-        uint32_t py = std::min((uint32_t)(m_data->height() * v), m_data->height() - 1);
-        SampledSpectrum ret;
-        switch (m_data->format()) {
-#ifdef SLR_Use_Spectral_Representation
-            case ColorFormat::uvs16Fx3: {
-                const uvs16Fx3 &data = m_data->get<uvs16Fx3>(px, py);
-                ret = UpsampledContinuousSpectrum(data.u, data.v, data.s / UPSAMPLED_CONTINOUS_SPECTRUM_SCALE_FACTOR).evaluate(wls);
-                break;
+    // JP: 全ミップレベルが同じタイル幅で直接参照可能なレイアウトを持つ場合にそのタイル幅(log2)を返す。そうでない場合はUINT32_MAXを返す。
+    // EN: return the tile width (log2) when all the mip levels have a directly accessible layout with the same tile width. Otherwise return UINT32_MAX.
+    static uint32_t commonLog2TileWidth(const Image2D* image) {
+        uint32_t log2TileWidth = image->log2TileWidth();
+        for (int i = 0; i < image->numMipLevels(); ++i) {
+            const Image2D* level = image->getMipLevel(i);
+            if (!level->hasDirectLayout() || level->log2TileWidth() != log2TileWidth)
+                return UINT32_MAX;
+        }
+        return log2TileWidth;
+    }
+    
+    // JP: テクセルの参照方法。
+    //     DirectTexelAccessorはタイル幅と格納形式に特殊化したアドレス計算のみを行う。
+    //     VirtualTexelAccessorは直接参照できない画像(例えばPagedImage2D)のために仮想関数を通じて参照する。
+    //     forEachInBlock()はxs, ysで指定されるNxNテクセルについてfunc(i, j, texel)を呼ぶ。
+    // EN: methods to access texels.
+    //     DirectTexelAccessor only performs address computation specialized for the tile width and the color format.
+    //     VirtualTexelAccessor accesses texels through the virtual function for images which cannot be accessed directly (e.g. PagedImage2D).
+    //     forEachInBlock() calls func(i, j, texel) for NxN texels specified by xs and ys.
+    template <uint32_t log2TileWidth, typename ColFmt>
+    struct DirectTexelAccessor {
+        typedef ColFmt Format;
+        
+        static const ColFmt &get(const Image2D* level, uint32_t px, uint32_t py) {
+            return level->getDirect<log2TileWidth, ColFmt>(px, py);
+        }
+        
+        template <uint32_t N, typename Func>
+        static void forEachInBlock(const Image2D* level, const uint32_t xs[N], const uint32_t ys[N], Func func) {
+            const uint32_t localMask = (1 << log2TileWidth) - 1;
+            // JP: ブロックが折り返さずに一つのタイルに収まる場合(多くの場合)は、先頭のテクセルからの一定のオフセットで参照する。
+            // EN: refer to texels by constant offsets from the first texel when the block fits in a single tile without wrapping (in most cases).
+            if (xs[N - 1] == xs[0] + N - 1 && ys[N - 1] == ys[0] + N - 1 &&
+                (xs[0] & localMask) + N - 1 <= localMask && (ys[0] & localMask) + N - 1 <= localMask) {
+                const ColFmt* first = &get(level, xs[0], ys[0]);
+                for (int j = 0; j < N; ++j)
+                    for (int i = 0; i < N; ++i)
+                        func(i, j, first[(j << log2TileWidth) + i]);
+                return;
             }
-            case ColorFormat::uvsA16Fx4: {
-                const uvsA16Fx4 &data = m_data->get<uvsA16Fx4>(px, py);
-                ret = UpsampledContinuousSpectrum(data.u, data.v, data.s / UPSAMPLED_CONTINOUS_SPECTRUM_SCALE_FACTOR).evaluate(wls);
-                break;
+            for (int j = 0; j < N; ++j)
+                for (int i = 0; i < N; ++i)
+                    func(i, j, get(level, xs[i], ys[j]));
+        }
+    };
+    
+    template <typename ColFmt>
+    struct VirtualTexelAccessor {
+        typedef ColFmt Format;
+        
+        static const ColFmt &get(const Image2D* level, uint32_t px, uint32_t py) {
+            return level->get<ColFmt>(px, py);
+        }
+        
+        template <uint32_t N, typename Func>
+        static void forEachInBlock(const Image2D* level, const uint32_t xs[N], const uint32_t ys[N], Func func) {
+            for (int j = 0; j < N; ++j)
+                for (int i = 0; i < N; ++i)
+                    func(i, j, get(level, xs[i], ys[j]));
+        }
+    };
+    
+    // JP: テクセルを読んで値に変換し、テクセルインデックスをラップモードに従って画像内に収める。
+    // EN: read texels and convert them into values, and bring texel indices into the image according to the wrap mode.
+    template <typename TexelAccessor, typename ValueType, typename ConvertFunc>
+    class TexelFetcher {
+        ConvertFunc m_convert;
+        ImageTextureWrap m_wrap;
+    public:
+        TexelFetcher(ConvertFunc convert, ImageTextureWrap wrap) : m_convert(convert), m_wrap(wrap) { }
+        
+        uint32_t wrapIndex(int32_t idx, uint32_t size) const {
+            switch (m_wrap) {
+                case ImageTextureWrap::Clamp:
+                    return std::clamp<int32_t>(idx, 0, size - 1);
+                case ImageTextureWrap::Mirror: {
+                    int32_t ret = idx % (int32_t)(2 * size);
+                    ret = ret < 0 ? ret + 2 * size : ret;
+                    return ret < (int32_t)size ? ret : 2 * size - 1 - ret;
+                }
+                case ImageTextureWrap::Repeat:
+                default: {
+                    int32_t ret = idx % (int32_t)size;
+                    return ret < 0 ? ret + size : ret;
+                }
             }
-            case ColorFormat::Gray8: {
-                const Gray8 &data = m_data->get<Gray8>(px, py);
-                ret = SampledSpectrum(data.v / 255.0f);
-                break;
+        }
+        
+        ValueType fetch(const Image2D* level, uint32_t px, uint32_t py) const {
+            return m_convert(TexelAccessor::get(level, px, py));
+        }
+        
+        // JP: xs, ysで指定されるNxNテクセルの値に重みwx[i] * wy[j]を掛けて足し合わせる。
+        // EN: sum up values of NxN texels specified by xs and ys multiplied by weights wx[i] * wy[j].
+        template <uint32_t N>
+        ValueType fetchWeightedBlock(const Image2D* level, const uint32_t xs[N], const uint32_t ys[N], const float wx[N], const float wy[N]) const {
+            ValueType ret(0.0f);
+            TexelAccessor::template forEachInBlock<N>(level, xs, ys, [this, &ret, wx, wy](uint32_t i, uint32_t j, const typename TexelAccessor::Format &texel) {
+                ret += m_convert(texel) * (wx[i] * wy[j]);
+            });
+            return ret;
+        }
+    };
+    
+    template <typename TexelAccessor, typename ValueType, typename ConvertFunc>
+    static TexelFetcher<TexelAccessor, ValueType, ConvertFunc> createTexelFetcher(ConvertFunc convert, ImageTextureWrap wrap) {
+        return TexelFetcher<TexelAccessor, ValueType, ConvertFunc>(convert, wrap);
+    }
+    
+    
+    
+    // JP: テクセル中心を基準に、線形(N = 2)もしくは3次Bスプライン(N = 4)の分離可能なカーネルで補間する。
+    // EN: interpolate with a separable kernel, linear (N = 2) or cubic B-spline (N = 4), relative to texel centers.
+    template <uint32_t N>
+    static inline void computeKernelWeights(float t, float weights[N]);
+    
+    template <>
+    inline void computeKernelWeights<2>(float t, float weights[2]) {
+        weights[0] = 1 - t;
+        weights[1] = t;
+    }
+    
+    template <>
+    inline void computeKernelWeights<4>(float t, float weights[4]) {
+        float t2 = t * t;
+        float t3 = t2 * t;
+        float it = 1 - t;
+        weights[0] = it * it * it / 6;
+        weights[1] = (3 * t3 - 6 * t2 + 4) / 6;
+        weights[2] = (-3 * t3 + 3 * t2 + 3 * t + 1) / 6;
+        weights[3] = t3 / 6;
+    }
+    
+    template <typename ValueType, uint32_t N, typename Fetcher>
+    static ValueType filterSeparable(const Image2D* level, float u, float v, const Fetcher &fetcher) {
+        float px = u * level->width() - 0.5f;
+        float py = v * level->height() - 0.5f;
+        float fx = std::floor(px);
+        float fy = std::floor(py);
+        float wx[N], wy[N];
+        computeKernelWeights<N>(px - fx, wx);
+        computeKernelWeights<N>(py - fy, wy);
+        int32_t x0 = (int32_t)fx - (int32_t)(N / 2 - 1);
+        int32_t y0 = (int32_t)fy - (int32_t)(N / 2 - 1);
+        uint32_t xs[N], ys[N];
+        for (int i = 0; i < N; ++i) {
+            xs[i] = fetcher.wrapIndex(x0 + i, level->width());
+            ys[i] = fetcher.wrapIndex(y0 + i, level->height());
+        }
+        return fetcher.template fetchWeightedBlock<N>(level, xs, ys, wx, wy);
+    }
+    
+    // JP: フットプリントの最大幅からミップマップのレベルを選び、隣接する2レベルの補間結果を線形補間する。
+    //     N = 2の場合はトライリニアフィルタリングとなる。
+    // EN: select a mipmap level from the maximum width of the footprint, and linearly interpolate interpolations of two adjacent levels.
+    //     This becomes trilinear filtering when N = 2.
+    template <typename ValueType, uint32_t N, typename Fetcher>
+    static ValueType filterMipmapped(const Image2D* image, float u, float v, const TexCoord2D &dTexCoordDx, const TexCoord2D &dTexCoordDy, const Fetcher &fetcher) {
+        float width = std::max(std::max(std::fabs(dTexCoordDx.u), std::fabs(dTexCoordDy.u)) * image->width(),
+                               std::max(std::fabs(dTexCoordDx.v), std::fabs(dTexCoordDy.v)) * image->height());
+        uint32_t maxLevel = image->numMipLevels() - 1;
+        float lod = width > 1.0f ? std::log2(width) : 0.0f;
+        if (lod <= 0.0f || maxLevel == 0)
+            return filterSeparable<ValueType, N>(image, u, v, fetcher);
+        if (lod >= maxLevel)
+            return filterSeparable<ValueType, N>(image->getMipLevel(maxLevel), u, v, fetcher);
+        uint32_t iLod = (uint32_t)lod;
+        float t = lod - iLod;
+        return (filterSeparable<ValueType, N>(image->getMipLevel(iLod), u, v, fetcher) * (1 - t) +
+                filterSeparable<ValueType, N>(image->getMipLevel(iLod + 1), u, v, fetcher) * t);
+    }
+    
+    // JP: 楕円形のフットプリント内のテクセルをガウシアンで重み付けして平均する。axis0, axis1はそのレベルのテクセル単位の楕円の軸。
+    // EN: average texels in the elliptical footprint weighted by a Gaussian. axis0 and axis1 are axes of the ellipse in texel units of the level.
+    template <typename ValueType, typename Fetcher>
+    static ValueType filterEWAAtLevel(const Image2D* level, float u, float v, const float axis0[2], const float axis1[2], const Fetcher &fetcher) {
+        const float Alpha = 2.0f;
+        const float ExpAlpha = std::exp(-Alpha);
+        
+        float s = u * level->width() - 0.5f;
+        float t = v * level->height() - 0.5f;
+        
+        // JP: 楕円の係数。最低でも1テクセルの幅を持たせる。
+        // EN: coefficients of the ellipse. Make it at least one texel wide.
+        float A = axis0[1] * axis0[1] + axis1[1] * axis1[1] + 1;
+        float B = -2 * (axis0[0] * axis0[1] + axis1[0] * axis1[1]);
+        float C = axis0[0] * axis0[0] + axis1[0] * axis1[0] + 1;
+        float invF = 1.0f / (A * C - B * B * 0.25f);
+        A *= invF;
+        B *= invF;
+        C *= invF;
+        
+        float det = -B * B + 4 * A * C;
+        float invDet = 1.0f / det;
+        float uSqrt = std::sqrt(det * C);
+        float vSqrt = std::sqrt(A * det);
+        int32_t s0 = (int32_t)std::ceil(s - 2 * invDet * uSqrt);
+        int32_t s1 = (int32_t)std::floor(s + 2 * invDet * uSqrt);
+        int32_t t0 = (int32_t)std::ceil(t - 2 * invDet * vSqrt);
+        int32_t t1 = (int32_t)std::floor(t + 2 * invDet * vSqrt);
+        
+        ValueType sum(0.0f);
+        float sumWeights = 0.0f;
+        for (int32_t it = t0; it <= t1; ++it) {
+            float tt = it - t;
+            uint32_t py = fetcher.wrapIndex(it, level->height());
+            for (int32_t is = s0; is <= s1; ++is) {
+                float ss = is - s;
+                float r2 = A * ss * ss + B * ss * tt + C * tt * tt;
+                if (r2 < 1) {
+                    float weight = std::exp(-Alpha * r2) - ExpAlpha;
+                    sum += fetcher.fetch(level, fetcher.wrapIndex(is, level->width()), py) * weight;
+                    sumWeights += weight;
+                }
             }
+        }
+        if (sumWeights <= 0.0f)
+            return filterSeparable<ValueType, 2>(level, u, v, fetcher);
+        return sum * (1.0f / sumWeights);
+    }
+    
+    // JP: 楕円の短軸からミップマップのレベルを選び、隣接する2レベルでEWAフィルタリングを行う。
+    //     離心率が大きすぎる場合は短軸を伸ばしてフィルタリングのコストを制限する。
+    // EN: select a mipmap level from the minor axis of the ellipse, and perform EWA filtering on two adjacent levels.
+    //     The minor axis is lengthened to limit the filtering cost when the eccentricity is too large.
+    template <typename ValueType, typename Fetcher>
+    static ValueType filterEWA(const Image2D* image, float u, float v, const TexCoord2D &dTexCoordDx, const TexCoord2D &dTexCoordDy, const Fetcher &fetcher) {
+        const float MaxAnisotropy = 8.0f;
+        
+        float axis0[2] = {dTexCoordDx.u * image->width(), dTexCoordDx.v * image->height()};
+        float axis1[2] = {dTexCoordDy.u * image->width(), dTexCoordDy.v * image->height()};
+        float majorLength = std::sqrt(axis0[0] * axis0[0] + axis0[1] * axis0[1]);
+        float minorLength = std::sqrt(axis1[0] * axis1[0] + axis1[1] * axis1[1]);
+        if (majorLength < minorLength) {
+            std::swap(axis0[0], axis1[0]);
+            std::swap(axis0[1], axis1[1]);
+            std::swap(majorLength, minorLength);
+        }
+        if (minorLength == 0.0f)
+            return filterMipmapped<ValueType, 2>(image, u, v, dTexCoordDx, dTexCoordDy, fetcher);
+        if (minorLength * MaxAnisotropy < majorLength) {
+            float scale = majorLength / (minorLength * MaxAnisotropy);
+            axis1[0] *= scale;
+            axis1[1] *= scale;
+            minorLength *= scale;
+        }
+        
+        uint32_t maxLevel = image->numMipLevels() - 1;
+        float lod = std::clamp(minorLength > 1.0f ? std::log2(minorLength) : 0.0f, 0.0f, (float)maxLevel);
+        uint32_t iLod = std::min((uint32_t)lod, maxLevel);
+        float t = lod - iLod;
+        
+        auto filterAtLevel = [&](uint32_t levelIdx) {
+            const Image2D* level = image->getMipLevel(levelIdx);
+            float scaleX = (float)level->width() / image->width();
+            float scaleY = (float)level->height() / image->height();
+            float levelAxis0[2] = {axis0[0] * scaleX, axis0[1] * scaleY};
+            float levelAxis1[2] = {axis1[0] * scaleX, axis1[1] * scaleY};
+            return filterEWAAtLevel<ValueType>(level, u, v, levelAxis0, levelAxis1, fetcher);
+        };
+        if (t == 0.0f || iLod == maxLevel)
+            return filterAtLevel(iLod);
+        return filterAtLevel(iLod) * (1 - t) + filterAtLevel(iLod + 1) * t;
+    }
+    
+    template <typename ValueType, typename Fetcher>
+    static ValueType filterImage(const Image2D* image, ImageTextureFilter filter, float u, float v, const TexCoord2D &dTexCoordDx, const TexCoord2D &dTexCoordDy,
+                                 const Fetcher &fetcher) {
+        switch (filter) {
+            case ImageTextureFilter::EWA:
+                return filterEWA<ValueType>(image, u, v, dTexCoordDx, dTexCoordDy, fetcher);
+            case ImageTextureFilter::Bicubic:
+                return filterMipmapped<ValueType, 4>(image, u, v, dTexCoordDx, dTexCoordDy, fetcher);
+            case ImageTextureFilter::Trilinear:
+            default:
+                return filterMipmapped<ValueType, 2>(image, u, v, dTexCoordDx, dTexCoordDy, fetcher);
+        }
+    }
+    
+    
+    
+    // JP: 格納形式ごとのテクセル値の変換。対応しない格納形式は0として扱う。
+    // EN: conversion of texel values per color format. Unsupported color formats are treated as 0.
+#ifdef SLR_Use_Spectral_Representation
+#   ifdef SLR_Use_Spectral_Coefficient_Table
+    // JP: 事前計算した係数表からシグモイド多項式スペクトルとしてuvsテクセルを評価する。
+    // EN: evaluate uvs texels as sigmoid-polynomial spectra from the precomputed coefficient table.
+    struct TexelWavelengths {
+        const SpectralCoefficientTable &table;
+        SigmoidPolynomialSpectrum::NormalizedWavelengths nwls;
+        
+        TexelWavelengths(const WavelengthSamples &wls) : table(SpectralCoefficientTable::instance()), nwls(wls) { }
+    };
+    
+    static inline SampledSpectrum uvsToSpectrum(float u, float v, float s, const TexelWavelengths &wlData) {
+        return wlData.table.lookup(u, v).evaluate(wlData.nwls, s / UPSAMPLED_CONTINOUS_SPECTRUM_SCALE_FACTOR);
+    }
+#   else
+    typedef UpsampledContinuousSpectrum::WavelengthBins TexelWavelengths;
+    
+    static inline SampledSpectrum uvsToSpectrum(float u, float v, float s, const TexelWavelengths &wlBins) {
+        return UpsampledContinuousSpectrum(u, v, s / UPSAMPLED_CONTINOUS_SPECTRUM_SCALE_FACTOR).evaluate(wlBins);
+    }
+#   endif
+    
+    template <typename ColFmt>
+    static inline SampledSpectrum texelToSpectrum(const ColFmt &data, const TexelWavelengths &wlBins) {
+        SLRAssert(false, "Image data format is unknown.");
+        return SampledSpectrum::Zero;
+    }
+    static inline SampledSpectrum texelToSpectrum(const uvs16Fx3 &data, const TexelWavelengths &wlBins) {
+        return uvsToSpectrum(data.u, data.v, data.s, wlBins);
+    }
+    static inline SampledSpectrum texelToSpectrum(const uvsA16Fx4 &data, const TexelWavelengths &wlBins) {
+        return uvsToSpectrum(data.u, data.v, data.s, wlBins);
+    }
+    static inline SampledSpectrum texelToSpectrum(const Gray8 &data, const TexelWavelengths &wlBins) {
+        return SampledSpectrum(data.v / 255.0f);
+    }
+    
+    template <typename ColFmt>
+    static inline float texelToLuminance(const ColFmt &data) {
+        SLRAssert(false, "Image data format is unknown.");
+        return 0.0f;
+    }
+    static inline float texelToLuminance(const uvs16Fx3 &data) {
+        float uvs[] = {data.u, data.v, data.s / (float)UPSAMPLED_CONTINOUS_SPECTRUM_SCALE_FACTOR};
+        return UpsampledContinuousSpectrum::uvs_to_luminance(uvs);
+    }
+    static inline float texelToLuminance(const uvsA16Fx4 &data) {
+        float uvs[] = {data.u, data.v, data.s / (float)UPSAMPLED_CONTINOUS_SPECTRUM_SCALE_FACTOR};
+        return UpsampledContinuousSpectrum::uvs_to_luminance(uvs);
+    }
+    static inline float texelToLuminance(const Gray8 &data) {
+        return data.v / 255.0f;
+    }
 #else
-            case ColorFormat::RGB8x3: {
-                const RGB8x3 &data = m_data->get<RGB8x3>(px, py);
-                ret.r = data.r / 255.0f;
-                ret.g = data.g / 255.0f;
-                ret.b = data.b / 255.0f;
+    struct TexelWavelengths {
+        TexelWavelengths(const WavelengthSamples &wls) { }
+    };
+    
+    template <typename ColFmt>
+    static inline SampledSpectrum texelToSpectrum(const ColFmt &data, const TexelWavelengths &wlBins) {
+        SampledSpectrum ret;
+        ret.r = data.r / 255.0f;
+        ret.g = data.g / 255.0f;
+        ret.b = data.b / 255.0f;
+        return ret;
+    }
+    static inline SampledSpectrum texelToSpectrum(const RGBA16Fx4 &data, const TexelWavelengths &wlBins) {
+        SampledSpectrum ret;
+        ret.r = data.r;
+        ret.g = data.g;
+        ret.b = data.b;
+        return ret;
+    }
+    static inline SampledSpectrum texelToSpectrum(const Gray8 &data, const TexelWavelengths &wlBins) {
+        SampledSpectrum ret;
+        ret.r = ret.g = ret.b = data.v / 255.0f;
+        return ret;
+    }
+    
+    template <typename ColFmt>
+    static inline float texelToLuminance(const ColFmt &data) {
+        return sRGB_to_Luminance(data.r / 255.0f, data.g / 255.0f, data.b / 255.0f);
+    }
+    static inline float texelToLuminance(const RGBA16Fx4 &data) {
+        return sRGB_to_Luminance(data.r, data.g, data.b);
+    }
+    static inline float texelToLuminance(const Gray8 &data) {
+        return data.v / 255.0f;
+    }
+#endif
+    
+    template <typename ColFmt>
+    static inline Vector3D texelToNormal(const ColFmt &data) {
+        return Vector3D::Zero;
+    }
+    static inline Vector3D texelToNormal(const RGB8x3 &data) {
+        return normalize(Vector3D(data.r / 255.0f - 0.5f, data.g / 255.0f - 0.5f, data.b / 255.0f - 0.5f));
+    }
+    static inline Vector3D texelToNormal(const RGB_8x4 &data) {
+        return normalize(Vector3D(data.r / 255.0f - 0.5f, data.g / 255.0f - 0.5f, data.b / 255.0f - 0.5f));
+    }
+    static inline Vector3D texelToNormal(const RGBA8x4 &data) {
+        return normalize(Vector3D(data.r / 255.0f - 0.5f, data.g / 255.0f - 0.5f, data.b / 255.0f - 0.5f));
+    }
+    
+    template <typename ColFmt>
+    static inline float texelToFloat(const ColFmt &data) {
+        return 0.0f;
+    }
+    static inline float texelToFloat(const Gray8 &data) {
+        return data.v / 255.0f;
+    }
+#ifdef SLR_Use_Spectral_Representation
+    static inline float texelToFloat(const uvsA16Fx4 &data) {
+        return data.a;
+    }
+#endif
+    
+    
+    
+    ImageSpectrumTexture::ImageSpectrumTexture(const Image2D* image, const Texture2DMapping* mapping, ImageTextureFilter filter, ImageTextureWrap wrap) :
+    m_data(image), m_mapping(mapping), m_filter(filter), m_wrap(wrap) {
+        switch (m_data->format()) {
+            case ColorFormat::RGB8x3:
+                selectEvaluateFunctions<RGB8x3>();
                 break;
-            }
-            case ColorFormat::RGB_8x4: {
-                const RGB_8x4 &data = m_data->get<RGB_8x4>(px, py);
-                ret.r = data.r / 255.0f;
-                ret.g = data.g / 255.0f;
-                ret.b = data.b / 255.0f;
+            case ColorFormat::RGB_8x4:
+                selectEvaluateFunctions<RGB_8x4>();
                 break;
-            }
-            case ColorFormat::RGBA8x4: {
-                const RGBA8x4 &data = m_data->get<RGBA8x4>(px, py);
-                ret.r = data.r / 255.0f;
-                ret.g = data.g / 255.0f;
-                ret.b = data.b / 255.0f;
+            case ColorFormat::RGBA8x4:
+                selectEvaluateFunctions<RGBA8x4>();
                 break;
-            }
-            case ColorFormat::RGBA16Fx4: {
-                const RGBA16Fx4 &data = m_data->get<RGBA16Fx4>(px, py);
-                ret.r = data.r;
-                ret.g = data.g;
-                ret.b = data.b;
+            case ColorFormat::RGBA16Fx4:
+                selectEvaluateFunctions<RGBA16Fx4>();
                 break;
-            }
-            case ColorFormat::Gray8: {
-                const Gray8 &data = m_data->get<Gray8>(px, py);
-                ret.r = ret.g = ret.b = data.v / 255.0f;
+            case ColorFormat::Gray8:
+                selectEvaluateFunctions<Gray8>();
+                break;
+#ifdef SLR_Use_Spectral_Representation
+            case ColorFormat::uvs16Fx3:
+                selectEvaluateFunctions<uvs16Fx3>();
+                break;
+            case ColorFormat::uvsA16Fx4:
+                selectEvaluateFunctions<uvsA16Fx4>();
                 break;
-            }
 #endif
             default:
                 SLRAssert(false, "Image data format is unknown.");
                 break;
         }
-        return ret;
     }
     
-    float ImageSpectrumTexture::evaluateLuminance(const Point3D &p) const {
-        float u = std::fmod(p.x, 1.0f);
-        float v = std::fmod(p.y, 1.0f);
-        u += u < 0 ? 1.0f : 0.0f;
-        v += v < 0 ? 1.0f : 0.0f;
-        uint32_t px = std::min((uint32_t)(m_data->width() * u), m_data->width() - 1);
-        uint32_t py = std::min((uint32_t)(m_data->height() * v), m_data->height() - 1);
+    template <typename ColFmt>
+    void ImageSpectrumTexture::selectEvaluateFunctions() {
+        switch (commonLog2TileWidth(m_data)) {
+            case 3: // TiledImage2D
+                m_evaluate = &ImageSpectrumTexture::evaluateInternal<DirectTexelAccessor<3, ColFmt>>;
+                m_evaluateLuminance = &ImageSpectrumTexture::evaluateLuminanceInternal<DirectTexelAccessor<3, ColFmt>>;
+                break;
+            case TiledTextureFile::LogPageWidth: // MappedTiledImage2D
+                m_evaluate = &ImageSpectrumTexture::evaluateInternal<DirectTexelAccessor<TiledTextureFile::LogPageWidth, ColFmt>>;
+                m_evaluateLuminance = &ImageSpectrumTexture::evaluateLuminanceInternal<DirectTexelAccessor<TiledTextureFile::LogPageWidth, ColFmt>>;
+                break;
+            default:
+                m_evaluate = &ImageSpectrumTexture::evaluateInternal<VirtualTexelAccessor<ColFmt>>;
+                m_evaluateLuminance = &ImageSpectrumTexture::evaluateLuminanceInternal<VirtualTexelAccessor<ColFmt>>;
+                break;
+        }
+    }
+    
+    template <typename TexelAccessor>
+    SampledSpectrum ImageSpectrumTexture::evaluateInternal(const Point3D &p, const TexCoord2D &dTexCoordDx, const TexCoord2D &dTexCoordDy, const WavelengthSamples &wls) const {
+        // JP: 波長サンプルに対応するビンをフィルターが参照する全テクセルで共有する。
+        // EN: share the bins corresponding to the wavelength samples among all the texels referred by the filter.
+        const TexelWavelengths wlBins(wls);
+        auto convert = [&wlBins](const typename TexelAccessor::Format &texel) {
+            return texelToSpectrum(texel, wlBins);
+        };
+        auto fetcher = createTexelFetcher<TexelAccessor, SampledSpectrum>(convert, m_wrap);
+        return filterImage<SampledSpectrum>(m_data, m_filter, p.x, p.y, dTexCoordDx, dTexCoordDy, fetcher);
+    }
+    
+    template <typename TexelAccessor>
+    float ImageSpectrumTexture::evaluateLuminanceInternal(const Point3D &p, const TexCoord2D &dTexCoordDx, const TexCoord2D &dTexCoordDy) const {
+        auto convert = [](const typename TexelAccessor::Format &texel) {
+            return texelToLuminance(texel);
+        };
+        auto fetcher = createTexelFetcher<TexelAccessor, float>(convert, m_wrap);
+        return filterImage<float>(m_data, m_filter, p.x, p.y, dTexCoordDx, dTexCoordDy, fetcher);
+    }
+    
+    // JP: IBLの重要度マップのキャッシュファイルのヘッダー。
+    //     元画像ファイルの内容のハッシュと重要度マップの構成が一致する場合のみ有効なキャッシュとして扱う。
+    // EN: header of a cache file of an IBL importance map.
+    //     It is treated as a valid cache only when the hash of the source image file content and the configuration of the importance map match.
+    struct IBLImportanceMapFileHeader {
+        char magic[4];
+        uint32_t version;
+        uint32_t headerSize;
+        uint32_t colorFormat;
+        uint32_t spectrumType;
+        uint32_t mapWidth;
+        uint32_t mapHeight;
+        uint32_t realSize;
+        uint64_t contentHash;
         
-        float ret = 0.0f;
-        switch (m_data->format()) {
+        static const char Magic[4];
+        static const uint32_t Version = 2;
+        
+        bool operator==(const IBLImportanceMapFileHeader &h) const {
+            return (std::equal(magic, magic + 4, h.magic) && version == h.version && headerSize == h.headerSize &&
+                    colorFormat == h.colorFormat && spectrumType == h.spectrumType &&
+                    mapWidth == h.mapWidth && mapHeight == h.mapHeight && realSize == h.realSize && contentHash == h.contentHash);
+        }
+    };
+    const char IBLImportanceMapFileHeader::Magic[4] = {'S', 'L', 'R', 'I'};
+    
+    static float computeIBLImportance(const Image2D* image, uint32_t x, uint32_t y, uint32_t mapWidth, uint32_t mapHeight) {
+        float deltaX = (float)image->width() / mapWidth;
+        float deltaY = (float)image->height() / mapHeight;
+        uint8_t data[16];
+        image->areaAverage(x * deltaX, (x + 1) * deltaX, y * deltaY, (y + 1) * deltaY, data);
+        // JP: テクスチャーの評価と同じ変換で平均値の輝度を求める。
+        // EN: calculate the luminance of the average value with the same conversion as texture evaluation.
+        float luminance;
+        switch (image->format()) {
 #ifdef SLR_Use_Spectral_Representation
-            case ColorFormat::uvs16Fx3: {
-                const uvs16Fx3 &data = m_data->get<uvs16Fx3>(px, py);
-                float uvs[] = {data.u, data.v, data.s / (float)UPSAMPLED_CONTINOUS_SPECTRUM_SCALE_FACTOR};
-                ret = UpsampledContinuousSpectrum::uvs_to_luminance(uvs);
-            }
-            case ColorFormat::uvsA16Fx4: {
-                const uvsA16Fx4 &data = m_data->get<uvsA16Fx4>(px, py);
-                float uvs[] = {data.u, data.v, data.s / (float)UPSAMPLED_CONTINOUS_SPECTRUM_SCALE_FACTOR};
-                ret = UpsampledContinuousSpectrum::uvs_to_luminance(uvs);
+            case ColorFormat::uvs16Fx3:
+                luminance = texelToLuminance(*(uvs16Fx3*)data);
                 break;
-            }
-            case ColorFormat::Gray8: {
-                const Gray8 &data = m_data->get<Gray8>(px, py);
-                ret = data.v / 255.0f;
+            case ColorFormat::uvsA16Fx4:
+                luminance = texelToLuminance(*(uvsA16Fx4*)data);
                 break;
-            }
 #else
-            case ColorFormat::RGB8x3: {
-                const RGB8x3 &data = m_data->get<RGB8x3>(px, py);
-                return sRGB_to_Luminance(data.r / 255.0f, data.g / 255.0f, data.b / 255.0f);
-                break;
-            }
-            case ColorFormat::RGB_8x4: {
-                const RGB_8x4 &data = m_data->get<RGB_8x4>(px, py);
-                return sRGB_to_Luminance(data.r / 255.0f, data.g / 255.0f, data.b / 255.0f);
+            case ColorFormat::RGB8x3:
+                luminance = texelToLuminance(*(RGB8x3*)data);
                 break;
-            }
-            case ColorFormat::RGBA8x4: {
-                const RGBA8x4 &data = m_data->get<RGBA8x4>(px, py);
-                return sRGB_to_Luminance(data.r / 255.0f, data.g / 255.0f, data.b / 255.0f);
+            case ColorFormat::RGB_8x4:
+                luminance = texelToLuminance(*(RGB_8x4*)data);
                 break;
-            }
-            case ColorFormat::RGBA16Fx4: {
-                const RGBA16Fx4 &data = m_data->get<RGBA16Fx4>(px, py);
-                return sRGB_to_Luminance(data.r, data.g, data.b);
+            case ColorFormat::RGBA8x4:
+                luminance = texelToLuminance(*(RGBA8x4*)data);
                 break;
-            }
-            case ColorFormat::Gray8: {
-                const Gray8 &data = m_data->get<Gray8>(px, py);
-                ret = data.v / 255.0f;
+            case ColorFormat::RGBA16Fx4:
+                luminance = texelToLuminance(*(RGBA16Fx4*)data);
                 break;
-            }
 #endif
             default:
-                SLRAssert(false, "Image data format is unknown.");
-                break;
+                return 0.0f;
         }
-        return ret;
+        SLRAssert(std::isfinite(luminance), "Invalid area average value.");
+        return std::sin(M_PI * (y + 0.5f) / mapHeight) * luminance;
     }
     
     const ContinuousDistribution2D* ImageSpectrumTexture::createIBLImportanceMap() const {
         uint32_t mapWidth = m_data->width() / 4;
         uint32_t mapHeight = m_data->height() / 4;
-        float deltaX = m_data->width() / mapWidth;
-        float deltaY = m_data->height() / mapHeight;
-        std::function<float(uint32_t, uint32_t)> pickFunc = [this, &deltaX, &deltaY, &mapHeight](uint32_t x, uint32_t y) -> float {
-            uint8_t data[16];
-            m_data->areaAverage(x * deltaX, (x + 1) * deltaX, y * deltaY, (y + 1) * deltaY, data);
-            float luminance;
-            switch (m_data->format()) {
-                case ColorFormat::RGB8x3: {
-                    RGB8x3 avg = *(RGB8x3*)data;
-                    luminance = sRGB_to_Luminance(avg.r, avg.g, avg.b);
-                    break;
-                }
-                case ColorFormat::RGB_8x4: {
-                    RGB_8x4 avg = *(RGB_8x4*)data;
-                    luminance = sRGB_to_Luminance(avg.r, avg.g, avg.b);
-                    break;
-                }
-                case ColorFormat::RGBA8x4: {
-                    RGBA8x4 avg = *(RGBA8x4*)data;
-                    luminance = sRGB_to_Luminance(avg.r, avg.g, avg.b);
-                    break;
-                }
-                case ColorFormat::RGBA16Fx4: {
-                    RGBA16Fx4 avg = *(RGBA16Fx4*)data;
-                    luminance = sRGB_to_Luminance(avg.r, avg.g, avg.b);
-                    break;
-                }
-#ifdef SLR_Use_Spectral_Representation
-                case ColorFormat::uvs16Fx3: {
-                    uvs16Fx3 avg = *(uvs16Fx3*)data;
-                    float uvs[3] = {avg.u, avg.v, avg.s};
-                    float rgb[3];
-                    UpsampledContinuousSpectrum::uvs_to_sRGB(m_data->spectrumType(), uvs, rgb);
-                    luminance = sRGB_to_Luminance(rgb[0], rgb[1], rgb[2]);
-                    break;
-                }
-                case ColorFormat::uvsA16Fx4: {
-                    uvsA16Fx4 avg = *(uvsA16Fx4*)data;
-                    float uvs[3] = {avg.u, avg.v, avg.s};
-                    float rgb[3];
-                    UpsampledContinuousSpectrum::uvs_to_sRGB(m_data->spectrumType(), uvs, rgb);
-                    luminance = sRGB_to_Luminance(rgb[0], rgb[1], rgb[2]);
-                    break;
-                }
-#endif
-                default:
-                    return 0.0f;
+        
+        // JP: キャッシュが指定されている場合、元画像ファイルの内容のハッシュをキーとして読み込みを試みる。
+        // EN: when a cache is specified, try to read it with the hash of the source image file content as the key.
+        IBLImportanceMapFileHeader header;
+        bool useCache = false;
+        if (!m_importanceMapCachePath.empty()) {
+            MappedFile sourceFile(m_sourceFilePath);
+            if (sourceFile.isValid()) {
+                std::copy(IBLImportanceMapFileHeader::Magic, IBLImportanceMapFileHeader::Magic + 4, header.magic);
+                header.version = IBLImportanceMapFileHeader::Version;
+                header.headerSize = sizeof(IBLImportanceMapFileHeader);
+                header.colorFormat = (uint32_t)m_data->format();
+                header.spectrumType = (uint32_t)m_data->spectrumType();
+                header.mapWidth = mapWidth;
+                header.mapHeight = mapHeight;
+                header.realSize = sizeof(float);
+                header.contentHash = getFNV1Hash64((uint8_t*)sourceFile.data(), sourceFile.size());
+                useCache = true;
             }
-            SLRAssert(std::isfinite(luminance), "Invalid area average value.");
-            return std::sin(M_PI * (y + 0.5f) / mapHeight) * luminance;
-        };
-        return new RegularConstantContinuousDistribution2D(mapWidth, mapHeight, pickFunc);
+        }
+        if (useCache) {
+            if (FILE* fp = fopen(m_importanceMapCachePath.c_str(), "rb")) {
+                IBLImportanceMapFileHeader cachedHeader;
+                RegularConstantContinuousAliasDistribution2D* dist = nullptr;
+                if (fread(&cachedHeader, sizeof(cachedHeader), 1, fp) == 1 && cachedHeader == header)
+                    dist = RegularConstantContinuousAliasDistribution2D::read(fp, mapWidth, mapHeight);
+                fclose(fp);
+                if (dist)
+                    return dist;
+            }
+        }
+        
+        // JP: 輝度とsinθの重みの計算は面積平均を伴うため、行ごとに並列に行う。
+        // EN: computing luminance and sinθ weights involves area averaging, so do it in parallel for each row.
+        std::vector<float> values(mapWidth * mapHeight);
+        ThreadPool threadPool;
+        for (uint32_t y = 0; y < mapHeight; ++y) {
+            threadPool.enqueue([this, y, mapWidth, mapHeight, &values](uint32_t threadID) {
+                for (uint32_t x = 0; x < mapWidth; ++x)
+                    values[y * mapWidth + x] = computeIBLImportance(m_data, x, y, mapWidth, mapHeight);
+            });
+        }
+        threadPool.wait();
+        RegularConstantContinuousAliasDistribution2D* dist = new RegularConstantContinuousAliasDistribution2D(mapWidth, mapHeight, values.data());
+        
+        if (useCache) {
+            // JP: 一時ファイルに書いてから置き換えるので、失敗時や書き込み中に他のプロセスが書きかけのファイルを読むことはない。
+            // EN: write to a temporary file and then replace, so other processes never read a partially written file during or after a failed write.
+            AtomicFileWriter writer(m_importanceMapCachePath);
+            if (writer.isValid()) {
+                bool success = fwrite(&header, sizeof(header), 1, writer.file()) == 1;
+                success &= dist->write(writer.file());
+                if (success)
+                    writer.commit();
+            }
+        }
+        
+        return dist;
     }
     
     
     
-    Normal3D ImageNormalTexture::evaluate(const Point3D &p) const {
-        float u = std::fmod(p.x, 1.0f);
-        float v = std::fmod(p.y, 1.0f);
-        u += u < 0 ? 1.0f : 0.0f;
-        v += v < 0 ? 1.0f : 0.0f;
-        uint32_t px = std::min((uint32_t)(m_data->width() * u), m_data->width() - 1);
-        uint32_t py = std::min((uint32_t)(m_data->height() * v), m_data->height() - 1);
-        Normal3D ret;
+    ImageNormalTexture::ImageNormalTexture(const Image2D* image, const Texture2DMapping* mapping, ImageTextureFilter filter, ImageTextureWrap wrap) :
+    m_data(image), m_mapping(mapping), m_filter(filter), m_wrap(wrap) {
         switch (m_data->format()) {
-            case ColorFormat::RGB8x3: {
-                const RGB8x3 &data = m_data->get<RGB8x3>(px, py);
-                ret = normalize(Normal3D(data.r / 255.0f - 0.5f, data.g / 255.0f - 0.5f, data.b / 255.0f - 0.5f));
+            case ColorFormat::RGB8x3:
+                selectEvaluateFunctions<RGB8x3>();
                 break;
-            }
-            case ColorFormat::RGB_8x4: {
-                const RGB_8x4 &data = m_data->get<RGB_8x4>(px, py);
-                ret = normalize(Normal3D(data.r / 255.0f - 0.5f, data.g / 255.0f - 0.5f, data.b / 255.0f - 0.5f));
+            case ColorFormat::RGB_8x4:
+                selectEvaluateFunctions<RGB_8x4>();
                 break;
-            }
-            case ColorFormat::RGBA8x4: {
-                const RGBA8x4 &data = m_data->get<RGBA8x4>(px, py);
-                ret = normalize(Normal3D(data.r / 255.0f - 0.5f, data.g / 255.0f - 0.5f, data.b / 255.0f - 0.5f));
+            case ColorFormat::RGBA8x4:
+                selectEvaluateFunctions<RGBA8x4>();
                 break;
-            }
-            case ColorFormat::RGBA16Fx4: {
+            case ColorFormat::RGBA16Fx4:
+                selectEvaluateFunctions<RGBA16Fx4>();
                 break;
-            }
-            case ColorFormat::Gray8: {
+            case ColorFormat::Gray8:
+                selectEvaluateFunctions<Gray8>();
                 break;
-            }
+#ifdef SLR_Use_Spectral_Representation
+            case ColorFormat::uvs16Fx3:
+                selectEvaluateFunctions<uvs16Fx3>();
+                break;
+            case ColorFormat::uvsA16Fx4:
+                selectEvaluateFunctions<uvsA16Fx4>();
+                break;
+#endif
             default:
+                SLRAssert(false, "Image data format is unknown.");
+                break;
+        }
+    }
+    
+    template <typename ColFmt>
+    void ImageNormalTexture::selectEvaluateFunctions() {
+        switch (commonLog2TileWidth(m_data)) {
+            case 3: // TiledImage2D
+                m_evaluate = &ImageNormalTexture::evaluateInternal<DirectTexelAccessor<3, ColFmt>>;
+                break;
+            case TiledTextureFile::LogPageWidth: // MappedTiledImage2D
+                m_evaluate = &ImageNormalTexture::evaluateInternal<DirectTexelAccessor<TiledTextureFile::LogPageWidth, ColFmt>>;
+                break;
+            default:
+                m_evaluate = &ImageNormalTexture::evaluateInternal<VirtualTexelAccessor<ColFmt>>;
                 break;
         }
-        return ret;
+    }
+    
+    template <typename TexelAccessor>
+    Normal3D ImageNormalTexture::evaluateInternal(const Point3D &p, const TexCoord2D &dTexCoordDx, const TexCoord2D &dTexCoordDy) const {
+        auto convert = [](const typename TexelAccessor::Format &texel) {
+            return texelToNormal(texel);
+        };
+        auto fetcher = createTexelFetcher<TexelAccessor, Vector3D>(convert, m_wrap);
+        Vector3D ret = filterImage<Vector3D>(m_data, m_filter, p.x, p.y, dTexCoordDx, dTexCoordDy, fetcher);
+        float length = ret.length();
+        return length > 0.0f ? Normal3D(ret / length) : Normal3D();
     }
     
     
     
-    float ImageFloatTexture::evaluate(const Point3D &p) const {
-        float u = std::fmod(p.x, 1.0f);
-        float v = std::fmod(p.y, 1.0f);
-        u += u < 0 ? 1.0f : 0.0f;
-        v += v < 0 ? 1.0f : 0.0f;
-        uint32_t px = std::min((uint32_t)(m_data->width() * u), m_data->width() - 1);
-        uint32_t py = std::min((uint32_t)(m_data->height() * v), m_data->height() - 1);
-        float ret = 0.0f;
+    ImageFloatTexture::ImageFloatTexture(const Image2D* image, const Texture2DMapping* mapping, ImageTextureFilter filter, ImageTextureWrap wrap) :
+    m_data(image), m_mapping(mapping), m_filter(filter), m_wrap(wrap) {
         switch (m_data->format()) {
-            case ColorFormat::RGB8x3: {
+            case ColorFormat::RGB8x3:
+                selectEvaluateFunctions<RGB8x3>();
                 break;
-            }
-            case ColorFormat::RGB_8x4: {
+            case ColorFormat::RGB_8x4:
+                selectEvaluateFunctions<RGB_8x4>();
                 break;
-            }
-            case ColorFormat::RGBA8x4: {
+            case ColorFormat::RGBA8x4:
+                selectEvaluateFunctions<RGBA8x4>();
                 break;
-            }
-            case ColorFormat::RGBA16Fx4: {
+            case ColorFormat::RGBA16Fx4:
+                selectEvaluateFunctions<RGBA16Fx4>();
                 break;
-            }
-            case ColorFormat::Gray8: {
-                const Gray8 &data = m_data->get<Gray8>(px, py);
-                ret = data.v / 255.0f;
+            case ColorFormat::Gray8:
+                selectEvaluateFunctions<Gray8>();
                 break;
-            }
 #ifdef SLR_Use_Spectral_Representation
-            case ColorFormat::uvsA16Fx4: {
-                const uvsA16Fx4 &data = m_data->get<uvsA16Fx4>(px, py);
-                ret = data.a;
+            case ColorFormat::uvs16Fx3:
+                selectEvaluateFunctions<uvs16Fx3>();
+                break;
+            case ColorFormat::uvsA16Fx4:
+                selectEvaluateFunctions<uvsA16Fx4>();
                 break;
-            }
 #endif
             default:
+                SLRAssert(false, "Image data format is unknown.");
                 break;
         }
-        return ret;
-    }    
+    }
+    
+    template <typename ColFmt>
+    void ImageFloatTexture::selectEvaluateFunctions() {
+        switch (commonLog2TileWidth(m_data)) {
+            case 3: // TiledImage2D
+                m_evaluate = &ImageFloatTexture::evaluateInternal<DirectTexelAccessor<3, ColFmt>>;
+                break;
+            case TiledTextureFile::LogPageWidth: // MappedTiledImage2D
+                m_evaluate = &ImageFloatTexture::evaluateInternal<DirectTexelAccessor<TiledTextureFile::LogPageWidth, ColFmt>>;
+                break;
+            default:
+                m_evaluate = &ImageFloatTexture::evaluateInternal<VirtualTexelAccessor<ColFmt>>;
+                break;
+        }
+    }
+    
+    template <typename TexelAccessor>
+    float ImageFloatTexture::evaluateInternal(const Point3D &p, const TexCoord2D &dTexCoordDx, const TexCoord2D &dTexCoordDy) const {
+        auto convert = [](const typename TexelAccessor::Format &texel) {
+            return texelToFloat(texel);
+        };
+        auto fetcher = createTexelFetcher<TexelAccessor, float>(convert, m_wrap);
+        return filterImage<float>(m_data, m_filter, p.x, p.y, dTexCoordDx, dTexCoordDy, fetcher);
+    }
 }
@@ -13,42 +13,123 @@
 #include "../Core/textures.h"
 
 namespace SLR {
+    // JP: 画像テクスチャーのフィルタリング手法。
+    //     いずれもミップマップとレイ微分から求めたフットプリントを使用する。
+    //     フットプリントが無い場合、TrilinearとEWAは最も細かいレベルの双線形補間(2x2)、Bicubicは3次Bスプライン補間(4x4)となる。
+    // EN: filtering methods for image textures.
+    //     All use the mipmap and the footprint obtained from ray differentials.
+    //     When there is no footprint, Trilinear and EWA become bilinear interpolation (2x2) at the finest level, and Bicubic becomes cubic B-spline interpolation (4x4).
+    enum class ImageTextureFilter {
+        Trilinear = 0,
+        EWA,
+        Bicubic,
+    };
+    
+    // JP: 画像の範囲外のテクスチャー座標の扱い。
+    // EN: treatment of texture coordinates outside the image.
+    enum class ImageTextureWrap {
+        Repeat = 0,
+        Clamp,
+        Mirror,
+    };
+    
+    
+    
+    // JP: 画像テクスチャーは構築時に画像の格納形式とタイル幅に特殊化した評価関数を選ぶ。
+    //     特殊化された関数ではテクセルの参照が仮想関数を介さないアドレス計算としてインライン化される。
+    // EN: image textures select evaluation functions specialized for the color format and the tile width of the image at construction.
+    //     Texel access in a specialized function is inlined as address computation without the virtual function.
     class SLR_API ImageSpectrumTexture : public SpectrumTexture {
+        typedef SampledSpectrum (ImageSpectrumTexture::*EvaluateFunction)(const Point3D &p, const TexCoord2D &dTexCoordDx, const TexCoord2D &dTexCoordDy,
+                                                                          const WavelengthSamples &wls) const;
+        typedef float (ImageSpectrumTexture::*EvaluateLuminanceFunction)(const Point3D &p, const TexCoord2D &dTexCoordDx, const TexCoord2D &dTexCoordDy) const;
+        
         const Image2D* m_data;
         const Texture2DMapping* m_mapping;
+        ImageTextureFilter m_filter;
+        ImageTextureWrap m_wrap;
+        EvaluateFunction m_evaluate;
+        EvaluateLuminanceFunction m_evaluateLuminance;
+        std::string m_sourceFilePath;
+        std::string m_importanceMapCachePath;
+        
+        template <typename TexelAccessor>
+        SampledSpectrum evaluateInternal(const Point3D &p, const TexCoord2D &dTexCoordDx, const TexCoord2D &dTexCoordDy, const WavelengthSamples &wls) const;
+        template <typename TexelAccessor>
+        float evaluateLuminanceInternal(const Point3D &p, const TexCoord2D &dTexCoordDx, const TexCoord2D &dTexCoordDy) const;
+        template <typename ColFmt>
+        void selectEvaluateFunctions();
     public:
-        ImageSpectrumTexture(const Image2D* image, const Texture2DMapping* mapping) :
-        m_data(image), m_mapping(mapping) { }
+        ImageSpectrumTexture(const Image2D* image, const Texture2DMapping* mapping,
+                             ImageTextureFilter filter = ImageTextureFilter::Trilinear, ImageTextureWrap wrap = ImageTextureWrap::Repeat);
         
-        SampledSpectrum evaluate(const Point3D &p, const WavelengthSamples &wls) const;
+        SampledSpectrum evaluate(const Point3D &p, const TexCoord2D &dTexCoordDx, const TexCoord2D &dTexCoordDy, const WavelengthSamples &wls) const {
+            return (this->*m_evaluate)(p, dTexCoordDx, dTexCoordDy, wls);
+        }
+        SampledSpectrum evaluate(const Point3D &p, const WavelengthSamples &wls) const {
+            return evaluate(p, TexCoord2D::Zero, TexCoord2D::Zero, wls);
+        }
         SampledSpectrum evaluate(const SurfacePoint &surfPt, const WavelengthSamples &wls) const override {
-            return evaluate(m_mapping->map(surfPt), wls);
+            TexCoord2D dTexCoordDx, dTexCoordDy;
+            m_mapping->mapDifferentials(surfPt, &dTexCoordDx, &dTexCoordDy);
+            return evaluate(m_mapping->map(surfPt), dTexCoordDx, dTexCoordDy, wls);
         }
         SampledSpectrum evaluate(const MediumPoint &medPt, const WavelengthSamples &wls) const override {
             return evaluate(m_mapping->map(medPt), wls);
         }
-        float evaluateLuminance(const Point3D &p) const;
+        float evaluateLuminance(const Point3D &p, const TexCoord2D &dTexCoordDx, const TexCoord2D &dTexCoordDy) const {
+            return (this->*m_evaluateLuminance)(p, dTexCoordDx, dTexCoordDy);
+        }
+        float evaluateLuminance(const Point3D &p) const {
+            return evaluateLuminance(p, TexCoord2D::Zero, TexCoord2D::Zero);
+        }
         float evaluateLuminance(const SurfacePoint &surfPt) const override {
-            return evaluateLuminance(m_mapping->map(surfPt));
+            TexCoord2D dTexCoordDx, dTexCoordDy;
+            m_mapping->mapDifferentials(surfPt, &dTexCoordDx, &dTexCoordDy);
+            return evaluateLuminance(m_mapping->map(surfPt), dTexCoordDx, dTexCoordDy);
         }
         float evaluateLuminance(const MediumPoint &medPt) const override {
             return evaluateLuminance(m_mapping->map(medPt));
         }
         const ContinuousDistribution2D* createIBLImportanceMap() const override;
+        
+        // JP: IBLの重要度マップをcacheFilePathにキャッシュし、元画像ファイルの内容のハッシュが一致する限り次回以降の起動で再利用する。
+        // EN: cache the IBL importance map at cacheFilePath and reuse it at later launches as long as the hash of the source image file content matches.
+        void setIBLImportanceMapCache(const std::string &sourceFilePath, const std::string &cacheFilePath) {
+            m_sourceFilePath = sourceFilePath;
+            m_importanceMapCachePath = cacheFilePath;
+        }
     };
     
     
     
     class SLR_API ImageNormalTexture : public NormalTexture {
+        typedef Normal3D (ImageNormalTexture::*EvaluateFunction)(const Point3D &p, const TexCoord2D &dTexCoordDx, const TexCoord2D &dTexCoordDy) const;
+        
         const Image2D* m_data;
         const Texture2DMapping* m_mapping;
+        ImageTextureFilter m_filter;
+        ImageTextureWrap m_wrap;
+        EvaluateFunction m_evaluate;
+        
+        template <typename TexelAccessor>
+        Normal3D evaluateInternal(const Point3D &p, const TexCoord2D &dTexCoordDx, const TexCoord2D &dTexCoordDy) const;
+        template <typename ColFmt>
+        void selectEvaluateFunctions();
     public:
-        ImageNormalTexture(const Image2D* image, const Texture2DMapping* mapping) :
-        m_data(image), m_mapping(mapping) { }
+        ImageNormalTexture(const Image2D* image, const Texture2DMapping* mapping,
+                           ImageTextureFilter filter = ImageTextureFilter::Trilinear, ImageTextureWrap wrap = ImageTextureWrap::Repeat);
         
-        Normal3D evaluate(const Point3D &p) const ;
+        Normal3D evaluate(const Point3D &p, const TexCoord2D &dTexCoordDx, const TexCoord2D &dTexCoordDy) const {
+            return (this->*m_evaluate)(p, dTexCoordDx, dTexCoordDy);
+        }
+        Normal3D evaluate(const Point3D &p) const {
+            return evaluate(p, TexCoord2D::Zero, TexCoord2D::Zero);
+        }
         Normal3D evaluate(const SurfacePoint &surfPt) const override {
-            return evaluate(m_mapping->map(surfPt));
+            TexCoord2D dTexCoordDx, dTexCoordDy;
+            m_mapping->mapDifferentials(surfPt, &dTexCoordDx, &dTexCoordDy);
+            return evaluate(m_mapping->map(surfPt), dTexCoordDx, dTexCoordDy);
         }
         Normal3D evaluate(const MediumPoint &medPt) const override {
             return evaluate(m_mapping->map(medPt));
@@ -58,15 +139,32 @@ namespace SLR {
     
     
     class SLR_API ImageFloatTexture : public FloatTexture {
+        typedef float (ImageFloatTexture::*EvaluateFunction)(const Point3D &p, const TexCoord2D &dTexCoordDx, const TexCoord2D &dTexCoordDy) const;
+        
         const Image2D* m_data;
         const Texture2DMapping* m_mapping;
+        ImageTextureFilter m_filter;
+        ImageTextureWrap m_wrap;
+        EvaluateFunction m_evaluate;
+        
+        template <typename TexelAccessor>
+        float evaluateInternal(const Point3D &p, const TexCoord2D &dTexCoordDx, const TexCoord2D &dTexCoordDy) const;
+        template <typename ColFmt>
+        void selectEvaluateFunctions();
     public:
-        ImageFloatTexture(const Image2D* image, const Texture2DMapping* mapping) :
-        m_data(image), m_mapping(mapping) { }
+        ImageFloatTexture(const Image2D* image, const Texture2DMapping* mapping,
+                          ImageTextureFilter filter = ImageTextureFilter::Trilinear, ImageTextureWrap wrap = ImageTextureWrap::Repeat);
         
-        float evaluate(const Point3D &p) const;
+        float evaluate(const Point3D &p, const TexCoord2D &dTexCoordDx, const TexCoord2D &dTexCoordDy) const {
+            return (this->*m_evaluate)(p, dTexCoordDx, dTexCoordDy);
+        }
+        float evaluate(const Point3D &p) const {
+            return evaluate(p, TexCoord2D::Zero, TexCoord2D::Zero);
+        }
         float evaluate(const SurfacePoint &surfPt) const override {
-            return evaluate(m_mapping->map(surfPt));
+            TexCoord2D dTexCoordDx, dTexCoordDy;
+            m_mapping->mapDifferentials(surfPt, &dTexCoordDx, &dTexCoordDy);
+            return evaluate(m_mapping->map(surfPt), dTexCoordDx, dTexCoordDy);
         }
         float evaluate(const MediumPoint &medPt) const override {
             return evaluate(m_mapping->map(medPt));
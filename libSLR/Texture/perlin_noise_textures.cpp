@@ -8,19 +8,37 @@
 #include "perlin_noise_textures.h"
 
 #include "../Core/geometry.h"
+#include "../Core/texture_evaluation_cache.h"
 #include "../RNG/LinearCongruentialRNG.h"
 
 namespace SLR {
-    Normal3D PerlinNoiseNormalTexture::evaluate(const Point3D &p) const {
+    // JP: 多オクターブのノイズは高価なので、同じシェーディング点で同じノードが複数回評価される場合はキャッシュした結果を使う。
+    // EN: multi-octave noise is expensive, so use the cached result when the same node is evaluated multiple times at the same shading point.
+    Normal3D PerlinNoiseNormalTexture::evaluate(const Point3D &p, TextureEvaluationCache* cache) const {
+        Normal3D ret;
+        if (cache && cache->find(this, p, 0.0f, &ret))
+            return ret;
+        
         float phi = 2 * M_PI * m_generator[0].evaluate(p);
         float theta = m_thetaMax * m_generator[1].evaluate(p);
+        ret = Normal3D::fromPolarZUp(phi, theta);
         
-        return Normal3D::fromPolarZUp(phi, theta);
+        if (cache)
+            cache->insert(this, p, 0.0f, ret);
+        return ret;
     }
     
     
     
-    float PerlinNoiseFloatTexture::evaluate(const Point3D &p) const {
-        return m_generator.evaluate(p);
+    float PerlinNoiseFloatTexture::evaluate(const Point3D &p, TextureEvaluationCache* cache) const {
+        float ret;
+        if (cache && cache->find(this, p, 0.0f, &ret))
+            return ret;
+        
+        ret = m_generator.evaluate(p);
+        
+        if (cache)
+            cache->insert(this, p, 0.0f, ret);
+        return ret;
     }
 }
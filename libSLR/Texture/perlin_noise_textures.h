@@ -26,9 +26,9 @@ namespace SLR {
         m_generator{{numOctaves, initialFrequencyPhi, 1.0f, true, frequencyMultiplier, persistence, repeat}, 
                     {numOctaves, initialFrequencyTheta, 1.0f, true, frequencyMultiplier, persistence, repeat}} { }
         
-        Normal3D evaluate(const Point3D &p) const;
+        Normal3D evaluate(const Point3D &p, TextureEvaluationCache* cache = nullptr) const;
         Normal3D evaluate(const SurfacePoint &surfPt) const override {
-            return evaluate(m_mapping->map(surfPt));
+            return evaluate(m_mapping->map(surfPt), surfPt.getTextureEvaluationCache());
         }
         Normal3D evaluate(const MediumPoint &medPt) const override {
             return evaluate(m_mapping->map(medPt));
@@ -45,9 +45,9 @@ namespace SLR {
                                 float frequencyMultiplier, float persistence, uint32_t repeat) :  
         m_mapping(mapping), m_generator(numOctaves, initialFrequency, supValueOrInitialAmplitude, supSpecified, frequencyMultiplier, persistence, repeat) { }
         
-        float evaluate(const Point3D &p) const;
+        float evaluate(const Point3D &p, TextureEvaluationCache* cache = nullptr) const;
         float evaluate(const SurfacePoint &surfPt) const override {
-            return evaluate(m_mapping->map(surfPt));
+            return evaluate(m_mapping->map(surfPt), surfPt.getTextureEvaluationCache());
         }
         float evaluate(const MediumPoint &medPt) const override {
             return evaluate(m_mapping->map(medPt));
@@ -9,16 +9,38 @@
 
 #include "../Core/distributions.h"
 #include "../Core/geometry.h"
+#include "../Core/texture_evaluation_cache.h"
 #include "../RNG/LinearCongruentialRNG.h"
 
 namespace SLR {
-    SampledSpectrum VoronoiSpectrumTexture::evaluate(const Point3D &p, const WavelengthSamples &wls) const {
+    struct WorleyCell {
         float closestSqDistance;
         uint32_t hash;
         uint32_t fpIdx;
-        m_noiseGen.evaluate(p, 1.0f / m_scale, &closestSqDistance, &hash, &fpIdx);
+    };
+    
+    // JP: ボロノイテクスチャーはいずれも同じ(繰り返し無しの)ワーリーノイズを使うため、色・法線・スカラーの各テクスチャーで
+    //     同じ点のセル探索の結果をキャッシュを通じて共有する。
+    // EN: all the Voronoi textures use the same Worley noise (without repeat), so color, normal and float textures share
+    //     the result of the cell search at the same point via the cache.
+    static const uint8_t s_voronoiCellCacheKey = 0;
+    
+    static WorleyCell evaluateVoronoiCell(const WorleyNoise3DGeneratorTemplate<float> &noiseGen, const Point3D &p, float frequency, TextureEvaluationCache* cache) {
+        WorleyCell cell;
+        if (cache && cache->find(&s_voronoiCellCacheKey, p, frequency, &cell))
+            return cell;
+        
+        noiseGen.evaluate(p, frequency, &cell.closestSqDistance, &cell.hash, &cell.fpIdx);
+        
+        if (cache)
+            cache->insert(&s_voronoiCellCacheKey, p, frequency, cell);
+        return cell;
+    }
+    
+    SampledSpectrum VoronoiSpectrumTexture::evaluate(const Point3D &p, const WavelengthSamples &wls, TextureEvaluationCache* cache) const {
+        WorleyCell cell = evaluateVoronoiCell(m_noiseGen, p, 1.0f / m_scale, cache);
         
-        LinearCongruentialRNG rng(hash + fpIdx);
+        LinearCongruentialRNG rng(cell.hash + cell.fpIdx);
         float rgb[3] = {
             rng.getFloat0cTo1o() * m_brightness,
             rng.getFloat0cTo1o() * m_brightness,
@@ -32,13 +54,10 @@ namespace SLR {
 #endif
     }
     
-    float VoronoiSpectrumTexture::evaluateLuminance(const Point3D &p) const {
-        float closestDistance;
-        uint32_t hash;
-        uint32_t fpIdx;
-        m_noiseGen.evaluate(p, 1.0f / m_scale, &closestDistance, &hash, &fpIdx);
+    float VoronoiSpectrumTexture::evaluateLuminance(const Point3D &p, TextureEvaluationCache* cache) const {
+        WorleyCell cell = evaluateVoronoiCell(m_noiseGen, p, 1.0f / m_scale, cache);
         
-        LinearCongruentialRNG rng(hash + fpIdx);
+        LinearCongruentialRNG rng(cell.hash + cell.fpIdx);
         float rgb[3] = {
             rng.getFloat0cTo1o() * m_brightness,
             rng.getFloat0cTo1o() * m_brightness,
@@ -53,34 +72,36 @@ namespace SLR {
         return nullptr;
     }
     
-    Normal3D VoronoiNormalTexture::evaluate(const Point3D &p) const {
-        float closestSqDistance;
-        uint32_t hash;
-        uint32_t fpIdx;
-        m_noiseGen.evaluate(p, 1.0f / m_scale, &closestSqDistance, &hash, &fpIdx);
+    Normal3D VoronoiNormalTexture::evaluate(const Point3D &p, TextureEvaluationCache* cache) const {
+        WorleyCell cell = evaluateVoronoiCell(m_noiseGen, p, 1.0f / m_scale, cache);
         
-        LinearCongruentialRNG rng(hash + fpIdx);
+        LinearCongruentialRNG rng(cell.hash + cell.fpIdx);
         return uniformSampleCone(rng.getFloat0cTo1o(), rng.getFloat0cTo1o(), m_cosThetaMax);
     }
     
-    float VoronoiFloatTexture::evaluate(const Point3D &p) const {
-        float closestSqDistance;
-        uint32_t hash;
-        uint32_t fpIdx;
-        m_noiseGen.evaluate(p, 1.0f / m_scale, &closestSqDistance, &hash, &fpIdx);
+    float VoronoiFloatTexture::evaluate(const Point3D &p, TextureEvaluationCache* cache) const {
+        WorleyCell cell = evaluateVoronoiCell(m_noiseGen, p, 1.0f / m_scale, cache);
         
         if (m_flat) {
-            LinearCongruentialRNG rng(hash + fpIdx);
+            LinearCongruentialRNG rng(cell.hash + cell.fpIdx);
             return m_valueScale * rng.getFloat0cTo1o();
         }
         else {
-            return std::sqrt(closestSqDistance / 3.0f) * m_valueScale;
+            return std::sqrt(cell.closestSqDistance / 3.0f) * m_valueScale;
         }
     }
     
     
     
-    float WorleyNoiseFloatTexture::evaluate(const Point3D &p) const {
-        return m_generator.evaluate(p);
+    float WorleyNoiseFloatTexture::evaluate(const Point3D &p, TextureEvaluationCache* cache) const {
+        float ret;
+        if (cache && cache->find(this, p, 0.0f, &ret))
+            return ret;
+        
+        ret = m_generator.evaluate(p);
+        
+        if (cache)
+            cache->insert(this, p, 0.0f, ret);
+        return ret;
     }
 }
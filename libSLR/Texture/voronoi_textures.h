@@ -23,16 +23,16 @@ namespace SLR {
         VoronoiSpectrumTexture(const Texture3DMapping* mapping, float scale, float brightness) :
         m_mapping(mapping), m_noiseGen(0), m_scale(scale), m_brightness(brightness) { }
         
-        SampledSpectrum evaluate(const Point3D &p, const WavelengthSamples &wls) const;
+        SampledSpectrum evaluate(const Point3D &p, const WavelengthSamples &wls, TextureEvaluationCache* cache = nullptr) const;
         SampledSpectrum evaluate(const SurfacePoint &surfPt, const WavelengthSamples &wls) const override {
-            return evaluate(m_mapping->map(surfPt), wls);
+            return evaluate(m_mapping->map(surfPt), wls, surfPt.getTextureEvaluationCache());
         }
         SampledSpectrum evaluate(const MediumPoint &medPt, const WavelengthSamples &wls) const override {
             return evaluate(m_mapping->map(medPt), wls);
         }
-        float evaluateLuminance(const Point3D &p) const;
+        float evaluateLuminance(const Point3D &p, TextureEvaluationCache* cache = nullptr) const;
         float evaluateLuminance(const SurfacePoint &surfPt) const override {
-            return evaluateLuminance(m_mapping->map(surfPt) / m_scale);
+            return evaluateLuminance(m_mapping->map(surfPt) / m_scale, surfPt.getTextureEvaluationCache());
         }
         float evaluateLuminance(const MediumPoint &medPt) const override {
             return evaluateLuminance(m_mapping->map(medPt) / m_scale);
@@ -51,9 +51,9 @@ namespace SLR {
         VoronoiNormalTexture(const Texture3DMapping* mapping, float scale, float thetaMax) :
         m_mapping(mapping), m_noiseGen(0), m_scale(scale), m_cosThetaMax(std::cos(thetaMax)) { }
         
-        Normal3D evaluate(const Point3D &p) const;
+        Normal3D evaluate(const Point3D &p, TextureEvaluationCache* cache = nullptr) const;
         Normal3D evaluate(const SurfacePoint &surfPt) const override {
-            return evaluate(m_mapping->map(surfPt));
+            return evaluate(m_mapping->map(surfPt), surfPt.getTextureEvaluationCache());
         }
         Normal3D evaluate(const MediumPoint &medPt) const override {
             return evaluate(m_mapping->map(medPt));
@@ -72,9 +72,9 @@ namespace SLR {
         VoronoiFloatTexture(const Texture3DMapping* mapping, float scale, float valueScale, bool flat) :
         m_mapping(mapping), m_noiseGen(0), m_scale(scale), m_valueScale(valueScale), m_flat(flat) { }
         
-        float evaluate(const Point3D &p) const;
+        float evaluate(const Point3D &p, TextureEvaluationCache* cache = nullptr) const;
         float evaluate(const SurfacePoint &surfPt) const override {
-            return evaluate(m_mapping->map(surfPt));
+            return evaluate(m_mapping->map(surfPt), surfPt.getTextureEvaluationCache());
         }
         float evaluate(const MediumPoint &medPt) const override {
             return evaluate(m_mapping->map(medPt));
@@ -91,9 +91,9 @@ namespace SLR {
                                 float frequencyMultiplier, float persistence, int32_t repeat) :  
         m_mapping(mapping), m_generator(numOctaves, initialFrequency, supValueOrInitialAmplitude, supSpecified, clipValue, frequencyMultiplier, persistence, repeat) { }
         
-        float evaluate(const Point3D &p) const;
+        float evaluate(const Point3D &p, TextureEvaluationCache* cache = nullptr) const;
         float evaluate(const SurfacePoint &surfPt) const override {
-            return evaluate(m_mapping->map(surfPt));
+            return evaluate(m_mapping->map(surfPt), surfPt.getTextureEvaluationCache());
         }
         float evaluate(const MediumPoint &medPt) const override {
             return evaluate(m_mapping->map(medPt));
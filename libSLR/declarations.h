@@ -93,6 +93,7 @@ namespace SLR {
     template <typename RealType> struct TexCoord2DTemplate;
     template <typename RealType> struct RayTemplate;
     template <typename RealType> struct RaySegmentTemplate;
+    template <typename RealType> struct RayDifferentialTemplate;
     template <typename RealType> struct BoundingBox3DTemplate;
     typedef Point3DTemplate<float> Point3D;
     typedef Vector3DTemplate<float> Vector3D;
@@ -106,6 +107,7 @@ namespace SLR {
     typedef TexCoord2DTemplate<float> TexCoord2D;
     typedef RayTemplate<float> Ray;
     typedef RaySegmentTemplate<float> RaySegment;
+    typedef RayDifferentialTemplate<float> RayDifferential;
     typedef BoundingBox3DTemplate<float> BoundingBox3D;
     typedef CompensatedSum<float> FloatSum;
     
@@ -131,12 +133,18 @@ namespace SLR {
     template <typename RealType> class RegularConstantContinuousDistribution1DTemplate;
     template <typename RealType> class ContinuousDistribution2DTemplate;
     template <typename RealType> class RegularConstantContinuousDistribution2DTemplate;
+    template <typename RealType> class DiscreteAliasDistribution1DTemplate;
+    template <typename RealType> class RegularConstantContinuousAliasDistribution1DTemplate;
+    template <typename RealType> class RegularConstantContinuousAliasDistribution2DTemplate;
     template <typename RealType> class MultiContinuousDistribution2DTemplate;
     typedef DiscreteDistribution1DTemplate<float> DiscreteDistribution1D;
     typedef ContinuousDistribution1DTemplate<float> ContinuousDistribution1D;
     typedef RegularConstantContinuousDistribution1DTemplate<float> RegularConstantContinuousDistribution1D;
     typedef ContinuousDistribution2DTemplate<float> ContinuousDistribution2D;
     typedef RegularConstantContinuousDistribution2DTemplate<float> RegularConstantContinuousDistribution2D;
+    typedef DiscreteAliasDistribution1DTemplate<float> DiscreteAliasDistribution1D;
+    typedef RegularConstantContinuousAliasDistribution1DTemplate<float> RegularConstantContinuousAliasDistribution1D;
+    typedef RegularConstantContinuousAliasDistribution2DTemplate<float> RegularConstantContinuousAliasDistribution2D;
     typedef MultiContinuousDistribution2DTemplate<float> MultiContinuousDistribution2D;
     template <typename RealType> class ImprovedPerlinNoise3DGeneratorTemplate;
     template <typename RealType> class MultiOctavePerlinNoise3DGeneratorTemplate;
@@ -251,6 +259,7 @@ namespace SLR {
     class SpectrumTexture;
     class NormalTexture;
     class FloatTexture;
+    class TextureEvaluationCache;
     
     // Surface Material
     class SurfaceMaterial;
@@ -275,6 +284,10 @@ namespace SLR {
     class Image2D;
     template <uint32_t log2_tileWidth = 3> class TiledImage2DTemplate;
     typedef TiledImage2DTemplate<> TiledImage2D;
+    class TiledTextureFile;
+    class MappedTiledImage2D;
+    class PagedImage2D;
+    class TextureCache;
     
     // Image Sensor
     class ImageSensor;
@@ -317,6 +330,11 @@ namespace SLR {
     
     class HomogeneousMediumDistribution;
     class DensityGridMediumDistribution;
+    struct DensityGridFileHeader;
+    class DensityGridFile;
+    class SparseDensityGrid;
+    class MajorantGrid;
+    class SparseGridMediumDistribution;
     class AchromaticExtinctionGridMediumDistribution;
     class GridMediumDistribution;
     class VacuumMediumDistribution;
@@ -440,6 +458,9 @@ namespace SLR {
     class StandardBVH;
     class SBVH;
     class QBVH;
+    struct LightBounds;
+    class LightBVH;
+    class MediumBVH;
     
     // END: Accelerator
     // ----------------------------------------------------------------
@@ -476,6 +497,7 @@ namespace SLR {
     class HomogeneousMediumNode;
     class GridMediumNode;
     class DensityGridMediumNode;
+    class SparseGridMediumNode;
     class VacuumMediumNode;
     class CloudMediumNode;
     class Scene;
@@ -493,6 +515,8 @@ namespace SLR {
     class AMCMCPPMRenderer;
     class VolumetricPTRenderer;
     class VolumetricBPTRenderer;
+    class DirectionalQuadtree;
+    class SDTree;
     
     // END: Renderer
     // ----------------------------------------------------------------
@@ -207,6 +207,9 @@ std::unique_ptr<T> createUnique(ArgTypes&&... args) {
 
 #define SLR_Color_System_is_based_on SLR_Color_System_CIE_1931_2deg
 #define SLR_Use_Spectral_Representation
+// JP: uvs形式のテクスチャーを事前計算したシグモイド多項式の係数表で評価する。
+// EN: evaluate textures in uvs formats with the precomputed coefficient table of sigmoid polynomials.
+//#define SLR_Use_Spectral_Coefficient_Table
 
 // END: Feature Switches and Parameters
 // ----------------------------------------------------------------
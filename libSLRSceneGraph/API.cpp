@@ -13,6 +13,7 @@
 #include <libSLR/BasicTypes/spectrum_library.h>
 #include <libSLR/Core/transform.h>
 #include <libSLR/Core/image_2d.h>
+#include <libSLR/MediumDistribution/DensityGridFile.h>
 #include <libSLR/RNG/XORShiftRNG.h>
 #include <libSLR/SurfaceShape/TriangleSurfaceShape.h>
 #include <libSLR/Scene/Scene.h>
@@ -21,6 +22,7 @@
 #include <libSLR/Renderer/BPTRenderer.h>
 #include <libSLR/Renderer/VolumetricPTRenderer.h>
 #include <libSLR/Renderer/VolumetricBPTRenderer.h>
+#include <libSLR/Renderer/VCMRenderer.h>
 
 #include "images.h"
 #include "textures.h"
@@ -516,6 +518,19 @@ namespace SLRSceneGraph {
                                                    return Element::createFromReference<TypeMap::Image2D>(createImage2D(path, mode, spType, false));
                                                }
                                                );
+            stack["setTextureCacheBudget"] =
+            Element::create<TypeMap::Function>(1,
+                                               std::vector<ArgInfo>{{"megabytes", Type::Integer}},
+                                               [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                   int32_t megabytes = args.at("megabytes").raw<TypeMap::Integer>();
+                                                   if (megabytes < 0) {
+                                                       *err = ErrorMessage("Texture cache budget must be non-negative.");
+                                                       return Element();
+                                                   }
+                                                   setTextureCacheBudget((size_t)megabytes << 20);
+                                                   return Element();
+                                               }
+                                               );
             
             stack["createSurfaceMaterial"] =
             Element::create<TypeMap::Function>(1,
@@ -910,13 +925,13 @@ namespace SLRSceneGraph {
                                                        {"min", Type::Point}, {"max", Type::Point},
                                                        {"base_sigma_s", Type::Spectrum}, {"base_sigma_e", Type::Spectrum},
                                                        {"density_grid", Type::Tuple}, {"numX", Type::Integer}, {"numY", Type::Integer}, {"numZ", Type::Integer},
-                                                       {"mat", Type::MediumMaterial}
+                                                       {"mat", Type::MediumMaterial}, {"sparse", Type::Bool, Element(false)}
                                                    },
                                                    {
                                                        {"min", Type::Point}, {"max", Type::Point},
                                                        {"base_sigma_s", Type::Spectrum}, {"base_sigma_e", Type::Spectrum},
                                                        {"density_grid", Type::String},
-                                                       {"mat", Type::MediumMaterial}
+                                                       {"mat", Type::MediumMaterial}, {"sparse", Type::Bool, Element(false)}
                                                    },
                                                    {
                                                        {"min", Type::Point}, {"max", Type::Point},
@@ -951,8 +966,14 @@ namespace SLRSceneGraph {
                                                            densityArray[z] = std::move(zSliceArray);
                                                        }
                                                        MediumMaterialRef mat = args.at("mat").rawRef<TypeMap::MediumMaterial>();
-                                                       MediumNodeRef mediumNode = createShared<DensityGridMediumNode>(SLR::BoundingBox3D(minP, maxP), base_sigma_s, base_sigma_e, 
-                                                                                                                      std::move(densityArray), numX, numY, numZ, mat);
+                                                       bool sparse = args.at("sparse").raw<TypeMap::Bool>();
+                                                       MediumNodeRef mediumNode;
+                                                       if (sparse)
+                                                           mediumNode = createShared<SparseGridMediumNode>(SLR::BoundingBox3D(minP, maxP), base_sigma_s, base_sigma_e, 
+                                                                                                           std::move(densityArray), numX, numY, numZ, mat);
+                                                       else
+                                                           mediumNode = createShared<DensityGridMediumNode>(SLR::BoundingBox3D(minP, maxP), base_sigma_s, base_sigma_e, 
+                                                                                                            std::move(densityArray), numX, numY, numZ, mat);
                                                        return Element::createFromReference<TypeMap::MediumNode>(mediumNode);
                                                    },
                                                    [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
@@ -961,6 +982,27 @@ namespace SLRSceneGraph {
                                                        AssetSpectrumRef base_sigma_s = args.at("base_sigma_s").rawRef<TypeMap::Spectrum>();
                                                        AssetSpectrumRef base_sigma_e = args.at("base_sigma_e").rawRef<TypeMap::Spectrum>();
                                                        const std::string density_grid = context.absFileDirPath + args.at("density_grid").raw<TypeMap::String>();
+                                                       MediumMaterialRef mat = args.at("mat").rawRef<TypeMap::MediumMaterial>();
+                                                       bool sparse = args.at("sparse").raw<TypeMap::Bool>();
+                                                       
+                                                       // JP: 版付きの密度グリッドファイルはメモリーマップして直接参照する。
+                                                       // EN: map a versioned density grid file and refer to it directly.
+                                                       if (SLR::DensityGridFile::isDensityGridFile(density_grid)) {
+                                                           auto file = std::make_shared<SLR::DensityGridFile>(density_grid);
+                                                           if (!file->isValid()) {
+                                                               char msg[256];
+                                                               sprintf(msg, "invalid density grid file: %s.", density_grid.c_str());
+                                                               *err = ErrorMessage(msg);
+                                                               return Element();
+                                                           }
+                                                           
+                                                           MediumNodeRef mediumNode;
+                                                           if (sparse)
+                                                               mediumNode = createShared<SparseGridMediumNode>(SLR::BoundingBox3D(minP, maxP), base_sigma_s, base_sigma_e, file, mat);
+                                                           else
+                                                               mediumNode = createShared<DensityGridMediumNode>(SLR::BoundingBox3D(minP, maxP), base_sigma_s, base_sigma_e, file, mat);
+                                                           return Element::createFromReference<TypeMap::MediumNode>(mediumNode);
+                                                       }
                                                        
                                                        uint32_t numX, numY, numZ;
                                                        std::vector<std::vector<float>> densityArray;
@@ -988,9 +1030,13 @@ namespace SLRSceneGraph {
                                                            fclose(fp);
                                                        }
                                                        
-                                                       MediumMaterialRef mat = args.at("mat").rawRef<TypeMap::MediumMaterial>();
-                                                       MediumNodeRef mediumNode = createShared<DensityGridMediumNode>(SLR::BoundingBox3D(minP, maxP), base_sigma_s, base_sigma_e, 
-                                                                                                                      std::move(densityArray), numX, numY, numZ, mat);
+                                                       MediumNodeRef mediumNode;
+                                                       if (sparse)
+                                                           mediumNode = createShared<SparseGridMediumNode>(SLR::BoundingBox3D(minP, maxP), base_sigma_s, base_sigma_e, 
+                                                                                                           std::move(densityArray), numX, numY, numZ, mat);
+                                                       else
+                                                           mediumNode = createShared<DensityGridMediumNode>(SLR::BoundingBox3D(minP, maxP), base_sigma_s, base_sigma_e, 
+                                                                                                            std::move(densityArray), numX, numY, numZ, mat);
                                                        return Element::createFromReference<TypeMap::MediumNode>(mediumNode);
                                                    },
                                                    [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
@@ -999,12 +1045,53 @@ namespace SLRSceneGraph {
                                                    }
                                                }
                                                );
+            stack["convertDensityGrid"] =
+            Element::create<TypeMap::Function>(1,
+                                               std::vector<ArgInfo>{{"src", Type::String}, {"dst", Type::String}},
+                                               [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                   const std::string src = context.absFileDirPath + args.at("src").raw<TypeMap::String>();
+                                                   const std::string dst = context.absFileDirPath + args.at("dst").raw<TypeMap::String>();
+                                                   
+                                                   uint32_t numX, numY, numZ;
+                                                   std::vector<std::vector<float>> densityArray;
+                                                   {
+                                                       FILE* fp = fopen(src.c_str(), "rb");
+                                                       if (fp == nullptr) {
+                                                           char msg[256];
+                                                           sprintf(msg, "failed to read density grid file: %s.", src.c_str());
+                                                           *err = ErrorMessage(msg);
+                                                           return Element();
+                                                       }
+                                                       
+                                                       fread(&numX, sizeof(uint32_t), 1, fp);
+                                                       fread(&numY, sizeof(uint32_t), 1, fp);
+                                                       fread(&numZ, sizeof(uint32_t), 1, fp);
+                                                       
+                                                       densityArray.resize(numZ);
+                                                       for (int iz = 0; iz < numZ; ++iz) {
+                                                           std::vector<float> zSliceArray;
+                                                           zSliceArray.resize(numY * numX);
+                                                           fread(zSliceArray.data(), sizeof(float), numX * numY, fp);
+                                                           densityArray[iz] = std::move(zSliceArray);
+                                                       }
+                                                       
+                                                       fclose(fp);
+                                                   }
+                                                   
+                                                   if (!SLR::DensityGridFile::write(dst, densityArray, numX, numY, numZ)) {
+                                                       char msg[256];
+                                                       sprintf(msg, "failed to write density grid file: %s.", dst.c_str());
+                                                       *err = ErrorMessage(msg);
+                                                   }
+                                                   return Element();
+                                               }
+                                               );
             stack["createCloudMedium"] =
             Element::create<TypeMap::Function>(1,
                                                std::vector<ArgInfo>{
                                                    {"min", Type::Point}, {"max", Type::Point}, 
                                                    {"scale", Type::RealNumber}, {"density", Type::RealNumber}, {"rng seed", Type::Integer}, 
-                                                   {"mat", Type::MediumMaterial}},
+                                                   {"mat", Type::MediumMaterial}, {"bake resolution", Type::Integer, Element(0)}},
                                                [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
                                                    const auto &minP = args.at("min").raw<TypeMap::Point>();
                                                    const auto &maxP = args.at("max").raw<TypeMap::Point>();
@@ -1012,7 +1099,12 @@ namespace SLRSceneGraph {
                                                    auto density = args.at("density").raw<TypeMap::RealNumber>();
                                                    auto rngSeed = args.at("rng seed").raw<TypeMap::Integer>(); 
                                                    MediumMaterialRef mat = args.at("mat").rawRef<TypeMap::MediumMaterial>();
-                                                   MediumNodeRef mediumNode = createShared<CloudMediumNode>(SLR::BoundingBox3D(minP, maxP), scale, density, rngSeed, mat);
+                                                   auto bakeResolution = args.at("bake resolution").raw<TypeMap::Integer>();
+                                                   if (bakeResolution < 0 || bakeResolution == 1) {
+                                                       *err = ErrorMessage("Bake resolution must be 0 (no bake) or at least 2.");
+                                                       return Element();
+                                                   }
+                                                   MediumNodeRef mediumNode = createShared<CloudMediumNode>(SLR::BoundingBox3D(minP, maxP), scale, density, rngSeed, bakeResolution, mat);
                                                    return Element::createFromReference<TypeMap::MediumNode>(mediumNode);
                                                }
                                                );
@@ -1217,10 +1309,14 @@ namespace SLRSceneGraph {
                                                    const ParameterList &config = args.at("config").raw<TypeMap::Tuple>();
                                                    if (method == "PT") {
                                                        const static Function configPT{
-                                                           0, {{"samples", Type::Integer, Element(8)}},
+                                                           0, {
+                                                               {"samples", Type::Integer, Element(8)},
+                                                               {"guiding", Type::Bool, Element(false)}
+                                                           },
                                                            [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
                                                                uint32_t spp = args.at("samples").raw<TypeMap::Integer>();
-                                                               context.renderingContext->renderer = createUnique<SLR::PTRenderer>(spp);
+                                                               bool pathGuiding = args.at("guiding").raw<TypeMap::Bool>();
+                                                               context.renderingContext->renderer = createUnique<SLR::PTRenderer>(spp, pathGuiding);
                                                                return Element();
                                                            }
                                                        };
@@ -1237,12 +1333,33 @@ namespace SLRSceneGraph {
                                                        };
                                                        return configBPT(config, context, err);
                                                    }
+                                                   else if (method == "VCM") {
+                                                       const static Function configVCM{
+                                                           0, {
+                                                               {"samples", Type::Integer, Element(8)},
+                                                               {"radius", Type::RealNumber, Element(0.005)},
+                                                               {"alpha", Type::RealNumber, Element(0.75)}
+                                                           },
+                                                           [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
+                                                               uint32_t spp = args.at("samples").raw<TypeMap::Integer>();
+                                                               float radius = args.at("radius").raw<TypeMap::RealNumber>();
+                                                               float alpha = args.at("alpha").raw<TypeMap::RealNumber>();
+                                                               context.renderingContext->renderer = createUnique<SLR::VCMRenderer>(spp, radius, alpha);
+                                                               return Element();
+                                                           }
+                                                       };
+                                                       return configVCM(config, context, err);
+                                                   }
                                                    else if (method == "Volumetric PT") {
                                                        const static Function configVolumetricPT{
-                                                           0, {{"samples", Type::Integer, Element(8)}},
+                                                           0, {
+                                                               {"samples", Type::Integer, Element(8)},
+                                                               {"equiangular", Type::Bool, Element(false)}
+                                                           },
                                                            [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
                                                                uint32_t spp = args.at("samples").raw<TypeMap::Integer>();
-                                                               context.renderingContext->renderer = createUnique<SLR::VolumetricPTRenderer>(spp);
+                                                               bool equiangularSampling = args.at("equiangular").raw<TypeMap::Bool>();
+                                                               context.renderingContext->renderer = createUnique<SLR::VolumetricPTRenderer>(spp, equiangularSampling);
                                                                return Element();
                                                            }
                                                        };
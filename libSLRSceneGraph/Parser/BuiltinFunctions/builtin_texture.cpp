@@ -15,6 +15,30 @@ namespace SLRSceneGraph {
             static const Element tex2DMapSharedInstance = Element::createFromReference<TypeMap::Texture2DMapping>(Texture2DMapping::sharedInstanceRef());
             static const Element worldPos3DMapSharedInstance = Element::createFromReference<TypeMap::Texture3DMapping>(WorldPosition3DMapping::sharedInstanceRef()); 
             
+            static bool parseImageTextureFilter(const std::string &str, SLR::ImageTextureFilter* filter) {
+                if (str == "trilinear")
+                    *filter = SLR::ImageTextureFilter::Trilinear;
+                else if (str == "ewa")
+                    *filter = SLR::ImageTextureFilter::EWA;
+                else if (str == "bicubic")
+                    *filter = SLR::ImageTextureFilter::Bicubic;
+                else
+                    return false;
+                return true;
+            }
+            
+            static bool parseImageTextureWrap(const std::string &str, SLR::ImageTextureWrap* wrap) {
+                if (str == "repeat")
+                    *wrap = SLR::ImageTextureWrap::Repeat;
+                else if (str == "clamp")
+                    *wrap = SLR::ImageTextureWrap::Clamp;
+                else if (str == "mirror")
+                    *wrap = SLR::ImageTextureWrap::Mirror;
+                else
+                    return false;
+                return true;
+            }
+            
             const Element Texture2DMapping = 
             Element::create<TypeMap::Function>(1,
                                                std::vector<ArgInfo>{
@@ -55,7 +79,9 @@ namespace SLRSceneGraph {
             Element::create<TypeMap::Function>(1,
                                                std::vector<std::vector<ArgInfo>>{
                                                    {{"spectrum", Type::Spectrum}},
-                                                   {{"image", Type::Image2D}, {"mapping", Type::Texture2DMapping, tex2DMapSharedInstance}},
+                                                   {{"image", Type::Image2D}, {"mapping", Type::Texture2DMapping, tex2DMapSharedInstance},
+                                                    {"filter", Type::String, Element::create<TypeMap::String>("trilinear")},
+                                                    {"wrap", Type::String, Element::create<TypeMap::String>("repeat")}},
                                                    {{"procedure", Type::String}, {"params", Type::Tuple}}
                                                },
                                                std::vector<Function::Procedure>{
@@ -67,7 +93,17 @@ namespace SLRSceneGraph {
                                                    [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
                                                        const auto &image = args.at("image").rawRef<TypeMap::Image2D>();
                                                        const auto &mapping = args.at("mapping").rawRef<TypeMap::Texture2DMapping>();
-                                                       SpectrumTextureRef rawRef = createShared<ImageSpectrumTexture>(mapping, image);
+                                                       SLR::ImageTextureFilter filter;
+                                                       if (!parseImageTextureFilter(args.at("filter").raw<TypeMap::String>(), &filter)) {
+                                                           *err = ErrorMessage("Specified filter is invalid.");
+                                                           return Element();
+                                                       }
+                                                       SLR::ImageTextureWrap wrap;
+                                                       if (!parseImageTextureWrap(args.at("wrap").raw<TypeMap::String>(), &wrap)) {
+                                                           *err = ErrorMessage("Specified wrap mode is invalid.");
+                                                           return Element();
+                                                       }
+                                                       SpectrumTextureRef rawRef = createShared<ImageSpectrumTexture>(mapping, image, filter, wrap);
                                                        return Element::createFromReference<TypeMap::SpectrumTexture>(rawRef);
                                                    },
                                                    [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
@@ -133,14 +169,26 @@ namespace SLRSceneGraph {
             const Element NormalTexture = 
             Element::create<TypeMap::Function>(1,
                                                std::vector<std::vector<ArgInfo>>{
-                                                   {{"image", Type::Image2D}, {"mapping", Type::Texture2DMapping, tex2DMapSharedInstance}},
+                                                   {{"image", Type::Image2D}, {"mapping", Type::Texture2DMapping, tex2DMapSharedInstance},
+                                                    {"filter", Type::String, Element::create<TypeMap::String>("trilinear")},
+                                                    {"wrap", Type::String, Element::create<TypeMap::String>("repeat")}},
                                                    {{"procedure", Type::String}, {"params", Type::Tuple}}
                                                },
                                                std::vector<Function::Procedure>{
                                                    [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
                                                        const auto &image = args.at("image").rawRef<TypeMap::Image2D>();
                                                        const auto &mapping = args.at("mapping").rawRef<TypeMap::Texture2DMapping>();
-                                                       NormalTextureRef rawRef = createShared<ImageNormalTexture>(mapping, image);
+                                                       SLR::ImageTextureFilter filter;
+                                                       if (!parseImageTextureFilter(args.at("filter").raw<TypeMap::String>(), &filter)) {
+                                                           *err = ErrorMessage("Specified filter is invalid.");
+                                                           return Element();
+                                                       }
+                                                       SLR::ImageTextureWrap wrap;
+                                                       if (!parseImageTextureWrap(args.at("wrap").raw<TypeMap::String>(), &wrap)) {
+                                                           *err = ErrorMessage("Specified wrap mode is invalid.");
+                                                           return Element();
+                                                       }
+                                                       NormalTextureRef rawRef = createShared<ImageNormalTexture>(mapping, image, filter, wrap);
                                                        return Element::createFromReference<TypeMap::NormalTexture>(rawRef);
                                                    },
                                                    [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
@@ -215,7 +263,9 @@ namespace SLRSceneGraph {
             Element::create<TypeMap::Function>(1,
                                                std::vector<std::vector<ArgInfo>>{
                                                    {{"value", Type::RealNumber}},
-                                                   {{"image", Type::Image2D}, {"mapping", Type::Texture2DMapping, tex2DMapSharedInstance}},
+                                                   {{"image", Type::Image2D}, {"mapping", Type::Texture2DMapping, tex2DMapSharedInstance},
+                                                    {"filter", Type::String, Element::create<TypeMap::String>("trilinear")},
+                                                    {"wrap", Type::String, Element::create<TypeMap::String>("repeat")}},
                                                    {{"procedure", Type::String}, {"params", Type::Tuple}}
                                                },
                                                std::vector<Function::Procedure>{
@@ -227,7 +277,17 @@ namespace SLRSceneGraph {
                                                    [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
                                                        const auto &image = args.at("image").rawRef<TypeMap::Image2D>();
                                                        const auto &mapping = args.at("mapping").rawRef<TypeMap::Texture2DMapping>();
-                                                       FloatTextureRef rawRef = createShared<ImageFloatTexture>(mapping, image);
+                                                       SLR::ImageTextureFilter filter;
+                                                       if (!parseImageTextureFilter(args.at("filter").raw<TypeMap::String>(), &filter)) {
+                                                           *err = ErrorMessage("Specified filter is invalid.");
+                                                           return Element();
+                                                       }
+                                                       SLR::ImageTextureWrap wrap;
+                                                       if (!parseImageTextureWrap(args.at("wrap").raw<TypeMap::String>(), &wrap)) {
+                                                           *err = ErrorMessage("Specified wrap mode is invalid.");
+                                                           return Element();
+                                                       }
+                                                       FloatTextureRef rawRef = createShared<ImageFloatTexture>(mapping, image, filter, wrap);
                                                        return Element::createFromReference<TypeMap::FloatTexture>(rawRef);
                                                    },
                                                    [](const std::map<std::string, Element> &args, ExecuteContext &context, ErrorMessage* err) {
@@ -13,6 +13,7 @@
 #include <libSLR/MediumDistribution/HomogeneousMediumDistribution.h>
 #include <libSLR/MediumDistribution/GridMediumDistribution.h>
 #include <libSLR/MediumDistribution/DensityGridMediumDistribution.h>
+#include <libSLR/MediumDistribution/DensityGridFile.h>
 #include <libSLR/MediumDistribution/VacuumMediumDistribution.h>
 #include "../medium_materials.h"
 
@@ -54,7 +55,10 @@ namespace SLRSceneGraph {
     }
     
     void DensityGridMediumNode::setupRawData() {
-        new (m_rawData) SLR::DensityGridMediumNode(m_region, m_base_sigma_s.get(), m_base_sigma_e.get(), m_density_grid, m_numX, m_numY, m_numZ, m_material->getRaw());
+        if (m_file)
+            new (m_rawData) SLR::DensityGridMediumNode(m_region, m_base_sigma_s.get(), m_base_sigma_e.get(), m_file.get(), m_material->getRaw());
+        else
+            new (m_rawData) SLR::DensityGridMediumNode(m_region, m_base_sigma_s.get(), m_base_sigma_e.get(), m_density_grid, m_numX, m_numY, m_numZ, m_material->getRaw());
         m_setup = true;
     }
     
@@ -72,6 +76,13 @@ namespace SLRSceneGraph {
         allocateRawData();
     }
     
+    DensityGridMediumNode::DensityGridMediumNode(const SLR::BoundingBox3D &region, const AssetSpectrumRef &base_sigma_s, const AssetSpectrumRef &base_sigma_e, 
+                                                 const std::shared_ptr<SLR::DensityGridFile> &file, const MediumMaterialRef &material) :
+    m_region(region), m_base_sigma_s(base_sigma_s), m_base_sigma_e(base_sigma_e),
+    m_numX(file->numX()), m_numY(file->numY()), m_numZ(file->numZ()), m_file(file), m_material(material) {
+        allocateRawData();
+    }
+    
     NodeRef DensityGridMediumNode::copy() const {
         SLRAssert_NotImplemented();
         return nullptr;
@@ -84,6 +95,51 @@ namespace SLRSceneGraph {
     
     
     
+    void SparseGridMediumNode::allocateRawData() {
+        m_rawData = (SLR::Node*)malloc(sizeof(SLR::SparseGridMediumNode));
+    }
+    
+    void SparseGridMediumNode::setupRawData() {
+        if (m_file)
+            new (m_rawData) SLR::SparseGridMediumNode(m_region, m_base_sigma_s.get(), m_base_sigma_e.get(), m_file.get(), m_material->getRaw());
+        else
+            new (m_rawData) SLR::SparseGridMediumNode(m_region, m_base_sigma_s.get(), m_base_sigma_e.get(), m_density_grid, m_numX, m_numY, m_numZ, m_material->getRaw());
+        m_setup = true;
+    }
+    
+    void SparseGridMediumNode::terminateRawData() {
+        SLR::SparseGridMediumNode &raw = *(SLR::SparseGridMediumNode*)m_rawData;
+        if (m_setup)
+            raw.~SparseGridMediumNode();
+        m_setup = false;
+    }
+    
+    SparseGridMediumNode::SparseGridMediumNode(const SLR::BoundingBox3D &region, const AssetSpectrumRef &base_sigma_s, const AssetSpectrumRef &base_sigma_e, 
+                                               std::vector<std::vector<float>> &&density_grid, uint32_t numX, uint32_t numY, uint32_t numZ, const MediumMaterialRef &material) :
+    m_region(region), m_base_sigma_s(base_sigma_s), m_base_sigma_e(base_sigma_e),
+    m_density_grid(std::move(density_grid)), m_numX(numX), m_numY(numY), m_numZ(numZ), m_material(material) {
+        allocateRawData();
+    }
+    
+    SparseGridMediumNode::SparseGridMediumNode(const SLR::BoundingBox3D &region, const AssetSpectrumRef &base_sigma_s, const AssetSpectrumRef &base_sigma_e, 
+                                               const std::shared_ptr<SLR::DensityGridFile> &file, const MediumMaterialRef &material) :
+    m_region(region), m_base_sigma_s(base_sigma_s), m_base_sigma_e(base_sigma_e),
+    m_numX(file->numX()), m_numY(file->numY()), m_numZ(file->numZ()), m_file(file), m_material(material) {
+        allocateRawData();
+    }
+    
+    NodeRef SparseGridMediumNode::copy() const {
+        SLRAssert_NotImplemented();
+        return nullptr;
+    }
+    
+    void SparseGridMediumNode::prepareForRendering() {
+        terminateRawData();
+        setupRawData();
+    }
+    
+    
+    
     void GridMediumNode::allocateRawData() {
         m_rawData = (SLR::Node*)malloc(sizeof(SLR::GridMediumNode));
     }
@@ -182,7 +238,7 @@ namespace SLRSceneGraph {
     }
     
     void CloudMediumNode::setupRawData() {
-        new (m_rawData) SLR::CloudMediumNode(m_region, m_featureScale, m_density, m_rngSeed, m_material->getRaw());
+        new (m_rawData) SLR::CloudMediumNode(m_region, m_featureScale, m_density, m_rngSeed, m_bakeResolution, m_material->getRaw());
         m_setup = true;
     }
     
@@ -193,8 +249,8 @@ namespace SLRSceneGraph {
         m_setup = false;
     }
     
-    CloudMediumNode::CloudMediumNode(const SLR::BoundingBox3D &region, float featureScale, float density, uint32_t rngSeed, const MediumMaterialRef &material) :
-    m_region(region), m_featureScale(featureScale), m_density(density), m_rngSeed(rngSeed), m_material(material) {
+    CloudMediumNode::CloudMediumNode(const SLR::BoundingBox3D &region, float featureScale, float density, uint32_t rngSeed, uint32_t bakeResolution, const MediumMaterialRef &material) :
+    m_region(region), m_featureScale(featureScale), m_density(density), m_rngSeed(rngSeed), m_bakeResolution(bakeResolution), m_material(material) {
         allocateRawData();
     }
     
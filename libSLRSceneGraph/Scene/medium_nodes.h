@@ -39,6 +39,7 @@ namespace SLRSceneGraph {
         AssetSpectrumRef m_base_sigma_e;
         std::vector<std::vector<float>> m_density_grid;
         uint32_t m_numX, m_numY, m_numZ;
+        std::shared_ptr<SLR::DensityGridFile> m_file;
         MediumMaterialRef m_material;
         
         void allocateRawData() override;
@@ -47,6 +48,33 @@ namespace SLRSceneGraph {
     public:
         DensityGridMediumNode(const SLR::BoundingBox3D &region, const AssetSpectrumRef &base_sigma_s, const AssetSpectrumRef &base_sigma_e, 
                               std::vector<std::vector<float>> &&density_grid, uint32_t numX, uint32_t numY, uint32_t numZ, const MediumMaterialRef &material);
+        DensityGridMediumNode(const SLR::BoundingBox3D &region, const AssetSpectrumRef &base_sigma_s, const AssetSpectrumRef &base_sigma_e, 
+                              const std::shared_ptr<SLR::DensityGridFile> &file, const MediumMaterialRef &material);
+        
+        NodeRef copy() const override;
+        
+        void prepareForRendering() override;
+    };
+    
+    
+    
+    class SLR_SCENEGRAPH_API SparseGridMediumNode : public MediumNode {
+        SLR::BoundingBox3D m_region;
+        AssetSpectrumRef m_base_sigma_s;
+        AssetSpectrumRef m_base_sigma_e;
+        std::vector<std::vector<float>> m_density_grid;
+        uint32_t m_numX, m_numY, m_numZ;
+        std::shared_ptr<SLR::DensityGridFile> m_file;
+        MediumMaterialRef m_material;
+        
+        void allocateRawData() override;
+        void setupRawData() override;
+        void terminateRawData() override;
+    public:
+        SparseGridMediumNode(const SLR::BoundingBox3D &region, const AssetSpectrumRef &base_sigma_s, const AssetSpectrumRef &base_sigma_e, 
+                             std::vector<std::vector<float>> &&density_grid, uint32_t numX, uint32_t numY, uint32_t numZ, const MediumMaterialRef &material);
+        SparseGridMediumNode(const SLR::BoundingBox3D &region, const AssetSpectrumRef &base_sigma_s, const AssetSpectrumRef &base_sigma_e, 
+                             const std::shared_ptr<SLR::DensityGridFile> &file, const MediumMaterialRef &material);
         
         NodeRef copy() const override;
         
@@ -99,13 +127,14 @@ namespace SLRSceneGraph {
         float m_featureScale;
         float m_density;
         uint32_t m_rngSeed;
+        uint32_t m_bakeResolution;
         MediumMaterialRef m_material;
         
         void allocateRawData() override;
         void setupRawData() override;
         void terminateRawData() override;
     public:
-        CloudMediumNode(const SLR::BoundingBox3D &region, float featureScale, float density, uint32_t rngSeed, const MediumMaterialRef &material);
+        CloudMediumNode(const SLR::BoundingBox3D &region, float featureScale, float density, uint32_t rngSeed, uint32_t bakeResolution, const MediumMaterialRef &material);
         ~CloudMediumNode();
         
         NodeRef copy() const override;
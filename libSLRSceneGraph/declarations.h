@@ -105,6 +105,7 @@ namespace SLRSceneGraph {
     class HomogeneousMediumNode;
     class GridMediumNode;
     class DensityGridMediumNode;
+    class SparseGridMediumNode;
     typedef std::shared_ptr<Node> NodeRef;
     typedef std::shared_ptr<InternalNode> InternalNodeRef;
     typedef std::shared_ptr<ReferenceNode> ReferenceNodeRef;
@@ -8,6 +8,9 @@
 #include "images.h"
 
 #include <libSLR/Core/image_2d.h>
+#include <libSLR/Core/tiled_texture_file.h>
+#include <libSLR/Core/texture_cache.h>
+#include <libSLR/Helper/ThreadPool.h>
 
 #include "Helper/image_loader.h"
 
@@ -20,7 +23,11 @@ namespace SLRSceneGraph {
             return s_imageDB[params];
         }
         else {
-            Image2DRef ret = createShared<TiledImage2D>(filepath, mode, spType, gammaCorrection);
+            Image2DRef ret;
+            if (SLR::TextureCache::instance().budget() > 0)
+                ret = createShared<PagedImage2D>(filepath, mode, spType, gammaCorrection);
+            else
+                ret = createShared<TiledImage2D>(filepath, mode, spType, gammaCorrection);
             s_imageDB[params] = ret;
             return ret;
         }
@@ -28,30 +35,135 @@ namespace SLRSceneGraph {
     
     
     
+    // JP: 各画像のデコードは単一スレッドで行われるため、複数の画像の読み込みを並列に進める。
+    //     関数内のstaticとすることで、プールはs_imageDBより先に破棄され、その際に残りの読み込みを完了させる。
+    // EN: decoding of each image is done on a single thread, so loads of multiple images proceed in parallel.
+    //     As a function-local static, the pool is destroyed before s_imageDB, finishing the remaining loads at that time.
+    static ThreadPool &imageLoaderPool() {
+        static ThreadPool s_pool;
+        return s_pool;
+    }
+    
+    void Image2D::loadAsync(const std::function<SLR::Image2D*()> &loadFunc) {
+        auto task = std::make_shared<std::packaged_task<SLR::Image2D*()>>(loadFunc);
+        m_rawData = task->get_future().share();
+        imageLoaderPool().enqueue([task](uint32_t threadID) {
+            (*task)();
+        });
+    }
+    
     Image2D::~Image2D() {
-        delete m_rawData;
+        delete m_rawData.get();
     }
     
+    static std::string derivedFilePath(const Image2DLoadParams &params, const char* extension) {
+        char suffix[64];
+        sprintf(suffix, ".%u_%u_%u.%s", (uint32_t)params.storeMode, (uint32_t)params.spectrumType, (uint32_t)params.gammaCorrection, extension);
+        return params.filePath + suffix;
+    }
+    
+    std::string Image2D::derivedFilePath(const char* extension) const {
+        return SLRSceneGraph::derivedFilePath(m_loadParams, extension);
+    }
     
     
-    TiledImage2D::TiledImage2D(const std::string &filePath, SLR::ImageStoreMode storeMode, SLR::SpectrumType spectrumType, bool gammaCorrection) : 
-    m_filePath(filePath), m_storeMode(storeMode), m_spectrumType(spectrumType), m_gammaCorrection(gammaCorrection) {
+    
+    // JP: 画像を読み込んでタイル化し、フィルタリングされたテクスチャー参照のためにミップマップを生成する。
+    // EN: load an image, tile it and generate mipmaps for filtered texture lookups.
+    static SLR::TiledImage2D* loadTiledImage(const std::string &filePath, SLR::ImageStoreMode storeMode, SLR::SpectrumType spectrumType, bool gammaCorrection) {
         uint64_t requiredSize;
         bool imgSuccess;
         uint32_t width, height;
         ::ColorFormat colorFormat;
-        imgSuccess = getImageInfo(m_filePath, &width, &height, &requiredSize, &colorFormat);
-        SLRAssert(imgSuccess, "Error occured during getting image information.\n%s", m_filePath.c_str());
+        imgSuccess = getImageInfo(filePath, &width, &height, &requiredSize, &colorFormat);
+        SLRAssert(imgSuccess, "Error occured during getting image information.\n%s", filePath.c_str());
         
         void* linearData = malloc(requiredSize);
-        imgSuccess = loadImage(m_filePath, (uint8_t*)linearData, m_gammaCorrection);
-        SLRAssert(imgSuccess, "failed to load the image\n%s", m_filePath.c_str());
+        imgSuccess = loadImage(filePath, (uint8_t*)linearData, gammaCorrection);
+        SLRAssert(imgSuccess, "failed to load the image\n%s", filePath.c_str());
         
         SLR::ColorFormat internalFormat = (SLR::ColorFormat)colorFormat;
         
         // TODO: ?? make a memory allocator selectable.
         SLR::DefaultAllocator &defMem = SLR::DefaultAllocator::instance();
-        m_rawData = new SLR::TiledImage2D(linearData, width, height, internalFormat, &defMem, storeMode, spectrumType);
+        SLR::TiledImage2D* tiledImage = new SLR::TiledImage2D(linearData, width, height, internalFormat, &defMem, storeMode, spectrumType);
         free(linearData);
+        
+        tiledImage->generateMipmaps();
+        return tiledImage;
+    }
+    
+    // JP: 読み込みパラメターに対応する最新のタイル化テクスチャーファイルを用意する。ファイルが無いか古い場合は画像を変換して書き出す。
+    //     書き出しに失敗した場合はfalseを返し、変換済みの画像があればconvertedImageに渡す。
+    // EN: prepare an up-to-date tiled texture file corresponding to the load parameters. Convert and write the image when the file is missing or stale.
+    //     This returns false when writing fails, and hands over the converted image via convertedImage if any.
+    static bool prepareTiledTextureFile(const std::string &filePath, SLR::ImageStoreMode storeMode, SLR::SpectrumType spectrumType, bool gammaCorrection,
+                                        std::string* tiledFilePath, SLR::TiledImage2D** convertedImage) {
+        *convertedImage = nullptr;
+        
+        SLR::TiledTextureFileKey key{filePath, 0, storeMode, spectrumType, gammaCorrection};
+        if (!SLR::TiledTextureFileKey::getModificationTime(filePath, &key.sourceModificationTime))
+            printf("Failed to get the modification time of the image\n%s\n", filePath.c_str());
+        
+        *tiledFilePath = derivedFilePath(Image2DLoadParams{filePath, storeMode, spectrumType, gammaCorrection}, "slrtex");
+        {
+            SLR::TiledTextureFile file(*tiledFilePath);
+            if (file.matches(key))
+                return true;
+        }
+        
+        SLR::TiledImage2D* tiledImage = loadTiledImage(filePath, storeMode, spectrumType, gammaCorrection);
+        if (SLR::TiledTextureFile::write(*tiledFilePath, *tiledImage, key)) {
+            delete tiledImage;
+            return true;
+        }
+        *convertedImage = tiledImage;
+        return false;
+    }
+    
+    TiledImage2D::TiledImage2D(const std::string &filePath, SLR::ImageStoreMode storeMode, SLR::SpectrumType spectrumType, bool gammaCorrection) :
+    Image2D(Image2DLoadParams{filePath, storeMode, spectrumType, gammaCorrection}) {
+        // JP: 変換済みのファイルをメモリーマップして直接参照し、起動のたびの変換を避ける。
+        //     ファイルを書き出せない場合は変換した画像をそのまま使う。
+        // EN: map the converted file and refer to it directly to avoid conversion at every launch.
+        //     Use the converted image as is when the file cannot be written.
+        loadAsync([filePath, storeMode, spectrumType, gammaCorrection]() -> SLR::Image2D* {
+            std::string tiledFilePath;
+            SLR::TiledImage2D* convertedImage;
+            if (!prepareTiledTextureFile(filePath, storeMode, spectrumType, gammaCorrection, &tiledFilePath, &convertedImage))
+                return convertedImage;
+            
+            auto file = std::make_shared<const SLR::TiledTextureFile>(tiledFilePath);
+            SLRAssert(file->isValid(), "failed to map the tiled texture file\n%s", tiledFilePath.c_str());
+            return new SLR::MappedTiledImage2D(file);
+        });
+    }
+    
+    
+    
+    PagedImage2D::PagedImage2D(const std::string &filePath, SLR::ImageStoreMode storeMode, SLR::SpectrumType spectrumType, bool gammaCorrection) :
+    Image2D(Image2DLoadParams{filePath, storeMode, spectrumType, gammaCorrection}) {
+        // JP: 変換済みのタイル化テクスチャーファイルを、テクスチャーキャッシュを通じてページ単位で読み込む。
+        // EN: load the converted tiled texture file in pages through the texture cache.
+        loadAsync([filePath, storeMode, spectrumType, gammaCorrection]() -> SLR::Image2D* {
+            std::string tiledFilePath;
+            SLR::TiledImage2D* convertedImage;
+            if (!prepareTiledTextureFile(filePath, storeMode, spectrumType, gammaCorrection, &tiledFilePath, &convertedImage)) {
+                // JP: ファイルを書き出せない場合は変換した画像をそのまま使う。
+                // EN: use the converted image as is when the file cannot be written.
+                printf("Failed to write the tiled texture file. Use the converted image instead.\n%s\n", tiledFilePath.c_str());
+                return convertedImage;
+            }
+            
+            SLR::PagedImage2D* pagedImage = new SLR::PagedImage2D(tiledFilePath, &SLR::TextureCache::instance());
+            SLRAssert(pagedImage->isValid(), "failed to open the tiled texture file\n%s", tiledFilePath.c_str());
+            return pagedImage;
+        });
+    }
+    
+    
+    
+    SLR_SCENEGRAPH_API void setTextureCacheBudget(size_t budget) {
+        SLR::TextureCache::instance().setBudget(budget);
     }
 }
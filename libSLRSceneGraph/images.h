@@ -12,6 +12,7 @@
 #include "declarations.h"
 
 #include <libSLR/Core/image_2d.h>
+#include <future>
 
 namespace SLRSceneGraph {
     struct Image2DLoadParams {
@@ -46,28 +47,51 @@ namespace SLRSceneGraph {
     
     SLR_SCENEGRAPH_API Image2DRef createImage2D(const std::string &filepath, SLR::ImageStoreMode mode, SLR::SpectrumType spType, bool gammaCorrection);
     
+    // JP: テクスチャーキャッシュの予算(バイト)。0より大きい場合、以降に読み込む画像はページ単位で必要に応じて読み込まれる。
+    // EN: budget of the texture cache (in bytes). Images loaded afterward are loaded in pages on demand when it is greater than 0.
+    SLR_SCENEGRAPH_API void setTextureCacheBudget(size_t budget);
     
     
+    
+    // JP: 画像の読み込みと変換は画像読み込み用のスレッドプールで非同期に行われ、生データは最初に必要になった時点で解決される。
+    // EN: loading and conversion of an image are performed asynchronously in the thread pool for image loading,
+    //     and the raw data is resolved when it is needed first.
     class SLR_SCENEGRAPH_API Image2D {
     protected:
-        SLR::Image2D* m_rawData;
+        Image2DLoadParams m_loadParams;
+        std::shared_future<SLR::Image2D*> m_rawData;
+        
+        Image2D(const Image2DLoadParams &loadParams) : m_loadParams(loadParams) {}
+        void loadAsync(const std::function<SLR::Image2D*()> &loadFunc);
     public:
         virtual ~Image2D();
+        // JP: 読み込みが終わっていなければ完了を待つ。
+        // EN: wait for completion if loading has not finished.
         const SLR::Image2D* getRaw() const {
-            return m_rawData;
+            return m_rawData.get();
         };
+        
+        const Image2DLoadParams &loadParams() const {
+            return m_loadParams;
+        }
+        // JP: 元画像の隣に置く、読み込みパラメターごとの派生ファイル(例えば変換済みテクスチャー)のパス。
+        // EN: path of a file derived per load parameters (e.g. a converted texture), placed next to the source image.
+        std::string derivedFilePath(const char* extension) const;
     };
     
     
     
     class SLR_SCENEGRAPH_API TiledImage2D : public Image2D {
-        std::string m_filePath;
-        SLR::ImageStoreMode m_storeMode;
-        SLR::SpectrumType m_spectrumType;
-        bool m_gammaCorrection;
     public:
         TiledImage2D(const std::string &filePath, SLR::ImageStoreMode storeMode, SLR::SpectrumType spectrumType, bool gammaCorrection);
     };
+    
+    
+    
+    class SLR_SCENEGRAPH_API PagedImage2D : public Image2D {
+    public:
+        PagedImage2D(const std::string &filePath, SLR::ImageStoreMode storeMode, SLR::SpectrumType spectrumType, bool gammaCorrection);
+    };
 }
 
 #endif /* __SLRSceneGraph_images__ */
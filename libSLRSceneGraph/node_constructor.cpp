@@ -325,6 +325,21 @@ namespace SLRSceneGraph {
         
         std::string pathPrefix = filePath.substr(0, filePath.find_last_of("/") + 1);
         
+        // JP: マテリアルの生成に先立って、テクスチャーの読み込みを既定の格納モードで全て発行しておき、デコードと変換を並列に進める。
+        //     同じパラメターでのcreateImage2D()はs_imageDBから読み込み中の画像を返す。
+        // EN: issue loads of all the textures with the default store modes before creating materials so that decoding and conversion proceed in parallel.
+        //     createImage2D() with the same parameters returns the image being loaded from s_imageDB.
+        for (int m = 0; m < scene->mNumMaterials; ++m) {
+            const aiMaterial* aiMat = scene->mMaterials[m];
+            aiString strValue;
+            if (aiMat->Get(AI_MATKEY_TEXTURE_DIFFUSE(0), strValue) == aiReturn_SUCCESS)
+                createImage2D(pathPrefix + strValue.C_Str(), ImageStoreMode::AsIs, SpectrumType::Reflectance, false);
+            if (aiMat->Get(AI_MATKEY_TEXTURE_DISPLACEMENT(0), strValue) == aiReturn_SUCCESS)
+                createImage2D(pathPrefix + strValue.C_Str(), ImageStoreMode::NormalTexture, SpectrumType::Reflectance, false);
+            if (aiMat->Get(AI_MATKEY_TEXTURE_OPACITY(0), strValue) == aiReturn_SUCCESS)
+                createImage2D(pathPrefix + strValue.C_Str(), ImageStoreMode::AlphaTexture, SpectrumType::Reflectance, false);
+        }
+        
         // create materials
         std::vector<SurfaceMaterialRef> materials;
         std::vector<NormalTextureRef> normalMaps;
@@ -65,19 +65,23 @@ namespace SLRSceneGraph {
         m_rawData = new SLR::ConstantFloatTexture(value);
     }
     
-    ImageSpectrumTexture::ImageSpectrumTexture(const Texture2DMappingRef &mapping, const Image2DRef &image) :
+    ImageSpectrumTexture::ImageSpectrumTexture(const Texture2DMappingRef &mapping, const Image2DRef &image, SLR::ImageTextureFilter filter, SLR::ImageTextureWrap wrap) :
     m_mapping(mapping), m_data(image) {
-        m_rawData = new SLR::ImageSpectrumTexture(image->getRaw(), mapping->getRaw());
+        SLR::ImageSpectrumTexture* raw = new SLR::ImageSpectrumTexture(image->getRaw(), mapping->getRaw(), filter, wrap);
+        // JP: 環境マップとして使われた場合のため、重要度マップのキャッシュを画像の隣に置く。
+        // EN: place the cache of the importance map next to the image for the case it is used as an environment map.
+        raw->setIBLImportanceMapCache(image->loadParams().filePath, image->derivedFilePath("slribl"));
+        m_rawData = raw;
     }
     
-    ImageNormalTexture::ImageNormalTexture(const Texture2DMappingRef &mapping, const Image2DRef &image) :
+    ImageNormalTexture::ImageNormalTexture(const Texture2DMappingRef &mapping, const Image2DRef &image, SLR::ImageTextureFilter filter, SLR::ImageTextureWrap wrap) :
     m_mapping(mapping), m_data(image) {
-        m_rawData = new SLR::ImageNormalTexture(image->getRaw(), mapping->getRaw());
+        m_rawData = new SLR::ImageNormalTexture(image->getRaw(), mapping->getRaw(), filter, wrap);
     }
     
-    ImageFloatTexture::ImageFloatTexture(const Texture2DMappingRef &mapping, const Image2DRef &image) :
+    ImageFloatTexture::ImageFloatTexture(const Texture2DMappingRef &mapping, const Image2DRef &image, SLR::ImageTextureFilter filter, SLR::ImageTextureWrap wrap) :
     m_mapping(mapping), m_data(image) {
-        m_rawData = new SLR::ImageFloatTexture(image->getRaw(), mapping->getRaw());
+        m_rawData = new SLR::ImageFloatTexture(image->getRaw(), mapping->getRaw(), filter, wrap);
     }
     
     CheckerBoardSpectrumTexture::CheckerBoardSpectrumTexture(const Texture2DMappingRef &mapping, const AssetSpectrumRef &v0, const AssetSpectrumRef &v1) :
@@ -9,6 +9,7 @@
 #define __SLRSceneGraph_textures__
 
 #include <libSLR/defines.h>
+#include <libSLR/Texture/image_textures.h>
 #include "declarations.h"
 
 namespace SLRSceneGraph {
@@ -119,7 +120,8 @@ namespace SLRSceneGraph {
         Texture2DMappingRef m_mapping;
         Image2DRef m_data;
     public:
-        ImageSpectrumTexture(const Texture2DMappingRef &mapping, const Image2DRef &image);
+        ImageSpectrumTexture(const Texture2DMappingRef &mapping, const Image2DRef &image,
+                             SLR::ImageTextureFilter filter = SLR::ImageTextureFilter::Trilinear, SLR::ImageTextureWrap wrap = SLR::ImageTextureWrap::Repeat);
         
         bool generateLuminanceChannel() override { return true; }
     };
@@ -128,14 +130,16 @@ namespace SLRSceneGraph {
         Texture2DMappingRef m_mapping;
         Image2DRef m_data;
     public:
-        ImageNormalTexture(const Texture2DMappingRef &mapping, const Image2DRef &image);
+        ImageNormalTexture(const Texture2DMappingRef &mapping, const Image2DRef &image,
+                           SLR::ImageTextureFilter filter = SLR::ImageTextureFilter::Trilinear, SLR::ImageTextureWrap wrap = SLR::ImageTextureWrap::Repeat);
     };
     
     class SLR_SCENEGRAPH_API ImageFloatTexture : public FloatTexture {
         Texture2DMappingRef m_mapping;
         Image2DRef m_data;
     public:
-        ImageFloatTexture(const Texture2DMappingRef &mapping, const Image2DRef &image);
+        ImageFloatTexture(const Texture2DMappingRef &mapping, const Image2DRef &image,
+                          SLR::ImageTextureFilter filter = SLR::ImageTextureFilter::Trilinear, SLR::ImageTextureWrap wrap = SLR::ImageTextureWrap::Repeat);
     };
     
     